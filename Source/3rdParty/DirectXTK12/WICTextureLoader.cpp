@@ -219,12 +219,10 @@ namespace
     }
 
     //---------------------------------------------------------------------------------
-    HRESULT CreateTextureFromWIC(_In_ ID3D12Device* d3dDevice,
-        _In_ IWICBitmapFrameDecode *frame,
+    HRESULT DecodeTextureFromWIC(_In_ IWICBitmapFrameDecode *frame,
         size_t maxsize,
-        D3D12_RESOURCE_FLAGS resFlags,
         unsigned int loadFlags,
-        _Outptr_ ID3D12Resource** texture,
+        D3D12_RESOURCE_DESC& desc,
         std::unique_ptr<uint8_t[]>& decodedData,
         D3D12_SUBRESOURCE_DATA& subresource)
     {
@@ -472,8 +470,8 @@ namespace
         // Count the number of mips
         uint32_t mipCount = (loadFlags & (WIC_LOADER_MIP_AUTOGEN | WIC_LOADER_MIP_RESERVE)) ? CountMips(twidth, theight) : 1;
 
-        // Create texture
-        D3D12_RESOURCE_DESC desc = {};
+        // Describe texture
+        desc = {};
         desc.Width = twidth;
         desc.Height = theight;
         desc.MipLevels = static_cast<UINT16>(mipCount);
@@ -481,9 +479,34 @@ namespace
         desc.Format = format;
         desc.SampleDesc.Count = 1;
         desc.SampleDesc.Quality = 0;
-        desc.Flags = resFlags;
+        desc.Flags = D3D12_RESOURCE_FLAG_NONE;
         desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
 
+        subresource.pData = decodedData.get();
+        subresource.RowPitch = rowPitch;
+        subresource.SlicePitch = imageSize;
+
+        return S_OK;
+    }
+
+    //---------------------------------------------------------------------------------
+    HRESULT CreateTextureFromWIC(_In_ ID3D12Device* d3dDevice,
+        _In_ IWICBitmapFrameDecode *frame,
+        size_t maxsize,
+        D3D12_RESOURCE_FLAGS resFlags,
+        unsigned int loadFlags,
+        _Outptr_ ID3D12Resource** texture,
+        std::unique_ptr<uint8_t[]>& decodedData,
+        D3D12_SUBRESOURCE_DATA& subresource)
+    {
+        D3D12_RESOURCE_DESC desc;
+        HRESULT hr = DecodeTextureFromWIC(frame, maxsize, loadFlags, desc, decodedData, subresource);
+        if (FAILED(hr))
+            return hr;
+
+        // Create texture
+        desc.Flags = resFlags;
+
         CD3DX12_HEAP_PROPERTIES defaultHeapProperties(D3D12_HEAP_TYPE_DEFAULT);
 
         ID3D12Resource* tex = nullptr;
@@ -502,10 +525,6 @@ namespace
 
         _Analysis_assume_(tex != nullptr);
 
-        subresource.pData = decodedData.get();
-        subresource.RowPitch = rowPitch;
-        subresource.SlicePitch = imageSize;
-
         *texture = tex;
         return hr;
     }
@@ -817,3 +836,35 @@ HRESULT DirectX::CreateWICTextureFromFileEx(
 
     return hr;
 }
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::DecodeWICTextureFromFileEx(
+    const wchar_t* fileName,
+    size_t maxsize,
+    unsigned int loadFlags,
+    D3D12_RESOURCE_DESC& desc,
+    std::unique_ptr<uint8_t[]>& decodedData,
+    D3D12_SUBRESOURCE_DATA& subresource)
+{
+    if (!fileName)
+        return E_INVALIDARG;
+
+    auto pWIC = _GetWIC();
+    if (!pWIC)
+        return E_NOINTERFACE;
+
+    // Initialize WIC
+    ComPtr<IWICBitmapDecoder> decoder;
+    HRESULT hr = pWIC->CreateDecoderFromFilename(fileName, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, decoder.GetAddressOf());
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<IWICBitmapFrameDecode> frame;
+    hr = decoder->GetFrame(0, frame.GetAddressOf());
+    if (FAILED(hr))
+        return hr;
+
+    return DecodeTextureFromWIC(frame.Get(), maxsize, loadFlags, desc, decodedData, subresource);
+}
@@ -119,4 +119,13 @@ namespace DirectX
         D3D12_RESOURCE_FLAGS resFlags,
         unsigned int loadFlags,
         _Outptr_ ID3D12Resource** texture);
+
+    // Decode only, no device required. desc describes the texture to create for the decoded data
+    HRESULT __cdecl DecodeWICTextureFromFileEx(
+        _In_z_ const wchar_t* szFileName,
+        size_t maxsize,
+        unsigned int loadFlags,
+        D3D12_RESOURCE_DESC& desc,
+        std::unique_ptr<uint8_t[]>& decodedData,
+        D3D12_SUBRESOURCE_DATA& subresource);
 }
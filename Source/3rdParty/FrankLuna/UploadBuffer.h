@@ -50,6 +50,12 @@ public:
         return mUploadBuffer.Get();
     }
 
+    // Start of the mapped memory, write only: upload heaps are write combined and uncached for reads
+    BYTE* MappedData()const
+    {
+        return mMappedData;
+    }
+
     void CopyData(int elementIndex, const T& data)
     {
         memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
@@ -0,0 +1,2244 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <random>
+
+#include "Core.h"
+#include "Profiler.h"
+#include "ObjLoader.h"
+#include "ObjParser.h"
+#include "Parallel.h"
+#include "Texture.h"
+#include "MeshCache.h"
+#include "Mesh.h"
+#include "MeshOptimizer.h"
+#include "VertexPacking.h"
+#include "MeshletBuilder.h"
+#include "MeshSimplifier.h"
+#include "RangeAllocator.h"
+#include "Culling.h"
+#include "DrawSort.h"
+#include "FrameRenderer.h"
+#include "NullBackend.h"
+#include "InstanceUpload.h"
+#include "TransientAllocator.h"
+#include "LightClusters.h"
+#include "Light.h"
+#include "LightTable.h"
+#include "TransformHierarchy.h"
+#include "SceneGraph.h"
+#include "Node.h"
+
+// Headless CPU benchmarks, run with the -benchmark command line switch.
+// Nothing in here touches the D3D12 device.
+namespace Loxodonta
+{
+namespace Benchmarks
+{
+	inline void ReportTimes(std::ostream& out, const std::string& label, SampleSet& samples)
+	{
+		out << "  " << label << ": mean " << samples.Mean() << " ms, min " << samples.Min()
+			<< " ms, p50 " << samples.Percentile(0.5) << " ms, max " << samples.Max() << " ms\n";
+	}
+
+	// Tail of a per frame distribution, where hitches show up
+	inline void ReportFrameTimes(std::ostream& out, const std::string& label, SampleSet& samples)
+	{
+		out << "  " << label << ": p50 " << samples.Percentile(0.5) << " ms, p95 " << samples.Percentile(0.95)
+			<< " ms, p99 " << samples.Percentile(0.99) << " ms, max " << samples.Max() << " ms\n";
+	}
+
+	// 1, 2, 4, ... threads and finally one per core
+	inline std::vector<u32> ThreadCounts()
+	{
+		u32 maxThreads = WorkerCount();
+		std::vector<u32> threadCounts;
+		for (u32 threads = 1; threads < maxThreads; threads *= 2)
+			threadCounts.push_back(threads);
+		threadCounts.push_back(maxThreads);
+		return threadCounts;
+	}
+
+	// Text .obj import versus the memory mapped binary cache
+	inline void MeshLoad(std::ostream& out, const std::string& objPath, int iterations = 5)
+	{
+		out << "MeshLoad " << objPath << "\n";
+
+		SampleSet importTimes;
+		ObjModel model;
+		for (int i = 0; i < iterations; i++)
+		{
+			Stopwatch timer;
+			ImportOBJ(objPath, model);
+			std::vector<u16> indices16;
+			PackIndices(model.Indices, model.MaxIndex, indices16);
+			importTimes.Add(timer.ElapsedMs());
+		}
+
+		std::string cachePath = MeshCache::CachePath(objPath);
+		Stopwatch writeTimer;
+		if (!MeshCache::Write(cachePath, objPath, model))
+		{
+			out << "  could not write " << cachePath << "\n";
+			return;
+		}
+		f64 writeTime = writeTimer.ElapsedMs();
+
+		SampleSet cacheTimes;
+		std::vector<u8> vertexBlob;
+		std::vector<u8> indexBlob;
+		for (int i = 0; i < iterations; i++)
+		{
+			Stopwatch timer;
+			MeshCache::View cache;
+			if (!cache.Open(cachePath, objPath))
+			{
+				out << "  cache rejected " << cachePath << "\n";
+				return;
+			}
+			ObjModelView view;
+			cache.GetModelView(view);
+			// Same copies LoadOBJModel makes into the Mesh CPU blobs
+			vertexBlob.resize(view.VertexBufferByteSize());
+			indexBlob.resize(view.IndexBufferByteSize());
+			std::memcpy(vertexBlob.data(), view.pVertices, vertexBlob.size());
+			std::memcpy(indexBlob.data(), view.pIndices, indexBlob.size());
+			cacheTimes.Add(timer.ElapsedMs());
+		}
+
+		out << "  " << model.Vertices.size() << " vertices, " << model.Indices.size() << " indices, "
+			<< model.Submeshes.size() << " submeshes\n";
+		ReportTimes(out, "obj import", importTimes);
+		ReportTimes(out, "cache load", cacheTimes);
+		out << "  cache write: " << writeTime << " ms\n";
+		out << "  speedup: " << importTimes.Percentile(0.5) / Math::Max(cacheTimes.Percentile(0.5), 1e-6) << "x\n";
+	}
+
+	// Reference dedup keyed on the whole Vertex, as LoadOBJModel did before ObjIndexTable
+	struct VertexHash
+	{
+		static void Combine(size_t& seed, size_t hash)
+		{
+			hash += 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			seed ^= hash;
+		}
+
+		size_t operator()(const Vertex& V) const
+		{
+			const float* pFloats = &V.Pos.x;
+			size_t seed = std::hash<float>{}(pFloats[0]);
+			for (size_t i = 1; i < sizeof(Vertex) / sizeof(float); i++)
+				Combine(seed, std::hash<float>{}(pFloats[i]));
+			return seed;
+		}
+	};
+
+	inline void DeduplicateByVertex(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::index_t>& objIndices,
+		std::vector<Vertex>& vertices, std::vector<u32>& indices)
+	{
+		std::unordered_map<Vertex, u32, VertexHash> uniqueVertices;
+		for (const auto& index : objIndices)
+		{
+			Vertex V = MakeObjVertex(attrib, index);
+			auto unique = uniqueVertices.find(V);
+			if (unique == uniqueVertices.end())
+			{
+				unique = uniqueVertices.emplace(V, (u32) vertices.size()).first;
+				vertices.push_back(V);
+			}
+			indices.push_back(unique->second);
+		}
+	}
+
+	// Regular grid of 2 * quads * quads triangles with shared position/normal/texcoord indices,
+	// laid out the way tinyobj returns a smooth scanned mesh
+	inline void BuildSyntheticObj(u32 quads, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& objIndices)
+	{
+		u32 rowCount = quads + 1;
+		attrib = tinyobj::attrib_t();
+		attrib.vertices.resize(rowCount * rowCount * 3);
+		attrib.normals.resize(rowCount * rowCount * 3);
+		attrib.texcoords.resize(rowCount * rowCount * 2);
+		for (u32 i = 0; i < rowCount; i++)
+		{
+			for (u32 j = 0; j < rowCount; j++)
+			{
+				u32 v = i * rowCount + j;
+				attrib.vertices[3*v+0] = (float) j;
+				attrib.vertices[3*v+1] = 0.0f;
+				attrib.vertices[3*v+2] = (float) i;
+				attrib.normals[3*v+0] = 0.0f;
+				attrib.normals[3*v+1] = 1.0f;
+				attrib.normals[3*v+2] = 0.0f;
+				attrib.texcoords[2*v+0] = (float) j / quads;
+				attrib.texcoords[2*v+1] = (float) i / quads;
+			}
+		}
+
+		objIndices.clear();
+		objIndices.reserve((size_t) quads * quads * 6);
+		auto corner = [rowCount](u32 i, u32 j)
+		{
+			int v = (int) (i * rowCount + j);
+			tinyobj::index_t index = { v, v, v };
+			return index;
+		};
+		for (u32 i = 0; i < quads; i++)
+		{
+			for (u32 j = 0; j < quads; j++)
+			{
+				objIndices.push_back(corner(i, j));
+				objIndices.push_back(corner(i, j + 1));
+				objIndices.push_back(corner(i + 1, j));
+				objIndices.push_back(corner(i + 1, j));
+				objIndices.push_back(corner(i, j + 1));
+				objIndices.push_back(corner(i + 1, j + 1));
+			}
+		}
+	}
+
+	inline void VertexDedup(std::ostream& out, const std::string& label,
+		const tinyobj::attrib_t& attrib, const std::vector<tinyobj::index_t>& objIndices, int iterations = 3)
+	{
+		out << "VertexDedup " << label << " (" << objIndices.size() / 3 << " triangles)\n";
+
+		SampleSet vertexTimes;
+		SampleSet tripletTimes;
+		std::vector<Vertex> vertexRef, vertexNew;
+		std::vector<u32> indexRef, indexNew;
+		for (int i = 0; i < iterations; i++)
+		{
+			vertexRef.clear();
+			indexRef.clear();
+			Stopwatch timer;
+			DeduplicateByVertex(attrib, objIndices, vertexRef, indexRef);
+			vertexTimes.Add(timer.ElapsedMs());
+
+			vertexNew.clear();
+			indexNew.clear();
+			timer.Reset();
+			size_t expected = EstimateObjVertexCount(attrib);
+			ObjIndexTable table(expected);
+			vertexNew.reserve(expected);
+			indexNew.reserve(objIndices.size());
+			u32 maxIndex = 0;
+			DeduplicateObjIndices(attrib, objIndices, table, vertexNew, indexNew, maxIndex);
+			tripletTimes.Add(timer.ElapsedMs());
+		}
+
+		out << "  unique vertices: whole vertex " << vertexRef.size() << ", triplet " << vertexNew.size() << "\n";
+		ReportTimes(out, "unordered_map<Vertex>", vertexTimes);
+		ReportTimes(out, "ObjIndexTable", tripletTimes);
+		out << "  speedup: " << vertexTimes.Percentile(0.5) / Math::Max(tripletTimes.Percentile(0.5), 1e-6) << "x\n";
+	}
+
+	inline void VertexDedup(std::ostream& out, const std::string& objPath)
+	{
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t> materials;
+		std::string err;
+		std::string basepath = objPath.substr(0, objPath.find_last_of("/") + 1);
+		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, objPath.c_str(), basepath.c_str(), true))
+		{
+			out << "VertexDedup " << objPath << ": " << err << "\n";
+			return;
+		}
+		std::vector<tinyobj::index_t> objIndices;
+		for (const auto& shape : shapes)
+			objIndices.insert(objIndices.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+		VertexDedup(out, objPath, attrib, objIndices);
+
+		// 1M and 10M triangle grids
+		const u32 quadCounts[] = { 708, 2237 };
+		for (u32 quads : quadCounts)
+		{
+			BuildSyntheticObj(quads, attrib, objIndices);
+			VertexDedup(out, "synthetic grid", attrib, objIndices, 1);
+		}
+	}
+
+	inline bool SameObjModel(const ObjModel& a, const ObjModel& b)
+	{
+		if (a.Vertices.size() != b.Vertices.size() || a.Indices != b.Indices || a.MaxIndex != b.MaxIndex ||
+			a.Submeshes.size() != b.Submeshes.size() || a.Materials.size() != b.Materials.size())
+			return false;
+		if (!a.Vertices.empty() && std::memcmp(a.Vertices.data(), b.Vertices.data(), a.Vertices.size() * sizeof(Vertex)) != 0)
+			return false;
+		for (size_t i = 0; i < a.Submeshes.size(); i++)
+		{
+			const ObjSubmesh& x = a.Submeshes[i];
+			const ObjSubmesh& y = b.Submeshes[i];
+			if (x.Name != y.Name || x.MaterialIndex != y.MaterialIndex || x.IndexCount != y.IndexCount ||
+				x.StartIndexLocation != y.StartIndexLocation || x.BaseVertexLocation != y.BaseVertexLocation)
+				return false;
+		}
+		for (size_t i = 0; i < a.Materials.size(); i++)
+		{
+			if (a.Materials[i].Name != b.Materials[i].Name || a.Materials[i].DiffuseTexname != b.Materials[i].DiffuseTexname ||
+				std::memcmp(&a.Materials[i].Properties, &b.Materials[i].Properties, sizeof(MaterialProperties)) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	// tinyobj against ObjParser from 1 thread up to one per core, parse only and full import
+	inline void ObjParse(std::ostream& out, const std::string& objPath, int iterations = 5)
+	{
+		out << "ObjParse " << objPath << "\n";
+		std::string basepath = objPath.substr(0, objPath.find_last_of("/") + 1);
+
+		ObjModel reference;
+		SampleSet tinyobjTimes;
+		SampleSet importTimes;
+		for (int i = 0; i < iterations; i++)
+		{
+			tinyobj::attrib_t attrib;
+			std::vector<tinyobj::shape_t> shapes;
+			std::vector<tinyobj::material_t> materials;
+			std::string err;
+			Stopwatch timer;
+			if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, objPath.c_str(), basepath.c_str(), true))
+			{
+				out << "  " << err << "\n";
+				return;
+			}
+			tinyobjTimes.Add(timer.ElapsedMs());
+
+			timer.Reset();
+			ImportOBJ(objPath, reference);
+			importTimes.Add(timer.ElapsedMs());
+		}
+		ReportTimes(out, "tinyobj parse", tinyobjTimes);
+		ReportTimes(out, "ImportOBJ", importTimes);
+
+		f64 singleThreaded = 0.0;
+		for (u32 threads : ThreadCounts())
+		{
+			SampleSet parseTimes;
+			SampleSet parallelImportTimes;
+			ObjModel model;
+			for (int i = 0; i < iterations; i++)
+			{
+				tinyobj::attrib_t attrib;
+				std::vector<tinyobj::shape_t> shapes;
+				std::vector<tinyobj::material_t> materials;
+				std::string err;
+				Stopwatch timer;
+				ObjParser::LoadObj(attrib, shapes, materials, err, objPath, basepath, threads);
+				parseTimes.Add(timer.ElapsedMs());
+
+				timer.Reset();
+				ImportOBJParallel(objPath, model, threads);
+				parallelImportTimes.Add(timer.ElapsedMs());
+			}
+			if (threads == 1)
+				singleThreaded = parseTimes.Percentile(0.5);
+
+			out << "  " << threads << " threads: parse p50 " << parseTimes.Percentile(0.5) << " ms ("
+				<< singleThreaded / Math::Max(parseTimes.Percentile(0.5), 1e-6) << "x), import p50 "
+				<< parallelImportTimes.Percentile(0.5) << " ms, identical " << (SameObjModel(reference, model) ? "yes" : "NO") << "\n";
+		}
+	}
+
+	// Decode to CPU images, one thread (the old serial load) up to one per core
+	inline void TextureDecode(std::ostream& out, const std::wstring& folder, int iterations = 3)
+	{
+		std::vector<std::wstring> files;
+		ListImageFiles(folder, files);
+		out << "TextureDecode " << files.size() << " images\n";
+
+		f64 singleThreaded = 0.0;
+		for (u32 threads : ThreadCounts())
+		{
+			SampleSet times;
+			u64 decodedBytes = 0;
+			size_t failures = 0;
+			for (int i = 0; i < iterations; i++)
+			{
+				std::vector<CpuImage> images(files.size());
+				for (size_t f = 0; f < files.size(); f++)
+					images[f].Filename = files[f];
+
+				Stopwatch timer;
+				DecodeImages(images, threads);
+				times.Add(timer.ElapsedMs());
+
+				decodedBytes = 0;
+				failures = 0;
+				for (const CpuImage& image : images)
+				{
+					decodedBytes += image.DataSize;
+					failures += FAILED(image.Result) ? 1 : 0;
+				}
+			}
+			if (threads == 1)
+				singleThreaded = times.Percentile(0.5);
+
+			f64 megabytes = decodedBytes / (1024.0 * 1024.0);
+			out << "  " << threads << " threads: p50 " << times.Percentile(0.5) << " ms ("
+				<< singleThreaded / Math::Max(times.Percentile(0.5), 1e-6) << "x), " << megabytes << " MB decoded, "
+				<< megabytes / Math::Max(times.Percentile(0.5) / 1000.0, 1e-9) << " MB/s";
+			if (failures != 0)
+				out << ", " << failures << " failed";
+			out << "\n";
+		}
+	}
+
+	// SphereMesh generation as it was before the sincos tables: trig per vertex, push_back into
+	// unreserved vectors, 32 bit indices so it can run past the old 250 x 250 limit
+	inline void GenerateSphereReference(float radius, u32 sliceCount, u32 stackCount,
+		std::vector<Vertex>& vertices, std::vector<u32>& indices)
+	{
+		vertices.clear();
+		indices.clear();
+
+		vertices.push_back(Vertex({0.0f, +radius, 0.0f},
+			{0.0f, +1.0f, 0.0f}, {+1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 0.0f}));
+		float deltaPhi = M_PI / stackCount;
+		float deltaTheta = M_2PI / sliceCount;
+		for (u32 i = 1; i <= stackCount - 1; i++)
+		{
+			float phi = i * deltaPhi;
+			for (u32 j = 0; j <= sliceCount; j++)
+			{
+				float theta = j * deltaTheta;
+				Vertex v;
+				v.Pos.x = radius * sinf(phi) * cosf(theta);
+				v.Pos.y = radius * cosf(phi);
+				v.Pos.z = radius * sinf(phi) * sinf(theta);
+				vect normal = Vector::Normalize3(Vector::LoadFloat3(&v.Pos));
+				Vector::StoreFloat3(&v.Normal, normal);
+				v.Tangent.x = -radius * sinf(phi) * sinf(theta);
+				v.Tangent.y = 0.0f;
+				v.Tangent.z = radius * sinf(phi) * cosf(theta);
+				vect tangent = Vector::LoadFloat3(&v.Tangent);
+				vect bitangent = Vector::CrossProduct3(normal, tangent);
+				Vector::StoreFloat3(&v.Bitangent, bitangent);
+				v.TexCoord.x = theta / M_2PI;
+				v.TexCoord.y = phi / M_PI;
+				vertices.push_back(v);
+			}
+		}
+		vertices.push_back(Vertex({0.0f, -radius, 0.0f},
+			{0.0f, -1.0f, 0.0f}, {+1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, +1.0f}, {0.0f, 1.0f}));
+
+		for (u32 i = 1; i <= sliceCount; i++)
+		{
+			indices.push_back(0);
+			indices.push_back(i + 1);
+			indices.push_back(i);
+		}
+		u32 ringVertexCount = sliceCount + 1;
+		for (u32 i = 0; i < stackCount - 2; i++)
+		{
+			for (u32 j = 0; j < sliceCount; j++)
+			{
+				indices.push_back(1 + i * ringVertexCount + j);
+				indices.push_back(1 + i * ringVertexCount + j + 1);
+				indices.push_back(1 + (i + 1) * ringVertexCount + j);
+				indices.push_back(1 + (i + 1) * ringVertexCount + j);
+				indices.push_back(1 + i * ringVertexCount + j + 1);
+				indices.push_back(1 + (i + 1) * ringVertexCount + j + 1);
+			}
+		}
+		u32 southPoleIndex = (u32) vertices.size() - 1;
+		u32 baseIndex = southPoleIndex - ringVertexCount;
+		for (u32 i = 0; i < sliceCount; i++)
+		{
+			indices.push_back(southPoleIndex);
+			indices.push_back(baseIndex + i);
+			indices.push_back(baseIndex + i + 1);
+		}
+	}
+
+	// CPU side sphere generation, per vertex trig versus the SphereMesh sincos tables
+	inline void SphereGeneration(std::ostream& out, int iterations = 3)
+	{
+		out << "SphereGeneration\n";
+
+		const u32 tessellations[][2] = { {64, 32}, {256, 128}, {1024, 512}, {4096, 2048} };
+		for (const auto& tessellation : tessellations)
+		{
+			u32 slices = tessellation[0];
+			u32 stacks = tessellation[1];
+
+			SampleSet referenceTimes;
+			{
+				std::vector<Vertex> vertices;
+				std::vector<u32> indices;
+				for (int i = 0; i < iterations; i++)
+				{
+					vertices = std::vector<Vertex>();
+					indices = std::vector<u32>();
+					Stopwatch timer;
+					GenerateSphereReference(1.0f, slices, stacks, vertices, indices);
+					referenceTimes.Add(timer.ElapsedMs());
+				}
+			}
+
+			SampleSet tableTimes;
+			DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT;
+			{
+				std::vector<Vertex> vertices;
+				std::vector<u16> indices16;
+				std::vector<u32> indices32;
+				for (int i = 0; i < iterations; i++)
+				{
+					// Fresh buffers each time, the same allocations Initialize makes
+					vertices = std::vector<Vertex>();
+					indices16 = std::vector<u16>();
+					indices32 = std::vector<u32>();
+					Stopwatch timer;
+					indexFormat = SphereMesh::Generate(1.0f, slices, stacks, vertices, indices16, indices32);
+					tableTimes.Add(timer.ElapsedMs());
+				}
+			}
+
+			out << "  " << slices << "x" << stacks << ": " << SphereMesh::VertexCount(slices, stacks) << " vertices, "
+				<< SphereMesh::IndexCount(slices, stacks) << " indices, "
+				<< (indexFormat == DXGI_FORMAT_R16_UINT ? "16" : "32") << " bit\n";
+			ReportTimes(out, "per vertex trig", referenceTimes);
+			ReportTimes(out, "sincos tables", tableTimes);
+			out << "  speedup: " << referenceTimes.Percentile(0.5) / Math::Max(tableTimes.Percentile(0.5), 1e-6) << "x\n";
+		}
+	}
+
+	// Mesh::Subdivide as it was before midpoint sharing: six unshared vertices per input triangle.
+	// Writes 32 bit indices so levels past the old u16 limit can still be measured.
+	inline void SubdivideReference(std::vector<Vertex>& vertices, std::vector<u32>& indices)
+	{
+		std::vector<Vertex> inputVertices = vertices;
+		std::vector<u32> inputIndices = indices;
+		vertices.resize(0);
+		indices.resize(0);
+
+		u32 numTris = (u32) inputIndices.size() / 3;
+		for (u32 i = 0; i < numTris; i++)
+		{
+			Vertex v0 = inputVertices[inputIndices[i * 3 + 0]];
+			Vertex v1 = inputVertices[inputIndices[i * 3 + 1]];
+			Vertex v2 = inputVertices[inputIndices[i * 3 + 2]];
+			vertices.push_back(v0);
+			vertices.push_back(v1);
+			vertices.push_back(v2);
+			vertices.push_back(Mesh::MidPoint(v0, v1));
+			vertices.push_back(Mesh::MidPoint(v1, v2));
+			vertices.push_back(Mesh::MidPoint(v0, v2));
+			const u32 pattern[12] = { 0, 3, 5, 3, 4, 5, 5, 4, 2, 3, 1, 4 };
+			for (u32 k = 0; k < 12; k++)
+				indices.push_back(i * 6 + pattern[k]);
+		}
+	}
+
+	// Repeated subdivision of a coarse sphere, unshared versus shared midpoints
+	inline void Subdivision(std::ostream& out, u32 levels = 7)
+	{
+		out << "Subdivision\n";
+
+		std::vector<Vertex> baseVertices;
+		std::vector<u16> baseIndices16;
+		std::vector<u32> baseIndices;
+		SphereMesh::Generate(1.0f, 8, 4, baseVertices, baseIndices16, baseIndices);
+		baseIndices.assign(baseIndices16.begin(), baseIndices16.end());
+
+		std::vector<Vertex> referenceVertices = baseVertices;
+		std::vector<u32> referenceIndices = baseIndices;
+		std::vector<Vertex> vertices = baseVertices;
+		std::vector<u32> indices = baseIndices;
+		for (u32 level = 1; level <= levels; level++)
+		{
+			Stopwatch referenceTimer;
+			SubdivideReference(referenceVertices, referenceIndices);
+			f64 referenceTime = referenceTimer.ElapsedMs();
+
+			Stopwatch timer;
+			Mesh::Subdivide(vertices, indices);
+			f64 time = timer.ElapsedMs();
+
+			f64 referenceMB = (referenceVertices.size() * sizeof(Vertex) + referenceIndices.size() * sizeof(u32)) / (1024.0 * 1024.0);
+			f64 sharedMB = (vertices.size() * sizeof(Vertex) + indices.size() * sizeof(u32)) / (1024.0 * 1024.0);
+			out << "  level " << level << ": " << indices.size() / 3 << " triangles, "
+				<< referenceVertices.size() << " -> " << vertices.size() << " vertices, "
+				<< referenceMB << " -> " << sharedMB << " MB, "
+				<< referenceTime << " -> " << time << " ms"
+				<< (vertices.size() > 0xFFFF ? ", 32 bit indices" : "") << "\n";
+		}
+	}
+
+	// Tessellation quality of a mesh approximating a sphere of the given radius centered on the origin
+	struct SphereError
+	{
+		f32 Silhouette = 0.0f;        // largest gap between a triangle and the sphere, in radii
+		f32 MaxNormalDegrees = 0.0f;  // largest angle between the normals at the two ends of an edge
+		f32 MeanNormalDegrees = 0.0f; // per triangle largest edge angle, averaged
+	};
+
+	template <typename Index>
+	inline SphereError MeasureSphere(const std::vector<Vertex>& vertices, const std::vector<Index>& indices, f32 radius)
+	{
+		SphereError error;
+		f64 sum = 0.0;
+		for (size_t t = 0; t < indices.size(); t += 3)
+		{
+			const Vertex* v[3] = {&vertices[indices[t]], &vertices[indices[t + 1]], &vertices[indices[t + 2]]};
+			float3 n = VertexPacking::Cross(
+				float3(v[1]->Pos.x - v[0]->Pos.x, v[1]->Pos.y - v[0]->Pos.y, v[1]->Pos.z - v[0]->Pos.z),
+				float3(v[2]->Pos.x - v[0]->Pos.x, v[2]->Pos.y - v[0]->Pos.y, v[2]->Pos.z - v[0]->Pos.z));
+			f32 length = VertexPacking::Length(n);
+			if (length <= 0.0f)
+				continue;
+			f32 planeDistance = std::fabs(VertexPacking::Dot(n, v[0]->Pos)) / length;
+			error.Silhouette = Math::Max(error.Silhouette, (radius - planeDistance) / radius);
+
+			f32 triangleMax = 0.0f;
+			for (int k = 0; k < 3; k++)
+				triangleMax = Math::Max(triangleMax, VertexPacking::AngleDegrees(v[k]->Normal, v[(k + 1) % 3]->Normal));
+			error.MaxNormalDegrees = Math::Max(error.MaxNormalDegrees, triangleMax);
+			sum += triangleMax;
+		}
+		error.MeanNormalDegrees = (f32) (sum / Math::Max(indices.size() / 3, (size_t) 1));
+		return error;
+	}
+
+	// UV spheres against the first geosphere level with at least the same silhouette quality,
+	// then the cost of a cold, cached and copied geosphere level
+	inline void SphereTessellation(std::ostream& out)
+	{
+		out << "SphereTessellation\n";
+
+		std::vector<Vertex> vertices;
+		std::vector<u16> indices16;
+		std::vector<u32> indices32;
+		auto measure = [&](DXGI_FORMAT format)
+		{
+			return (format == DXGI_FORMAT_R16_UINT) ? MeasureSphere(vertices, indices16, 1.0f) : MeasureSphere(vertices, indices32, 1.0f);
+		};
+		auto describe = [&](const std::string& label, const SphereError& error)
+		{
+			out << label << " " << vertices.size() << " vertices, silhouette " << error.Silhouette
+				<< " (x vertices " << error.Silhouette * vertices.size() << "), normal step max " << error.MaxNormalDegrees
+				<< " mean " << error.MeanNormalDegrees << " degrees";
+		};
+
+		for (u32 sliceCount = 16; sliceCount <= 256; sliceCount *= 2)
+		{
+			SphereError sphere = measure(SphereMesh::Generate(1.0f, sliceCount, sliceCount / 2, vertices, indices16, indices32));
+			describe("  sphere " + std::to_string(sliceCount) + "x" + std::to_string(sliceCount / 2) + ":", sphere);
+			for (u32 level = 0; level <= GeosphereMesh::MAX_SUBDIVISIONS; level++)
+			{
+				SphereError geosphere = measure(GeosphereMesh::Generate(1.0f, level, vertices, indices16, indices32));
+				if (geosphere.Silhouette <= sphere.Silhouette)
+				{
+					describe("\n    geosphere " + std::to_string(level) + ":", geosphere);
+					break;
+				}
+			}
+			out << "\n";
+		}
+
+		const u32 level = 7;
+		Stopwatch coldTimer;
+		GeosphereMesh::GetLevel(level);
+		f64 coldTime = coldTimer.ElapsedMs();
+		Stopwatch cachedTimer;
+		GeosphereMesh::GetLevel(level);
+		f64 cachedTime = cachedTimer.ElapsedMs();
+		Stopwatch copyTimer;
+		GeosphereMesh::Generate(1.0f, level, vertices, indices16, indices32);
+		f64 copyTime = copyTimer.ElapsedMs();
+		out << "  geosphere level " << level << ": first request " << coldTime << " ms, cached "
+			<< cachedTime << " ms, scaled copy " << copyTime << " ms\n";
+	}
+
+	inline void ReportCache(std::ostream& out, const std::string& label, const std::vector<u32>& indices, u32 vertexCount)
+	{
+		for (MeshOptimizer::CacheModel model : { MeshOptimizer::CacheModel::FIFO, MeshOptimizer::CacheModel::LRU })
+		{
+			MeshOptimizer::CacheStats stats = MeshOptimizer::SimulateCache(indices.data(), indices.size(), vertexCount,
+				MeshOptimizer::DEFAULT_CACHE_SIZE, model);
+			out << "  " << label << (model == MeshOptimizer::CacheModel::FIFO ? " FIFO" : " LRU") << ": ACMR "
+				<< stats.ACMR() << ", ATVR " << stats.ATVR() << "\n";
+		}
+	}
+
+	// Post-transform cache efficiency of imported and generated meshes before and after MeshOptimizer
+	inline void VertexCacheOptimization(std::ostream& out, const std::string& label,
+		std::vector<Vertex>& vertices, std::vector<u32>& indices, const std::vector<MeshOptimizer::IndexRange>& ranges)
+	{
+		out << "VertexCacheOptimization " << label << ": " << vertices.size() << " vertices, "
+			<< indices.size() / 3 << " triangles\n";
+		ReportCache(out, "before", indices, (u32) vertices.size());
+
+		Stopwatch timer;
+		MeshOptimizer::Optimize(vertices.data(), (u32) vertices.size(), sizeof(Vertex), indices.data(), indices.size(), ranges);
+		f64 time = timer.ElapsedMs();
+
+		ReportCache(out, "after", indices, (u32) vertices.size());
+		out << "  optimize: " << time << " ms\n";
+	}
+
+	inline void VertexCacheOptimization(std::ostream& out, const std::string& objPath)
+	{
+		ObjModel model;
+		ImportOBJParallel(objPath, model);
+		std::vector<MeshOptimizer::IndexRange> ranges(model.Submeshes.size());
+		for (size_t i = 0; i < model.Submeshes.size(); i++)
+		{
+			ranges[i].StartIndex = model.Submeshes[i].StartIndexLocation;
+			ranges[i].IndexCount = model.Submeshes[i].IndexCount;
+		}
+		VertexCacheOptimization(out, objPath, model.Vertices, model.Indices, ranges);
+
+		std::vector<Vertex> vertices;
+		std::vector<u16> indices16;
+		std::vector<u32> indices;
+		SphereMesh::Generate(1.0f, 256, 128, vertices, indices16, indices);
+		indices.assign(indices16.begin(), indices16.end());
+		ranges.assign(1, MeshOptimizer::IndexRange());
+		ranges[0].IndexCount = (u32) indices.size();
+		VertexCacheOptimization(out, "sphere 256x128", vertices, indices, ranges);
+	}
+
+	inline void PackedVertices(std::ostream& out, const std::string& label, const std::vector<Vertex>& vertices)
+	{
+		Stopwatch timer;
+		std::vector<PackedVertex> packed;
+		VertexQuantization quantization = VertexPacking::PackVertices(vertices.data(), (u32) vertices.size(), packed);
+		f64 time = timer.ElapsedMs();
+
+		PackingError error = VertexPacking::MeasureError(vertices.data(), packed.data(), (u32) packed.size(), quantization);
+		out << "PackedVertices " << label << ": " << vertices.size() * sizeof(Vertex) / 1024 << " KB -> "
+			<< packed.size() * sizeof(PackedVertex) / 1024 << " KB, pack " << time << " ms
+"
+			<< "  max error: position " << error.MaxPosition << ", texcoord " << error.MaxTexCoord
+			<< ", normal " << error.MaxNormalDegrees << " deg, tangent " << error.MaxTangentDegrees
+			<< " deg, " << error.BitangentSignFlips << " bitangent sign flips\n";
+	}
+
+	// Size and round trip error of the quantized vertex format
+	inline void PackedVertices(std::ostream& out, const std::string& objPath)
+	{
+		ObjModel model;
+		ImportOBJParallel(objPath, model);
+		PackedVertices(out, objPath, model.Vertices);
+
+		std::vector<Vertex> vertices;
+		std::vector<u16> indices16;
+		std::vector<u32> indices32;
+		SphereMesh::Generate(1.0f, 256, 128, vertices, indices16, indices32);
+		PackedVertices(out, "sphere 256x128", vertices);
+	}
+
+	// Meshlet build rate, and how much of the mesh 16 cameras around it could skip per cluster:
+	// 8 wide views (60 degrees) from 2.5 bounding radii, 8 narrow ones (20 degrees) at the same distance
+	inline void MeshletCulling(std::ostream& out, const std::string& label,
+		std::vector<Vertex>& vertices, std::vector<u32>& indices, const std::vector<MeshOptimizer::IndexRange>& ranges)
+	{
+		MeshOptimizer::Optimize(vertices.data(), (u32) vertices.size(), sizeof(Vertex), indices.data(), indices.size(), ranges);
+
+		Stopwatch timer;
+		MeshletBuilder::MeshletSet set;
+		for (const MeshOptimizer::IndexRange& range : ranges)
+			MeshletBuilder::Build(set, indices.data() + range.StartIndex, range.IndexCount, 0,
+				(const u8*) vertices.data(), sizeof(Vertex), (u32) vertices.size());
+		f64 time = timer.ElapsedMs();
+
+		float3 minPos = vertices[0].Pos, maxPos = vertices[0].Pos;
+		for (const Vertex& v : vertices)
+		{
+			minPos = float3(Math::Min(minPos.x, v.Pos.x), Math::Min(minPos.y, v.Pos.y), Math::Min(minPos.z, v.Pos.z));
+			maxPos = float3(Math::Max(maxPos.x, v.Pos.x), Math::Max(maxPos.y, v.Pos.y), Math::Max(maxPos.z, v.Pos.z));
+		}
+		float3 center((minPos.x + maxPos.x) * 0.5f, (minPos.y + maxPos.y) * 0.5f, (minPos.z + maxPos.z) * 0.5f);
+		f32 radius = 0.5f * std::sqrt((maxPos.x - minPos.x) * (maxPos.x - minPos.x) +
+			(maxPos.y - minPos.y) * (maxPos.y - minPos.y) + (maxPos.z - minPos.z) * (maxPos.z - minPos.z));
+
+		Stopwatch cullTimer;
+		MeshletBuilder::CullStats total;
+		const int viewCount = 16;
+		for (int view = 0; view < viewCount; view++)
+		{
+			f32 angle = view * M_2PI / (viewCount / 2);
+			f32 eye[3] = {center.x + 2.5f * radius * std::cos(angle), center.y + 0.5f * radius, center.z + 2.5f * radius * std::sin(angle)};
+			f32 fov = (view < viewCount / 2) ? Math::DegreesToRadians(60.0f) : Math::DegreesToRadians(20.0f);
+
+			vect4 viewMatrix = Matrix::LookAt(Vector::Set3(eye[0], eye[1], eye[2]), Vector::Set3(center.x, center.y, center.z), Vector::Set3(0.0f, 1.0f, 0.0f));
+			vect4 projection = Matrix::PerspectiveFov(fov, 16.0f / 9.0f, 0.01f * radius, 10.0f * radius);
+			vect4 viewProjection = Matrix::Multiply(viewMatrix, projection);
+			float4x4 viewProj;
+			Matrix::StoreFloat4x4(&viewProj, viewProjection);
+
+			f32 planes[6][4];
+			MeshletBuilder::ExtractFrustumPlanes(&viewProj.m[0][0], planes);
+			total.Add(MeshletBuilder::Cull(set, 0, (u32) set.Meshlets.size(), planes, eye));
+		}
+		f64 cullTime = cullTimer.ElapsedMs();
+
+		out << "MeshletCulling " << label << ": " << MeshletBuilder::Describe(set) << "\n"
+			<< "  build: " << time << " ms, " << (indices.size() / 3) / Math::Max(time, 1e-3) / 1000.0 << " M triangles/s\n"
+			<< "  cull: " << cullTime / viewCount << " ms per view, frustum " << 100.0 * total.FrustumCulled / total.MeshletCount
+			<< "%, backface " << 100.0 * total.BackfaceCulled / total.MeshletCount << "% of meshlets, "
+			<< 100.0 * total.TrianglesCulled / total.TriangleCount << "% of triangles skipped\n";
+	}
+
+	inline void MeshletCulling(std::ostream& out, const std::string& objPath)
+	{
+		ObjModel model;
+		ImportOBJParallel(objPath, model);
+		std::vector<MeshOptimizer::IndexRange> ranges(model.Submeshes.size());
+		for (size_t i = 0; i < model.Submeshes.size(); i++)
+		{
+			ranges[i].StartIndex = model.Submeshes[i].StartIndexLocation;
+			ranges[i].IndexCount = model.Submeshes[i].IndexCount;
+		}
+		MeshletCulling(out, objPath, model.Vertices, model.Indices, ranges);
+
+		// Dense synthetic meshes: a finely tessellated sphere and a subdivided coarse one
+		std::vector<Vertex> vertices;
+		std::vector<u16> indices16;
+		std::vector<u32> indices;
+		SphereMesh::Generate(1.0f, 1024, 512, vertices, indices16, indices);
+		ranges.assign(1, MeshOptimizer::IndexRange());
+		ranges[0].IndexCount = (u32) indices.size();
+		MeshletCulling(out, "sphere 1024x512", vertices, indices, ranges);
+
+		SphereMesh::Generate(1.0f, 8, 4, vertices, indices16, indices);
+		indices.assign(indices16.begin(), indices16.end());
+		for (u32 level = 0; level < 7; level++)
+			Mesh::Subdivide(vertices, indices);
+		ranges[0].IndexCount = (u32) indices.size();
+		MeshletCulling(out, "sphere 8x4 subdivided 7 times", vertices, indices, ranges);
+	}
+
+	// LOD chains of every submesh, then a 20x20 grid of copies seen by a 1080p camera
+	// drawn at full detail and at the levels SelectLod picks for one pixel of error
+	inline void LodSelection(std::ostream& out, const std::string& objPath)
+	{
+		ObjModel model;
+		ImportOBJParallel(objPath, model);
+		std::vector<MeshOptimizer::IndexRange> ranges(model.Submeshes.size());
+		for (size_t i = 0; i < model.Submeshes.size(); i++)
+		{
+			ranges[i].StartIndex = model.Submeshes[i].StartIndexLocation;
+			ranges[i].IndexCount = model.Submeshes[i].IndexCount;
+		}
+		MeshOptimizer::Optimize(model.Vertices.data(), (u32) model.Vertices.size(), sizeof(Vertex),
+			model.Indices.data(), model.Indices.size(), ranges);
+
+		out << "LodSelection " << objPath << "\n";
+		Stopwatch timer;
+		auto chains = MeshSimplifier::BuildLods((const u8*) model.Vertices.data(), sizeof(Vertex), (u32) model.Vertices.size(),
+			model.Indices, ranges);
+		f64 time = timer.ElapsedMs();
+
+		f32 radius = 0.0f;
+		for (const Vertex& v : model.Vertices)
+			radius = Math::Max(radius, std::sqrt(v.Pos.x * v.Pos.x + v.Pos.y * v.Pos.y + v.Pos.z * v.Pos.z));
+
+		size_t fullTriangles = 0;
+		for (const MeshOptimizer::IndexRange& range : ranges)
+			fullTriangles += range.IndexCount / 3;
+		out << "  build: " << time << " ms for " << fullTriangles << " triangles\n";
+		for (size_t r = 0; r < chains.size(); r++)
+		{
+			out << "  " << model.Submeshes[r].Name << ":";
+			for (const MeshSimplifier::LodRange& lod : chains[r])
+				out << " " << lod.IndexCount / 3 << " (" << lod.Error << ")";
+			out << "\n";
+		}
+
+		// Camera on the near edge of the grid looking across it with a 45 degree vertical field of view
+		const u32 gridSize = 20;
+		const f32 spacing = 3.0f * radius;
+		const f32 screenHeight = 1080.0f;
+		const f32 pixelsPerUnitAtOne = screenHeight * 0.5f / std::tan(Math::DegreesToRadians(45.0f) * 0.5f);
+		const f32 eye[3] = {0.5f * (gridSize - 1) * spacing, 2.0f * radius, -2.0f * spacing};
+
+		size_t drawnFull = 0, drawnLod = 0;
+		std::vector<size_t> levelUse;
+		for (u32 z = 0; z < gridSize; z++)
+		{
+			for (u32 x = 0; x < gridSize; x++)
+			{
+				f32 dx = x * spacing - eye[0], dy = -eye[1], dz = z * spacing - eye[2];
+				f32 distance = Math::Max(std::sqrt(dx * dx + dy * dy + dz * dz) - radius, 0.1f);
+				for (const auto& chain : chains)
+				{
+					u32 lod = MeshSimplifier::SelectLod(chain.data(), (u32) chain.size(), pixelsPerUnitAtOne / distance);
+					drawnFull += chain[0].IndexCount / 3;
+					drawnLod += chain[lod].IndexCount / 3;
+					if (levelUse.size() <= lod)
+						levelUse.resize(lod + 1, 0);
+					levelUse[lod]++;
+				}
+			}
+		}
+
+		out << "  " << gridSize * gridSize << " instances: " << drawnFull << " triangles at full detail, " << drawnLod
+			<< " with LODs (" << 100.0 * drawnLod / Math::Max(drawnFull, (size_t) 1) << "%), draws per level:";
+		for (size_t use : levelUse)
+			out << " " << use;
+		out << "\n";
+	}
+
+	// The allocator behind GeometryArena under mesh streaming: fill a 16M vertex pool with ranges of
+	// 64 to 64k vertices up to 80%, then keep replacing random meshes and watch fragmentation
+	inline void GeometryArenaChurn(std::ostream& out)
+	{
+		const u32 capacity = 1u << 24;
+		const u32 rounds = 8;
+		const u32 opsPerRound = 100000;
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<f32> logSize(std::log(64.0f), std::log(65536.0f));
+		auto randomSize = [&]() { return (u32) std::exp(logSize(rng)); };
+
+		out << "GeometryArenaChurn\n";
+		RangeAllocator allocator(capacity);
+		std::vector<RangeAllocation> live;
+		u64 liveUnits = 0;
+		Stopwatch timer;
+		while (liveUnits < capacity / 5 * 4)
+		{
+			RangeAllocation range = allocator.Allocate(randomSize());
+			if (!range.IsValid())
+				break;
+			liveUnits += range.Size;
+			live.push_back(range);
+		}
+		out << "  fill: " << live.size() << " ranges in " << timer.ElapsedMs() << " ms, "
+			<< RangeAllocator::Describe(allocator.Stats()) << "\n";
+
+		u64 failures = 0;
+		for (u32 round = 0; round < rounds; round++)
+		{
+			timer.Reset();
+			for (u32 op = 0; op < opsPerRound; op++)
+			{
+				// Replace one mesh, keeping the pool near 80% full
+				size_t victim = rng() % live.size();
+				liveUnits -= live[victim].Size;
+				allocator.Free(live[victim]);
+				live[victim] = live.back();
+				live.pop_back();
+
+				while (liveUnits < capacity / 5 * 4)
+				{
+					RangeAllocation range = allocator.Allocate(randomSize());
+					if (!range.IsValid())
+					{
+						failures++;
+						break;
+					}
+					liveUnits += range.Size;
+					live.push_back(range);
+				}
+			}
+			f64 time = timer.ElapsedMs();
+			RangeAllocatorStats stats = allocator.Stats();
+			out << "  round " << round << ": " << 1.0e6 * time / opsPerRound << " ns per replacement, "
+				<< RangeAllocator::Describe(stats) << ", " << failures << " failed allocations, "
+				<< (allocator.Validate() ? "valid" : "CORRUPT") << "\n";
+		}
+
+		for (RangeAllocation& range : live)
+			allocator.Free(range);
+		RangeAllocatorStats stats = allocator.Stats();
+		out << "  emptied: " << RangeAllocator::Describe(stats) << ", "
+			<< ((stats.FreeRangeCount == 1 && stats.LargestFreeRange == capacity) ? "fully coalesced" : "NOT coalesced") << "\n";
+	}
+
+	// Render items of 0.5 to 5 units scattered through a 2 km cube around a camera with a 60 degree
+	// view and a 1 km far plane: world box update and culling throughput, and how many draws survive
+	inline void FrustumCulling(std::ostream& out)
+	{
+		vect Eye = Vector::Set3(0.0f, 0.0f, 0.0f);
+		vect Forward = Vector::Set3(0.0f, 0.0f, 1.0f);
+		vect Up = Vector::Set3(0.0f, 1.0f, 0.0f);
+		vect4 View = Matrix::LookTo(Eye, Forward, Up);
+		vect4 Proj = Matrix::PerspectiveFov(Math::DegreesToRadians(60.0f), 16.0f / 9.0f, 1.0f, 1000.0f);
+		vect4 ViewProj = Matrix::Multiply(View, Proj);
+		float4x4 viewProj;
+		Matrix::StoreFloat4x4(&viewProj, ViewProj);
+		const Culling::Frustum frustum = Culling::ExtractFrustum(viewProj);
+
+		out << "FrustumCulling\n";
+		const u32 counts[] = {10000, 30000, 100000};
+		for (u32 count : counts)
+		{
+			std::mt19937 rng(count);
+			std::uniform_real_distribution<f32> position(-1000.0f, 1000.0f), extent(0.5f, 5.0f), scale(0.5f, 2.0f), angle(0.0f, M_2PI);
+			std::vector<Culling::Bounds> local(count);
+			std::vector<float4x4> world(count);
+			for (u32 i = 0; i < count; i++)
+			{
+				for (int k = 0; k < 3; k++)
+					local[i].Extents[k] = extent(rng);
+				local[i].Radius = std::sqrt(local[i].Extents[0] * local[i].Extents[0] +
+					local[i].Extents[1] * local[i].Extents[1] + local[i].Extents[2] * local[i].Extents[2]);
+
+				// Uniform scale, a turn around y, then the translation
+				f32 s = scale(rng), a = angle(rng), c = std::cos(a) * s, n = std::sin(a) * s;
+				float4x4& m = world[i];
+				m = float4x4(c, 0.0f, -n, 0.0f,  0.0f, s, 0.0f, 0.0f,  n, 0.0f, c, 0.0f,
+					position(rng), position(rng), position(rng), 1.0f);
+			}
+
+			const u32 repeats = Math::Max(2000000u / count, 1u);
+			Culling::CullingSet cullingSet;
+			cullingSet.Resize(count);
+			Stopwatch timer;
+			for (u32 r = 0; r < repeats; r++)
+				for (u32 i = 0; i < count; i++)
+					cullingSet.Set(i, Culling::TransformBounds(local[i], world[i]));
+			f64 updateTime = timer.ElapsedMs() / repeats;
+
+			std::vector<u32> reference, visible;
+			timer.Reset();
+			for (u32 r = 0; r < repeats; r++)
+				cullingSet.CullScalar(frustum, reference);
+			f64 scalarTime = timer.ElapsedMs() / repeats;
+
+			out << "  " << count << " items: update " << count / updateTime << " items/ms, scalar " << count / scalarTime << " items/ms";
+#if defined(CULLING_SSE)
+			timer.Reset();
+			for (u32 r = 0; r < repeats; r++)
+				cullingSet.CullSse(frustum, visible);
+			f64 sseTime = timer.ElapsedMs() / repeats;
+			out << ", SSE " << count / sseTime << " items/ms (" << (visible == reference ? "matches" : "MISMATCH") << ")";
+#endif
+#if defined(CULLING_AVX)
+			if (Culling::HasAvx())
+			{
+				timer.Reset();
+				for (u32 r = 0; r < repeats; r++)
+					cullingSet.CullAvx(frustum, visible);
+				f64 avxTime = timer.ElapsedMs() / repeats;
+				out << ", AVX " << count / avxTime << " items/ms (" << (visible == reference ? "matches" : "MISMATCH") << ")";
+			}
+#endif
+			out << "\n    draws submitted: " << reference.size() << " of " << count << " ("
+				<< 100.0 * reference.size() / count << "%)\n";
+		}
+	}
+
+	// State changes a submission order costs: PSO, descriptor table and vertex/index buffer binds
+	// that differ from the previous draw's
+	struct StateChanges
+	{
+		size_t Pso = 0;
+		size_t Material = 0;
+		size_t Mesh = 0;
+	};
+
+	inline void ReportStateChanges(std::ostream& out, const std::string& label, const StateChanges& changes)
+	{
+		out << "    " << label << ": " << changes.Pso << " PSO, " << changes.Material << " table, "
+			<< changes.Mesh << " buffer changes\n";
+	}
+
+	// Draws over 4 PSOs, 200 descriptor tables and 64 meshes in arbitrary order, like the
+	// unordered_map walk that built the render layers: radix sort time against std::sort on the same
+	// keys, and the state changes left before and after sorting
+	inline void DrawSorting(std::ostream& out)
+	{
+		struct Draw
+		{
+			u32 Pso, Material, Mesh;
+			f32 Depth;
+		};
+
+		out << "DrawSorting\n";
+		const u32 counts[] = {1000, 10000, 100000};
+		for (u32 count : counts)
+		{
+			std::mt19937 rng(count);
+			std::vector<Draw> draws(count);
+			for (Draw& draw : draws)
+			{
+				draw.Pso = rng() % 4;
+				draw.Material = rng() % 200;
+				draw.Mesh = rng() % 64;
+				draw.Depth = std::uniform_real_distribution<f32>(1.0f, 1000.0f)(rng);
+			}
+
+			std::vector<DrawSort::Entry> entries(count), scratch;
+			auto makeEntries = [&]()
+			{
+				for (u32 i = 0; i < count; i++)
+				{
+					entries[i].Key = DrawSort::MakeKey(0, draws[i].Pso, draws[i].Material, draws[i].Mesh,
+						DrawSort::QuantizeDepth(draws[i].Depth, 1.0f, 1000.0f), false);
+					entries[i].Index = i;
+				}
+			};
+			auto countChanges = [&](bool sorted)
+			{
+				StateChanges changes;
+				for (u32 i = 1; i < count; i++)
+				{
+					const Draw& a = draws[sorted ? entries[i - 1].Index : i - 1];
+					const Draw& b = draws[sorted ? entries[i].Index : i];
+					changes.Pso += (a.Pso != b.Pso) ? 1 : 0;
+					changes.Material += (a.Material != b.Material) ? 1 : 0;
+					changes.Mesh += (a.Mesh != b.Mesh) ? 1 : 0;
+				}
+				return changes;
+			};
+
+			const u32 repeats = Math::Max(1000000u / count, 1u);
+			f64 keyTime = 0.0, radixTime = 0.0, stdTime = 0.0;
+			for (u32 r = 0; r < repeats; r++)
+			{
+				Stopwatch timer;
+				makeEntries();
+				keyTime += timer.ElapsedMs();
+				timer.Reset();
+				DrawSort::RadixSort(entries, scratch);
+				radixTime += timer.ElapsedMs();
+			}
+			std::vector<DrawSort::Entry> radixSorted = entries;
+			for (u32 r = 0; r < repeats; r++)
+			{
+				makeEntries();
+				Stopwatch timer;
+				std::stable_sort(entries.begin(), entries.end(),
+					[](const DrawSort::Entry& a, const DrawSort::Entry& b) { return a.Key < b.Key; });
+				stdTime += timer.ElapsedMs();
+			}
+			bool same = true;
+			for (u32 i = 0; i < count; i++)
+				same = same && entries[i].Index == radixSorted[i].Index;
+
+			out << "  " << count << " draws: keys " << 1000.0 * keyTime / repeats << " us, radix sort "
+				<< 1000.0 * radixTime / repeats << " us, std::stable_sort " << 1000.0 * stdTime / repeats << " us ("
+				<< (same ? "same order" : "ORDER DIFFERS") << ")\n";
+			ReportStateChanges(out, "unsorted", countChanges(false));
+			ReportStateChanges(out, "sorted", countChanges(true));
+		}
+	}
+
+	// itemCount render items over 8 meshes with submeshCount submeshes and 4 levels each, a quarter of
+	// them blended, scattered around the origin out to 500 units. Every submesh is a batch of its own.
+	struct FrameScene
+	{
+		static const u32 MESH_COUNT = 8, LOD_COUNT = 4, MATERIAL_COUNT = 32;
+		static const u32 SUBMESH_INDICES = 3 * 2048;
+
+		std::vector<std::unique_ptr<Mesh>> Meshes;
+		std::vector<std::unique_ptr<Material>> Materials;
+		FrameRenderer Renderer;
+		std::vector<RenderItem*> Items;
+		std::mt19937 Rng;
+
+		explicit FrameScene(u32 itemCount = 16000, u32 submeshCount = 4)
+			: Rng(itemCount)
+		{
+			for (u32 m = 0; m < MESH_COUNT; m++)
+			{
+				Meshes.push_back(std::make_unique<Mesh>());
+				Meshes.back()->BoundingRadius = 1.0f;
+			}
+			for (u32 m = 0; m < MATERIAL_COUNT; m++)
+			{
+				Materials.push_back(std::make_unique<Material>());
+				Renderer.AddMaterial(Materials.back().get());
+			}
+
+			AddItems(itemCount, submeshCount);
+			Renderer.BuildInstanceBatches();
+		}
+
+		// Every fourth item is transparent, the others opaque
+		void AddItems(u32 itemCount, u32 submeshCount)
+		{
+			std::uniform_real_distribution<f32> distance(5.0f, 500.0f), height(-20.0f, 20.0f), angle(0.0f, M_2PI), scale(0.5f, 2.0f);
+			for (u32 i = 0; i < itemCount; i++)
+			{
+				auto ri = std::make_unique<RenderItem>();
+				const u32 submesh = Rng() % submeshCount;
+				ri->Geo = Meshes[Rng() % MESH_COUNT].get();
+				ri->Mat = Materials[Rng() % Materials.size()].get();
+				ri->indexCount = SUBMESH_INDICES;
+				ri->startIndexLocation = submesh * SUBMESH_INDICES;
+
+				// Each level has half the triangles and twice the error of the one before
+				for (u32 l = 0; l < LOD_COUNT; l++)
+				{
+					MeshSimplifier::LodRange lod;
+					lod.StartIndex = ri->startIndexLocation;
+					lod.IndexCount = SUBMESH_INDICES >> l;
+					lod.Error = (l == 0) ? 0.0f : 0.002f * (f32) (1u << l);
+					ri->Lods.push_back(lod);
+				}
+				for (int k = 0; k < 3; k++)
+					ri->LocalBounds.Extents[k] = 0.577f;
+				ri->LocalBounds.Radius = 1.0f;
+
+				const f32 a = angle(Rng), d = distance(Rng), s = scale(Rng);
+				ri->World = float4x4(s, 0.0f, 0.0f, 0.0f,  0.0f, s, 0.0f, 0.0f,  0.0f, 0.0f, s, 0.0f,
+					std::cos(a) * d, height(Rng), std::sin(a) * d, 1.0f);
+
+				const RenderLayer layer = (Items.size() % 4 == 3) ? RenderLayer::Transparent : RenderLayer::OpaqueTextureless;
+				Items.push_back(Renderer.AddRenderItem(std::move(ri), layer));
+			}
+		}
+
+		// Turns 1% of the items around their vertical axis, in place so they keep their level of detail
+		void Animate()
+		{
+			std::uniform_real_distribution<f32> angle(0.0f, M_2PI);
+			const u32 itemCount = (u32) Items.size();
+			for (u32 i = 0; i < itemCount / 100; i++)
+			{
+				RenderItem* ri = Items[Rng() % itemCount];
+				const f32 s = ri->World._22, a = angle(Rng), c = std::cos(a) * s, n = std::sin(a) * s;
+				ri->World._11 = c;
+				ri->World._13 = -n;
+				ri->World._31 = n;
+				ri->World._33 = c;
+				Renderer.MarkDirty(ri);
+			}
+		}
+	};
+
+	// The whole CPU side of a frame against the null backend, with a camera turning a full circle in
+	// 360 frames through the FrameScene. Time of each phase per frame.
+	inline void FrameLoop(std::ostream& out)
+	{
+		FrameScene scene;
+		NullBackend backend(scene.Renderer.RenderItemCount(), (u32) Material::MatCBCount, scene.Renderer.LocalLightCount());
+		Camera camera(Math::DegreesToRadians(60.0f), 1920, 1080, 1.0f, 1000.0f);
+
+		const u32 FRAME_COUNT = 360;
+		SampleSet total, beginFrame, transforms, cull, selectLods, sort, instances, materials, lights, pass, record;
+		u64 drawCount = 0, commandCount = 0;
+		for (u32 frame = 0; frame < FRAME_COUNT; frame++)
+		{
+			camera.ProcessMouseMovement(M_2PI / FRAME_COUNT, 0.0f);
+			camera.DeriveViewMatrix();
+			scene.Animate();
+
+			Stopwatch timer;
+			scene.Renderer.Update(backend, camera, 1920, 1080, frame / 60.0f, 1.0f / 60.0f);
+			scene.Renderer.Record(backend);
+			total.Add(timer.ElapsedMs());
+
+			const FrameRenderer::PhaseTimes& times = scene.Renderer.Times();
+			beginFrame.Add(times.BeginFrame);
+			transforms.Add(times.Transforms);
+			cull.Add(times.Cull);
+			selectLods.Add(times.SelectLods);
+			sort.Add(times.Sort);
+			instances.Add(times.Instances);
+			materials.Add(times.Materials);
+			lights.Add(times.Lights);
+			pass.Add(times.Pass);
+			record.Add(times.Record);
+			drawCount += backend.DrawCount();
+			commandCount += backend.CommandCount();
+		}
+
+		out << "FrameLoop\n  " << scene.Items.size() << " render items, " << (f64) drawCount / FRAME_COUNT << " draws and "
+			<< (f64) commandCount / FRAME_COUNT << " commands per frame\n";
+		ReportFrameTimes(out, "frame", total);
+		ReportFrameTimes(out, "begin frame", beginFrame);
+		ReportFrameTimes(out, "transforms", transforms);
+		ReportFrameTimes(out, "cull", cull);
+		ReportFrameTimes(out, "select lods", selectLods);
+		ReportFrameTimes(out, "sort", sort);
+		ReportFrameTimes(out, "instances", instances);
+		ReportFrameTimes(out, "materials", materials);
+		ReportFrameTimes(out, "lights", lights);
+		ReportFrameTimes(out, "pass", pass);
+		ReportFrameTimes(out, "record", record);
+	}
+
+	// Draws of all lists of a frame in submission order, binds left out since every list makes its own
+	inline std::vector<NullBackend::Command> SubmittedDraws(const NullBackend& backend)
+	{
+		std::vector<NullBackend::Command> draws;
+		for (u32 list = 0; list < backend.ListCount(); list++)
+			for (const NullBackend::Command& command : backend.List(list).Commands())
+				if (command.Type == NullBackend::CommandType::Draw)
+					draws.push_back(command);
+		return draws;
+	}
+
+	// Recording the draws of a FrameScene with 256 submeshes per mesh on 1, 2, 4, ... threads, with every
+	// command costing 0.5 us as a stand in for the driver. Recording must give the same draws in the same order on any number of
+	// threads, and the same lists every time on a given number.
+	inline void ParallelRecording(std::ostream& out, int frames = 60)
+	{
+		FrameScene scene(16000, 256);
+		NullBackend backend(scene.Renderer.RenderItemCount(), (u32) Material::MatCBCount, scene.Renderer.LocalLightCount());
+		backend.SetCommandCost(0.0005);
+		Camera camera(Math::DegreesToRadians(60.0f), 1920, 1080, 1.0f, 1000.0f);
+		camera.DeriveViewMatrix();
+		scene.Renderer.Update(backend, camera, 1920, 1080, 0.0f, 1.0f / 60.0f);
+
+		scene.Renderer.Record(backend, 1);
+		const std::vector<NullBackend::Command> reference = SubmittedDraws(backend);
+		out << "ParallelRecording\n  " << reference.size() << " draws\n";
+
+		for (u32 threads : ThreadCounts())
+		{
+			scene.Renderer.Record(backend, threads);
+			std::vector<std::vector<NullBackend::Command>> firstLists;
+			for (u32 list = 0; list < backend.ListCount(); list++)
+				firstLists.push_back(backend.List(list).Commands());
+			const bool sameDraws = SubmittedDraws(backend) == reference;
+
+			SampleSet times;
+			bool repeatable = true;
+			for (int frame = 0; frame < frames; frame++)
+			{
+				scene.Renderer.Record(backend, threads);
+				times.Add(scene.Renderer.Times().Record);
+				repeatable = repeatable && backend.ListCount() == (u32) firstLists.size();
+				for (u32 list = 0; repeatable && list < backend.ListCount(); list++)
+					repeatable = backend.List(list).Commands() == firstLists[list];
+			}
+
+			ReportFrameTimes(out, std::to_string(threads) + " threads, " + std::to_string(backend.ListCount()) + " lists", times);
+			out << "    " << backend.CommandCount() << " commands, draws " << (sameDraws ? "same as" : "DIFFERENT FROM")
+				<< " 1 thread, lists " << (repeatable ? "repeat" : "CHANGE") << " between frames\n";
+		}
+	}
+
+	// Cost of handing a frame's loop of one task per thread to threads started for it, as ParallelFor does,
+	// and to a WorkerPool's waiting threads, as the frame loop does. Every index must run exactly once.
+	inline void WorkerDispatch(std::ostream& out, int rounds = 1000)
+	{
+		out << "WorkerDispatch\n";
+		WorkerPool pool;
+		for (u32 threads : ThreadCounts())
+		{
+			std::vector<std::atomic<u32>> runs(threads);
+			for (std::atomic<u32>& run : runs)
+				run = 0;
+			auto task = [&runs](size_t i) { runs[i]++; };
+
+			Stopwatch timer;
+			for (int round = 0; round < rounds; round++)
+				ParallelFor(threads, threads, task);
+			const f64 spawnTime = timer.ElapsedMs() / rounds;
+			timer.Reset();
+			for (int round = 0; round < rounds; round++)
+				pool.For(threads, threads, task);
+			const f64 poolTime = timer.ElapsedMs() / rounds;
+
+			bool exact = true;
+			for (std::atomic<u32>& run : runs)
+				exact = exact && run == 2u * rounds;
+			out << "  " << threads << " threads: started per call " << 1000.0 * spawnTime << " us, pool " << 1000.0 * poolTime
+				<< " us per loop" << (exact ? "" : ", TASKS LOST OR REPEATED") << "\n";
+		}
+	}
+
+	// Instance uploads of 100k render items of which 1% move every frame: the dirty rings against the
+	// walk over every item they replaced, which checked each one for a pending upload
+	inline void DirtyUpdates(std::ostream& out, int frames = 200)
+	{
+		FrameScene scene(100000);
+		NullBackend backend(scene.Renderer.RenderItemCount(), (u32) Material::MatCBCount, scene.Renderer.LocalLightCount());
+		Camera camera(Math::DegreesToRadians(60.0f), 1920, 1080, 1.0f, 1000.0f);
+		camera.DeriveViewMatrix();
+
+		// Settle the uploads of the initial marks and of the first level selection
+		for (int frame = 0; frame < 2 * NUM_FRAME_RESOURCES; frame++)
+			scene.Renderer.Update(backend, camera, 1920, 1080, 0.0f, 1.0f / 60.0f);
+
+		SampleSet ringTimes, walkTimes;
+		u64 written = 0;
+		u64 frame = 2 * NUM_FRAME_RESOURCES + 1; // the dirty rings' frame, they start at 1
+		for (int f = 0; f < frames; f++, frame++)
+		{
+			scene.Animate();
+			scene.Renderer.Update(backend, camera, 1920, 1080, 0.0f, 1.0f / 60.0f);
+			ringTimes.Add(scene.Renderer.Times().Instances);
+
+			Stopwatch timer;
+			InstanceData* pInstances = backend.MapInstances();
+			for (RenderItem* ri : scene.Items)
+			{
+				if (ri->DirtyFrame + NUM_FRAME_RESOURCES <= frame)
+					continue;
+
+				InstanceUpload::Source source;
+				source.pWorld = &ri->World;
+				source.pTexTransform = &ri->TexTransform;
+				source.pQuantization = &ri->Geo->Quantization;
+				source.MaterialIndex = (u32) ri->Mat->MatCBIndex;
+				source.Slot = ri->instanceIndex;
+				InstanceUpload::WriteCopied(pInstances, (u32) scene.Items.size(), &source, 1);
+				written++;
+			}
+			walkTimes.Add(timer.ElapsedMs());
+		}
+
+		out << "DirtyUpdates\n  " << scene.Items.size() << " render items, " << (f64) written / frames << " uploaded per frame\n";
+		ReportFrameTimes(out, "dirty rings", ringTimes);
+		ReportFrameTimes(out, "walk every item", walkTimes);
+	}
+
+	// 16k render items of which 1% move every frame, with 1000 more items, a new material and 8 point lights
+	// arriving every 20 frames, in buffers sized for the first items. After every frame, the frame resource
+	// just written must hold the instance of every item at its slot, every material and every light,
+	// however often it grew.
+	inline void RuntimeAdds(std::ostream& out, int frames = 200)
+	{
+		FrameScene scene(16000);
+		NullBackend backend(scene.Renderer.RenderItemCount(), scene.Renderer.MaterialSlotCount(), scene.Renderer.LocalLightCount());
+		Camera camera(Math::DegreesToRadians(60.0f), 1920, 1080, 1.0f, 1000.0f);
+		camera.DeriveViewMatrix();
+
+		SampleSet addFrames, otherFrames;
+		u32 staleFrames = 0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			const bool adding = frame % 20 == 10;
+			if (adding)
+			{
+				scene.Materials.push_back(std::make_unique<Material>());
+				scene.Materials.back()->Properties.Roughness = 0.001f * (f32) frame;
+				scene.Renderer.AddMaterial(scene.Materials.back().get());
+				scene.AddItems(1000, 4);
+				for (int l = 0; l < 8; l++)
+				{
+					auto light = std::make_shared<PointLightNode>();
+					light->SetPosition(float3((f32) frame, 0.0f, (f32) l));
+					scene.Renderer.AddLight(light);
+				}
+			}
+			scene.Animate();
+
+			Stopwatch timer;
+			scene.Renderer.Update(backend, camera, 1920, 1080, 0.0f, 1.0f / 60.0f);
+			(adding ? addFrames : otherFrames).Add(timer.ElapsedMs());
+
+			const std::vector<InstanceData>& instances = backend.Instances();
+			const std::vector<MaterialProperties>& materials = backend.Materials();
+			const std::vector<LocalLight>& lights = backend.Lights();
+			bool current = true;
+			for (const RenderItem* ri : scene.Items)
+			{
+				if (!current)
+					break;
+				current = ri->instanceIndex < instances.size() && instances[ri->instanceIndex].MaterialIndex == (u32) ri->Mat->MatCBIndex;
+				for (int e = 0; current && e < 16; e++)
+					current = instances[ri->instanceIndex].World.m[e % 4][e / 4] == ri->World.m[e / 4][e % 4];
+			}
+			for (const std::unique_ptr<Material>& material : scene.Materials)
+			{
+				current = current && (u32) material->MatCBIndex < materials.size() &&
+					std::memcmp(&materials[material->MatCBIndex], &material->Properties, sizeof(MaterialProperties)) == 0;
+			}
+			for (u32 slot = 0; current && slot < scene.Renderer.LocalLightCount(); slot++)
+				current = slot < lights.size() && std::memcmp(&lights[slot], &scene.Renderer.Lights().Record(slot), sizeof(LocalLight)) == 0;
+			staleFrames += current ? 0 : 1;
+		}
+
+		out << "RuntimeAdds\n  " << scene.Items.size() << " render items, " << scene.Materials.size() << " materials and "
+			<< scene.Renderer.LocalLightCount() << " lights after "
+			<< frames << " frames, " << (staleFrames == 0 ? "buffers current every frame" : std::to_string(staleFrames) + " FRAMES WITH STALE BUFFERS") << "\n";
+		ReportFrameTimes(out, "frames adding items", addFrames);
+		ReportFrameTimes(out, "other frames", otherFrames);
+	}
+
+	// Instance uploads of 1k to 1M objects into a plain memory buffer standing in for the upload heap:
+	// built in a temporary and copied with memcpy, against transposed in registers and streamed. Slots
+	// in increasing order fill whole lines one after the other, shuffled ones leave each store alone.
+	inline void InstanceUploads(std::ostream& out)
+	{
+		out << "InstanceUploads\n";
+		const u32 counts[] = {1000, 10000, 100000, 1000000};
+		for (u32 count : counts)
+		{
+			std::mt19937 rng(count);
+			std::uniform_real_distribution<f32> value(-100.0f, 100.0f);
+			std::vector<float4x4> worlds(count), texTransforms(count, Matrix::Identity4x4());
+			for (float4x4& world : worlds)
+				for (int k = 0; k < 16; k++)
+					world.m[k / 4][k % 4] = value(rng);
+			VertexQuantization quantization;
+
+			std::vector<InstanceUpload::Source> sources(count);
+			for (u32 i = 0; i < count; i++)
+			{
+				sources[i].pWorld = &worlds[i];
+				sources[i].pTexTransform = &texTransforms[i];
+				sources[i].pQuantization = &quantization;
+				sources[i].MaterialIndex = i;
+				sources[i].Slot = i;
+			}
+
+			std::vector<InstanceData> copied(count), streamed(count);
+			const u32 repeats = Math::Max(2000000u / count, 1u);
+			for (int shuffled = 0; shuffled < 2; shuffled++)
+			{
+				if (shuffled != 0)
+					std::shuffle(sources.begin(), sources.end(), rng);
+
+				Stopwatch timer;
+				for (u32 r = 0; r < repeats; r++)
+					InstanceUpload::WriteCopied(copied.data(), (u32) copied.size(), sources.data(), count);
+				const f64 copiedTime = timer.ElapsedMs() / repeats;
+
+				f64 streamedTime = copiedTime;
+#if defined(INSTANCE_UPLOAD_SSE)
+				timer.Reset();
+				for (u32 r = 0; r < repeats; r++)
+					InstanceUpload::WriteStreamed(streamed.data(), (u32) streamed.size(), sources.data(), count);
+				streamedTime = timer.ElapsedMs() / repeats;
+#else
+				InstanceUpload::WriteCopied(streamed.data(), (u32) streamed.size(), sources.data(), count);
+#endif
+				const bool same = std::memcmp(copied.data(), streamed.data(), count * sizeof(InstanceData)) == 0;
+
+				out << "  " << count << (shuffled != 0 ? " shuffled" : " in order") << ": copied "
+					<< 1000000.0 * copiedTime / count << " ns, streamed " << 1000000.0 * streamedTime / count
+					<< " ns per instance (" << (same ? "same data" : "DATA DIFFERS") << ")\n";
+			}
+		}
+	}
+
+	// Transient constants under a simulated fence the GPU reaches latency frames after it is signaled.
+	// Every frame allocates 500 to 3000 constant blocks of 256 bytes and 50 of 1 to 16 KB, and one frame
+	// in 100 a 256 KB block. Each allocation is tagged with its frame at both ends, and the tags must
+	// still be there when the GPU finishes that frame, or a page was reused while in flight.
+	inline void TransientChurn(std::ostream& out, u32 frames = 2000)
+	{
+		struct Tagged
+		{
+			u8* pCpu;
+			u64 Size;
+		};
+
+		out << "TransientChurn\n";
+		for (u32 latency = 1; latency <= 3; latency++)
+		{
+			MemoryPageSource pages;
+			TransientAllocator allocator;
+			allocator.Initialize(&pages);
+
+			std::mt19937 rng(latency);
+			std::vector<std::vector<Tagged>> inFlight(latency + 1);
+			u64 allocationCount = 0, bytes = 0;
+			u32 maxPages = 0;
+			bool aligned = true, intact = true;
+			f64 allocateTime = 0.0;
+			for (u64 frame = 1; frame <= frames; frame++)
+			{
+				// The GPU finished frame - latency, whose tags must have survived
+				if (frame > latency)
+				{
+					const u64 completed = frame - latency;
+					for (const Tagged& tagged : inFlight[completed % inFlight.size()])
+					{
+						u64 head, tail;
+						std::memcpy(&head, tagged.pCpu, sizeof(u64));
+						std::memcpy(&tail, tagged.pCpu + tagged.Size - sizeof(u64), sizeof(u64));
+						intact = intact && head == completed && tail == completed;
+					}
+					allocator.Retire(completed);
+				}
+
+				std::vector<Tagged>& tagged = inFlight[frame % inFlight.size()];
+				tagged.clear();
+				const u32 constantCount = 500 + rng() % 2501;
+				const u32 blockCount = 50;
+				const bool large = (rng() % 100) == 0;
+				Stopwatch timer;
+				for (u32 i = 0; i < constantCount + blockCount + (large ? 1 : 0); i++)
+				{
+					u64 size = 256;
+					if (i >= constantCount)
+						size = (i == constantCount + blockCount) ? 256 * 1024 : 1024 + rng() % (15 * 1024);
+
+					TransientAllocation allocation = allocator.Allocate(size);
+					aligned = aligned && allocation.IsValid() && (allocation.GpuAddress % TransientAllocator::DEFAULT_ALIGNMENT) == 0 &&
+						(reinterpret_cast<uintptr_t>(allocation.pCpu) % TransientAllocator::DEFAULT_ALIGNMENT) == 0;
+					std::memcpy(allocation.pCpu, &frame, sizeof(u64));
+					std::memcpy(allocation.pCpu + size - sizeof(u64), &frame, sizeof(u64));
+					tagged.push_back({allocation.pCpu, size});
+					bytes += size;
+				}
+				allocateTime += timer.ElapsedMs();
+				allocationCount += tagged.size();
+
+				allocator.Commit(frame);
+				const TransientAllocatorStats stats = allocator.Stats();
+				maxPages = Math::Max(maxPages, stats.PageCount + stats.LargePageCount);
+			}
+
+			// Once the GPU catches up every page is free, and Shrink gives them back
+			const TransientAllocatorStats stats = allocator.Stats();
+			allocator.Retire(frames);
+			allocator.Shrink();
+			out << "  " << latency << " frames in flight: " << 1000000.0 * allocateTime / allocationCount << " ns per allocation, "
+				<< (f64) bytes / frames / 1024.0 << " KB per frame, " << stats.PageCount << " pages of "
+				<< allocator.PageSize() / 1024 << " KB at the end, " << maxPages << " at most, "
+				<< (aligned ? "aligned" : "MISALIGNED") << ", " << (intact ? "no early reuse" : "REUSED IN FLIGHT") << ", "
+				<< pages.LivePageCount() << " pages live after Shrink\n";
+		}
+	}
+
+	// Binning 1k to 64k point and spot lights scattered around a camera into the default 16x9x24 cluster
+	// grid of a 45 degree view reaching 100 units, on 1, 2, 4, ... threads. Every thread count must give
+	// the lists of one thread, the SSE kernel the bins of the scalar one, and at points sampled inside
+	// the lights every light reaching the point must be in the point's cluster.
+	inline void LightClustering(std::ostream& out, int frames = 30)
+	{
+		LightClusters::ClusterView view;
+		view.FovY = M_PI_OVER_4;
+		view.AspectRatio = 16.0f / 9.0f;
+		view.NearZ = 0.1f;
+		view.FarZ = 100.0f;
+
+		// Camera at eye turned by yaw about the vertical, as a row vector world to view matrix
+		const float3 eye = {10.0f, 2.0f, -5.0f};
+		const f32 yaw = 0.5f;
+		const f32 axes[3][3] = {{std::cos(yaw), 0.0f, -std::sin(yaw)}, {0.0f, 1.0f, 0.0f}, {std::sin(yaw), 0.0f, std::cos(yaw)}};
+		for (int c = 0; c < 3; c++)
+		{
+			for (int r = 0; r < 3; r++)
+				view.View.m[r][c] = axes[c][r];
+			view.View.m[3][c] = -(eye.x * axes[c][0] + eye.y * axes[c][1] + eye.z * axes[c][2]);
+		}
+		const f32 tanHalfFovY = std::tan(view.FovY * 0.5f), tanHalfFovX = tanHalfFovY * view.AspectRatio;
+
+		out << "LightClustering\n";
+		for (u32 lightCount : {1024u, 4096u, 16384u, 65536u})
+		{
+			std::mt19937 rng(lightCount);
+			std::uniform_real_distribution<f32> across(-110.0f, 110.0f), height(-20.0f, 20.0f), range(1.0f, 8.0f), unit(-1.0f, 1.0f);
+			std::vector<LocalLight> lights(lightCount);
+			for (u32 i = 0; i < lightCount; i++)
+			{
+				lights[i].Position = float3(eye.x + across(rng), eye.y + height(rng), eye.z + across(rng));
+				lights[i].Range = range(rng);
+				lights[i].Type = (i % 4 == 0) ? LocalLightType::Spot : LocalLightType::Point;
+			}
+			LightClusters::LightSpheres spheres;
+			spheres.Resize(lightCount);
+			for (u32 i = 0; i < lightCount; i++)
+			{
+				spheres.X[i] = lights[i].Position.x;
+				spheres.Y[i] = lights[i].Position.y;
+				spheres.Z[i] = lights[i].Position.z;
+				spheres.Radius[i] = lights[i].Range;
+				spheres.Slots[i] = i;
+			}
+
+			LightClusters::ClusterBuilder builder;
+			LightClusters::ClusterLists reference;
+			builder.Build(view, spheres, 1, reference);
+
+			// The kernel the builder uses against the scalar one, on the bins just built
+			std::vector<LightClusters::LightBins> bins(lightCount);
+			for (u32 i = 0; i < lightCount; i++)
+				bins[i] = builder.Bins(i);
+			builder.BinLightsScalar(spheres, 0, lightCount);
+			u32 binMismatches = 0;
+			for (u32 i = 0; i < lightCount; i++)
+			{
+				const LightClusters::LightBins& a = bins[i];
+				const LightClusters::LightBins& b = builder.Bins(i);
+				if (a.Visible != b.Visible || (a.Visible && (a.X0 != b.X0 || a.X1 != b.X1 || a.Y0 != b.Y0 || a.Y1 != b.Y1 || a.Z0 != b.Z0 || a.Z1 != b.Z1)))
+					binMismatches++;
+			}
+
+			// Points in view inside random lights, with every light reaching them counted three ways
+			auto toView = [&view](const float3& p, f32* v)
+			{
+				for (int c = 0; c < 3; c++)
+					v[c] = p.x * view.View.m[0][c] + p.y * view.View.m[1][c] + p.z * view.View.m[2][c] + view.View.m[3][c];
+			};
+			auto reaches = [](const LocalLight& light, const float3& p)
+			{
+				const f32 dx = p.x - light.Position.x, dy = p.y - light.Position.y, dz = p.z - light.Position.z;
+				return dx * dx + dy * dy + dz * dz < light.Range * light.Range;
+			};
+			u32 samples = 0, missed = 0;
+			for (int attempt = 0; attempt < 20000 && samples < 500; attempt++)
+			{
+				const LocalLight& light = lights[rng() % lightCount];
+				float3 p(unit(rng), unit(rng), unit(rng));
+				const f32 length = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+				if (length > 1.0f || length == 0.0f)
+					continue;
+				p = float3(light.Position.x + p.x * light.Range, light.Position.y + p.y * light.Range, light.Position.z + p.z * light.Range);
+				f32 v[3];
+				toView(p, v);
+				if (v[2] <= view.NearZ || v[2] >= view.FarZ || std::fabs(v[0]) >= v[2] * tanHalfFovX || std::fabs(v[1]) >= v[2] * tanHalfFovY)
+					continue;
+
+				u32 inScene = 0, inCluster = 0;
+				for (const LocalLight& other : lights)
+					inScene += reaches(other, p) ? 1 : 0;
+				const LightClusters::ClusterRange& cluster = reference.Clusters[builder.ClusterIndex(v[0], v[1], v[2])];
+				for (u32 i = cluster.Offset; i < cluster.Offset + cluster.Count; i++)
+					inCluster += reaches(lights[reference.Indices[i]], p) ? 1 : 0;
+				missed += (inCluster != inScene) ? 1 : 0;
+				samples++;
+			}
+
+			u32 usedClusters = 0, mostLights = 0;
+			for (const LightClusters::ClusterRange& cluster : reference.Clusters)
+			{
+				usedClusters += (cluster.Count != 0) ? 1 : 0;
+				mostLights = Math::Max(mostLights, cluster.Count);
+			}
+			out << "  " << lightCount << " lights, " << builder.VisibleCount() << " in view, " << reference.Indices.size()
+				<< " cluster entries, " << (usedClusters != 0 ? (f64) reference.Indices.size() / usedClusters : 0.0)
+				<< " lights per lit cluster, " << mostLights << " at most, "
+				<< (binMismatches == 0 ? "SSE matches scalar" : std::to_string(binMismatches) + " BINS DIFFER FROM SCALAR") << ", "
+				<< (missed == 0 ? "no lights missed" : std::to_string(missed) + " POINTS MISSING LIGHTS") << " at " << samples << " points\n";
+
+			WorkerPool workers;
+			for (u32 threads : ThreadCounts())
+			{
+				LightClusters::ClusterLists lists;
+				SampleSet times;
+				for (int frame = 0; frame < frames; frame++)
+				{
+					Stopwatch timer;
+					builder.Build(view, spheres, threads, lists, &workers);
+					times.Add(timer.ElapsedMs());
+				}
+				bool same = lists.Indices == reference.Indices &&
+					lists.Clusters.size() == reference.Clusters.size();
+				for (size_t c = 0; same && c < lists.Clusters.size(); c++)
+					same = lists.Clusters[c].Offset == reference.Clusters[c].Offset && lists.Clusters[c].Count == reference.Clusters[c].Count;
+				ReportTimes(out, "  " + std::to_string(threads) + (same ? " threads" : " threads, LISTS DIFFER"), times);
+			}
+		}
+	}
+
+	// 1k to 256k point and spot light nodes scattered over 1000 by 1000 units around a camera turning in
+	// place, seeing 200 units far, with 1% of the points and 1% of the spots moving every frame. Time per
+	// frame of gathering the changes into the light table, uploading the changed slots, culling to the
+	// view and binning what is left, against binning every light as before. The SSE cull must keep the
+	// lights of the scalar one, culling must keep every light reaching points sampled in view, and the
+	// light buffer of the last frame must hold every light as it is.
+	inline void LightGather(std::ostream& out, int frames = 60)
+	{
+		out << "LightGather\n";
+		for (u32 lightCount : {1024u, 16384u, 65536u, 262144u})
+		{
+			std::mt19937 rng(lightCount);
+			std::uniform_real_distribution<f32> across(-500.0f, 500.0f), height(-20.0f, 20.0f), range(1.0f, 8.0f);
+			std::uniform_real_distribution<f32> unit(-1.0f, 1.0f), power(8.0f, 128.0f);
+			auto randomDirection = [&rng, &unit]()
+			{
+				float3 d(unit(rng), unit(rng), unit(rng));
+				return (d.x == 0.0f && d.y == 0.0f && d.z == 0.0f) ? float3(0.0f, -1.0f, 0.0f) : d;
+			};
+
+			SceneGraph scene;
+			const NodeHandle root = scene.CreateNode("lights");
+			LightTable table;
+			std::vector<std::shared_ptr<PointLightNode>> points;
+			std::vector<std::shared_ptr<SpotLightNode>> spots;
+			for (u32 i = 0; i < lightCount; i++)
+			{
+				const float3 position(across(rng), height(rng), across(rng));
+				std::shared_ptr<LightNode> light;
+				if (i % 4 == 0)
+				{
+					spots.push_back(std::make_shared<SpotLightNode>());
+					spots.back()->SetPosition(position);
+					spots.back()->SetFalloffEnd(range(rng));
+					spots.back()->SetDirection(randomDirection());
+					spots.back()->SetSpotPower(power(rng));
+					light = spots.back();
+				}
+				else
+				{
+					points.push_back(std::make_shared<PointLightNode>());
+					points.back()->SetPosition(position);
+					points.back()->SetFalloffEnd(range(rng));
+					light = points.back();
+				}
+				scene.Get(scene.CreateNode(light->GetName(), root))->pObject = light.get();
+				table.Add(light.get());
+			}
+
+			NullBackend backend(0, 0, table.LocalLightCount());
+			Camera camera(Math::DegreesToRadians(60.0f), 1920, 1080, 1.0f, 200.0f);
+			LightClusters::ClusterBuilder builder;
+			WorkerPool workers;
+			LightClusters::LightSpheres visible, all;
+			LightClusters::ClusterLists lists;
+			SampleSet gather, upload, cull, cluster, clusterAll;
+			u32 changed = 0;
+			size_t visibleCount = 0;
+			for (int frame = 0; frame < frames; frame++)
+			{
+				camera.ProcessMouseMovement(M_2PI / frames, 0.0f);
+				camera.DeriveViewMatrix();
+				backend.BeginFrame();
+				for (u32 i = 0; i < (u32) points.size() / 100; i++)
+				{
+					PointLightNode& light = *points[rng() % points.size()];
+					const float3 p = light.GetPosition();
+					light.SetPosition(float3(p.x + unit(rng), p.y, p.z + unit(rng)));
+				}
+				for (u32 i = 0; i < (u32) spots.size() / 100; i++)
+				{
+					SpotLightNode& light = *spots[rng() % spots.size()];
+					light.SetDirection(randomDirection());
+				}
+
+				LightClusters::ClusterView view;
+				Matrix::StoreFloat4x4(&view.View, camera.GetViewMatrix());
+				view.FovY = camera.GetFovY();
+				view.AspectRatio = camera.GetAspectRatio();
+				view.NearZ = camera.GetNearZ();
+				view.FarZ = camera.GetFarZ();
+
+				Stopwatch timer;
+				const u32 frameChanges = table.Gather();
+				gather.Add(timer.ElapsedMs());
+				if (frame != 0)
+					changed += frameChanges;
+
+				timer.Reset();
+				table.ForEachDirty([&backend](u32 slot, const LocalLight& light) { backend.WriteLight(slot, light); });
+				upload.Add(timer.ElapsedMs());
+
+				timer.Reset();
+				table.Cull(camera.GetFrustum(), visible);
+				cull.Add(timer.ElapsedMs());
+				visibleCount += visible.Count();
+
+				timer.Reset();
+				builder.Build(view, visible, 0, lists, &workers);
+				backend.WriteLightClusters(lists);
+				cluster.Add(timer.ElapsedMs());
+
+				// What the frame cost before the table, every light binned
+				all.Resize(lightCount);
+				for (u32 i = 0; i < lightCount; i++)
+				{
+					const LocalLight& light = table.Record(i);
+					all.X[i] = light.Position.x;
+					all.Y[i] = light.Position.y;
+					all.Z[i] = light.Position.z;
+					all.Radius[i] = light.Range;
+					all.Slots[i] = i;
+				}
+				timer.Reset();
+				builder.Build(view, all, 0, lists, &workers);
+				clusterAll.Add(timer.ElapsedMs());
+
+				backend.EndFrame();
+				table.Advance();
+			}
+
+			// Culling the last frame's view again one light at a time
+			LightClusters::LightSpheres scalar;
+			const Culling::Frustum frustum = camera.GetFrustum();
+			table.CullScalar(frustum, scalar);
+			const bool sameCull = scalar.Slots == visible.Slots;
+
+			// Points in view inside random lights, every light lighting them above SPOT_CUTOFF must have been kept
+			auto lit = [](const LocalLight& light, const float3& p)
+			{
+				const f32 dx = p.x - light.Position.x, dy = p.y - light.Position.y, dz = p.z - light.Position.z;
+				const f32 distanceSq = dx * dx + dy * dy + dz * dz;
+				if (distanceSq >= light.Range * light.Range)
+					return false;
+				if (light.Type != LocalLightType::Spot || distanceSq == 0.0f)
+					return true;
+				const f32 cosine = (dx * light.Direction.x + dy * light.Direction.y + dz * light.Direction.z) / std::sqrt(distanceSq);
+				return cosine > 0.0f && std::pow(cosine, light.SpotPower) >= SPOT_CUTOFF;
+			};
+			std::vector<bool> kept(lightCount, false);
+			for (u32 slot : visible.Slots)
+				kept[slot] = true;
+			u32 samples = 0, missed = 0;
+			for (int attempt = 0; attempt < 100000 && samples < 200; attempt++)
+			{
+				const LocalLight& light = table.Record(rng() % lightCount);
+				const float3 p(light.Position.x + unit(rng) * light.Range, light.Position.y + unit(rng) * light.Range,
+					light.Position.z + unit(rng) * light.Range);
+				bool inView = true;
+				for (const f32* plane : frustum.Planes)
+					inView = inView && plane[0] * p.x + plane[1] * p.y + plane[2] * p.z + plane[3] >= 0.0f;
+				if (!inView)
+					continue;
+				for (u32 i = 0; i < lightCount; i++)
+					missed += (!kept[i] && lit(table.Record(i), p)) ? 1 : 0;
+				samples++;
+			}
+
+			u32 staleSlots = 0;
+			for (u32 i = 0; i < lightCount; i++)
+				staleSlots += (std::memcmp(&backend.Lights()[i], &table.Record(i), sizeof(LocalLight)) != 0) ? 1 : 0;
+
+			out << "  " << lightCount << " lights, " << (f64) changed / (frames - 1) << " changed and "
+				<< (f64) visibleCount / frames << " in view per frame, "
+				<< (sameCull ? "SSE cull matches scalar" : "SSE CULL DIFFERS FROM SCALAR") << ", "
+				<< (missed == 0 ? "no lights missed" : std::to_string(missed) + " LIGHTS MISSED") << " at " << samples << " points, "
+				<< (staleSlots == 0 ? "light buffer up to date" : std::to_string(staleSlots) + " STALE SLOTS") << "\n";
+			ReportTimes(out, "  gather", gather);
+			ReportTimes(out, "  upload", upload);
+			ReportTimes(out, "  cull", cull);
+			ReportTimes(out, "  cluster", cluster);
+			ReportTimes(out, "  cluster all", clusterAll);
+		}
+	}
+
+	// About 1M nodes in two shapes, 100 trees of 5 levels with 10 children per node and one binary tree of
+	// 20 levels, added depth first. Per frame time of updating the world matrices with 1% of all nodes,
+	// 1% of the leaves or every root given a new rotation, on 1, 2, 4, ... threads. Sampled world matrices
+	// must match the product of the local transforms up the tree. Last, a render item and a point light
+	// placed on scene nodes of a FrameRenderer must follow when the node above them moves, and items moved
+	// to another node must stay with that one.
+	inline void TransformUpdates(std::ostream& out, int frames = 10)
+	{
+		struct Shape
+		{
+			const char* Name;
+			u32 Roots, Fanout, Levels;
+		};
+		const Shape shapes[] = {{"wide", 100, 10, 5}, {"deep", 1, 2, 20}};
+
+		out << "TransformUpdates\n";
+		WorkerPool workers;
+		for (const Shape& shape : shapes)
+		{
+			std::mt19937 rng(shape.Levels);
+			std::uniform_real_distribution<f32> offset(-10.0f, 10.0f), angle(0.0f, M_2PI), scale(0.9f, 1.1f);
+			auto rotation = [&rng, &angle]()
+			{
+				const f32 a = angle(rng) * 0.5f;
+				return float4(0.0f, std::sin(a), 0.0f, std::cos(a));
+			};
+
+			TransformHierarchy hierarchy;
+			std::vector<u32> roots, leaves;
+			std::vector<std::pair<u32, u32>> stack; // node, level
+			for (u32 r = 0; r < shape.Roots; r++)
+			{
+				Transform local;
+				local.Translation = float3(offset(rng), offset(rng), offset(rng));
+				roots.push_back(hierarchy.Add(local));
+				stack.push_back(std::make_pair(roots.back(), 0u));
+				while (!stack.empty())
+				{
+					const std::pair<u32, u32> node = stack.back();
+					stack.pop_back();
+					if (node.second + 1 == shape.Levels)
+					{
+						leaves.push_back(node.first);
+						continue;
+					}
+					for (u32 c = 0; c < shape.Fanout; c++)
+					{
+						Transform child;
+						child.Translation = float3(offset(rng) * 0.1f, offset(rng) * 0.1f, offset(rng) * 0.1f);
+						child.Rotation = rotation();
+						const f32 s = scale(rng);
+						child.Scale = float3(s, s, s);
+						stack.push_back(std::make_pair(hierarchy.Add(child, node.first), node.second + 1));
+					}
+				}
+			}
+
+			Stopwatch timer;
+			hierarchy.Update(1);
+			out << "  " << shape.Name << ": " << hierarchy.Count() << " nodes on " << hierarchy.LevelCount()
+				<< " levels, flattened and updated in " << timer.ElapsedMs() << " ms\n";
+
+			const u32 count = hierarchy.Count();
+			auto animateNodes = [&]() { for (u32 i = 0; i < count / 100; i++) hierarchy.SetRotation(rng() % count, rotation()); };
+			auto animateLeaves = [&]() { for (u32 i = 0; i < (u32) leaves.size() / 100; i++) hierarchy.SetRotation(leaves[rng() % leaves.size()], rotation()); };
+			auto animateRoots = [&]() { for (u32 root : roots) hierarchy.SetRotation(root, rotation()); };
+			const std::pair<const char*, std::function<void()>> animations[] =
+			{
+				{"1% of nodes", animateNodes}, {"1% of leaves", animateLeaves}, {"every root", animateRoots}
+			};
+			for (const auto& animation : animations)
+			{
+				for (u32 threads : ThreadCounts())
+				{
+					SampleSet times;
+					u64 updated = 0;
+					for (int frame = 0; frame < frames; frame++)
+					{
+						animation.second();
+						timer.Reset();
+						hierarchy.Update(threads, &workers);
+						times.Add(timer.ElapsedMs());
+						updated += hierarchy.UpdatedCount();
+					}
+
+					u32 wrong = 0;
+					for (int sample = 0; sample < 200; sample++)
+					{
+						const u32 id = rng() % count;
+						const float4x4 reference = hierarchy.ComputeReference(id);
+						const float4x4& world = hierarchy.World(id);
+						bool same = true;
+						for (int e = 0; e < 16; e++)
+						{
+							const f32 expected = reference.m[e / 4][e % 4];
+							same = same && std::fabs(world.m[e / 4][e % 4] - expected) <= 1e-3f * (1.0f + std::fabs(expected));
+						}
+						wrong += same ? 0 : 1;
+					}
+					ReportTimes(out, std::string("  ") + animation.first + ", " + std::to_string(threads) + " threads, " +
+						std::to_string(updated / frames) + " nodes updated" + (wrong == 0 ? "" : ", " + std::to_string(wrong) + " WRONG MATRICES"), times);
+				}
+			}
+		}
+
+		// The first item sits 5 units ahead of its parent node, the light 1 unit to the side of its own node.
+		// The second item starts on the same node as the first, then joins the third 3 units below the origin.
+		FrameScene scene(16);
+		Transform ahead, below;
+		ahead.Translation = float3(0.0f, 0.0f, 5.0f);
+		below.Translation = float3(0.0f, -3.0f, 0.0f);
+		const NodeHandle parent = scene.Renderer.CreateNode("parent");
+		const NodeHandle child = scene.Renderer.CreateNode("child", ahead, parent), other = scene.Renderer.CreateNode("other", below);
+		scene.Renderer.AttachRenderItem(scene.Items[0], child);
+		scene.Renderer.AttachRenderItem(scene.Items[1], child);
+		scene.Renderer.AttachRenderItem(scene.Items[2], other);
+		scene.Renderer.AttachRenderItem(scene.Items[1], other);
+		auto light = std::make_shared<PointLightNode>();
+		light->SetPosition(float3(1.0f, 0.0f, 0.0f));
+		scene.Renderer.AddLight(light, parent);
+		NullBackend backend(scene.Renderer.RenderItemCount(), scene.Renderer.MaterialSlotCount(), scene.Renderer.LocalLightCount());
+		Camera camera(Math::DegreesToRadians(60.0f), 1920, 1080, 1.0f, 1000.0f);
+		camera.DeriveViewMatrix();
+		scene.Renderer.Update(backend, camera, 1920, 1080, 0.0f, 1.0f / 60.0f);
+		scene.Renderer.SetTranslation(parent, float3(10.0f, 0.0f, 0.0f));
+		scene.Renderer.Update(backend, camera, 1920, 1080, 0.0f, 1.0f / 60.0f);
+
+		const float4x4& world = scene.Items[0]->World;
+		const float3& position = scene.Renderer.Lights().Record(0).Position;
+		const bool itemFollows = world.m[3][0] == 10.0f && world.m[3][1] == 0.0f && world.m[3][2] == 5.0f;
+		const bool lightFollows = position.x == 11.0f && position.y == 0.0f && position.z == 0.0f;
+		bool movedStay = true;
+		for (u32 i : {1u, 2u})
+		{
+			const float4x4& moved = scene.Items[i]->World;
+			movedStay = movedStay && moved.m[3][0] == 0.0f && moved.m[3][1] == -3.0f && moved.m[3][2] == 0.0f;
+		}
+		out << "  scene nodes: " << (itemFollows ? "render item follows its node" : "RENDER ITEM LEFT BEHIND") << ", "
+			<< (lightFollows ? "light follows its node" : "LIGHT LEFT BEHIND") << ", "
+			<< (movedStay ? "moved items stay on their new node" : "MOVED ITEMS FOLLOW THEIR OLD NODE") << "\n";
+	}
+
+	// The scene tree as Node kept it before SceneGraph: shared_ptr children, looked up by id with a
+	// linear search that copies every shared_ptr it passes
+	struct SharedPtrNode
+	{
+		u32 Id;
+		std::string Name;
+		float4x4 World;
+		bool Active = true;
+		SharedPtrNode* pParent = nullptr;
+		std::vector<std::shared_ptr<SharedPtrNode>> Children;
+
+		SharedPtrNode()
+		{
+			static std::atomic<u32> newId(1);
+			Id = newId++;
+			Name = "Node_" + std::to_string(Id);
+			World = Matrix::Identity4x4();
+		}
+
+		u32 GetChildrenCount() { return (u32) Children.size(); }
+
+		std::shared_ptr<SharedPtrNode> GetChildByIndex(u32 index)
+		{
+			if (index < Children.size())
+				return Children[index];
+			return nullptr;
+		}
+
+		void AddChild(std::shared_ptr<SharedPtrNode> child)
+		{
+			child->pParent = this;
+			Children.push_back(child);
+		}
+
+		std::shared_ptr<SharedPtrNode> GetChildByID(u32 childId)
+		{
+			for (auto child : Children)
+			{
+				if (child->Id == childId)
+					return child;
+			}
+			return nullptr;
+		}
+	};
+
+	// A root with 100 or 1000 children of 1000 children each, as the old shared_ptr tree and as a
+	// SceneGraph. Time per lookup of a random child by id under its parent, and per node of walking the
+	// whole tree: through GetChildByIndex for the old tree, the sibling links and memory order for the
+	// graph. After destroying and recreating 10% of the leaves, stale handles must no longer resolve, every
+	// live handle must reach its node and a walk must find every node. Nodes created on several threads at
+	// once must get distinct ids.
+	inline void SceneLookup(std::ostream& out, u32 lookups = 100000)
+	{
+		out << "SceneLookup\n";
+		for (u32 branches : {100u, 1000u})
+		{
+			const u32 LEAVES = 1000;
+			std::mt19937 rng(branches);
+
+			std::shared_ptr<SharedPtrNode> legacyRoot = std::make_shared<SharedPtrNode>();
+			SceneGraph graph;
+			const NodeHandle root = graph.CreateNode("root");
+			std::vector<std::shared_ptr<SharedPtrNode>> legacyBranches;
+			std::vector<NodeHandle> branchHandles, leafHandles;
+			std::vector<std::pair<u32, u32>> legacyLeaves; // branch, id
+			for (u32 b = 0; b < branches; b++)
+			{
+				legacyBranches.push_back(std::make_shared<SharedPtrNode>());
+				legacyRoot->AddChild(legacyBranches.back());
+				branchHandles.push_back(graph.CreateNode("branch", root));
+				for (u32 l = 0; l < LEAVES; l++)
+				{
+					auto leaf = std::make_shared<SharedPtrNode>();
+					legacyLeaves.push_back(std::make_pair(b, leaf->Id));
+					legacyBranches.back()->AddChild(leaf);
+					leafHandles.push_back(graph.CreateNode("leaf", branchHandles.back()));
+				}
+			}
+			const u32 nodeCount = graph.NodeCount();
+
+			std::vector<u32> picks(lookups);
+			for (u32& pick : picks)
+				pick = rng() % (u32) leafHandles.size();
+
+			Stopwatch timer;
+			u32 found = 0;
+			for (u32 pick : picks)
+				found += (legacyBranches[legacyLeaves[pick].first]->GetChildByID(legacyLeaves[pick].second) != nullptr) ? 1 : 0;
+			const f64 legacyLookup = timer.ElapsedMs();
+
+			std::vector<u32> leafIds(leafHandles.size());
+			for (size_t i = 0; i < leafHandles.size(); i++)
+				leafIds[i] = graph.Get(leafHandles[i])->Id;
+			timer.Reset();
+			for (u32 pick : picks)
+				found += graph.FindChild(branchHandles[pick / LEAVES], leafIds[pick]).IsNull() ? 0 : 1;
+			const f64 graphLookup = timer.ElapsedMs();
+
+			timer.Reset();
+			for (u32 pick : picks)
+				found += (graph.Get(leafHandles[pick]) != nullptr) ? 1 : 0;
+			const f64 handleLookup = timer.ElapsedMs();
+
+			// Whole tree walks, counting active nodes
+			std::function<u32(const std::shared_ptr<SharedPtrNode>&)> walkLegacy = [&walkLegacy](const std::shared_ptr<SharedPtrNode>& node)
+			{
+				u32 active = node->Active ? 1 : 0;
+				for (u32 i = 0; i < node->GetChildrenCount(); i++)
+					active += walkLegacy(node->GetChildByIndex(i));
+				return active;
+			};
+			timer.Reset();
+			const u32 legacyActive = walkLegacy(legacyRoot);
+			const f64 legacyWalk = timer.ElapsedMs();
+
+			u32 linkedActive = 0, memoryActive = 0;
+			timer.Reset();
+			graph.ForEachDepthFirst(root, [&linkedActive](NodeHandle, const SceneNode& node) { linkedActive += node.Active ? 1 : 0; });
+			const f64 linkedWalk = timer.ElapsedMs();
+			timer.Reset();
+			graph.ForEachNode([&memoryActive](NodeHandle, const SceneNode& node) { memoryActive += node.Active ? 1 : 0; });
+			const f64 memoryWalk = timer.ElapsedMs();
+
+			// Churn: a tenth of the leaves replaced by new ones under random branches
+			std::vector<NodeHandle> stale;
+			for (u32 i = 0; i < (u32) leafHandles.size() / 10; i++)
+			{
+				NodeHandle& leaf = leafHandles[rng() % leafHandles.size()];
+				if (!graph.IsAlive(leaf))
+					continue;
+				stale.push_back(leaf);
+				graph.DestroyNode(leaf);
+				leaf = graph.CreateNode("leaf", branchHandles[rng() % branches]);
+			}
+			u32 staleResolved = 0, liveMissing = 0, walked = 0;
+			for (NodeHandle handle : stale)
+				staleResolved += (graph.Get(handle) != nullptr) ? 1 : 0;
+			for (NodeHandle handle : leafHandles)
+			{
+				const SceneNode* pNode = graph.Get(handle);
+				liveMissing += (pNode == nullptr || graph.Find(pNode->Id) != handle) ? 1 : 0;
+			}
+			graph.ForEachDepthFirst(root, [&walked](NodeHandle, const SceneNode&) { walked++; });
+			const bool churnOk = staleResolved == 0 && liveMissing == 0 && walked == graph.NodeCount() && graph.NodeCount() == nodeCount;
+
+			// Ids handed out on 4 threads at once, each into its own graph
+			SceneGraph threadGraphs[4];
+			ParallelFor(4, 4, [&threadGraphs](size_t t)
+			{
+				for (u32 i = 0; i < 10000; i++)
+					threadGraphs[t].CreateNode();
+			});
+			std::vector<u32> ids;
+			for (SceneGraph& threadGraph : threadGraphs)
+				threadGraph.ForEachNode([&ids](NodeHandle, const SceneNode& node) { ids.push_back(node.Id); });
+			std::sort(ids.begin(), ids.end());
+			const bool idsUnique = std::adjacent_find(ids.begin(), ids.end()) == ids.end();
+
+			out << "  " << nodeCount << " nodes, " << branches << " branches of " << LEAVES << " leaves"
+				<< (found == 3 * lookups ? "" : ", LOOKUPS FAILED") << (legacyActive == linkedActive && linkedActive == memoryActive ? "" : ", WALKS DIFFER")
+				<< (churnOk ? ", handles survive churn" : ", HANDLES BROKEN BY CHURN") << (idsUnique ? ", ids unique" : ", DUPLICATE IDS") << "\n";
+			out << "    child by id: shared_ptr tree " << 1e6 * legacyLookup / lookups << " ns, SceneGraph " << 1e6 * graphLookup / lookups
+				<< " ns, by handle " << 1e6 * handleLookup / lookups << " ns\n";
+			out << "    walk per node: shared_ptr tree " << 1e6 * legacyWalk / nodeCount << " ns, sibling links " << 1e6 * linkedWalk / nodeCount
+				<< " ns, memory order " << 1e6 * memoryWalk / nodeCount << " ns\n";
+		}
+	}
+
+	inline void RunAll(std::ostream& out)
+	{
+		MeshLoad(out, "../../../Assets/mori_knob/testObj.obj");
+		VertexDedup(out, "../../../Assets/mori_knob/testObj.obj");
+		ObjParse(out, "../../../Assets/mori_knob/testObj.obj");
+		TextureDecode(out, L"../../../Assets");
+		SphereGeneration(out);
+		Subdivision(out);
+		SphereTessellation(out);
+		VertexCacheOptimization(out, "../../../Assets/mori_knob/testObj.obj");
+		PackedVertices(out, "../../../Assets/mori_knob/testObj.obj");
+		MeshletCulling(out, "../../../Assets/mori_knob/testObj.obj");
+		LodSelection(out, "../../../Assets/mori_knob/testObj.obj");
+		GeometryArenaChurn(out);
+		FrustumCulling(out);
+		DrawSorting(out);
+		FrameLoop(out);
+		ParallelRecording(out);
+		WorkerDispatch(out);
+		DirtyUpdates(out);
+		RuntimeAdds(out);
+		InstanceUploads(out);
+		TransientChurn(out);
+		LightClustering(out);
+		LightGather(out);
+		TransformUpdates(out);
+		SceneLookup(out);
+	}
+}
+}
+
+#endif //!BENCHMARKS_H
@@ -0,0 +1,986 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "Parallel.h"
+
+namespace Loxodonta
+{
+
+// CPU encoder for the BCn block formats used by material maps:
+//   BC4  one channel, 8 bytes per 4x4 block (roughness, metalness, displacement)
+//   BC5  two BC4 blocks for R and G, 16 bytes (tangent space normals, Z rebuilt in the shader)
+//   BC7  RGBA, 16 bytes (albedo, specular). Only modes 6 and 1 are emitted: mode 6 is a single
+//        RGBA subset with 4-bit indices, mode 1 splits the block into two RGB subsets.
+namespace BlockCompression
+{
+	enum class Format { BC4, BC5, BC7 };
+
+	// Fast fits endpoints once, Normal refines them and tries the best guess two-subset
+	// BC7 partition, Best refines longer and tries the four most promising partitions
+	enum class Quality { Fast, Normal, Best };
+
+	inline u32 BlockSize(Format format)
+	{
+		return format == Format::BC4 ? 8 : 16;
+	}
+
+	// Channels a format stores, the rest decode as 0 (alpha as 1)
+	inline u32 ChannelCount(Format format)
+	{
+		return format == Format::BC4 ? 1 : format == Format::BC5 ? 2 : 4;
+	}
+
+	inline int RoundToByte(f32 value)
+	{
+		return Math::Clamp((int) (value + 0.5f), 0, 255);
+	}
+
+	// Least squares endpoints for values interpolated with weights t in [0,1] from e0 to e1.
+	// The normal equations are shared by every channel. Returns false when every t is equal.
+	struct EndpointSolver
+	{
+		f32 A00 = 0.0f, A01 = 0.0f, A11 = 0.0f;
+		f32 B0[4] = {}, B1[4] = {};
+
+		void Add(f32 t, const f32* pValues, u32 channels)
+		{
+			f32 s = 1.0f - t;
+			A00 += s * s;
+			A01 += s * t;
+			A11 += t * t;
+			for (u32 c = 0; c < channels; c++)
+			{
+				B0[c] += s * pValues[c];
+				B1[c] += t * pValues[c];
+			}
+		}
+
+		bool Solve(u32 channels, f32 e0[4], f32 e1[4]) const
+		{
+			f32 det = A00 * A11 - A01 * A01;
+			if (std::fabs(det) < 1e-6f)
+				return false;
+			for (u32 c = 0; c < channels; c++)
+			{
+				e0[c] = (B0[c] * A11 - B1[c] * A01) / det;
+				e1[c] = (B1[c] * A00 - B0[c] * A01) / det;
+				e0[c] = e0[c] < 0.0f ? 0.0f : e0[c] > 255.0f ? 255.0f : e0[c];
+				e1[c] = e1[c] < 0.0f ? 0.0f : e1[c] > 255.0f ? 255.0f : e1[c];
+			}
+			return true;
+		}
+	};
+
+	// Little endian bit stream over a zeroed block
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(u8* pBlock) : m_pBlock(pBlock) {}
+
+		void Write(u32 value, u32 bitCount)
+		{
+			for (u32 i = 0; i < bitCount; i++, m_bit++)
+				m_pBlock[m_bit >> 3] |= (u8) (((value >> i) & 1) << (m_bit & 7));
+		}
+
+	private:
+		u8* m_pBlock;
+		u32 m_bit = 0;
+	};
+
+	class BitReader
+	{
+	public:
+		explicit BitReader(const u8* pBlock) : m_pBlock(pBlock) {}
+
+		u32 Read(u32 bitCount)
+		{
+			u32 value = 0;
+			for (u32 i = 0; i < bitCount; i++, m_bit++)
+				value |= (u32) ((m_pBlock[m_bit >> 3] >> (m_bit & 7)) & 1) << i;
+			return value;
+		}
+
+	private:
+		const u8* m_pBlock;
+		u32 m_bit = 0;
+	};
+
+	//-------------------------------------------------------------------------
+	// BC4
+	//-------------------------------------------------------------------------
+
+	// e0 > e1 selects eight interpolated values, otherwise six plus 0 and 255
+	inline void BC4Palette(int e0, int e1, int palette[8])
+	{
+		palette[0] = e0;
+		palette[1] = e1;
+		if (e0 > e1)
+		{
+			for (int i = 1; i < 7; i++)
+				palette[i + 1] = ((7 - i) * e0 + i * e1 + 3) / 7;
+		}
+		else
+		{
+			for (int i = 1; i < 5; i++)
+				palette[i + 1] = ((5 - i) * e0 + i * e1 + 2) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	// Picks the closest palette entry for every value, returns the squared error
+	inline u32 BC4AssignIndices(const u8 values[16], int e0, int e1, u8 indices[16])
+	{
+		int palette[8];
+		BC4Palette(e0, e1, palette);
+		u32 error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int bestDistance = 1 << 30;
+			for (int p = 0; p < 8; p++)
+			{
+				int distance = (palette[p] - values[i]) * (palette[p] - values[i]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					indices[i] = (u8) p;
+				}
+			}
+			error += (u32) bestDistance;
+		}
+		return error;
+	}
+
+	// Refits (e0, e1) to the current indices, the constants 0 and 255 of the six value mode are left out
+	inline bool BC4Refit(const u8 values[16], const u8 indices[16], bool eightValues, int& e0, int& e1)
+	{
+		EndpointSolver solver;
+		for (int i = 0; i < 16; i++)
+		{
+			int index = indices[i];
+			f32 t;
+			if (index <= 1)
+				t = (f32) index;
+			else if (eightValues)
+				t = (index - 1) / 7.0f;
+			else if (index <= 5)
+				t = (index - 1) / 5.0f;
+			else
+				continue;
+			f32 value = values[i];
+			solver.Add(t, &value, 1);
+		}
+		f32 r0, r1;
+		if (!solver.Solve(1, &r0, &r1))
+			return false;
+		e0 = RoundToByte(r0);
+		e1 = RoundToByte(r1);
+		return true;
+	}
+
+	struct BC4Candidate
+	{
+		int E0 = 0, E1 = 0;
+		u8 Indices[16] = {};
+		u32 Error = 0xFFFFFFFF;
+
+		void Try(const u8 values[16], int e0, int e1)
+		{
+			u8 indices[16];
+			u32 error = BC4AssignIndices(values, e0, e1, indices);
+			if (error < Error)
+			{
+				E0 = e0;
+				E1 = e1;
+				Error = error;
+				for (int i = 0; i < 16; i++)
+					Indices[i] = indices[i];
+			}
+		}
+	};
+
+	// Starts from (e0, e1) in one palette mode and refits while the error drops
+	inline void BC4Refine(const u8 values[16], int e0, int e1, bool eightValues, int iterations, BC4Candidate& best)
+	{
+		BC4Candidate candidate;
+		candidate.Try(values, e0, e1);
+		for (int i = 0; i < iterations; i++)
+		{
+			int r0, r1;
+			if (!BC4Refit(values, candidate.Indices, eightValues, r0, r1))
+				break;
+			// Keep the ordering that selects the palette mode being refined
+			if ((r0 > r1) != eightValues)
+				std::swap(r0, r1);
+			if (r0 == r1 && eightValues)
+				break;
+			u32 previous = candidate.Error;
+			candidate.Try(values, r0, r1);
+			if (candidate.Error >= previous)
+				break;
+		}
+		if (candidate.Error < best.Error)
+			best = candidate;
+	}
+
+	inline void EncodeBC4(const u8 values[16], Quality quality, u8 block[8])
+	{
+		int low = 255, high = 0;
+		int low6 = 255, high6 = 0; // range without the 0 and 255 the six value palette has for free
+		for (int i = 0; i < 16; i++)
+		{
+			low = Math::Min(low, (int) values[i]);
+			high = Math::Max(high, (int) values[i]);
+			if (values[i] != 0 && values[i] != 255)
+			{
+				low6 = Math::Min(low6, (int) values[i]);
+				high6 = Math::Max(high6, (int) values[i]);
+			}
+		}
+
+		BC4Candidate best;
+		if (low == high)
+		{
+			best.Try(values, low, low);
+		}
+		else if (quality == Quality::Fast)
+		{
+			best.Try(values, high, low);
+		}
+		else
+		{
+			int iterations = quality == Quality::Best ? 8 : 3;
+			BC4Refine(values, high, low, true, iterations, best);
+			if ((low == 0 || high == 255 || quality == Quality::Best) && low6 <= high6)
+				BC4Refine(values, low6, high6, false, iterations, best);
+
+			if (quality == Quality::Best)
+			{
+				// Local search around the refined endpoints, in the palette mode that won
+				bool eightValues = best.E0 > best.E1;
+				int e0 = best.E0, e1 = best.E1;
+				for (int d0 = -2; d0 <= 2; d0++)
+				{
+					for (int d1 = -2; d1 <= 2; d1++)
+					{
+						int c0 = Math::Clamp(e0 + d0, 0, 255), c1 = Math::Clamp(e1 + d1, 0, 255);
+						if ((c0 > c1) == eightValues)
+							best.Try(values, c0, c1);
+					}
+				}
+			}
+		}
+
+		block[0] = (u8) best.E0;
+		block[1] = (u8) best.E1;
+		u64 bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= (u64) best.Indices[i] << (3 * i);
+		for (int i = 0; i < 6; i++)
+			block[2 + i] = (u8) (bits >> (8 * i));
+	}
+
+	inline void DecodeBC4(const u8 block[8], u8 values[16])
+	{
+		int palette[8];
+		BC4Palette(block[0], block[1], palette);
+		u64 bits = 0;
+		for (int i = 0; i < 6; i++)
+			bits |= (u64) block[2 + i] << (8 * i);
+		for (int i = 0; i < 16; i++)
+			values[i] = (u8) palette[(bits >> (3 * i)) & 7];
+	}
+
+	//-------------------------------------------------------------------------
+	// BC7
+	//-------------------------------------------------------------------------
+
+	const int BC7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+	const int BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Two subset partitions, bit i is the subset of pixel i
+	const u16 BC7Partitions2[64] =
+	{
+		0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+		0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+		0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+		0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+		0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+		0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+		0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+		0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+	};
+
+	// Pixel whose index drops its top bit in the second subset
+	const u8 BC7Anchors2[64] =
+	{
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+		15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+		 6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+	};
+
+	// Endpoint layout of the modes the encoder emits
+	struct BC7Mode
+	{
+		u32 Channels;
+		u32 IndexBits;
+		u32 EndpointBits; // per channel, before the p-bit
+		bool SharedPBit;  // one p-bit per subset instead of per endpoint
+	};
+	const BC7Mode BC7Mode1 = { 3, 3, 6, true };
+	const BC7Mode BC7Mode6 = { 4, 4, 7, false };
+
+	inline int BC7Unquantize(int q, int p, const BC7Mode& mode)
+	{
+		int value = (q << 1) | p;
+		int bits = (int) mode.EndpointBits + 1;
+		return bits == 8 ? value : (value << (8 - bits)) | (value >> (2 * bits - 8));
+	}
+
+	inline int BC7Quantize(f32 value, int p, const BC7Mode& mode)
+	{
+		int maxQ = (1 << mode.EndpointBits) - 1;
+		int guess = Math::Clamp((int) (value * maxQ / 255.0f + 0.5f), 0, maxQ);
+		int best = guess;
+		f32 bestDistance = std::fabs(BC7Unquantize(guess, p, mode) - value);
+		for (int q = Math::Max(guess - 1, 0); q <= Math::Min(guess + 1, maxQ); q++)
+		{
+			f32 distance = std::fabs(BC7Unquantize(q, p, mode) - value);
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				best = q;
+			}
+		}
+		return best;
+	}
+
+	inline int BC7Interpolate(int e0, int e1, int weight)
+	{
+		return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+	}
+
+	// Quantized endpoints of one subset
+	struct BC7Endpoints
+	{
+		int Q[2][4] = {};
+		int P[2] = {};
+	};
+
+	// Assigns the closest palette entry to every member pixel, returns the squared error
+	inline u32 BC7AssignIndices(const u8 rgba[64], const u8* pMembers, u32 count, const BC7Mode& mode,
+		const BC7Endpoints& endpoints, u8 indices[16])
+	{
+		const int* pWeights = mode.IndexBits == 3 ? BC7Weights3 : BC7Weights4;
+		int entries = 1 << mode.IndexBits;
+		int palette[16][4];
+		for (u32 c = 0; c < mode.Channels; c++)
+		{
+			int e0 = BC7Unquantize(endpoints.Q[0][c], endpoints.P[0], mode);
+			int e1 = BC7Unquantize(endpoints.Q[1][c], endpoints.P[1], mode);
+			for (int i = 0; i < entries; i++)
+				palette[i][c] = BC7Interpolate(e0, e1, pWeights[i]);
+		}
+
+		u32 error = 0;
+		for (u32 m = 0; m < count; m++)
+		{
+			const u8* pPixel = rgba + 4 * pMembers[m];
+			int bestDistance = 1 << 30;
+			for (int i = 0; i < entries; i++)
+			{
+				int distance = 0;
+				for (u32 c = 0; c < mode.Channels; c++)
+					distance += (palette[i][c] - pPixel[c]) * (palette[i][c] - pPixel[c]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					indices[pMembers[m]] = (u8) i;
+				}
+			}
+			error += (u32) bestDistance;
+		}
+		return error;
+	}
+
+	// Mean and unnormalized scatter matrix of the member pixels
+	inline void BC7Scatter(const u8 rgba[64], const u8* pMembers, u32 count, u32 channels, f32 mean[4], f32 scatter[4][4])
+	{
+		for (u32 c = 0; c < 4; c++)
+		{
+			mean[c] = 0.0f;
+			for (u32 d = 0; d < 4; d++)
+				scatter[c][d] = 0.0f;
+		}
+		for (u32 m = 0; m < count; m++)
+			for (u32 c = 0; c < channels; c++)
+				mean[c] += rgba[4 * pMembers[m] + c];
+		for (u32 c = 0; c < channels; c++)
+			mean[c] /= (f32) count;
+		for (u32 m = 0; m < count; m++)
+		{
+			const u8* pPixel = rgba + 4 * pMembers[m];
+			for (u32 c = 0; c < channels; c++)
+				for (u32 d = 0; d < channels; d++)
+					scatter[c][d] += (pPixel[c] - mean[c]) * (pPixel[d] - mean[d]);
+		}
+	}
+
+	// Dominant eigenvector by power iteration, returns its eigenvalue (0 for a flat subset)
+	inline f32 BC7PrincipalAxis(const f32 scatter[4][4], u32 channels, f32 axis[4])
+	{
+		// Start from the column of the largest variance, which cannot be orthogonal to the answer
+		u32 start = 0;
+		for (u32 c = 1; c < channels; c++)
+			if (scatter[c][c] > scatter[start][start])
+				start = c;
+		for (u32 c = 0; c < 4; c++)
+			axis[c] = c < channels ? scatter[c][start] : 0.0f;
+
+		f32 eigenvalue = 0.0f;
+		for (int iteration = 0; iteration < 4; iteration++)
+		{
+			f32 length = 0.0f;
+			for (u32 c = 0; c < channels; c++)
+				length += axis[c] * axis[c];
+			length = std::sqrt(length);
+			if (length < 1e-6f)
+				return 0.0f;
+			for (u32 c = 0; c < channels; c++)
+				axis[c] /= length;
+
+			f32 next[4] = {};
+			for (u32 c = 0; c < channels; c++)
+				for (u32 d = 0; d < channels; d++)
+					next[c] += scatter[c][d] * axis[d];
+			eigenvalue = 0.0f;
+			for (u32 c = 0; c < channels; c++)
+				eigenvalue += next[c] * axis[c];
+			if (iteration < 3)
+				for (u32 c = 0; c < channels; c++)
+					axis[c] = next[c];
+		}
+		return eigenvalue;
+	}
+
+	// Endpoints at the extremes of the member pixels projected on their principal axis
+	inline void BC7InitialEndpoints(const u8 rgba[64], const u8* pMembers, u32 count, u32 channels, f32 e0[4], f32 e1[4])
+	{
+		f32 mean[4], scatter[4][4], axis[4];
+		BC7Scatter(rgba, pMembers, count, channels, mean, scatter);
+		if (BC7PrincipalAxis(scatter, channels, axis) <= 0.0f)
+		{
+			for (u32 c = 0; c < channels; c++)
+				e0[c] = e1[c] = mean[c];
+			return;
+		}
+
+		f32 low = 1e30f, high = -1e30f;
+		for (u32 m = 0; m < count; m++)
+		{
+			f32 projection = 0.0f;
+			for (u32 c = 0; c < channels; c++)
+				projection += (rgba[4 * pMembers[m] + c] - mean[c]) * axis[c];
+			low = projection < low ? projection : low;
+			high = projection > high ? projection : high;
+		}
+		for (u32 c = 0; c < channels; c++)
+		{
+			e0[c] = mean[c] + axis[c] * low;
+			e1[c] = mean[c] + axis[c] * high;
+			e0[c] = e0[c] < 0.0f ? 0.0f : e0[c] > 255.0f ? 255.0f : e0[c];
+			e1[c] = e1[c] < 0.0f ? 0.0f : e1[c] > 255.0f ? 255.0f : e1[c];
+		}
+	}
+
+	// Quantizes float endpoints under every p-bit choice worth trying and keeps the best
+	inline u32 BC7QuantizeEndpoints(const u8 rgba[64], const u8* pMembers, u32 count, const BC7Mode& mode, Quality quality,
+		const f32 e0[4], const f32 e1[4], BC7Endpoints& endpoints, u8 indices[16])
+	{
+		const f32* ends[2] = { e0, e1 };
+		int candidates[4][2];
+		int candidateCount = 0;
+		if (mode.SharedPBit)
+		{
+			candidates[candidateCount][0] = candidates[candidateCount][1] = 0; candidateCount++;
+			candidates[candidateCount][0] = candidates[candidateCount][1] = 1; candidateCount++;
+		}
+		else if (quality == Quality::Fast)
+		{
+			// Each endpoint takes the p-bit that quantizes it best on its own
+			for (int e = 0; e < 2; e++)
+			{
+				f32 errors[2] = {};
+				for (int p = 0; p < 2; p++)
+				{
+					for (u32 c = 0; c < mode.Channels; c++)
+					{
+						f32 d = BC7Unquantize(BC7Quantize(ends[e][c], p, mode), p, mode) - ends[e][c];
+						errors[p] += d * d;
+					}
+				}
+				candidates[0][e] = errors[1] < errors[0] ? 1 : 0;
+			}
+			candidateCount = 1;
+		}
+		else
+		{
+			for (int p = 0; p < 4; p++, candidateCount++)
+			{
+				candidates[p][0] = p & 1;
+				candidates[p][1] = p >> 1;
+			}
+		}
+
+		u32 bestError = 0xFFFFFFFF;
+		for (int i = 0; i < candidateCount; i++)
+		{
+			BC7Endpoints candidate;
+			u8 candidateIndices[16];
+			for (int e = 0; e < 2; e++)
+			{
+				candidate.P[e] = candidates[i][e];
+				for (u32 c = 0; c < mode.Channels; c++)
+					candidate.Q[e][c] = BC7Quantize(ends[e][c], candidate.P[e], mode);
+			}
+			u32 error = BC7AssignIndices(rgba, pMembers, count, mode, candidate, candidateIndices);
+			if (error < bestError)
+			{
+				bestError = error;
+				endpoints = candidate;
+				for (u32 m = 0; m < count; m++)
+					indices[pMembers[m]] = candidateIndices[pMembers[m]];
+			}
+		}
+		return bestError;
+	}
+
+	// Fits one subset: principal axis endpoints, then least squares refits while the error drops
+	inline u32 BC7FitSubset(const u8 rgba[64], const u8* pMembers, u32 count, const BC7Mode& mode, Quality quality,
+		BC7Endpoints& endpoints, u8 indices[16])
+	{
+		f32 e0[4], e1[4];
+		BC7InitialEndpoints(rgba, pMembers, count, mode.Channels, e0, e1);
+		u32 error = BC7QuantizeEndpoints(rgba, pMembers, count, mode, quality, e0, e1, endpoints, indices);
+
+		const int* pWeights = mode.IndexBits == 3 ? BC7Weights3 : BC7Weights4;
+		int iterations = quality == Quality::Fast ? 0 : quality == Quality::Normal ? 2 : 4;
+		for (int iteration = 0; iteration < iterations && error > 0; iteration++)
+		{
+			EndpointSolver solver;
+			for (u32 m = 0; m < count; m++)
+			{
+				f32 pixel[4];
+				for (u32 c = 0; c < mode.Channels; c++)
+					pixel[c] = rgba[4 * pMembers[m] + c];
+				solver.Add(pWeights[indices[pMembers[m]]] / 64.0f, pixel, mode.Channels);
+			}
+			if (!solver.Solve(mode.Channels, e0, e1))
+				break;
+
+			BC7Endpoints refined;
+			u8 refinedIndices[16];
+			u32 refinedError = BC7QuantizeEndpoints(rgba, pMembers, count, mode, quality, e0, e1, refined, refinedIndices);
+			if (refinedError >= error)
+				break;
+			error = refinedError;
+			endpoints = refined;
+			for (u32 m = 0; m < count; m++)
+				indices[pMembers[m]] = refinedIndices[pMembers[m]];
+		}
+		return error;
+	}
+
+	// Swaps the endpoints of a subset when its anchor index has the top bit set, which the format drops
+	inline void BC7FixAnchor(const BC7Mode& mode, u8 anchor, const u8* pMembers, u32 count, BC7Endpoints& endpoints, u8 indices[16])
+	{
+		u8 highBit = (u8) (1 << (mode.IndexBits - 1));
+		if ((indices[anchor] & highBit) == 0)
+			return;
+		for (u32 c = 0; c < 4; c++)
+			std::swap(endpoints.Q[0][c], endpoints.Q[1][c]);
+		std::swap(endpoints.P[0], endpoints.P[1]);
+		u8 maxIndex = (u8) ((1 << mode.IndexBits) - 1);
+		for (u32 m = 0; m < count; m++)
+			indices[pMembers[m]] = maxIndex - indices[pMembers[m]];
+	}
+
+	inline u32 EncodeBC7Mode6(const u8 rgba[64], Quality quality, u8 block[16])
+	{
+		static const u8 allPixels[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+		BC7Endpoints endpoints;
+		u8 indices[16];
+		u32 error = BC7FitSubset(rgba, allPixels, 16, BC7Mode6, quality, endpoints, indices);
+		BC7FixAnchor(BC7Mode6, 0, allPixels, 16, endpoints, indices);
+
+		for (int i = 0; i < 16; i++)
+			block[i] = 0;
+		BitWriter writer(block);
+		writer.Write(1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writer.Write(endpoints.Q[0][c], 7);
+			writer.Write(endpoints.Q[1][c], 7);
+		}
+		writer.Write(endpoints.P[0], 1);
+		writer.Write(endpoints.P[1], 1);
+		for (int i = 0; i < 16; i++)
+			writer.Write(indices[i], i == 0 ? 3 : 4);
+		return error;
+	}
+
+	// Splits the pixels of a partition into its two subsets
+	inline void BC7PartitionMembers(u32 partition, u8 members[2][16], u32 counts[2])
+	{
+		counts[0] = counts[1] = 0;
+		for (u8 i = 0; i < 16; i++)
+		{
+			u32 subset = (BC7Partitions2[partition] >> i) & 1;
+			members[subset][counts[subset]++] = i;
+		}
+	}
+
+	// Count, sums and products of RGB, enough to get the scatter matrix of any subset of the block
+	struct BC7Moments
+	{
+		f32 M[10] = {}; // n, r, g, b, rr, rg, rb, gg, gb, bb
+
+		void Add(const u8* pPixel)
+		{
+			f32 r = pPixel[0], g = pPixel[1], b = pPixel[2];
+			M[0] += 1.0f; M[1] += r; M[2] += g; M[3] += b;
+			M[4] += r * r; M[5] += r * g; M[6] += r * b; M[7] += g * g; M[8] += g * b; M[9] += b * b;
+		}
+
+		// Error that remains after projecting the subset on its principal axis
+		f32 Residual() const
+		{
+			if (M[0] == 0.0f)
+				return 0.0f;
+			f32 n = 1.0f / M[0];
+			f32 scatter[4][4] = {};
+			scatter[0][0] = M[4] - M[1] * M[1] * n;
+			scatter[0][1] = scatter[1][0] = M[5] - M[1] * M[2] * n;
+			scatter[0][2] = scatter[2][0] = M[6] - M[1] * M[3] * n;
+			scatter[1][1] = M[7] - M[2] * M[2] * n;
+			scatter[1][2] = scatter[2][1] = M[8] - M[2] * M[3] * n;
+			scatter[2][2] = M[9] - M[3] * M[3] * n;
+			f32 axis[4];
+			return scatter[0][0] + scatter[1][1] + scatter[2][2] - BC7PrincipalAxis(scatter, 3, axis);
+		}
+	};
+
+	// Residual of both subsets for every partition, a cheap stand-in for the fitted error when ranking them
+	inline void BC7PartitionEstimates(const u8 rgba[64], f32 estimates[64])
+	{
+		BC7Moments pixels[16], total;
+		for (int i = 0; i < 16; i++)
+		{
+			pixels[i].Add(rgba + 4 * i);
+			total.Add(rgba + 4 * i);
+		}
+		for (int partition = 0; partition < 64; partition++)
+		{
+			BC7Moments subsets[2];
+			for (int i = 0; i < 16; i++)
+				if ((BC7Partitions2[partition] >> i) & 1)
+					for (int m = 0; m < 10; m++)
+						subsets[1].M[m] += pixels[i].M[m];
+			for (int m = 0; m < 10; m++)
+				subsets[0].M[m] = total.M[m] - subsets[1].M[m];
+			estimates[partition] = subsets[0].Residual() + subsets[1].Residual();
+		}
+	}
+
+	// Mode 1 for opaque blocks: the estimated best partitions are fitted and the lowest error kept.
+	// Returns 0xFFFFFFFF and leaves block untouched when no partition beats maxError.
+	inline u32 EncodeBC7Mode1(const u8 rgba[64], Quality quality, u32 maxError, u8 block[16])
+	{
+		const int maxTried = 4;
+		int tryCount = quality == Quality::Best ? maxTried : 1;
+		int tried[maxTried];
+		f32 estimates[maxTried];
+		for (int i = 0; i < tryCount; i++)
+		{
+			tried[i] = -1;
+			estimates[i] = 1e30f;
+		}
+		f32 partitionEstimates[64];
+		BC7PartitionEstimates(rgba, partitionEstimates);
+		for (int partition = 0; partition < 64; partition++)
+		{
+			f32 estimate = partitionEstimates[partition];
+			for (int i = 0; i < tryCount; i++)
+			{
+				if (estimate < estimates[i])
+				{
+					for (int j = tryCount - 1; j > i; j--)
+					{
+						estimates[j] = estimates[j - 1];
+						tried[j] = tried[j - 1];
+					}
+					estimates[i] = estimate;
+					tried[i] = partition;
+					break;
+				}
+			}
+		}
+
+		u32 bestError = maxError;
+		int bestPartition = -1;
+		BC7Endpoints bestEndpoints[2];
+		u8 bestIndices[16];
+		for (int i = 0; i < tryCount; i++)
+		{
+			u8 members[2][16];
+			u32 counts[2];
+			BC7PartitionMembers(tried[i], members, counts);
+
+			BC7Endpoints endpoints[2];
+			u8 indices[16];
+			u32 error = 0;
+			for (int s = 0; s < 2 && error < bestError; s++)
+				error += BC7FitSubset(rgba, members[s], counts[s], BC7Mode1, quality, endpoints[s], indices);
+			if (error < bestError)
+			{
+				BC7FixAnchor(BC7Mode1, 0, members[0], counts[0], endpoints[0], indices);
+				BC7FixAnchor(BC7Mode1, BC7Anchors2[tried[i]], members[1], counts[1], endpoints[1], indices);
+				bestError = error;
+				bestPartition = tried[i];
+				bestEndpoints[0] = endpoints[0];
+				bestEndpoints[1] = endpoints[1];
+				for (int p = 0; p < 16; p++)
+					bestIndices[p] = indices[p];
+			}
+		}
+		if (bestPartition < 0)
+			return 0xFFFFFFFF;
+
+		for (int i = 0; i < 16; i++)
+			block[i] = 0;
+		BitWriter writer(block);
+		writer.Write(1 << 1, 2);
+		writer.Write((u32) bestPartition, 6);
+		for (int c = 0; c < 3; c++)
+		{
+			for (int s = 0; s < 2; s++)
+			{
+				writer.Write(bestEndpoints[s].Q[0][c], 6);
+				writer.Write(bestEndpoints[s].Q[1][c], 6);
+			}
+		}
+		writer.Write(bestEndpoints[0].P[0], 1);
+		writer.Write(bestEndpoints[1].P[0], 1);
+		u32 anchor = BC7Anchors2[bestPartition];
+		for (u32 i = 0; i < 16; i++)
+			writer.Write(bestIndices[i], i == 0 || i == anchor ? 2 : 3);
+		return bestError;
+	}
+
+	inline void EncodeBC7(const u8 rgba[64], Quality quality, u8 block[16])
+	{
+		u32 error = EncodeBC7Mode6(rgba, quality, block);
+		if (quality == Quality::Fast || error == 0)
+			return;
+
+		// Mode 1 has no alpha, it decodes as opaque
+		for (int i = 0; i < 16; i++)
+			if (rgba[4 * i + 3] != 255)
+				return;
+		u8 mode1Block[16];
+		if (EncodeBC7Mode1(rgba, quality, error, mode1Block) != 0xFFFFFFFF)
+		{
+			for (int i = 0; i < 16; i++)
+				block[i] = mode1Block[i];
+		}
+	}
+
+	// Decodes the modes EncodeBC7 emits, any other mode decodes as transparent black
+	inline void DecodeBC7(const u8 block[16], u8 rgba[64])
+	{
+		BitReader reader(block);
+		u32 mode = 0;
+		while (mode < 8 && reader.Read(1) == 0)
+			mode++;
+
+		for (int i = 0; i < 64; i++)
+			rgba[i] = 0;
+		if (mode == 6)
+		{
+			int q[2][4], p[2];
+			for (int c = 0; c < 4; c++)
+			{
+				q[0][c] = (int) reader.Read(7);
+				q[1][c] = (int) reader.Read(7);
+			}
+			p[0] = (int) reader.Read(1);
+			p[1] = (int) reader.Read(1);
+			for (int i = 0; i < 16; i++)
+			{
+				int weight = BC7Weights4[reader.Read(i == 0 ? 3 : 4)];
+				for (int c = 0; c < 4; c++)
+					rgba[4 * i + c] = (u8) BC7Interpolate(BC7Unquantize(q[0][c], p[0], BC7Mode6), BC7Unquantize(q[1][c], p[1], BC7Mode6), weight);
+			}
+		}
+		else if (mode == 1)
+		{
+			u32 partition = reader.Read(6);
+			int q[2][2][3], p[2];
+			for (int c = 0; c < 3; c++)
+			{
+				for (int s = 0; s < 2; s++)
+				{
+					q[s][0][c] = (int) reader.Read(6);
+					q[s][1][c] = (int) reader.Read(6);
+				}
+			}
+			p[0] = (int) reader.Read(1);
+			p[1] = (int) reader.Read(1);
+			u32 anchor = BC7Anchors2[partition];
+			for (u32 i = 0; i < 16; i++)
+			{
+				int s = (BC7Partitions2[partition] >> i) & 1;
+				int weight = BC7Weights3[reader.Read(i == 0 || i == anchor ? 2 : 3)];
+				for (int c = 0; c < 3; c++)
+					rgba[4 * i + c] = (u8) BC7Interpolate(BC7Unquantize(q[s][0][c], p[s], BC7Mode1), BC7Unquantize(q[s][1][c], p[s], BC7Mode1), weight);
+				rgba[4 * i + 3] = 255;
+			}
+		}
+	}
+
+	//-------------------------------------------------------------------------
+	// Images
+	//-------------------------------------------------------------------------
+
+	// Copies the 4x4 block at (blockX, blockY), partial blocks on the right and bottom edges repeat the last column and row
+	inline void LoadBlock(const u8* pRGBA, u32 width, u32 height, u32 rowPitch, u32 blockX, u32 blockY, u8 rgba[64])
+	{
+		for (u32 y = 0; y < 4; y++)
+		{
+			const u8* pRow = pRGBA + (size_t) Math::Min(blockY * 4 + y, height - 1) * rowPitch;
+			for (u32 x = 0; x < 4; x++)
+			{
+				const u8* pPixel = pRow + 4 * Math::Min(blockX * 4 + x, width - 1);
+				for (u32 c = 0; c < 4; c++)
+					rgba[16 * y + 4 * x + c] = pPixel[c];
+			}
+		}
+	}
+
+	inline void EncodeBlock(Format format, const u8 rgba[64], Quality quality, u8* pBlock)
+	{
+		if (format == Format::BC7)
+		{
+			EncodeBC7(rgba, quality, pBlock);
+			return;
+		}
+		for (u32 channel = 0; channel < ChannelCount(format); channel++)
+		{
+			u8 values[16];
+			for (int i = 0; i < 16; i++)
+				values[i] = rgba[4 * i + channel];
+			EncodeBC4(values, quality, pBlock + 8 * channel);
+		}
+	}
+
+	inline void DecodeBlock(Format format, const u8* pBlock, u8 rgba[64])
+	{
+		if (format == Format::BC7)
+		{
+			DecodeBC7(pBlock, rgba);
+			return;
+		}
+		// Channels missing from BC4/BC5 sample as 0, alpha as 1
+		for (int i = 0; i < 16; i++)
+		{
+			rgba[4 * i + 0] = rgba[4 * i + 1] = rgba[4 * i + 2] = 0;
+			rgba[4 * i + 3] = 255;
+		}
+		for (u32 channel = 0; channel < ChannelCount(format); channel++)
+		{
+			u8 values[16];
+			DecodeBC4(pBlock + 8 * channel, values);
+			for (int i = 0; i < 16; i++)
+				rgba[4 * i + channel] = values[i];
+		}
+	}
+
+	inline u32 BlockCount(u32 pixels)
+	{
+		return (pixels + 3) / 4;
+	}
+
+	// Compresses an RGBA8 image into rows of blocks, each block row is an independent work item
+	inline void CompressImage(const u8* pRGBA, u32 width, u32 height, u32 rowPitch, Format format, Quality quality,
+		u32 threadCount, std::vector<u8>& blocks)
+	{
+		u32 blocksX = BlockCount(width), blocksY = BlockCount(height);
+		u32 blockSize = BlockSize(format);
+		blocks.assign((size_t) blocksX * blocksY * blockSize, 0);
+		ParallelFor(blocksY, threadCount, [&](size_t blockY)
+		{
+			u8 rgba[64];
+			for (u32 blockX = 0; blockX < blocksX; blockX++)
+			{
+				LoadBlock(pRGBA, width, height, rowPitch, blockX, (u32) blockY, rgba);
+				EncodeBlock(format, rgba, quality, &blocks[(blockY * blocksX + blockX) * blockSize]);
+			}
+		});
+	}
+
+	// Decodes blocks back to a tightly packed RGBA8 image the way the sampler would see them
+	inline void DecompressImage(const u8* pBlocks, u32 width, u32 height, Format format, std::vector<u8>& rgba)
+	{
+		u32 blocksX = BlockCount(width), blocksY = BlockCount(height);
+		u32 blockSize = BlockSize(format);
+		rgba.assign((size_t) width * height * 4, 0);
+		for (u32 blockY = 0; blockY < blocksY; blockY++)
+		{
+			for (u32 blockX = 0; blockX < blocksX; blockX++)
+			{
+				u8 block[64];
+				DecodeBlock(format, pBlocks + ((size_t) blockY * blocksX + blockX) * blockSize, block);
+				for (u32 y = 0; y < 4 && blockY * 4 + y < height; y++)
+					for (u32 x = 0; x < 4 && blockX * 4 + x < width; x++)
+						for (u32 c = 0; c < 4; c++)
+							rgba[(((size_t) blockY * 4 + y) * width + blockX * 4 + x) * 4 + c] = block[16 * y + 4 * x + c];
+			}
+		}
+	}
+
+	// Peak signal to noise ratio in dB over the first channelCount channels, 99 for identical images
+	inline f64 PSNR(const u8* pA, u32 pitchA, const u8* pB, u32 pitchB, u32 width, u32 height, u32 channelCount)
+	{
+		u64 squaredError = 0;
+		for (u32 y = 0; y < height; y++)
+		{
+			const u8* pRowA = pA + (size_t) y * pitchA;
+			const u8* pRowB = pB + (size_t) y * pitchB;
+			for (u32 x = 0; x < width; x++)
+			{
+				for (u32 c = 0; c < channelCount; c++)
+				{
+					int d = pRowA[4 * x + c] - pRowB[4 * x + c];
+					squaredError += (u64) (d * d);
+				}
+			}
+		}
+		if (squaredError == 0)
+			return 99.0;
+		f64 mse = (f64) squaredError / ((f64) width * height * channelCount);
+		return 10.0 * std::log10(255.0 * 255.0 / mse);
+	}
+}
+
+}
+
+#endif //!BLOCK_COMPRESSION_H
@@ -61,6 +61,14 @@ float Camera::GetFarZ()
 {
 	return m_farZ;
 }
+float Camera::GetFovY()
+{
+	return m_fovY;
+}
+float Camera::GetAspectRatio()
+{
+	return m_aspectRatio;
+}
 vect4 Camera::GetProjectionMatrix()
 {
 	return m_Projection;
@@ -69,6 +77,13 @@ vect4 Camera::GetViewMatrix()
 {
 	return m_View;
 }
+Culling::Frustum Camera::GetFrustum()
+{
+	vect4 ViewProj = Matrix::Multiply(m_View, m_Projection);
+	float4x4 viewProj;
+	Matrix::StoreFloat4x4(&viewProj, ViewProj);
+	return Culling::ExtractFrustum(viewProj);
+}
 
 
 void Camera::ProcessKeyboardInput(float deltaSide, float deltaForward)
@@ -3,6 +3,7 @@
 
 #include "Core.h"
 #include "MathUtil.h"
+#include "Culling.h"
 
 namespace Loxodonta
 {
@@ -38,8 +39,13 @@ public:
 	vect GetUp();
 	float GetNearZ();
 	float GetFarZ();
+	// Vertical field of view in RADIANS
+	float GetFovY();
+	float GetAspectRatio();
 	vect4 GetProjectionMatrix();
 	vect4 GetViewMatrix();
+	// World space planes of the current view, call after DeriveViewMatrix
+	Culling::Frustum GetFrustum();
 
 	// Compute new View Matrix
 	void DeriveViewMatrix();
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <atomic>
+
 #include "MathUtil.h"
 
+namespace Loxodonta
+{
+
 class Component
 {
 	Component()
 	{
-		static uint newID = 1; // not thread safe
+		static std::atomic<uint> newID(1);
 		m_uniqueID = newID++;
 		m_isActive = true;
 	}
@@ -22,4 +27,6 @@ class Component
 protected:
 	uint m_uniqueID;
 	bool m_isActive;
-};
\ No newline at end of file
+};
+
+}
@@ -0,0 +1,311 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CULLING_SSE 1
+#include <emmintrin.h>
+#endif
+// AVX is compiled in wherever SSE is and picked at run time, the project builds for SSE2 only
+#if defined(CULLING_SSE) && (defined(_MSC_VER) || defined(__GNUC__))
+#define CULLING_AVX 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CULLING_AVX_TARGET
+#else
+#include <cpuid.h>
+#define CULLING_AVX_TARGET __attribute__((target("avx")))
+#endif
+#endif
+
+namespace Loxodonta
+{
+
+// Frustum culling of render items against their world space bounding boxes.
+// Bounds live in a structure of arrays so one plane test covers 4 items with SSE and 8 with AVX.
+namespace Culling
+{
+#if defined(CULLING_AVX)
+	// Whether the CPU has AVX and the OS saves the YMM registers on context switches
+	inline bool HasAvx()
+	{
+		static const bool hasAvx = []()
+		{
+			u32 info[4] = {};
+#if defined(_MSC_VER)
+			__cpuid((int*) info, 1);
+#else
+			__cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+			const u32 OSXSAVE = 1u << 27, AVX = 1u << 28;
+			if ((info[2] & OSXSAVE) == 0 || (info[2] & AVX) == 0)
+				return false;
+#if defined(_MSC_VER)
+			const u64 xcr0 = _xgetbv(0);
+#else
+			u32 low, high;
+			__asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+			const u64 xcr0 = ((u64) high << 32) | low;
+#endif
+			return (xcr0 & 6) == 6;
+		}();
+		return hasAvx;
+	}
+#endif
+
+	// Axis aligned box as center and half extents, and the sphere around the same center
+	struct Bounds
+	{
+		f32 Center[3] = {0.0f, 0.0f, 0.0f};
+		f32 Extents[3] = {0.0f, 0.0f, 0.0f};
+		f32 Radius = 0.0f;
+	};
+
+	// Planes as (normal, distance) with normals pointing inside, a point p is inside when dot(n, p) + d >= 0
+	struct Frustum
+	{
+		enum Plane { Left = 0, Right, Bottom, Top, Near, Far, Count };
+		f32 Planes[Count][4];
+	};
+
+	// Bounds of the vertices indexCount indices reference, the sphere is centered on the box and
+	// reaches the farthest vertex, which is tighter than the box's own corners
+	template <typename Index>
+	inline Bounds ComputeBounds(const u8* pVertices, u32 vertexStride, const Index* pIndices, u32 indexCount, i32 baseVertex)
+	{
+		Bounds bounds;
+		if (indexCount == 0)
+			return bounds;
+
+		f32 lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+		f32 hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+		for (u32 i = 0; i < indexCount; i++)
+		{
+			const f32* p = reinterpret_cast<const f32*>(pVertices + (size_t) (pIndices[i] + baseVertex) * vertexStride);
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = Math::Min(lo[k], p[k]);
+				hi[k] = Math::Max(hi[k], p[k]);
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			bounds.Center[k] = (lo[k] + hi[k]) * 0.5f;
+			bounds.Extents[k] = (hi[k] - lo[k]) * 0.5f;
+		}
+
+		f32 radiusSq = 0.0f;
+		for (u32 i = 0; i < indexCount; i++)
+		{
+			const f32* p = reinterpret_cast<const f32*>(pVertices + (size_t) (pIndices[i] + baseVertex) * vertexStride);
+			f32 dx = p[0] - bounds.Center[0], dy = p[1] - bounds.Center[1], dz = p[2] - bounds.Center[2];
+			radiusSq = Math::Max(radiusSq, dx * dx + dy * dy + dz * dz);
+		}
+		bounds.Radius = std::sqrt(radiusSq);
+		return bounds;
+	}
+
+	// Local bounds moved by a row vector world matrix. The box is the one enclosing the transformed
+	// box (Arvo), the sphere grows with the largest axis scale.
+	inline Bounds TransformBounds(const Bounds& local, const float4x4& world)
+	{
+		Bounds result;
+		f32 scaleSq = 0.0f;
+		for (int c = 0; c < 3; c++)
+		{
+			result.Center[c] = world.m[3][c];
+			result.Extents[c] = 0.0f;
+			for (int r = 0; r < 3; r++)
+			{
+				result.Center[c] += local.Center[r] * world.m[r][c];
+				result.Extents[c] += local.Extents[r] * std::fabs(world.m[r][c]);
+			}
+		}
+		for (int r = 0; r < 3; r++)
+			scaleSq = Math::Max(scaleSq, world.m[r][0] * world.m[r][0] + world.m[r][1] * world.m[r][1] + world.m[r][2] * world.m[r][2]);
+		result.Radius = local.Radius * std::sqrt(scaleSq);
+		return result;
+	}
+
+	// Gribb and Hartmann: with row vectors, clip space coordinate j is the dot product with column j
+	// of viewProj. D3D depth runs from 0 to w, so the near plane is column 2 alone.
+	inline Frustum ExtractFrustum(const float4x4& viewProj)
+	{
+		Frustum frustum;
+		for (int r = 0; r < 4; r++)
+		{
+			const f32 x = viewProj.m[r][0], y = viewProj.m[r][1], z = viewProj.m[r][2], w = viewProj.m[r][3];
+			frustum.Planes[Frustum::Left][r] = w + x;
+			frustum.Planes[Frustum::Right][r] = w - x;
+			frustum.Planes[Frustum::Bottom][r] = w + y;
+			frustum.Planes[Frustum::Top][r] = w - y;
+			frustum.Planes[Frustum::Near][r] = z;
+			frustum.Planes[Frustum::Far][r] = w - z;
+		}
+		for (f32* plane : frustum.Planes)
+		{
+			f32 invLength = 1.0f / std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+			for (int k = 0; k < 4; k++)
+				plane[k] *= invLength;
+		}
+		return frustum;
+	}
+
+	// A box is outside when it lies entirely behind one plane: its center is further behind
+	// than the box reaches along the normal
+	inline bool IsVisible(const Frustum& frustum, const Bounds& bounds)
+	{
+		for (const f32* plane : frustum.Planes)
+		{
+			f32 distance = plane[0] * bounds.Center[0] + plane[1] * bounds.Center[1] + plane[2] * bounds.Center[2] + plane[3];
+			f32 reach = std::fabs(plane[0]) * bounds.Extents[0] + std::fabs(plane[1]) * bounds.Extents[1] + std::fabs(plane[2]) * bounds.Extents[2];
+			if (distance + reach < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	// World space boxes of a list of items, item i of the caller's list is slot i.
+	// Arrays are padded to a multiple of 8 with empty boxes that are never reported.
+	class CullingSet
+	{
+	public:
+		static const u32 LANES = 8;
+
+		void Resize(u32 count)
+		{
+			m_Count = count;
+			const u32 padded = (count + LANES - 1) / LANES * LANES;
+			for (std::vector<f32>& column : m_Columns)
+				column.assign(padded, 0.0f);
+		}
+
+		u32 Count() const { return m_Count; }
+
+		void Set(u32 slot, const Bounds& world)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				m_Columns[k][slot] = world.Center[k];
+				m_Columns[3 + k][slot] = world.Extents[k];
+			}
+		}
+
+		// Slots of the visible items in increasing order, written over visible
+		void Cull(const Frustum& frustum, std::vector<u32>& visible) const
+		{
+#if defined(CULLING_AVX)
+			if (HasAvx())
+			{
+				CullAvx(frustum, visible);
+				return;
+			}
+#endif
+#if defined(CULLING_SSE)
+			CullSse(frustum, visible);
+#else
+			CullScalar(frustum, visible);
+#endif
+		}
+
+		// One item at a time, the reference the wide kernels must agree with
+		void CullScalar(const Frustum& frustum, std::vector<u32>& visible) const
+		{
+			visible.clear();
+			for (u32 i = 0; i < m_Count; i++)
+			{
+				Bounds bounds;
+				for (int k = 0; k < 3; k++)
+				{
+					bounds.Center[k] = m_Columns[k][i];
+					bounds.Extents[k] = m_Columns[3 + k][i];
+				}
+				if (IsVisible(frustum, bounds))
+					visible.push_back(i);
+			}
+		}
+
+#if defined(CULLING_SSE)
+		void CullSse(const Frustum& frustum, std::vector<u32>& visible) const
+		{
+			visible.resize(m_Count);
+			u32 visibleCount = 0;
+			const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			for (u32 i = 0; i < m_Count; i += 4)
+			{
+				const __m128 cx = _mm_loadu_ps(&m_Columns[0][i]), cy = _mm_loadu_ps(&m_Columns[1][i]), cz = _mm_loadu_ps(&m_Columns[2][i]);
+				const __m128 ex = _mm_loadu_ps(&m_Columns[3][i]), ey = _mm_loadu_ps(&m_Columns[4][i]), ez = _mm_loadu_ps(&m_Columns[5][i]);
+				__m128 outside = _mm_setzero_ps();
+				for (const f32* plane : frustum.Planes)
+				{
+					const __m128 nx = _mm_set1_ps(plane[0]), ny = _mm_set1_ps(plane[1]), nz = _mm_set1_ps(plane[2]);
+					__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+						_mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane[3])));
+					__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, signMask), ex), _mm_mul_ps(_mm_and_ps(ny, signMask), ey)),
+						_mm_mul_ps(_mm_and_ps(nz, signMask), ez));
+					outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+				}
+				visibleCount = Append(visible, visibleCount, i, ~_mm_movemask_ps(outside) & 0xf);
+			}
+			visible.resize(visibleCount);
+		}
+#endif
+
+#if defined(CULLING_AVX)
+		// Only where HasAvx()
+		CULLING_AVX_TARGET void CullAvx(const Frustum& frustum, std::vector<u32>& visible) const
+		{
+			visible.resize(m_Count);
+			u32 visibleCount = 0;
+			const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+			for (u32 i = 0; i < m_Count; i += 8)
+			{
+				const __m256 cx = _mm256_loadu_ps(&m_Columns[0][i]), cy = _mm256_loadu_ps(&m_Columns[1][i]), cz = _mm256_loadu_ps(&m_Columns[2][i]);
+				const __m256 ex = _mm256_loadu_ps(&m_Columns[3][i]), ey = _mm256_loadu_ps(&m_Columns[4][i]), ez = _mm256_loadu_ps(&m_Columns[5][i]);
+				__m256 outside = _mm256_setzero_ps();
+				for (const f32* plane : frustum.Planes)
+				{
+					const __m256 nx = _mm256_set1_ps(plane[0]), ny = _mm256_set1_ps(plane[1]), nz = _mm256_set1_ps(plane[2]);
+					__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)),
+						_mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(plane[3])));
+					__m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_and_ps(nx, signMask), ex), _mm256_mul_ps(_mm256_and_ps(ny, signMask), ey)),
+						_mm256_mul_ps(_mm256_and_ps(nz, signMask), ez));
+					outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+				}
+				visibleCount = Append(visible, visibleCount, i, ~_mm256_movemask_ps(outside) & 0xff);
+			}
+			// The rest of the build is SSE, leave the upper halves clean to avoid transition stalls
+			_mm256_zeroupper();
+			visible.resize(visibleCount);
+		}
+#endif
+
+	private:
+		// Writes the slots of the set bits of mask, dropping the padding past m_Count
+		u32 Append(std::vector<u32>& visible, u32 visibleCount, u32 first, int mask) const
+		{
+			for (u32 lane = 0; mask != 0; lane++, mask >>= 1)
+			{
+				if ((mask & 1) != 0 && first + lane < m_Count)
+					visible[visibleCount++] = first + lane;
+			}
+			return visibleCount;
+		}
+
+		u32 m_Count = 0;
+		// Center x, y, z then extents x, y, z. std::vector of f32 is only 8 byte aligned in general, so the
+		// kernels use the unaligned _mm_loadu_ps and _mm256_loadu_ps; the aligned loads would fault on it.
+		std::vector<f32> m_Columns[6];
+	};
+}
+
+}
+
+#endif //!CULLING_H
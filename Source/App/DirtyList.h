@@ -0,0 +1,75 @@
+#ifndef DIRTY_LIST_H
+#define DIRTY_LIST_H
+
+#include <vector>
+
+#include "../3rdParty/FrankLuna/d3dUtil.h"
+
+#include "Core.h"
+
+namespace Loxodonta
+{
+
+// Objects whose copy in some frame resources is out of date. Each frame resource has a list of the
+// objects marked in the frame that used it last, so an object marked dirty is visited in each of the
+// next NUM_FRAME_RESOURCES frames, and updates cost as much as the changes do rather than the scene.
+//
+// The lists are intrusive: T has a u64 DirtyFrame member holding the last frame it was marked in,
+// 0 for never. Marking an object twice in a frame adds it once, and an object marked again in a later
+// frame is only visited through its newest list.
+template <typename T>
+class DirtyRing
+{
+public:
+	DirtyRing()
+		: m_Lists(NUM_FRAME_RESOURCES)
+	{
+	}
+
+	void Mark(T* object)
+	{
+		if (object->DirtyFrame == m_Frame)
+			return;
+		object->DirtyFrame = m_Frame;
+		m_Lists[m_Frame % m_Lists.size()].push_back(object);
+	}
+
+	// Calls fn on every object marked this frame or in the NUM_FRAME_RESOURCES - 1 before, once each
+	template <typename Fn>
+	void ForEach(Fn fn) const
+	{
+		for (u64 age = 0; age < m_Lists.size() && age < m_Frame; age++)
+		{
+			const u64 frame = m_Frame - age;
+			for (T* object : m_Lists[frame % m_Lists.size()])
+			{
+				if (object->DirtyFrame == frame)
+					fn(object);
+			}
+		}
+	}
+
+	// Calls fn on the objects marked this frame only
+	template <typename Fn>
+	void ForEachNew(Fn fn) const
+	{
+		for (T* object : m_Lists[m_Frame % m_Lists.size()])
+			fn(object);
+	}
+
+	// Ends the frame, the list of the oldest frame is emptied to collect the marks of the next one
+	void Advance()
+	{
+		m_Frame++;
+		m_Lists[m_Frame % m_Lists.size()].clear();
+	}
+
+private:
+	std::vector<std::vector<T*>> m_Lists;
+	// Frames start at 1 so a DirtyFrame of 0 is never current
+	u64 m_Frame = 1;
+};
+
+}
+
+#endif //!DIRTY_LIST_H
@@ -0,0 +1,104 @@
+#ifndef DRAW_SORT_H
+#define DRAW_SORT_H
+
+#include <algorithm>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+
+namespace Loxodonta
+{
+
+// 64 bit draw keys and the radix sort that orders them. Sorting the keys of a frame's draws groups
+// them by pipeline state, then descriptor table, then geometry, so consecutive draws share as much
+// bound state as possible, and orders what is left by depth.
+//
+// Key layout, most significant bits first:
+//   front to back: layer 4 | pso 6 | material 14 | mesh 16 | depth 24
+//   back to front: layer 4 | ~depth 24 | pso 6 | material 14 | mesh 16
+// Blended layers give up state grouping for correct compositing, their depth comes first, inverted.
+namespace DrawSort
+{
+	const u32 LAYER_BITS = 4;
+	const u32 PSO_BITS = 6;
+	const u32 MATERIAL_BITS = 14;
+	const u32 MESH_BITS = 16;
+	const u32 DEPTH_BITS = 24;
+
+	// Below this many keys the fixed cost of the histograms outweighs the comparisons of std::stable_sort
+	const size_t RADIX_THRESHOLD = 1024;
+
+	struct Entry
+	{
+		u64 Key;
+		u32 Index; // the draw the key belongs to
+	};
+
+	// View depth mapped linearly from [nearZ, farZ] onto DEPTH_BITS, values outside are clamped
+	inline u32 QuantizeDepth(f32 depth, f32 nearZ, f32 farZ)
+	{
+		const f32 t = Math::Clamp((depth - nearZ) / (farZ - nearZ), 0.0f, 1.0f);
+		return (u32) (t * (f32) ((1u << DEPTH_BITS) - 1));
+	}
+
+	// Fields wider than their bits are masked, so ids past the limits only cost grouping
+	inline u64 MakeKey(u32 layer, u32 pso, u32 material, u32 mesh, u32 depth, bool backToFront)
+	{
+		const u64 l = layer & ((1u << LAYER_BITS) - 1);
+		const u64 p = pso & ((1u << PSO_BITS) - 1);
+		const u64 m = material & ((1u << MATERIAL_BITS) - 1);
+		const u64 g = mesh & ((1u << MESH_BITS) - 1);
+		const u64 d = depth & ((1u << DEPTH_BITS) - 1);
+		if (backToFront)
+		{
+			const u64 inverted = ((1u << DEPTH_BITS) - 1) - d;
+			return (l << 60) | (inverted << 36) | (p << 30) | (m << 16) | g;
+		}
+		return (l << 60) | (p << 54) | (m << 40) | (g << 24) | d;
+	}
+
+	// Stable LSD radix sort, one byte per pass. A single counting pass builds all eight histograms,
+	// and bytes that are equal in every key skip their pass: with a few layers and PSOs, most of the
+	// upper bytes never need one. Short lists go through std::stable_sort, with the same result.
+	inline void RadixSort(std::vector<Entry>& entries, std::vector<Entry>& scratch)
+	{
+		const size_t count = entries.size();
+		if (count < RADIX_THRESHOLD)
+		{
+			std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.Key < b.Key; });
+			return;
+		}
+
+		static const u32 BYTES = 8;
+		u32 histograms[BYTES][256] = {};
+		for (const Entry& entry : entries)
+		{
+			for (u32 b = 0; b < BYTES; b++)
+				histograms[b][(entry.Key >> (b * 8)) & 0xff]++;
+		}
+
+		scratch.resize(count);
+		for (u32 b = 0; b < BYTES; b++)
+		{
+			u32* histogram = histograms[b];
+			if (histogram[(entries[0].Key >> (b * 8)) & 0xff] == count)
+				continue;
+
+			u32 offset = 0;
+			for (u32 digit = 0; digit < 256; digit++)
+			{
+				const u32 digitCount = histogram[digit];
+				histogram[digit] = offset;
+				offset += digitCount;
+			}
+			for (const Entry& entry : entries)
+				scratch[histogram[(entry.Key >> (b * 8)) & 0xff]++] = entry;
+			entries.swap(scratch);
+		}
+	}
+}
+
+}
+
+#endif //!DRAW_SORT_H
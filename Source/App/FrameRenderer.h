@@ -0,0 +1,817 @@
+#ifndef FRAME_RENDERER_H
+#define FRAME_RENDERER_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "Profiler.h"
+#include "Parallel.h"
+#include "Camera.h"
+#include "FrameResource.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "Culling.h"
+#include "DrawSort.h"
+#include "RenderBackend.h"
+#include "DirtyList.h"
+#include "InstanceUpload.h"
+#include "LightClusters.h"
+#include "Light.h"
+#include "LightTable.h"
+#include "Node.h"
+#include "SceneGraph.h"
+#include "TransformHierarchy.h"
+
+namespace Loxodonta
+{
+
+struct RenderItem
+{
+	static const uint INVALID_INSTANCE = ~0u;
+
+	RenderItem() = default;
+
+	// Object's local space to World Space, kept up to date from Node when it has one
+	float4x4 World = Matrix::Identity4x4();
+	float4x4 TexTransform = Matrix::Identity4x4();
+	NodeHandle Node;
+	// Next item on the same scene node
+	RenderItem* pNextOnNode = nullptr;
+
+	// Last frame the item was marked dirty in, see DirtyRing. Mark items through FrameRenderer::MarkDirty.
+	u64 DirtyFrame = 0;
+	// Slot in the instance buffer, assigned when the instance batches are built
+	uint instanceIndex = INVALID_INSTANCE;
+	// Layer the item was added to and its place in the layer's list
+	RenderLayer Layer = RenderLayer::Opaque;
+	uint layerIndex = 0;
+
+	Material* Mat = nullptr;
+	Mesh* Geo = nullptr;
+
+	D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	uint indexCount = 0;
+	uint startIndexLocation = 0;
+	int baseVertexLocation = 0;
+
+	// Levels of detail of the submesh, empty when it has none
+	std::vector<MeshSimplifier::LodRange> Lods;
+
+	// Object space bounds of the submesh, and whether they touched the view frustum this frame
+	Culling::Bounds LocalBounds;
+	bool Visible = true;
+};
+
+// Render items of one layer sharing geometry and textures, issued as a single DrawIndexedInstanced.
+// Their instance data is contiguous in the instance buffer starting at baseInstance.
+// Items are kept sorted by level of detail, each level with instances is one draw over its part of the range.
+// Culled items sit behind the last level where no draw reaches them.
+struct InstanceBatch
+{
+	Mesh* Geo = nullptr;
+	Texture* pDiffuse = nullptr;
+
+	D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	uint indexCount = 0;
+	uint startIndexLocation = 0;
+	int baseVertexLocation = 0;
+
+	uint baseInstance = 0;
+	uint instanceCount = 0;
+
+	// Dense id of Geo for the draw sort keys
+	u32 MeshId = 0;
+
+	// Lods[0] is the full range above
+	std::vector<MeshSimplifier::LodRange> Lods;
+	// Items in instance slot order and how many visible ones use each level
+	std::vector<RenderItem*> Items;
+	std::vector<uint> LodInstanceCounts;
+
+	bool CanDraw(const RenderItem* ri) const
+	{
+		return Geo == ri->Geo && pDiffuse == ri->Mat->pDiffuse && PrimitiveType == ri->PrimitiveType &&
+			indexCount == ri->indexCount && startIndexLocation == ri->startIndexLocation &&
+			baseVertexLocation == ri->baseVertexLocation;
+	}
+};
+
+// One DrawIndexedInstanced: a level of detail of a batch and the instances using it
+struct DrawCommand
+{
+	const InstanceBatch* pBatch = nullptr;
+	uint Lod = 0;
+	uint BaseInstance = 0;
+	uint InstanceCount = 0;
+};
+
+// Blended layers go after everything they blend over, the sky fills what is left
+const RenderLayer LAYER_DRAW_ORDER[] = {RenderLayer::Opaque, RenderLayer::OpaqueAsrnd, RenderLayer::OpaqueAmrn,
+	RenderLayer::OpaqueTextureless, RenderLayer::AlphaTested, RenderLayer::Transparent, RenderLayer::SkyBox};
+
+// Fewest draws worth a command list of their own when recording is split across threads
+const u32 MIN_LIST_DRAWS = 64;
+
+// The part of a frame that does not depend on the graphics API: which render items are drawn, at
+// which level of detail and in which order, and the instance, material and pass data they read.
+// Everything reaches the GPU through a RenderBackend.
+class FrameRenderer
+{
+public:
+	// CPU time of each phase of the last frame, in milliseconds
+	struct PhaseTimes
+	{
+		f64 BeginFrame = 0.0; // frame resource cycling, including any wait for the GPU
+		f64 Transforms = 0.0;
+		f64 Cull = 0.0;
+		f64 SelectLods = 0.0;
+		f64 Sort = 0.0;
+		f64 Instances = 0.0;
+		f64 Materials = 0.0;
+		f64 Lights = 0.0;
+		f64 Pass = 0.0;
+		f64 Record = 0.0;
+	};
+
+	// Items can be added at any time, the next Update gives them an instance slot
+	RenderItem* AddRenderItem(std::unique_ptr<RenderItem> renderItem, RenderLayer layer)
+	{
+		RenderItem* result = renderItem.get();
+		result->Layer = layer;
+		result->layerIndex = (uint) m_RenderItemLayer[(int) layer].size();
+		m_RenderItemLayer[(int) layer].push_back(result);
+		m_AllRenderItems.push_back(std::move(renderItem));
+		m_BatchesStale = true;
+		UseMaterialSlot(result->Mat);
+		MarkDirty(result);
+		return result;
+	}
+
+	// Scene nodes place the render items and lights attached to them. Each has a node of the transform
+	// hierarchy under its parent's, or a root one. A null handle when parent is no longer alive.
+	NodeHandle CreateNode(const std::string& name, const Transform& local = Transform(), NodeHandle parent = NodeHandle())
+	{
+		const SceneNode* pParent = m_Scene.Get(parent);
+		if (!parent.IsNull() && pParent == nullptr)
+			return NodeHandle();
+		const u32 transform = m_Transforms.Add(local, (pParent != nullptr) ? pParent->TransformNode : TransformHierarchy::NO_PARENT);
+		const NodeHandle node = m_Scene.CreateNode(name, parent);
+		m_Scene.Get(node)->TransformNode = transform;
+		if (m_NodeObjects.size() <= transform)
+			m_NodeObjects.resize(transform + 1);
+		return node;
+	}
+
+	// New local transforms of nodes, false for nodes no longer alive. Everything below them follows on the
+	// next Update.
+	bool SetLocal(NodeHandle node, const Transform& local)
+	{
+		const SceneNode* pNode = m_Scene.Get(node);
+		if (pNode == nullptr)
+			return false;
+		m_Transforms.SetLocal(pNode->TransformNode, local);
+		return true;
+	}
+	bool SetTranslation(NodeHandle node, const float3& translation)
+	{
+		const SceneNode* pNode = m_Scene.Get(node);
+		if (pNode == nullptr)
+			return false;
+		m_Transforms.SetTranslation(pNode->TransformNode, translation);
+		return true;
+	}
+	bool SetRotation(NodeHandle node, const float4& rotation)
+	{
+		const SceneNode* pNode = m_Scene.Get(node);
+		if (pNode == nullptr)
+			return false;
+		m_Transforms.SetRotation(pNode->TransformNode, rotation);
+		return true;
+	}
+
+	// The item's World follows the node from now on, and no longer the node it was on before. False for
+	// nodes no longer alive.
+	bool AttachRenderItem(RenderItem* renderItem, NodeHandle node)
+	{
+		const SceneNode* pNode = m_Scene.Get(node);
+		if (pNode == nullptr)
+			return false;
+		if (const SceneNode* pPrevious = m_Scene.Get(renderItem->Node))
+		{
+			RenderItem** ppLink = &m_NodeObjects[pPrevious->TransformNode].pFirstItem;
+			while (*ppLink != renderItem)
+				ppLink = &(*ppLink)->pNextOnNode;
+			*ppLink = renderItem->pNextOnNode;
+		}
+		NodeObjects& objects = m_NodeObjects[pNode->TransformNode];
+		renderItem->Node = node;
+		renderItem->pNextOnNode = objects.pFirstItem;
+		objects.pFirstItem = renderItem;
+		// Nodes added since the last Update are still at identity, that Update places them and their items
+		renderItem->World = m_Transforms.World(pNode->TransformNode);
+		MarkDirty(renderItem);
+		return true;
+	}
+
+	const SceneGraph& Scene() const { return m_Scene; }
+	const TransformHierarchy& Transforms() const { return m_Transforms; }
+
+	// Materials whose properties are kept up to date in the material buffer, at any time
+	void AddMaterial(Material* material)
+	{
+		m_Materials.push_back(material);
+		UseMaterialSlot(material);
+		MarkDirty(material);
+	}
+
+	// Call after changing an item's World or TexTransform, or a material's properties, so the next frames upload them
+	void MarkDirty(RenderItem* renderItem) { m_DirtyItems.Mark(renderItem); }
+	void MarkDirty(Material* material) { m_DirtyMaterials.Mark(material); }
+
+	// Lights join the scene on a node of their own under parent, or as a root, and follow it: their
+	// position and direction are in the node's space. Point and spot lights each take a slot of the light
+	// buffer, at any time. Change them through their setters or move their node, the next frames pick the
+	// changes up. A null handle when parent is no longer alive.
+	NodeHandle AddLight(std::shared_ptr<LightNode> light, NodeHandle parent = NodeHandle())
+	{
+		const NodeHandle node = CreateNode(light->GetName(), Transform(), parent);
+		if (node.IsNull())
+			return node;
+		SceneNode* pNode = m_Scene.Get(node);
+		pNode->pObject = light.get();
+		m_NodeObjects[pNode->TransformNode].pLight = light.get();
+		light->SetTransform(m_Transforms.World(pNode->TransformNode));
+		const u32 lightSlots = LocalLightCount();
+		m_Lights.Add(light.get());
+		m_LightObjects.push_back(std::move(light));
+		// The light buffers may be replaced by empty ones to make room, every light goes in again
+		if(LocalLightCount() > lightSlots)
+			m_Lights.MarkAllDirty();
+		return node;
+	}
+	// Slots the light buffer needs
+	u32 LocalLightCount() const { return m_Lights.LocalLightCount(); }
+	const LightTable& Lights() const { return m_Lights; }
+	const LightClusters::LightSpheres& VisibleLights() const { return m_VisibleLights; }
+	const LightClusters::ClusterLists& LightLists() const { return m_LightLists; }
+
+	u32 RenderItemCount() const { return (u32) m_AllRenderItems.size(); }
+	u32 MaterialCount() const { return (u32) m_Materials.size(); }
+	// Slots the material buffer needs, up to the highest MatCBIndex of the materials and items added
+	u32 MaterialSlotCount() const { return m_MaterialSlots; }
+	const PhaseTimes& Times() const { return m_Times; }
+
+	// Groups the items into batches and hands out their instance slots. Update calls it again once items
+	// were added, every item then moves and is uploaded again.
+	void BuildInstanceBatches()
+	{
+		// Within a layer the PSO is fixed, so items only need the same geometry and texture table to share a draw.
+		// Instance slots are handed out batch by batch so every batch reads one contiguous range.
+		// Batches are found by what InstanceBatch::CanDraw compares, so the rebuild stays linear in the items.
+		struct BatchKey
+		{
+			const Mesh* Geo;
+			const Texture* pDiffuse;
+			D3D12_PRIMITIVE_TOPOLOGY PrimitiveType;
+			uint indexCount;
+			uint startIndexLocation;
+			int baseVertexLocation;
+
+			bool operator==(const BatchKey& other) const
+			{
+				return Geo == other.Geo && pDiffuse == other.pDiffuse && PrimitiveType == other.PrimitiveType &&
+					indexCount == other.indexCount && startIndexLocation == other.startIndexLocation &&
+					baseVertexLocation == other.baseVertexLocation;
+			}
+		};
+		struct BatchKeyHash
+		{
+			size_t operator()(const BatchKey& key) const
+			{
+				size_t seed = std::hash<const void*>{}(key.Geo);
+				for(size_t hash : {std::hash<const void*>{}(key.pDiffuse), (size_t) key.PrimitiveType, (size_t) key.indexCount,
+					(size_t) key.startIndexLocation, (size_t) (uint) key.baseVertexLocation})
+					seed ^= hash + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+				return seed;
+			}
+		};
+
+		uint nextInstance = 0;
+		uint itemCount = 0;
+		uint drawCount = 0;
+		std::unordered_map<const Mesh*, u32> meshIds;
+		std::unordered_map<BatchKey, size_t, BatchKeyHash> batchIds;
+		for(int layer = 0; layer < (int) RenderLayer::Count; layer++)
+		{
+			std::vector<InstanceBatch>& batches = m_InstanceBatchLayer[layer];
+			batches.clear();
+			batchIds.clear();
+			std::vector<std::vector<RenderItem*>> batchItems;
+			for(RenderItem* ri : m_RenderItemLayer[layer])
+			{
+				const BatchKey key = {ri->Geo, ri->Mat->pDiffuse, ri->PrimitiveType, ri->indexCount, ri->startIndexLocation, ri->baseVertexLocation};
+				const size_t b = batchIds.emplace(key, batches.size()).first->second;
+				if(b == batches.size())
+				{
+					InstanceBatch batch;
+					batch.Geo = ri->Geo;
+					batch.pDiffuse = ri->Mat->pDiffuse;
+					batch.PrimitiveType = ri->PrimitiveType;
+					batch.indexCount = ri->indexCount;
+					batch.startIndexLocation = ri->startIndexLocation;
+					batch.baseVertexLocation = ri->baseVertexLocation;
+					batch.MeshId = meshIds.emplace(ri->Geo, (u32) meshIds.size()).first->second;
+					batch.Lods = ri->Lods;
+					if(batch.Lods.empty())
+					{
+						MeshSimplifier::LodRange full;
+						full.StartIndex = ri->startIndexLocation;
+						full.IndexCount = ri->indexCount;
+						batch.Lods.push_back(full);
+					}
+					batches.push_back(batch);
+					batchItems.emplace_back();
+				}
+				batchItems[b].push_back(ri);
+			}
+
+			for(size_t b = 0; b < batches.size(); b++)
+			{
+				batches[b].baseInstance = nextInstance;
+				batches[b].instanceCount = (uint) batchItems[b].size();
+				for(RenderItem* ri : batchItems[b])
+				{
+					ri->instanceIndex = nextInstance++;
+					MarkDirty(ri);
+				}
+				// Everything starts at full detail until SelectLods runs
+				batches[b].Items = std::move(batchItems[b]);
+				batches[b].LodInstanceCounts.assign(batches[b].Lods.size(), 0);
+				batches[b].LodInstanceCounts[0] = batches[b].instanceCount;
+			}
+			itemCount += (uint) m_RenderItemLayer[layer].size();
+			drawCount += (uint) batches.size();
+		}
+		m_BatchesStale = false;
+
+		LogLine("BuildInstanceBatches: " + std::to_string(itemCount) + " render items in " +
+			std::to_string(drawCount) + " draws");
+	}
+
+	// Everything the GPU reads this frame, seen from camera. Derive its view matrix first.
+	void Update(RenderBackend& backend, Camera& camera, u32 width, u32 height, f32 totalTime, f32 deltaTime)
+	{
+		Stopwatch timer;
+		backend.BeginFrame();
+		// Items added since the last frame get their slots, and the buffers of the current frame resource
+		// grow to hold every slot
+		if(m_BatchesStale)
+			BuildInstanceBatches();
+		backend.Reserve(RenderItemCount(), m_MaterialSlots, LocalLightCount());
+		m_Times.BeginFrame = timer.ElapsedMs();
+
+		timer.Reset();
+		UpdateTransforms();
+		m_Times.Transforms = timer.ElapsedMs();
+
+		timer.Reset();
+		CullRenderItems(camera);
+		m_Times.Cull = timer.ElapsedMs();
+
+		timer.Reset();
+		SelectLods(camera, height);
+		m_Times.SelectLods = timer.ElapsedMs();
+
+		timer.Reset();
+		BuildDrawLists(camera);
+		m_Times.Sort = timer.ElapsedMs();
+
+		timer.Reset();
+		UpdateInstances(backend);
+		m_Times.Instances = timer.ElapsedMs();
+
+		timer.Reset();
+		UpdateMaterials(backend);
+		m_Times.Materials = timer.ElapsedMs();
+
+		timer.Reset();
+		UpdateLights(backend, camera, width, height);
+		m_Times.Lights = timer.ElapsedMs();
+
+		timer.Reset();
+		UpdatePass(backend, camera, width, height, totalTime, deltaTime);
+		m_Times.Pass = timer.ElapsedMs();
+
+		m_DirtyItems.Advance();
+		m_DirtyMaterials.Advance();
+		m_Lights.Advance();
+	}
+
+	// Records the draws of the last Update and submits them. Draws are split in order into one command
+	// list per thread, recorded on the renderer's worker threads, so lists come out the same however the
+	// threads run. threadCount 0 means one per core.
+	void Record(RenderBackend& backend, u32 threadCount = 1)
+	{
+		Stopwatch timer;
+		u32 drawCount = 0;
+		for(RenderLayer layer : LAYER_DRAW_ORDER)
+			drawCount += (u32) m_DrawLayer[(int) layer].size();
+
+		// Lists short of MIN_LIST_DRAWS spend more on their setup than they save
+		u32 listCount = Math::Min(WorkerCount(threadCount), backend.MaxCommandLists());
+		listCount = Math::Min(listCount, Math::Max((drawCount + MIN_LIST_DRAWS - 1) / MIN_LIST_DRAWS, 1u));
+
+		backend.BeginCommands(listCount);
+		m_Workers.For(listCount, listCount, [&](size_t list)
+		{
+			const u32 first = (u32) ((u64) drawCount * list / listCount);
+			const u32 last = (u32) ((u64) drawCount * (list + 1) / listCount);
+			RecordDraws(backend.Recorder((u32) list), first, last);
+		});
+		backend.EndFrame();
+		m_Times.Record = timer.ElapsedMs();
+	}
+
+private:
+	// A material buffer that has to grow is a new, empty one, so when the slot count goes up every material
+	// is written again, reaching each frame resource as it grows in the next NUM_FRAME_RESOURCES frames.
+	// Instance buffers only grow as items are added, which rebuilds the batches and writes every item again.
+	void UseMaterialSlot(const Material* material)
+	{
+		if(material == nullptr || material->MatCBIndex < 0 || (u32) material->MatCBIndex < m_MaterialSlots)
+			return;
+		m_MaterialSlots = (u32) material->MatCBIndex + 1;
+		for(Material* mat : m_Materials)
+			MarkDirty(mat);
+	}
+
+	// Items on the nodes that moved take their new world matrix and are uploaded again
+	void UpdateTransforms()
+	{
+		m_Transforms.Update(0, &m_Workers);
+		m_Transforms.ForEachUpdated([this](u32 node, const float4x4& world)
+		{
+			const NodeObjects& objects = m_NodeObjects[node];
+			for (RenderItem* ri = objects.pFirstItem; ri != nullptr; ri = ri->pNextOnNode)
+			{
+				ri->World = world;
+				MarkDirty(ri);
+			}
+			if (objects.pLight != nullptr)
+				objects.pLight->SetTransform(world);
+		});
+	}
+
+	void CullRenderItems(Camera& camera)
+	{
+		// Layers that gained items since the last frame start over with every box
+		for(int layer = 0; layer < (int) RenderLayer::Count; layer++)
+		{
+			const std::vector<RenderItem*>& items = m_RenderItemLayer[layer];
+			Culling::CullingSet& cullingSet = m_CullingLayer[layer];
+			if(cullingSet.Count() != (u32) items.size())
+			{
+				cullingSet.Resize((u32) items.size());
+				for(u32 i = 0; i < (u32) items.size(); i++)
+					cullingSet.Set(i, Culling::TransformBounds(items[i]->LocalBounds, items[i]->World));
+			}
+		}
+
+		// World matrices only change on items marked since the last frame, the other boxes are still valid
+		m_DirtyItems.ForEachNew([this](RenderItem* ri)
+		{
+			m_CullingLayer[(int) ri->Layer].Set(ri->layerIndex, Culling::TransformBounds(ri->LocalBounds, ri->World));
+		});
+
+		const Culling::Frustum frustum = camera.GetFrustum();
+		for(int layer = 0; layer < (int) RenderLayer::Count; layer++)
+		{
+			const std::vector<RenderItem*>& items = m_RenderItemLayer[layer];
+			for(RenderItem* ri : items)
+				ri->Visible = false;
+
+			m_CullingLayer[layer].Cull(frustum, m_VisibleLayer[layer]);
+			for(u32 slot : m_VisibleLayer[layer])
+				items[slot]->Visible = true;
+		}
+	}
+
+	void SelectLods(Camera& camera, u32 height)
+	{
+		// Screen height in pixels of one world unit at distance one
+		vect4 Proj = camera.GetProjectionMatrix();
+		float4x4 proj;
+		Matrix::StoreFloat4x4(&proj, Proj);
+		const f32 pixelsPerUnitAtOne = proj.m[1][1] * 0.5f * (f32) height;
+		const f32 nearZ = camera.GetNearZ();
+		vect Eye = camera.GetPosition();
+		float3 eye;
+		Vector::StoreFloat3(&eye, Eye);
+
+		for(auto& batches : m_InstanceBatchLayer)
+		{
+			for(InstanceBatch& batch : batches)
+			{
+				// Culled items go in one more bucket behind the last level
+				const uint lodCount = (uint) batch.Lods.size();
+				const uint culled = lodCount;
+
+				m_LodOf.resize(batch.Items.size());
+				std::fill(batch.LodInstanceCounts.begin(), batch.LodInstanceCounts.end(), 0);
+				for(size_t i = 0; i < batch.Items.size(); i++)
+				{
+					if(!batch.Items[i]->Visible)
+					{
+						m_LodOf[i] = culled;
+						continue;
+					}
+					if(lodCount < 2)
+					{
+						m_LodOf[i] = 0;
+						batch.LodInstanceCounts[0]++;
+						continue;
+					}
+
+					const float4x4& world = batch.Items[i]->World;
+					f32 scale = 0.0f;
+					for(int row = 0; row < 3; row++)
+						scale = Math::Max(scale, world.m[row][0] * world.m[row][0] + world.m[row][1] * world.m[row][1] + world.m[row][2] * world.m[row][2]);
+					scale = std::sqrt(scale);
+
+					// Distance to the nearest point of the bounding sphere, errors are judged where they are largest
+					f32 dx = world._41 - eye.x, dy = world._42 - eye.y, dz = world._43 - eye.z;
+					f32 distance = std::sqrt(dx * dx + dy * dy + dz * dz) - batch.Geo->BoundingRadius * scale;
+					distance = Math::Max(distance, nearZ);
+
+					m_LodOf[i] = MeshSimplifier::SelectLod(batch.Lods.data(), lodCount, pixelsPerUnitAtOne * scale / distance);
+					batch.LodInstanceCounts[m_LodOf[i]]++;
+				}
+
+				// Stable counting sort by level, only items that change slot are uploaded again
+				m_SortedItems.resize(batch.Items.size());
+				m_LodStarts.assign(lodCount + 1, 0);
+				for(uint l = 1; l <= lodCount; l++)
+					m_LodStarts[l] = m_LodStarts[l - 1] + batch.LodInstanceCounts[l - 1];
+				for(size_t i = 0; i < batch.Items.size(); i++)
+					m_SortedItems[m_LodStarts[m_LodOf[i]]++] = batch.Items[i];
+				for(size_t i = 0; i < m_SortedItems.size(); i++)
+				{
+					RenderItem* ri = m_SortedItems[i];
+					if(ri->instanceIndex != batch.baseInstance + (uint) i)
+					{
+						ri->instanceIndex = batch.baseInstance + (uint) i;
+						MarkDirty(ri);
+					}
+				}
+				batch.Items.swap(m_SortedItems);
+			}
+		}
+	}
+
+	void BuildDrawLists(Camera& camera)
+	{
+		vect Eye = camera.GetPosition();
+		vect Forward = camera.GetForward();
+		float3 eye, forward;
+		Vector::StoreFloat3(&eye, Eye);
+		Vector::StoreFloat3(&forward, Forward);
+		const f32 nearZ = camera.GetNearZ();
+		const f32 farZ = camera.GetFarZ();
+
+		for(int layer = 0; layer < (int) RenderLayer::Count; layer++)
+		{
+			// Blending needs the farthest surfaces first, the other layers go nearest first so the depth test rejects more
+			const bool backToFront = (layer == (int) RenderLayer::Transparent);
+			m_UnsortedDraws.clear();
+			m_SortEntries.clear();
+			for(const InstanceBatch& batch : m_InstanceBatchLayer[layer])
+			{
+				const u32 material = (batch.pDiffuse != nullptr) ? (u32) batch.pDiffuse->SRVHeapIndex + 1 : 0;
+				uint first = 0;
+				for(uint lod = 0; lod < (uint) batch.Lods.size(); lod++)
+				{
+					const uint instanceCount = batch.LodInstanceCounts[lod];
+					if(instanceCount == 0)
+						continue;
+
+					// An instanced draw is as near as its nearest instance, or as far as its farthest one
+					f32 depth = backToFront ? -FLT_MAX : FLT_MAX;
+					for(uint i = first; i < first + instanceCount; i++)
+					{
+						const float4x4& world = batch.Items[i]->World;
+						f32 d = (world._41 - eye.x) * forward.x + (world._42 - eye.y) * forward.y + (world._43 - eye.z) * forward.z;
+						depth = backToFront ? Math::Max(depth, d) : Math::Min(depth, d);
+					}
+
+					DrawCommand draw;
+					draw.pBatch = &batch;
+					draw.Lod = lod;
+					draw.BaseInstance = batch.baseInstance + first;
+					draw.InstanceCount = instanceCount;
+
+					// Every layer has a PSO of its own, so the layer doubles as the PSO id
+					DrawSort::Entry entry;
+					entry.Key = DrawSort::MakeKey(layer, layer, material, batch.MeshId,
+						DrawSort::QuantizeDepth(depth, nearZ, farZ), backToFront);
+					entry.Index = (u32) m_UnsortedDraws.size();
+					m_SortEntries.push_back(entry);
+					m_UnsortedDraws.push_back(draw);
+					first += instanceCount;
+				}
+			}
+
+			DrawSort::RadixSort(m_SortEntries, m_SortScratch);
+			std::vector<DrawCommand>& draws = m_DrawLayer[layer];
+			draws.resize(m_SortEntries.size());
+			for(size_t i = 0; i < m_SortEntries.size(); i++)
+				draws[i] = m_UnsortedDraws[m_SortEntries[i].Index];
+		}
+	}
+
+	void UpdateInstances(RenderBackend& backend)
+	{
+		// Only items marked in the last NUM_FRAME_RESOURCES frames, the others are current in every frame resource
+		m_InstanceSources.clear();
+		m_DirtyItems.ForEach([this](RenderItem* Item)
+		{
+			InstanceUpload::Source source;
+			source.pWorld = &Item->World;
+			source.pTexTransform = &Item->TexTransform;
+			source.pQuantization = &Item->Geo->Quantization;
+			source.MaterialIndex = (u32) Item->Mat->MatCBIndex;
+			source.Slot = Item->instanceIndex;
+			m_InstanceSources.push_back(source);
+		});
+
+		InstanceUpload::Write(backend.MapInstances(), RenderItemCount(), m_InstanceSources.data(), m_InstanceSources.size());
+	}
+
+	void UpdateMaterials(RenderBackend& backend)
+	{
+		m_DirtyMaterials.ForEach([&backend](Material* Mat)
+		{
+			backend.WriteMaterial(Mat->MatCBIndex, Mat->Properties);
+		});
+	}
+
+	void UpdateLights(RenderBackend& backend, Camera& camera, u32 width, u32 height)
+	{
+		// Lights that changed go to the light buffer, only those reaching into the view are binned
+		m_Lights.Gather();
+		m_Lights.ForEachDirty([&backend](u32 slot, const LocalLight& light)
+		{
+			backend.WriteLight(slot, light);
+		});
+		m_Lights.Cull(camera.GetFrustum(), m_VisibleLights);
+
+		LightClusters::ClusterView view;
+		vect4 View = camera.GetViewMatrix();
+		Matrix::StoreFloat4x4(&view.View, View);
+		view.FovY = camera.GetFovY();
+		view.AspectRatio = camera.GetAspectRatio();
+		view.NearZ = camera.GetNearZ();
+		view.FarZ = camera.GetFarZ();
+		m_LightClusters.Build(view, m_VisibleLights, 0, m_LightLists, &m_Workers);
+		backend.WriteLightClusters(m_LightLists);
+
+		// The pass constants tell the pixel shader how to find its cluster
+		const LightClusters::GridSize& size = m_LightClusters.Size();
+		m_MainPassCB.ClusterCountX = size.TilesX;
+		m_MainPassCB.ClusterCountY = size.TilesY;
+		m_MainPassCB.ClusterCountZ = size.Slices;
+		m_MainPassCB.ClusterDepthScale = m_LightClusters.DepthScale();
+		m_MainPassCB.ClusterDepthBias = m_LightClusters.DepthBias();
+		m_MainPassCB.ClusterTileScale = float2((float) size.TilesX / width, (float) size.TilesY / height);
+
+		const std::vector<Light>& directionalLights = m_Lights.DirectionalLights();
+		for (size_t i = 0; i < directionalLights.size(); i++)
+			m_MainPassCB.Lights[i] = directionalLights[i];
+		m_MainPassCB.DirectionalLightCount = (u32) directionalLights.size();
+	}
+
+	void UpdatePass(RenderBackend& backend, Camera& camera, u32 width, u32 height, f32 totalTime, f32 deltaTime)
+	{
+		vect4 View = camera.GetViewMatrix();
+		vect4 Proj = camera.GetProjectionMatrix();
+		vect4 ViewProj = Matrix::Multiply(View, Proj);
+		vect4 InvView = Matrix::Inverse(&Matrix::Determinant(View), View);
+		vect4 InvProj = Matrix::Inverse(&Matrix::Determinant(Proj), Proj);
+		vect4 InvViewProj = Matrix::Inverse(&Matrix::Determinant(ViewProj), ViewProj);
+
+		Matrix::StoreFloat4x4(&m_MainPassCB.View,        Matrix::Transpose(View));
+		Matrix::StoreFloat4x4(&m_MainPassCB.InvView,     Matrix::Transpose(InvView));
+		Matrix::StoreFloat4x4(&m_MainPassCB.Proj,        Matrix::Transpose(Proj));
+		Matrix::StoreFloat4x4(&m_MainPassCB.InvProj,     Matrix::Transpose(InvProj));
+		Matrix::StoreFloat4x4(&m_MainPassCB.ViewProj,    Matrix::Transpose(ViewProj));
+		Matrix::StoreFloat4x4(&m_MainPassCB.InvViewProj, Matrix::Transpose(InvViewProj));
+		Vector::StoreFloat3(&m_MainPassCB.EyePosW, camera.GetPosition());
+		m_MainPassCB.RenderTargetSize = float2((float) width, (float) height);
+		m_MainPassCB.InvRenderTargetSize = float2(1.0f / width, 1.0f / height);
+		m_MainPassCB.NearZ = camera.GetNearZ();
+		m_MainPassCB.FarZ = camera.GetFarZ();
+		m_MainPassCB.TotalTime = totalTime;
+		m_MainPassCB.DeltaTime = deltaTime;
+
+		m_MainPassCB.AmbientLight = { 0.03f, 0.03f, 0.03f, 1.0f };
+
+		backend.WritePass(m_MainPassCB);
+	}
+
+	// Draws [first, last) of the frame, counted across the layers in draw order
+	void RecordDraws(CommandRecorder& recorder, u32 first, u32 last)
+	{
+		u32 layerStart = 0;
+		for(RenderLayer layer : LAYER_DRAW_ORDER)
+		{
+			const std::vector<DrawCommand>& draws = m_DrawLayer[(int) layer];
+			const u32 layerEnd = layerStart + (u32) draws.size();
+			const u32 begin = Math::Max(first, layerStart);
+			const u32 end = Math::Min(last, layerEnd);
+			if(begin < end)
+			{
+				// Every list starts without a PSO of its own, even when it continues a layer
+				recorder.SetLayer(layer);
+				SubmitDraws(recorder, draws.data() + (begin - layerStart), draws.data() + (end - layerStart));
+			}
+			layerStart = layerEnd;
+		}
+	}
+
+	void SubmitDraws(CommandRecorder& recorder, const DrawCommand* pBegin, const DrawCommand* pEnd)
+	{
+		// Draws come sorted by state, consecutive ones of the same batch only differ in their range
+		const InstanceBatch* pBound = nullptr;
+		for(const DrawCommand* pDraw = pBegin; pDraw != pEnd; pDraw++)
+		{
+			const InstanceBatch& batch = *pDraw->pBatch;
+			if(&batch != pBound)
+			{
+				recorder.SetGeometry(batch.Geo, batch.PrimitiveType);
+				recorder.SetDiffuse(batch.pDiffuse);
+				pBound = &batch;
+			}
+
+			const MeshSimplifier::LodRange& lod = batch.Lods[pDraw->Lod];
+			recorder.DrawIndexedInstanced(lod.IndexCount, pDraw->InstanceCount, lod.StartIndex, batch.baseVertexLocation, pDraw->BaseInstance);
+		}
+	}
+
+	// List of all the render items.
+	std::vector<std::unique_ptr<RenderItem>> m_AllRenderItems;
+	std::vector<Material*> m_Materials;
+	u32 m_MaterialSlots = 0;
+
+	// Render items divided by PSO
+	std::vector<RenderItem*> m_RenderItemLayer[(int) RenderLayer::Count];
+	// The same render items merged into instanced draws
+	std::vector<InstanceBatch> m_InstanceBatchLayer[(int) RenderLayer::Count];
+	// Items were added since the batches were built
+	bool m_BatchesStale = false;
+	// World space boxes of each layer's render items and the slots that survived culling this frame
+	Culling::CullingSet m_CullingLayer[(int) RenderLayer::Count];
+	std::vector<u32> m_VisibleLayer[(int) RenderLayer::Count];
+	// This frame's draws of each layer in sort key order, and the buffers that sort them
+	std::vector<DrawCommand> m_DrawLayer[(int) RenderLayer::Count];
+	std::vector<DrawCommand> m_UnsortedDraws;
+	std::vector<DrawSort::Entry> m_SortEntries;
+	std::vector<DrawSort::Entry> m_SortScratch;
+	// Level selection scratch
+	std::vector<uint> m_LodOf;
+	std::vector<uint> m_LodStarts;
+	std::vector<RenderItem*> m_SortedItems;
+	// Items and materials to upload, for each of the frame resources
+	DirtyRing<RenderItem> m_DirtyItems;
+	DirtyRing<Material> m_DirtyMaterials;
+	std::vector<InstanceUpload::Source> m_InstanceSources;
+	// Nodes of the scene, their local transforms and what is on each transform node
+	struct NodeObjects
+	{
+		RenderItem* pFirstItem = nullptr;
+		LightNode* pLight = nullptr;
+	};
+	SceneGraph m_Scene;
+	TransformHierarchy m_Transforms;
+	std::vector<NodeObjects> m_NodeObjects;
+	// Lights of the scene, the local lights reaching into the view and what the shaders read of them this frame
+	std::vector<std::shared_ptr<LightNode>> m_LightObjects;
+	LightTable m_Lights;
+	LightClusters::LightSpheres m_VisibleLights;
+	LightClusters::ClusterBuilder m_LightClusters;
+	LightClusters::ClusterLists m_LightLists;
+
+	PassConstants m_MainPassCB;
+	PhaseTimes m_Times;
+
+	// Threads recording, clustering lights and updating transforms, one per core and kept for every frame
+	WorkerPool m_Workers;
+};
+
+}
+
+#endif //!FRAME_RENDERER_H
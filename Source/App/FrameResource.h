@@ -10,10 +10,36 @@
 
 using namespace Loxodonta;
 
-struct ObjectConstants
+// Per instance data read by the vertex shader through SV_InstanceID
+struct InstanceData
 {
 	float4x4 World = Matrix::Identity4x4();
 	float4x4 TexTransform = Matrix::Identity4x4();
+	// Mesh space position of a packed vertex is PosL * PositionScale + PositionOffset
+	float3 PositionScale = {1.0f, 1.0f, 1.0f};
+	u32 MaterialIndex = 0;
+	float3 PositionOffset = {0.0f, 0.0f, 0.0f};
+	u32 InstancePad0 = 0;
+	// xy scale, zw offset applied to packed texcoords before TexTransform
+	float4 TexCoordScaleOffset = {1.0f, 1.0f, 0.0f, 0.0f};
+};
+
+enum class LocalLightType : u32
+{
+	Point = 0,
+	Spot = 1
+};
+
+// Point or spot light as the pixel shader reads it from the light buffer, through the clustered light lists
+struct LocalLight
+{
+	float3 Position = { 0.0f, 0.0f, 0.0f };
+	// Distance at which the light fades out entirely, lights are binned by the sphere it spans
+	float Range = 10.0f;
+	float3 Direction = { 0.0f, -1.0f, 0.0f }; // spot light only
+	float SpotPower = 64.0f;                  // spot light only
+	float3 Strength = { 0.5f, 0.5f, 0.5f };
+	LocalLightType Type = LocalLightType::Point;
 };
 
 struct PassConstants
@@ -40,6 +66,17 @@ struct PassConstants
 	float gFogRange = 150.0f;
 	float2 cbPerObjectPad2;
 
+	// Cluster grid of the local lights, a pixel's slice is log(viewZ) * ClusterDepthScale + ClusterDepthBias
+	u32 ClusterCountX = 1;
+	u32 ClusterCountY = 1;
+	u32 ClusterCountZ = 1;
+	float ClusterDepthScale = 0.0f;
+	// Tiles per pixel
+	float2 ClusterTileScale = { 0.0f, 0.0f };
+	float ClusterDepthBias = 0.0f;
+	u32 DirectionalLightCount = 0;
+
+	// Directional lights, the first DirectionalLightCount are lit
 	Light Lights[MaxLights];
 };
 
@@ -62,7 +99,7 @@ struct Vertex
 		TexCoord = _TexCoord;
 	}
 
-	// Necessary for constructing map of Vertices for loading models
+	// Exact comparison of every attribute
 	bool operator==(const Vertex& other) const
 	{
 		return (
@@ -75,68 +112,67 @@ struct Vertex
 	}
 };
 
-void hash_combine(size_t &seed, size_t hash)
-{
-	hash += 0x9e3779b9 + (seed << 6) + (seed >> 2);
-	seed ^= hash;
-}
-
-namespace std
-{
-	template<> struct hash<Vertex>
-	{
-		// Generate the hash for a vertex
-		size_t operator()(const Vertex& V) const
-		{
-			size_t seed = hash<float>{}(V.Pos.x);
-			hash_combine(seed, hash<float>{}(V.Pos.y));
-			hash_combine(seed, hash<float>{}(V.Pos.z));
-			hash_combine(seed, hash<float>{}(V.Normal.x));
-			hash_combine(seed, hash<float>{}(V.Normal.y));
-			hash_combine(seed, hash<float>{}(V.Normal.z));
-			hash_combine(seed, hash<float>{}(V.Tangent.x));
-			hash_combine(seed, hash<float>{}(V.Tangent.y));
-			hash_combine(seed, hash<float>{}(V.Tangent.z));
-			hash_combine(seed, hash<float>{}(V.Bitangent.x));
-			hash_combine(seed, hash<float>{}(V.Bitangent.y));
-			hash_combine(seed, hash<float>{}(V.Bitangent.z));
-			hash_combine(seed, hash<float>{}(V.TexCoord.x));
-			hash_combine(seed, hash<float>{}(V.TexCoord.y));
-			return seed;
-		}
-	};
-	
-}
-
 struct FrameResource
 {
 public:
-	FrameResource(ID3D12Device* Device, UINT passCount, UINT objectCount, UINT materialCount);
+	FrameResource(ID3D12Device* Device, UINT instanceCount, UINT materialCount, UINT lightCount, UINT commandListCount);
 	FrameResource(const FrameResource& rhs) = delete;
 	FrameResource& operator=(const FrameResource& rhs) = delete;
 	~FrameResource();
 
-	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> CmdListAlloc;
+	// Replaces the instance, material and light buffers that hold fewer slots than asked with new, empty
+	// ones half as large again. Only while the GPU is done with this frame resource.
+	void Reserve(ID3D12Device* Device, UINT instanceCount, UINT materialCount, UINT lightCount);
+
+	// One allocator per command list, the lists of a frame are recorded in parallel
+	std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> CmdListAllocs;
 
-	std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
-	std::unique_ptr<UploadBuffer<MaterialProperties>> MaterialCB = nullptr;
-	std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
+	// Structured buffers indexed in the shaders, so a single draw can cover many objects and materials
+	std::unique_ptr<UploadBuffer<MaterialProperties>> MaterialBuffer = nullptr;
+	std::unique_ptr<UploadBuffer<InstanceData>> InstanceBuffer = nullptr;
+	UINT MaterialCapacity = 0;
+	UINT InstanceCapacity = 0;
+	// One slot per point or spot light, the clusters index into it
+	std::unique_ptr<UploadBuffer<LocalLight>> LightBuffer = nullptr;
+	UINT LightCapacity = 0;
 
 	UINT64 Fence = 0;
 };
 
-FrameResource::FrameResource(ID3D12Device* Device, UINT passCount, UINT objectCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* Device, UINT instanceCount, UINT materialCount, UINT lightCount, UINT commandListCount)
 {
-	ThrowIfFailed(Device->CreateCommandAllocator(
-		D3D12_COMMAND_LIST_TYPE_DIRECT,
-		IID_PPV_ARGS(CmdListAlloc.GetAddressOf()))
-	);
-
-	PassCB = std::make_unique<UploadBuffer<PassConstants>>(Device, passCount, true);
-	MaterialCB = std::make_unique<UploadBuffer<MaterialProperties>>(Device, materialCount, true);
-	ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(Device, objectCount, true);
+	CmdListAllocs.resize(commandListCount);
+	for (auto& CmdListAlloc : CmdListAllocs)
+	{
+		ThrowIfFailed(Device->CreateCommandAllocator(
+			D3D12_COMMAND_LIST_TYPE_DIRECT,
+			IID_PPV_ARGS(CmdListAlloc.GetAddressOf()))
+		);
+	}
+
+	Reserve(Device, instanceCount, materialCount, lightCount);
 }
 
 FrameResource::~FrameResource() { }
 
+void FrameResource::Reserve(ID3D12Device* Device, UINT instanceCount, UINT materialCount, UINT lightCount)
+{
+	// Empty buffers cannot be created, a scene without items, materials or local lights still binds one
+	if (MaterialBuffer == nullptr || MaterialCapacity < materialCount)
+	{
+		MaterialCapacity = Math::Max(Math::Max(materialCount, MaterialCapacity * 3 / 2), 1u);
+		MaterialBuffer = std::make_unique<UploadBuffer<MaterialProperties>>(Device, MaterialCapacity, false);
+	}
+	if (InstanceBuffer == nullptr || InstanceCapacity < instanceCount)
+	{
+		InstanceCapacity = Math::Max(Math::Max(instanceCount, InstanceCapacity * 3 / 2), 1u);
+		InstanceBuffer = std::make_unique<UploadBuffer<InstanceData>>(Device, InstanceCapacity, false);
+	}
+	if (LightBuffer == nullptr || LightCapacity < lightCount)
+	{
+		LightCapacity = Math::Max(Math::Max(lightCount, LightCapacity * 3 / 2), 1u);
+		LightBuffer = std::make_unique<UploadBuffer<LocalLight>>(Device, LightCapacity, false);
+	}
+}
+
 #endif //!FRAME_RESOURCE_H
\ No newline at end of file
@@ -0,0 +1,168 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <string>
+#include <vector>
+
+#include "../3rdParty/FrankLuna/d3dUtil.h"
+
+#include "Core.h"
+#include "RangeAllocator.h"
+
+namespace Loxodonta
+{
+
+// Large vertex and index buffers that meshes suballocate from. Draws of different meshes then bind
+// the same buffers and only differ by BaseVertexLocation and StartIndexLocation.
+// Indices stay relative to their mesh, so meshes below 64k vertices keep 16 bit indices in their own pool.
+class GeometryArena
+{
+public:
+	// Capacities are in vertices and indices, a pool of capacity 0 turns every request for it down
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice, u32 vertexStride,
+		u32 vertexCapacity, u32 index16Capacity, u32 index32Capacity)
+	{
+		m_Device = d3dDevice;
+		CreatePool(m_Vertices, vertexStride, vertexCapacity);
+		CreatePool(m_Indices16, sizeof(u16), index16Capacity);
+		CreatePool(m_Indices32, sizeof(u32), index32Capacity);
+	}
+
+	// Copies vertexCount vertices into a new range of the vertex pool.
+	// Returns an invalid range when the stride does not match the pool or it has no room left.
+	RangeAllocation AddVertices(ID3D12GraphicsCommandList* cmdList, const void* pVertices, u32 vertexCount, u32 vertexStride)
+	{
+		if(vertexStride != m_Vertices.Stride)
+			return RangeAllocation();
+		return Add(m_Vertices, cmdList, pVertices, vertexCount);
+	}
+
+	// Copies indexCount indices of the given format into a new range of the matching index pool
+	RangeAllocation AddIndices(ID3D12GraphicsCommandList* cmdList, const void* pIndices, u32 indexCount, DXGI_FORMAT format)
+	{
+		return Add(IndexPool(format), cmdList, pIndices, indexCount);
+	}
+
+	// Hands a range back. The GPU must be done with every draw that reads it.
+	void RemoveVertices(RangeAllocation& range) { m_Vertices.Allocator.Free(range); }
+	void RemoveIndices(RangeAllocation& range, DXGI_FORMAT format) { IndexPool(format).Allocator.Free(range); }
+
+	// The whole vertex pool, vertex ranges are addressed through BaseVertexLocation
+	D3D12_VERTEX_BUFFER_VIEW VertexBufferView() const
+	{
+		D3D12_VERTEX_BUFFER_VIEW vbv;
+		vbv.BufferLocation = m_Vertices.Buffer->GetGPUVirtualAddress();
+		vbv.StrideInBytes = m_Vertices.Stride;
+		vbv.SizeInBytes = m_Vertices.Allocator.Capacity() * m_Vertices.Stride;
+		return vbv;
+	}
+
+	// The whole index pool of format, index ranges are addressed through StartIndexLocation
+	D3D12_INDEX_BUFFER_VIEW IndexBufferView(DXGI_FORMAT format) const
+	{
+		const Pool& pool = (format == DXGI_FORMAT_R16_UINT) ? m_Indices16 : m_Indices32;
+		D3D12_INDEX_BUFFER_VIEW ibv;
+		ibv.BufferLocation = pool.Buffer->GetGPUVirtualAddress();
+		ibv.Format = format;
+		ibv.SizeInBytes = pool.Allocator.Capacity() * pool.Stride;
+		return ibv;
+	}
+
+	RangeAllocatorStats VertexStats() const { return m_Vertices.Allocator.Stats(); }
+	RangeAllocatorStats IndexStats(DXGI_FORMAT format) const
+	{
+		return ((format == DXGI_FORMAT_R16_UINT) ? m_Indices16 : m_Indices32).Allocator.Stats();
+	}
+
+	std::string Describe() const
+	{
+		return "vertices " + RangeAllocator::Describe(VertexStats()) +
+			"; 16 bit indices " + RangeAllocator::Describe(IndexStats(DXGI_FORMAT_R16_UINT)) +
+			"; 32 bit indices " + RangeAllocator::Describe(IndexStats(DXGI_FORMAT_R32_UINT));
+	}
+
+	// The staging copies can go once the command list that uploads them has executed
+	void DisposeUploaders()
+	{
+		m_Uploaders.clear();
+	}
+
+private:
+	struct Pool
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Buffer;
+		D3D12_RESOURCE_STATES State = D3D12_RESOURCE_STATE_COMMON;
+		u32 Stride = 0;
+		RangeAllocator Allocator;
+	};
+
+	void CreatePool(Pool& pool, u32 stride, u32 capacity)
+	{
+		pool.Stride = stride;
+		pool.State = D3D12_RESOURCE_STATE_COMMON;
+		pool.Buffer = nullptr;
+		pool.Allocator.Reset(0);
+		if(capacity == 0)
+			return;
+
+		ThrowIfFailed(m_Device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer((u64) capacity * stride),
+			pool.State,
+			nullptr,
+			IID_PPV_ARGS(pool.Buffer.GetAddressOf())));
+		pool.Allocator.Reset(capacity);
+	}
+
+	Pool& IndexPool(DXGI_FORMAT format)
+	{
+		return (format == DXGI_FORMAT_R16_UINT) ? m_Indices16 : m_Indices32;
+	}
+
+	// Same staging as d3dUtil::CreateDefaultBuffer, into a range of the pool instead of a buffer of its own
+	RangeAllocation Add(Pool& pool, ID3D12GraphicsCommandList* cmdList, const void* pData, u32 count)
+	{
+		RangeAllocation range = pool.Allocator.Allocate(count);
+		if(!range.IsValid())
+			return range;
+
+		const u64 byteSize = (u64) count * pool.Stride;
+		Microsoft::WRL::ComPtr<ID3D12Resource> uploader;
+		ThrowIfFailed(m_Device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(byteSize),
+			D3D12_RESOURCE_STATE_GENERIC_READ,
+			nullptr,
+			IID_PPV_ARGS(uploader.GetAddressOf())));
+
+		void* pMapped = nullptr;
+		ThrowIfFailed(uploader->Map(0, nullptr, &pMapped));
+		memcpy(pMapped, pData, (size_t) byteSize);
+		uploader->Unmap(0, nullptr);
+
+		if(pool.State != D3D12_RESOURCE_STATE_COPY_DEST)
+		{
+			cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(pool.Buffer.Get(),
+				pool.State, D3D12_RESOURCE_STATE_COPY_DEST));
+		}
+		cmdList->CopyBufferRegion(pool.Buffer.Get(), (u64) range.Offset * pool.Stride, uploader.Get(), 0, byteSize);
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(pool.Buffer.Get(),
+			D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ));
+		pool.State = D3D12_RESOURCE_STATE_GENERIC_READ;
+
+		m_Uploaders.push_back(uploader);
+		return range;
+	}
+
+	Microsoft::WRL::ComPtr<ID3D12Device> m_Device;
+	Pool m_Vertices;
+	Pool m_Indices16;
+	Pool m_Indices32;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> m_Uploaders;
+};
+
+}
+
+#endif //!GEOMETRY_ARENA_H
@@ -0,0 +1,196 @@
+#ifndef GEOMETRY_CACHE_H
+#define GEOMETRY_CACHE_H
+
+#include <map>
+#include <memory>
+
+#include "Core.h"
+#include "Mesh.h"
+#include "Profiler.h"
+
+namespace Loxodonta
+{
+
+enum class GeometryType : u8
+{
+	Sphere = 0,
+	Geosphere,
+	Cylinder,
+	Capsule,
+};
+
+// Everything the output of a procedural generator depends on.
+// Requests with equal keys get the same vertex and index buffers.
+struct GeometryKey
+{
+	GeometryType Type = GeometryType::Sphere;
+	float Size[3] = {0.0f, 0.0f, 0.0f};
+	u32 Tessellation[2] = {0, 0};
+
+	bool operator<(const GeometryKey& other) const
+	{
+		if(Type != other.Type)
+			return Type < other.Type;
+		for(int i = 0; i < 3; i++)
+			if(Size[i] != other.Size[i])
+				return Size[i] < other.Size[i];
+		for(int i = 0; i < 2; i++)
+			if(Tessellation[i] != other.Tessellation[i])
+				return Tessellation[i] < other.Tessellation[i];
+		return false;
+	}
+};
+
+// Owns procedurally generated meshes and hands out one shared instance per parameter set,
+// so identical shapes are built and uploaded once no matter how many render items use them.
+class GeometryCache
+{
+public:
+	SphereMesh* GetSphere(float radius, u32 sliceCount, u32 stackCount,
+		Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice,
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& commandList)
+	{
+		GeometryKey key;
+		key.Type = GeometryType::Sphere;
+		key.Size[0] = radius;
+		key.Tessellation[0] = sliceCount;
+		key.Tessellation[1] = stackCount;
+		return Get<SphereMesh>(key, d3dDevice, commandList, [&]()
+		{
+			auto sphere = std::make_unique<SphereMesh>(radius, sliceCount, stackCount);
+			sphere->Name = "sphere_" + std::to_string(radius) + "_" + std::to_string(sliceCount) + "x" + std::to_string(stackCount);
+			return sphere;
+		});
+	}
+
+	GeosphereMesh* GetGeosphere(float radius, u32 numSubdivisions,
+		Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice,
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& commandList)
+	{
+		numSubdivisions = Math::Min(numSubdivisions, (u32) GeosphereMesh::MAX_SUBDIVISIONS);
+		GeometryKey key;
+		key.Type = GeometryType::Geosphere;
+		key.Size[0] = radius;
+		key.Tessellation[0] = numSubdivisions;
+		return Get<GeosphereMesh>(key, d3dDevice, commandList, [&]()
+		{
+			auto geosphere = std::make_unique<GeosphereMesh>(radius, numSubdivisions);
+			geosphere->Name = "geosphere_" + std::to_string(radius) + "_" + std::to_string(numSubdivisions);
+			return geosphere;
+		});
+	}
+
+	CylinderMesh* GetCylinder(float bottomRadius, float topRadius, float height, u32 sliceCount, u32 stackCount,
+		Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice,
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& commandList)
+	{
+		GeometryKey key;
+		key.Type = GeometryType::Cylinder;
+		key.Size[0] = bottomRadius;
+		key.Size[1] = topRadius;
+		key.Size[2] = height;
+		key.Tessellation[0] = sliceCount;
+		key.Tessellation[1] = stackCount;
+		return Get<CylinderMesh>(key, d3dDevice, commandList, [&]()
+		{
+			auto cylinder = std::make_unique<CylinderMesh>(bottomRadius, topRadius, height, sliceCount, stackCount);
+			cylinder->Name = "cylinder_" + std::to_string(bottomRadius) + "_" + std::to_string(topRadius) + "_" +
+				std::to_string(height) + "_" + std::to_string(sliceCount) + "x" + std::to_string(stackCount);
+			return cylinder;
+		});
+	}
+
+	CapsuleMesh* GetCapsule(float radius, float height, u32 sliceCount, u32 hemisphereStackCount,
+		Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice,
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& commandList)
+	{
+		GeometryKey key;
+		key.Type = GeometryType::Capsule;
+		key.Size[0] = radius;
+		key.Size[1] = height;
+		key.Tessellation[0] = sliceCount;
+		key.Tessellation[1] = hemisphereStackCount;
+		return Get<CapsuleMesh>(key, d3dDevice, commandList, [&]()
+		{
+			auto capsule = std::make_unique<CapsuleMesh>(radius, height, sliceCount, hemisphereStackCount);
+			capsule->Name = "capsule_" + std::to_string(radius) + "_" + std::to_string(height) + "_" +
+				std::to_string(sliceCount) + "x" + std::to_string(hemisphereStackCount);
+			return capsule;
+		});
+	}
+
+	// Vertex buffer layout of the meshes built from now on
+	void SetVertexFormat(VertexFormat format) { m_VertexFormat = format; }
+	// Arena the meshes built from now on suballocate from, they get buffers of their own without one
+	void SetArena(GeometryArena* pArena) { m_pArena = pArena; }
+
+	// Number of Get calls answered so far
+	uint RequestCount() const { return m_RequestCount; }
+	// Number of distinct meshes actually built
+	uint MeshCount() const { return (uint) m_Meshes.size(); }
+	// Vertex and index bytes held on the GPU
+	u64 GpuBytes() const { return m_GpuBytes; }
+	// Vertex and index bytes the same requests would have needed without sharing
+	u64 RequestedBytes() const { return m_RequestedBytes; }
+
+	void DisposeUploaders()
+	{
+		for(auto& mesh : m_Meshes)
+			mesh.second->DisposeUploaders();
+	}
+
+private:
+	// Shared mesh for key, built with create and uploaded on the first request
+	template <typename MeshType, typename Create>
+	MeshType* Get(const GeometryKey& key,
+		Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice,
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>& commandList,
+		Create create)
+	{
+		Mesh* mesh = Find(key);
+		if(mesh == nullptr)
+		{
+			std::unique_ptr<MeshType> created = create();
+			created->Format = m_VertexFormat;
+			created->pArena = m_pArena;
+			created->Initialize(d3dDevice, commandList);
+			LogLine("GeometryCache " + created->Name + ": " + MeshOptimizer::Describe(created->Optimization) +
+				", " + MeshletBuilder::Describe(created->Meshlets) +
+				", " + std::to_string(created->DrawArgs.begin()->second.Lods.size()) + " levels of detail");
+			mesh = Insert(key, std::move(created));
+		}
+		m_RequestedBytes += MeshBytes(mesh);
+		return static_cast<MeshType*>(mesh);
+	}
+
+	Mesh* Find(const GeometryKey& key)
+	{
+		m_RequestCount++;
+		auto it = m_Meshes.find(key);
+		return (it != m_Meshes.end()) ? it->second.get() : nullptr;
+	}
+
+	Mesh* Insert(const GeometryKey& key, std::unique_ptr<Mesh> mesh)
+	{
+		m_GpuBytes += MeshBytes(mesh.get());
+		Mesh* result = mesh.get();
+		m_Meshes[key] = std::move(mesh);
+		return result;
+	}
+
+	static u64 MeshBytes(const Mesh* mesh)
+	{
+		return (u64) mesh->VertexBufferByteSize + mesh->IndexBufferByteSize;
+	}
+
+	std::map<GeometryKey, std::unique_ptr<Mesh>> m_Meshes;
+	uint m_RequestCount = 0;
+	u64 m_GpuBytes = 0;
+	u64 m_RequestedBytes = 0;
+	VertexFormat m_VertexFormat = VertexFormat::Full;
+	GeometryArena* m_pArena = nullptr;
+};
+
+}
+
+#endif //!GEOMETRY_CACHE_H
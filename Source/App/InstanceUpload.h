@@ -0,0 +1,120 @@
+#ifndef INSTANCE_UPLOAD_H
+#define INSTANCE_UPLOAD_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "FrameResource.h"
+#include "VertexPacking.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define INSTANCE_UPLOAD_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace Loxodonta
+{
+
+// Writing instance data straight into a mapped buffer. Upload heaps are write combined memory: reads
+// from them are uncached and writes only go out at full speed when they fill whole lines, so instances
+// are assembled in registers and streamed out in 16 byte pieces, never read back or staged in between.
+namespace InstanceUpload
+{
+	// What an instance is built from, gathered from a render item and its mesh
+	struct Source
+	{
+		float4x4* pWorld = nullptr;
+		float4x4* pTexTransform = nullptr;
+		const VertexQuantization* pQuantization = nullptr;
+		u32 MaterialIndex = 0;
+		u32 Slot = 0; // instance to write
+	};
+
+	static_assert(sizeof(InstanceData) % 16 == 0, "InstanceData is streamed in 16 byte pieces");
+
+	// Shaders read matrices column major, so both go in transposed
+	inline void Build(const Source& source, InstanceData& instance)
+	{
+		vect4 World = Matrix::LoadFloat4x4(source.pWorld);
+		vect4 TexTransform = Matrix::LoadFloat4x4(source.pTexTransform);
+		Matrix::StoreFloat4x4(&instance.World,        Matrix::Transpose(World));
+		Matrix::StoreFloat4x4(&instance.TexTransform, Matrix::Transpose(TexTransform));
+		instance.MaterialIndex = source.MaterialIndex;
+
+		// Dequantization of packed vertices, identity for full ones
+		const VertexQuantization& quantization = *source.pQuantization;
+		instance.PositionScale = quantization.PositionScale;
+		instance.PositionOffset = quantization.PositionOffset;
+		instance.TexCoordScaleOffset = float4(quantization.TexCoordScale.x, quantization.TexCoordScale.y,
+			quantization.TexCoordOffset.x, quantization.TexCoordOffset.y);
+	}
+
+	// One instance at a time through a temporary, copied out with memcpy. The buffer holds slotCount
+	// instances, every source's slot must be one of them.
+	inline void WriteCopied(InstanceData* pInstances, u32 slotCount, const Source* pSources, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			assert(pSources[i].Slot < slotCount);
+			InstanceData instance;
+			Build(pSources[i], instance);
+			std::memcpy(&pInstances[pSources[i].Slot], &instance, sizeof(InstanceData));
+		}
+	}
+
+#if defined(INSTANCE_UPLOAD_SSE)
+	inline void StreamTransposed(f32* pDest, const float4x4& m)
+	{
+		__m128 row0 = _mm_loadu_ps(m.m[0]), row1 = _mm_loadu_ps(m.m[1]), row2 = _mm_loadu_ps(m.m[2]), row3 = _mm_loadu_ps(m.m[3]);
+		_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+		_mm_stream_ps(pDest, row0);
+		_mm_stream_ps(pDest + 4, row1);
+		_mm_stream_ps(pDest + 8, row2);
+		_mm_stream_ps(pDest + 12, row3);
+	}
+
+	// Transposes in registers and writes every piece of an instance with a non temporal store.
+	// pInstances must be 16 byte aligned.
+	inline void WriteStreamed(InstanceData* pInstances, u32 slotCount, const Source* pSources, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const Source& source = pSources[i];
+			assert(source.Slot < slotCount);
+			InstanceData& instance = pInstances[source.Slot];
+			StreamTransposed(&instance.World.m[0][0], *source.pWorld);
+			StreamTransposed(&instance.TexTransform.m[0][0], *source.pTexTransform);
+
+			const VertexQuantization& q = *source.pQuantization;
+			f32 materialIndex;
+			std::memcpy(&materialIndex, &source.MaterialIndex, sizeof(f32));
+			_mm_stream_ps(&instance.PositionScale.x, _mm_setr_ps(q.PositionScale.x, q.PositionScale.y, q.PositionScale.z, materialIndex));
+			_mm_stream_ps(&instance.PositionOffset.x, _mm_setr_ps(q.PositionOffset.x, q.PositionOffset.y, q.PositionOffset.z, 0.0f));
+			_mm_stream_ps(&instance.TexCoordScaleOffset.x, _mm_setr_ps(q.TexCoordScale.x, q.TexCoordScale.y, q.TexCoordOffset.x, q.TexCoordOffset.y));
+		}
+
+		// Streamed stores are weakly ordered, make them visible before the GPU is told to read
+		_mm_sfence();
+	}
+#endif
+
+	// Writes the instance of every source, streamed where the CPU and the buffer's alignment allow
+	inline void Write(InstanceData* pInstances, u32 slotCount, const Source* pSources, size_t count)
+	{
+#if defined(INSTANCE_UPLOAD_SSE)
+		if ((reinterpret_cast<uintptr_t>(pInstances) & 15) == 0)
+		{
+			WriteStreamed(pInstances, slotCount, pSources, count);
+			return;
+		}
+#endif
+		WriteCopied(pInstances, slotCount, pSources, count);
+	}
+}
+
+}
+
+#endif //!INSTANCE_UPLOAD_H
@@ -2,65 +2,115 @@
 #define LIGHT_H
 
 
+#include <vector>
+
 #include "Core.h"
 #include "Component.h"
 #include "Node.h"
 
+namespace Loxodonta
+{
+
+enum class LightType : u8
+{
+	Directional,
+	Point,
+	Spot
+};
 
+// Lights are scene nodes, gathered every frame into a LightTable. Once a light is in a table, its setters
+// queue it there, so the table only visits the lights that changed since it last looked. Positions and
+// directions are in the space of the light's transform, the world matrix of its scene node.
 // @todo move light properties to components?
 class LightNode : public Node
 {
 public:
+	LightType GetType() const { return m_type; }
+
 	float3 GetStrength() { return m_strength; }
-	void SetStrength(float3 strength) { m_strength = strength; }
+	void SetStrength(float3 strength) { m_strength = strength; Changed(); }
+
+	void SetTransform(float4x4 transform) override { Node::SetTransform(transform); Changed(); }
 
 protected:
+	explicit LightNode(LightType type) : m_type(type) {}
+
+	void Changed()
+	{
+		if (m_pChangedLights != nullptr && !m_queued)
+		{
+			m_queued = true;
+			m_pChangedLights->push_back(this);
+		}
+	}
+
+	LightType m_type;
+	// Set by the light table the light is in
+	std::vector<LightNode*>* m_pChangedLights = nullptr;
+	u32 m_tableSlot = 0;
+	bool m_queued = false;
 	float3 m_strength = { 0.5f, 0.5f, 0.5f };
-	float m_falloffStart = 1.0f;                          // point/spot light only
+	float m_falloffStart = 1.0f;                          // point/spot light only, not in the light buffer
 	float3 m_direction = { 0.0f, -1.0f, 0.0f };// directional/spot light only
 	float m_falloffEnd = 10.0f;                           // point/spot light only
 	float3 m_position = { 0.0f, 0.0f, 0.0f };  // point/spot light only
 	float m_spotPower = 64.0f;                            // spot light only
+
+	friend class LightTable;
 };
 
 
 class DirectLightNode : public LightNode
 {
 public:
+	DirectLightNode() : LightNode(LightType::Directional) {}
+
 	float3 GetDirection() { return m_direction; }
-	void SetDirection(float3 dir) { m_direction = dir; }
+	void SetDirection(float3 dir) { m_direction = dir; Changed(); }
 };
 
 class PointLightNode : public LightNode
 {
 public:
+	PointLightNode() : LightNode(LightType::Point) {}
+
+	// Kept on the CPU only: the shaders fall off by the inverse square of the distance, windowed down to
+	// zero at the falloff end, so changing it does not upload the light
 	float GetFalloffStart() { return m_falloffStart; }
 	void SetFalloffStart(float start) { m_falloffStart = start; }
 
+	// Nothing is lit beyond the falloff end
 	float GetFalloffEnd() { return m_falloffEnd; }
-	void SetFalloffEnd(float end) { m_falloffEnd = end; }
+	void SetFalloffEnd(float end) { m_falloffEnd = end; Changed(); }
 
 	float3 GetPosition() { return m_position; }
-	void SetPosition(float3 pos) { m_position = pos; }
+	void SetPosition(float3 pos) { m_position = pos; Changed(); }
 };
 
 class SpotLightNode : public LightNode
 {
 public:
+	SpotLightNode() : LightNode(LightType::Spot) {}
+
+	// Kept on the CPU only: the shaders fall off by the inverse square of the distance, windowed down to
+	// zero at the falloff end, so changing it does not upload the light
 	float GetFalloffStart() { return m_falloffStart; }
 	void SetFalloffStart(float start) { m_falloffStart = start; }
 
 	float3 GetDirection() { return m_direction; }
-	void SetDirection(float3 dir) { m_direction = dir; }
+	void SetDirection(float3 dir) { m_direction = dir; Changed(); }
 
+	// Nothing is lit beyond the falloff end
 	float GetFalloffEnd() { return m_falloffEnd; }
-	void SetFalloffEnd(float end) { m_falloffEnd = end; }
+	void SetFalloffEnd(float end) { m_falloffEnd = end; Changed(); }
 
 	float3 GetPosition() { return m_position; }
-	void SetPosition(float3 pos) { m_position = pos; }
+	void SetPosition(float3 pos) { m_position = pos; Changed(); }
 
 	float GetSpotPower() { return m_spotPower; }
-	void SetSpotPower(float power) { m_spotPower = power; }
+	void SetSpotPower(float power) { m_spotPower = power; Changed(); }
 };
 
-#endif //!LIGHT_H
\ No newline at end of file
+}
+
+#endif //!LIGHT_H
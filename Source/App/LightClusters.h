@@ -0,0 +1,472 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "Parallel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define LIGHT_CLUSTERS_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace Loxodonta
+{
+
+// Clustered light assignment. The view frustum is cut into a grid of froxels: screen tiles across and
+// slices in depth, spaced exponentially so froxels stay about as deep as they are wide. Every point and
+// spot light is binned into the froxels its range sphere reaches, and the pixel shader only evaluates
+// the lights of its own cluster, so the light count is limited by how many overlap rather than the scene.
+namespace LightClusters
+{
+	// Where a cluster's lights are in ClusterLists::Indices, read by the shaders as a uint2
+	struct ClusterRange
+	{
+		u32 Offset = 0;
+		u32 Count = 0;
+	};
+
+	// What the shaders read besides the lights: for every cluster the range of its indices, and the indices
+	// themselves, which are slots of the light buffer. Cluster (x, y, z) is (z * TilesY + y) * TilesX + x,
+	// with tile row 0 at the top of the screen and slice 0 at the near plane.
+	struct ClusterLists
+	{
+		std::vector<ClusterRange> Clusters;
+		std::vector<u32> Indices;
+	};
+
+	// World space spheres of the lights to bin, with the light buffer slot of each
+	struct LightSpheres
+	{
+		std::vector<f32> X, Y, Z, Radius;
+		std::vector<u32> Slots;
+
+		u32 Count() const { return (u32) Slots.size(); }
+
+		void Resize(u32 count)
+		{
+			X.resize(count);
+			Y.resize(count);
+			Z.resize(count);
+			Radius.resize(count);
+			Slots.resize(count);
+		}
+	};
+
+	struct GridSize
+	{
+		u32 TilesX = 16;
+		u32 TilesY = 9;
+		u32 Slices = 24;
+
+		u32 ClusterCount() const { return TilesX * TilesY * Slices; }
+	};
+
+	// Camera a grid is laid out for. View is the row vector world to view matrix, view space is left
+	// handed with z forward.
+	struct ClusterView
+	{
+		float4x4 View = Matrix::Identity4x4();
+		f32 FovY = 0.785398f;
+		f32 AspectRatio = 1.0f;
+		f32 NearZ = 1.0f;
+		f32 FarZ = 1000.0f;
+	};
+
+	// Froxels a light reaches, inclusive in every direction
+	struct LightBins
+	{
+		u16 X0 = 0, X1 = 0, Y0 = 0, Y1 = 0, Z0 = 0, Z1 = 0;
+		bool Visible = false;
+	};
+
+	// Fewest lights worth a thread of their own
+	const u32 MIN_THREAD_LIGHTS = 1024;
+
+	// Bins lights into the clusters of a view. The builder keeps its scratch between frames.
+	class ClusterBuilder
+	{
+	public:
+		void SetGridSize(const GridSize& size) { m_Size = size; }
+		const GridSize& Size() const { return m_Size; }
+
+		// Rebuilds out for lights seen from view, threadCount 0 meaning one thread per core, taken from
+		// pPool when given. The indices of every cluster come in the order of lights, whatever the thread count.
+		void Build(const ClusterView& view, const LightSpheres& lights, u32 threadCount, ClusterLists& out, WorkerPool* pPool = nullptr)
+		{
+			SetView(view);
+			const u32 count = lights.Count();
+			const u32 threads = Math::Min(WorkerCount(threadCount), Math::Max((count + MIN_THREAD_LIGHTS - 1) / MIN_THREAD_LIGHTS, 1u));
+
+			// Froxel ranges of every light, a chunk of lights per task
+			m_Bins.resize(count);
+			const u32 chunkCount = (count + MIN_THREAD_LIGHTS - 1) / MIN_THREAD_LIGHTS;
+			ParallelFor(pPool, chunkCount, threads, [&](size_t chunk)
+			{
+				const u32 first = (u32) chunk * MIN_THREAD_LIGHTS;
+				BinLights(lights, first, Math::Min(first + MIN_THREAD_LIGHTS, count));
+			});
+
+			// Visible lights in order, and for every slice the visible lights reaching it
+			m_VisibleBins.clear();
+			m_VisibleSlots.clear();
+			m_SliceStarts.assign(m_Size.Slices + 1, 0);
+			for (u32 i = 0; i < count; i++)
+			{
+				if (!m_Bins[i].Visible)
+					continue;
+				m_VisibleBins.push_back(m_Bins[i]);
+				m_VisibleSlots.push_back(lights.Slots[i]);
+				for (u32 z = m_Bins[i].Z0; z <= m_Bins[i].Z1; z++)
+					m_SliceStarts[z + 1]++;
+			}
+			for (u32 z = 0; z < m_Size.Slices; z++)
+				m_SliceStarts[z + 1] += m_SliceStarts[z];
+			m_SliceLights.resize(m_SliceStarts[m_Size.Slices]);
+			m_SliceCursors.assign(m_SliceStarts.begin(), m_SliceStarts.end() - 1);
+			for (u32 light = 0; light < (u32) m_VisibleBins.size(); light++)
+			{
+				for (u32 z = m_VisibleBins[light].Z0; z <= m_VisibleBins[light].Z1; z++)
+					m_SliceLights[m_SliceCursors[z]++] = light;
+			}
+
+			// Clusters of a slice belong to it alone, so slices are counted and filled in parallel
+			const u32 tileCount = m_Size.TilesX * m_Size.TilesY;
+			const u32 sliceThreads = Math::Min(threads, Math::Max((u32) m_SliceLights.size() / MIN_THREAD_LIGHTS, 1u));
+			out.Clusters.assign(m_Size.ClusterCount(), ClusterRange());
+			ParallelFor(pPool, m_Size.Slices, sliceThreads, [&](size_t z)
+			{
+				ClusterRange* pSlice = out.Clusters.data() + z * tileCount;
+				ForEachSliceLight((u32) z, [pSlice](u32 light, u32 tile) { pSlice[tile].Count++; });
+			});
+
+			u32 indexCount = 0;
+			for (ClusterRange& cluster : out.Clusters)
+			{
+				cluster.Offset = indexCount;
+				indexCount += cluster.Count;
+			}
+			out.Indices.resize(indexCount);
+			m_ClusterCursors.resize(out.Clusters.size());
+			ParallelFor(pPool, m_Size.Slices, sliceThreads, [&](size_t z)
+			{
+				const ClusterRange* pSlice = out.Clusters.data() + z * tileCount;
+				u32* pCursors = m_ClusterCursors.data() + z * tileCount;
+				for (u32 tile = 0; tile < tileCount; tile++)
+					pCursors[tile] = pSlice[tile].Offset;
+				u32* pIndices = out.Indices.data();
+				const u32* pSlots = m_VisibleSlots.data();
+				ForEachSliceLight((u32) z, [pCursors, pIndices, pSlots](u32 light, u32 tile) { pIndices[pCursors[tile]++] = pSlots[light]; });
+			});
+		}
+
+		// Froxels of the last built view that light i reaches, valid until the next Build
+		const LightBins& Bins(u32 light) const { return m_Bins[light]; }
+		// Lights of the last Build that reach any cluster
+		u32 VisibleCount() const { return (u32) m_VisibleSlots.size(); }
+
+		// Cluster of a view space point as the pixel shader finds it, clamped to the grid
+		u32 ClusterIndex(f32 x, f32 y, f32 z) const
+		{
+			const f32 ndcX = x / (z * m_TanHalfFovX), ndcY = y / (z * m_TanHalfFovY);
+			const u32 tileX = ToCell((ndcX + 1.0f) * 0.5f * m_Size.TilesX, m_Size.TilesX);
+			const u32 tileY = ToCell((1.0f - ndcY) * 0.5f * m_Size.TilesY, m_Size.TilesY);
+			const u32 slice = ToCell(std::log(z) * m_DepthScale + m_DepthBias, m_Size.Slices);
+			return (slice * m_Size.TilesY + tileY) * m_Size.TilesX + tileX;
+		}
+
+		// slice = log(z) * DepthScale() + DepthBias(), what the shaders need to find a pixel's slice
+		f32 DepthScale() const { return m_DepthScale; }
+		f32 DepthBias() const { return m_DepthBias; }
+
+		// One light at a time, the reference the SSE kernel must agree with
+		void BinLightsScalar(const LightSpheres& lights, u32 first, u32 last)
+		{
+			for (u32 i = first; i < last; i++)
+			{
+				const float4x4& v = m_View;
+				const f32 px = lights.X[i], py = lights.Y[i], pz = lights.Z[i];
+				const f32 x = px * v.m[0][0] + py * v.m[1][0] + pz * v.m[2][0] + v.m[3][0];
+				const f32 y = px * v.m[0][1] + py * v.m[1][1] + pz * v.m[2][1] + v.m[3][1];
+				const f32 z = px * v.m[0][2] + py * v.m[1][2] + pz * v.m[2][2] + v.m[3][2];
+				const f32 r = lights.Radius[i];
+
+				LightBins& bins = m_Bins[i];
+				bins = LightBins();
+				if (!(r > 0.0f) || z + r < m_NearZ || z - r > m_FarZ)
+					continue;
+
+				u32 z0 = 0, z1 = 0;
+				for (u32 k = 1; k < m_Size.Slices; k++)
+				{
+					z0 += (m_SliceDepths[k] <= z - r) ? 1 : 0;
+					z1 += (m_SliceDepths[k] < z + r) ? 1 : 0;
+				}
+
+				i32 x0 = -1, x1 = -1, y0 = -1, y1 = -1;
+				AxisRangeScalar(m_PlanesX, m_Size.TilesX, x, z, r, x0, x1);
+				AxisRangeScalar(m_PlanesY, m_Size.TilesY, y, z, r, y0, y1);
+				if (x0 < 0 || y0 < 0)
+					continue;
+
+				bins.X0 = (u16) x0; bins.X1 = (u16) x1;
+				bins.Y0 = (u16) y0; bins.Y1 = (u16) y1;
+				bins.Z0 = (u16) z0; bins.Z1 = (u16) z1;
+				bins.Visible = true;
+			}
+		}
+
+#if defined(LIGHT_CLUSTERS_SSE)
+		// Four lights at a time, every grid plane is tested against all four spheres at once
+		void BinLightsSse(const LightSpheres& lights, u32 first, u32 last)
+		{
+			const __m128 v00 = _mm_set1_ps(m_View.m[0][0]), v01 = _mm_set1_ps(m_View.m[0][1]), v02 = _mm_set1_ps(m_View.m[0][2]);
+			const __m128 v10 = _mm_set1_ps(m_View.m[1][0]), v11 = _mm_set1_ps(m_View.m[1][1]), v12 = _mm_set1_ps(m_View.m[1][2]);
+			const __m128 v20 = _mm_set1_ps(m_View.m[2][0]), v21 = _mm_set1_ps(m_View.m[2][1]), v22 = _mm_set1_ps(m_View.m[2][2]);
+			const __m128 v30 = _mm_set1_ps(m_View.m[3][0]), v31 = _mm_set1_ps(m_View.m[3][1]), v32 = _mm_set1_ps(m_View.m[3][2]);
+			const __m128 nearZ = _mm_set1_ps(m_NearZ), farZ = _mm_set1_ps(m_FarZ);
+
+			for (u32 i = first; i < last; i += 4)
+			{
+				__m128 px, py, pz, r;
+				if (i + 4 <= last)
+				{
+					px = _mm_loadu_ps(&lights.X[i]);
+					py = _mm_loadu_ps(&lights.Y[i]);
+					pz = _mm_loadu_ps(&lights.Z[i]);
+					r = _mm_loadu_ps(&lights.Radius[i]);
+				}
+				else
+				{
+					// Lanes past last get no radius and are never visible
+					alignas(16) f32 tail[4][4] = {};
+					for (u32 lane = 0; i + lane < last; lane++)
+					{
+						tail[0][lane] = lights.X[i + lane];
+						tail[1][lane] = lights.Y[i + lane];
+						tail[2][lane] = lights.Z[i + lane];
+						tail[3][lane] = lights.Radius[i + lane];
+					}
+					px = _mm_load_ps(tail[0]);
+					py = _mm_load_ps(tail[1]);
+					pz = _mm_load_ps(tail[2]);
+					r = _mm_load_ps(tail[3]);
+				}
+
+				const __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, v00), _mm_mul_ps(py, v10)), _mm_add_ps(_mm_mul_ps(pz, v20), v30));
+				const __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, v01), _mm_mul_ps(py, v11)), _mm_add_ps(_mm_mul_ps(pz, v21), v31));
+				const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, v02), _mm_mul_ps(py, v12)), _mm_add_ps(_mm_mul_ps(pz, v22), v32));
+				const __m128 zMin = _mm_sub_ps(z, r), zMax = _mm_add_ps(z, r);
+				__m128 visible = _mm_and_ps(_mm_cmpgt_ps(r, _mm_setzero_ps()),
+					_mm_and_ps(_mm_cmpge_ps(zMax, nearZ), _mm_cmple_ps(zMin, farZ)));
+				visible = _mm_and_ps(visible, InsideSidesSse(m_PlanesX, x, z, r));
+				visible = _mm_and_ps(visible, InsideSidesSse(m_PlanesY, y, z, r));
+
+				// Most lights of a scene are out of view, four at once skip the grid altogether
+				if (_mm_movemask_ps(visible) == 0)
+				{
+					for (u32 lane = 0; lane < 4 && i + lane < last; lane++)
+						m_Bins[i + lane] = LightBins();
+					continue;
+				}
+
+				// Slices are counted off the boundaries in front of each end, compare masks are -1 where true
+				__m128i z0 = _mm_setzero_si128(), z1 = _mm_setzero_si128();
+				for (u32 k = 1; k < m_Size.Slices; k++)
+				{
+					const __m128 depth = _mm_set1_ps(m_SliceDepths[k]);
+					z0 = _mm_sub_epi32(z0, _mm_castps_si128(_mm_cmple_ps(depth, zMin)));
+					z1 = _mm_sub_epi32(z1, _mm_castps_si128(_mm_cmplt_ps(depth, zMax)));
+				}
+
+				__m128i x0, x1, y0, y1;
+				visible = _mm_and_ps(visible, AxisRangeSse(m_PlanesX, m_Size.TilesX, x, z, r, x0, x1));
+				visible = _mm_and_ps(visible, AxisRangeSse(m_PlanesY, m_Size.TilesY, y, z, r, y0, y1));
+
+				alignas(16) i32 lanes[6][4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[0]), x0);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[1]), x1);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[2]), y0);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[3]), y1);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[4]), z0);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[5]), z1);
+				const int visibleMask = _mm_movemask_ps(visible);
+				for (u32 lane = 0; lane < 4 && i + lane < last; lane++)
+				{
+					LightBins& bins = m_Bins[i + lane];
+					bins = LightBins();
+					if ((visibleMask & (1 << lane)) == 0)
+						continue;
+					bins.X0 = (u16) lanes[0][lane]; bins.X1 = (u16) lanes[1][lane];
+					bins.Y0 = (u16) lanes[2][lane]; bins.Y1 = (u16) lanes[3][lane];
+					bins.Z0 = (u16) lanes[4][lane]; bins.Z1 = (u16) lanes[5][lane];
+					bins.Visible = true;
+				}
+			}
+		}
+#endif
+
+	private:
+		// Plane through the eye between two rows or columns of tiles, as (a, b) with a * x + b * z the
+		// signed distance of a view space point in the direction of increasing tile index
+		struct GridPlane
+		{
+			f32 A = 0.0f;
+			f32 B = 0.0f;
+		};
+
+		void SetView(const ClusterView& view)
+		{
+			m_View = view.View;
+			m_NearZ = view.NearZ;
+			m_FarZ = view.FarZ;
+			m_TanHalfFovY = std::tan(view.FovY * 0.5f);
+			m_TanHalfFovX = m_TanHalfFovY * view.AspectRatio;
+
+			// Columns run left to right, rows top to bottom
+			m_PlanesX.resize(m_Size.TilesX + 1);
+			for (u32 j = 0; j <= m_Size.TilesX; j++)
+			{
+				const f32 slope = m_TanHalfFovX * (2.0f * j / m_Size.TilesX - 1.0f);
+				const f32 invLength = 1.0f / std::sqrt(1.0f + slope * slope);
+				m_PlanesX[j].A = invLength;
+				m_PlanesX[j].B = -slope * invLength;
+			}
+			m_PlanesY.resize(m_Size.TilesY + 1);
+			for (u32 j = 0; j <= m_Size.TilesY; j++)
+			{
+				const f32 slope = m_TanHalfFovY * (1.0f - 2.0f * j / m_Size.TilesY);
+				const f32 invLength = 1.0f / std::sqrt(1.0f + slope * slope);
+				m_PlanesY[j].A = -invLength;
+				m_PlanesY[j].B = slope * invLength;
+			}
+
+			const f32 logDepthRange = std::log(m_FarZ / m_NearZ);
+			m_DepthScale = m_Size.Slices / logDepthRange;
+			m_DepthBias = -(f32) m_Size.Slices * std::log(m_NearZ) / logDepthRange;
+			m_SliceDepths.resize(m_Size.Slices + 1);
+			for (u32 k = 0; k <= m_Size.Slices; k++)
+				m_SliceDepths[k] = m_NearZ * std::pow(m_FarZ / m_NearZ, (f32) k / m_Size.Slices);
+		}
+
+		// First and last cells of one axis the sphere reaches, -1 when it misses the frustum on that axis.
+		// Cell i lies between planes i and i + 1, a sphere reaches it unless it is entirely behind either.
+		// Spheres outside the frustum's sides reach none, whatever the planes between say of them.
+		static void AxisRangeScalar(const std::vector<GridPlane>& planes, u32 cellCount, f32 c, f32 z, f32 r, i32& first, i32& last)
+		{
+			first = -1;
+			last = -1;
+			if (planes[0].A * c + planes[0].B * z <= -r || planes[cellCount].A * c + planes[cellCount].B * z >= r)
+				return;
+			for (u32 i = 0; i < cellCount; i++)
+			{
+				const f32 low = planes[i].A * c + planes[i].B * z;
+				const f32 high = planes[i + 1].A * c + planes[i + 1].B * z;
+				if (low > -r && high < r)
+				{
+					if (first < 0)
+						first = (i32) i;
+					last = (i32) i;
+				}
+			}
+		}
+
+#if defined(LIGHT_CLUSTERS_SSE)
+		// Mask of the spheres not entirely outside the frustum's two sides along one axis
+		static __m128 InsideSidesSse(const std::vector<GridPlane>& planes, __m128 c, __m128 z, __m128 r)
+		{
+			const GridPlane& first = planes.front();
+			const GridPlane& last = planes.back();
+			const __m128 low = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(first.A), c), _mm_mul_ps(_mm_set1_ps(first.B), z));
+			const __m128 high = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(last.A), c), _mm_mul_ps(_mm_set1_ps(last.B), z));
+			return _mm_and_ps(_mm_cmpgt_ps(low, _mm_sub_ps(_mm_setzero_ps(), r)), _mm_cmplt_ps(high, r));
+		}
+
+		// AxisRangeScalar for four spheres, returns the mask of the ones that reach any cell
+		static __m128 AxisRangeSse(const std::vector<GridPlane>& planes, u32 cellCount, __m128 c, __m128 z, __m128 r, __m128i& first, __m128i& last)
+		{
+			const __m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+			__m128i found = _mm_setzero_si128();
+			first = _mm_setzero_si128();
+			last = _mm_setzero_si128();
+			__m128 low = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[0].A), c), _mm_mul_ps(_mm_set1_ps(planes[0].B), z));
+			for (u32 i = 0; i < cellCount; i++)
+			{
+				const __m128 high = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[i + 1].A), c), _mm_mul_ps(_mm_set1_ps(planes[i + 1].B), z));
+				const __m128i reaches = _mm_castps_si128(_mm_and_ps(_mm_cmpgt_ps(low, negR), _mm_cmplt_ps(high, r)));
+				const __m128i cell = _mm_set1_epi32((int) i);
+				const __m128i isFirst = _mm_andnot_si128(found, reaches);
+				first = _mm_or_si128(_mm_and_si128(isFirst, cell), _mm_andnot_si128(isFirst, first));
+				last = _mm_or_si128(_mm_and_si128(reaches, cell), _mm_andnot_si128(reaches, last));
+				found = _mm_or_si128(found, reaches);
+				low = high;
+			}
+			return _mm_castsi128_ps(found);
+		}
+#endif
+
+		void BinLights(const LightSpheres& lights, u32 first, u32 last)
+		{
+#if defined(LIGHT_CLUSTERS_SSE)
+			BinLightsSse(lights, first, last);
+#else
+			BinLightsScalar(lights, first, last);
+#endif
+		}
+
+		// Calls fn(light, tile) for every tile of slice z each of its lights reaches, lights in order
+		template <typename Fn>
+		void ForEachSliceLight(u32 z, Fn fn) const
+		{
+			for (u32 i = m_SliceStarts[z]; i < m_SliceStarts[z + 1]; i++)
+			{
+				const u32 light = m_SliceLights[i];
+				const LightBins& bins = m_VisibleBins[light];
+				for (u32 y = bins.Y0; y <= bins.Y1; y++)
+				{
+					for (u32 x = bins.X0; x <= bins.X1; x++)
+						fn(light, y * m_Size.TilesX + x);
+				}
+			}
+		}
+
+		static u32 ToCell(f32 position, u32 cellCount)
+		{
+			if (!(position > 0.0f))
+				return 0;
+			return Math::Min((u32) position, cellCount - 1);
+		}
+
+		GridSize m_Size;
+
+		float4x4 m_View = Matrix::Identity4x4();
+		f32 m_NearZ = 1.0f;
+		f32 m_FarZ = 1000.0f;
+		f32 m_TanHalfFovX = 1.0f;
+		f32 m_TanHalfFovY = 1.0f;
+		f32 m_DepthScale = 0.0f;
+		f32 m_DepthBias = 0.0f;
+		std::vector<GridPlane> m_PlanesX;
+		std::vector<GridPlane> m_PlanesY;
+		// Depth where each slice starts, and the far plane
+		std::vector<f32> m_SliceDepths;
+
+		// Froxel ranges of every light, then of the visible ones in order with their slots
+		std::vector<LightBins> m_Bins;
+		std::vector<LightBins> m_VisibleBins;
+		std::vector<u32> m_VisibleSlots;
+		// Visible lights reaching each slice, slice z's are [m_SliceStarts[z], m_SliceStarts[z + 1])
+		std::vector<u32> m_SliceStarts;
+		std::vector<u32> m_SliceCursors;
+		std::vector<u32> m_SliceLights;
+		std::vector<u32> m_ClusterCursors;
+	};
+}
+
+}
+
+#endif //!LIGHT_CLUSTERS_H
@@ -0,0 +1,295 @@
+#ifndef LIGHT_TABLE_H
+#define LIGHT_TABLE_H
+
+#include <cfloat>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "FrameResource.h"
+#include "Light.h"
+#include "Culling.h"
+#include "LightClusters.h"
+#include "DirtyList.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define LIGHT_TABLE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace Loxodonta
+{
+
+// Spot lights are culled by the cone where their falloff drops below this fraction of their strength
+const f32 SPOT_CUTOFF = 1.0f / 256.0f;
+
+// The scene's light nodes as the frame loop sees them. Point and spot lights each own a slot of the light
+// buffer, and what culling reads of them is kept in a structure of arrays so one plane test covers 4 lights.
+// Setters of a light in the table queue it, Gather copies the queued lights in and their slots are uploaded
+// in each of the next NUM_FRAME_RESOURCES frames, so lights that do not change cost nothing.
+// Directional lights light everything, they are copied every frame into the pass constants.
+class LightTable
+{
+public:
+	LightTable() = default;
+	LightTable(const LightTable&) = delete;
+	LightTable& operator=(const LightTable&) = delete;
+
+	// The lights must still be alive, their setters stop queueing them
+	~LightTable()
+	{
+		for (Slot& slot : m_Slots)
+			slot.pNode->m_pChangedLights = nullptr;
+	}
+
+	// Lights keep their slot for good. Each point or spot light takes the next one, so the light buffers
+	// have to grow with LocalLightCount.
+	void Add(LightNode* light)
+	{
+		if (light->GetType() == LightType::Directional)
+		{
+			m_DirectionalNodes.push_back(light);
+			return;
+		}
+
+		Slot slot;
+		slot.pNode = light;
+		slot.Index = (u32) m_Slots.size();
+		m_Slots.push_back(slot);
+		light->m_pChangedLights = &m_Changed;
+		light->m_tableSlot = slot.Index;
+		light->m_queued = true;
+		m_Changed.push_back(light);
+		m_Records.emplace_back();
+		for (std::vector<f32>* column : {&m_X, &m_Y, &m_Z, &m_Radius, &m_DirX, &m_DirY, &m_DirZ, &m_ConeRadius, &m_Spot})
+			column->push_back(0.0f);
+	}
+
+	u32 LocalLightCount() const { return (u32) m_Slots.size(); }
+	const std::vector<Light>& DirectionalLights() const { return m_DirectionalLights; }
+	const LocalLight& Record(u32 slot) const { return m_Records[slot]; }
+
+	// Brings the table up to date with the nodes, returns how many local lights changed
+	u32 Gather()
+	{
+		const u32 changed = (u32) m_Changed.size();
+		for (LightNode* light : m_Changed)
+		{
+			Slot& slot = m_Slots[light->m_tableSlot];
+			Copy(slot);
+			light->m_queued = false;
+			m_Dirty.Mark(&slot);
+		}
+		m_Changed.clear();
+
+		m_DirectionalLights.resize(Math::Min((u32) m_DirectionalNodes.size(), (u32) MaxLights));
+		for (size_t i = 0; i < m_DirectionalLights.size(); i++)
+		{
+			Light& light = m_DirectionalLights[i];
+			light.Strength = m_DirectionalNodes[i]->m_strength;
+			light.Direction = ToWorld(m_DirectionalNodes[i]->m_toWorldTransform, m_DirectionalNodes[i]->m_direction, 0.0f);
+		}
+		return changed;
+	}
+
+	// Calls fn(slot, record) for every slot the current frame resource's light buffer is missing
+	template <typename Fn>
+	void ForEachDirty(Fn fn) const
+	{
+		m_Dirty.ForEach([this, &fn](Slot* slot) { fn(slot->Index, m_Records[slot->Index]); });
+	}
+
+	// Every slot is uploaded again in the next frames, as after the light buffers were replaced
+	void MarkAllDirty()
+	{
+		for (Slot& slot : m_Slots)
+			m_Dirty.Mark(&slot);
+	}
+
+	// Ends the frame, see DirtyRing::Advance
+	void Advance() { m_Dirty.Advance(); }
+
+	// World space spheres and slots of the local lights that can reach into the frustum, in slot order
+	void Cull(const Culling::Frustum& frustum, LightClusters::LightSpheres& visible) const
+	{
+#if defined(LIGHT_TABLE_SSE)
+		CullSse(frustum, visible);
+#else
+		CullScalar(frustum, visible);
+#endif
+	}
+
+	// One light at a time, the reference the SSE kernel must agree with. A light is out when its falloff
+	// sphere is behind a plane, or for a spot, when its cone is: the apex and the point of the cone's
+	// base furthest along the plane's normal are both behind it.
+	void CullScalar(const Culling::Frustum& frustum, LightClusters::LightSpheres& visible) const
+	{
+		visible.Resize(LocalLightCount());
+		u32 visibleCount = 0;
+		for (u32 i = 0; i < LocalLightCount(); i++)
+		{
+			bool outside = false;
+			for (const f32* plane : frustum.Planes)
+			{
+				const f32 apex = plane[0] * m_X[i] + plane[1] * m_Y[i] + plane[2] * m_Z[i] + plane[3];
+				const f32 axial = plane[0] * m_DirX[i] + plane[1] * m_DirY[i] + plane[2] * m_DirZ[i];
+				const f32 base = apex + m_Radius[i] * axial + m_ConeRadius[i] * std::sqrt(Math::Max(1.0f - axial * axial, 0.0f));
+				outside = outside || apex < -m_Radius[i] || (m_Spot[i] != 0.0f && apex < 0.0f && base < 0.0f);
+			}
+			if (!outside)
+				visibleCount = Append(visible, visibleCount, i);
+		}
+		visible.Resize(visibleCount);
+	}
+
+#if defined(LIGHT_TABLE_SSE)
+	// Spheres first, most lights are out of view and leave after a plane or two. Cones are only tested
+	// for the groups with a spot still in.
+	void CullSse(const Culling::Frustum& frustum, LightClusters::LightSpheres& visible) const
+	{
+		visible.Resize(LocalLightCount());
+		u32 visibleCount = 0;
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		for (u32 i = 0; i < LocalLightCount(); i += 4)
+		{
+			const __m128 x = Load(m_X, i), y = Load(m_Y, i), z = Load(m_Z, i), r = Load(m_Radius, i);
+			const __m128 negR = _mm_sub_ps(zero, r);
+			__m128 outside = zero;
+			__m128 apex[Culling::Frustum::Count];
+			for (int p = 0; p < Culling::Frustum::Count && _mm_movemask_ps(outside) != 0xf; p++)
+			{
+				const f32* plane = frustum.Planes[p];
+				apex[p] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), x), _mm_mul_ps(_mm_set1_ps(plane[1]), y)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), z), _mm_set1_ps(plane[3])));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(apex[p], negR));
+			}
+
+			const __m128 spot = _mm_andnot_ps(outside, _mm_cmpneq_ps(Load(m_Spot, i), zero));
+			if (_mm_movemask_ps(spot) != 0)
+			{
+				const __m128 dx = Load(m_DirX, i), dy = Load(m_DirY, i), dz = Load(m_DirZ, i);
+				const __m128 coneRadius = Load(m_ConeRadius, i);
+				for (int p = 0; p < Culling::Frustum::Count; p++)
+				{
+					const f32* plane = frustum.Planes[p];
+					const __m128 axial = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), dx), _mm_mul_ps(_mm_set1_ps(plane[1]), dy)),
+						_mm_mul_ps(_mm_set1_ps(plane[2]), dz));
+					const __m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(axial, axial)), zero));
+					const __m128 base = _mm_add_ps(_mm_add_ps(apex[p], _mm_mul_ps(r, axial)), _mm_mul_ps(coneRadius, across));
+					outside = _mm_or_ps(outside, _mm_and_ps(spot, _mm_and_ps(_mm_cmplt_ps(apex[p], zero), _mm_cmplt_ps(base, zero))));
+				}
+			}
+
+			int mask = ~_mm_movemask_ps(outside) & 0xf;
+			for (u32 lane = 0; mask != 0; lane++, mask >>= 1)
+			{
+				if ((mask & 1) != 0 && i + lane < LocalLightCount())
+					visibleCount = Append(visible, visibleCount, i + lane);
+			}
+		}
+		visible.Resize(visibleCount);
+	}
+#endif
+
+private:
+	struct Slot
+	{
+		LightNode* pNode = nullptr;
+		u32 Index = 0;
+		u64 DirtyFrame = 0;
+	};
+
+	void Copy(const Slot& slot)
+	{
+		const LightNode& node = *slot.pNode;
+		const u32 i = slot.Index;
+
+		// Spot directions are normalized here once rather than by every pixel. Ranges do not scale with
+		// the light's transform.
+		float3 direction = ToWorld(node.m_toWorldTransform, node.m_direction, 0.0f);
+		const f32 length = std::sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+		if (length > 0.0f)
+			direction = float3(direction.x / length, direction.y / length, direction.z / length);
+
+		LocalLight& record = m_Records[i];
+		record.Position = ToWorld(node.m_toWorldTransform, node.m_position, 1.0f);
+		record.Range = node.m_falloffEnd;
+		record.Direction = direction;
+		record.SpotPower = node.m_spotPower;
+		record.Strength = node.m_strength;
+		record.Type = (node.GetType() == LightType::Spot) ? LocalLightType::Spot : LocalLightType::Point;
+
+		m_X[i] = record.Position.x;
+		m_Y[i] = record.Position.y;
+		m_Z[i] = record.Position.z;
+		m_Radius[i] = record.Range;
+		m_DirX[i] = direction.x;
+		m_DirY[i] = direction.y;
+		m_DirZ[i] = direction.z;
+
+		// Cone where pow(cos, SpotPower) reaches SPOT_CUTOFF, as the radius of its base at the falloff end.
+		// Cones too wide to cull better than the sphere are left to it.
+		m_Spot[i] = 0.0f;
+		m_ConeRadius[i] = 0.0f;
+		if (record.Type == LocalLightType::Spot && record.SpotPower > 0.0f && length > 0.0f)
+		{
+			const f32 cosine = std::pow(SPOT_CUTOFF, 1.0f / record.SpotPower);
+			if (cosine > 0.1f)
+			{
+				m_Spot[i] = 1.0f;
+				m_ConeRadius[i] = record.Range * std::sqrt(1.0f - cosine * cosine) / cosine;
+			}
+		}
+	}
+
+	// Point (w 1) or direction (w 0) of a light's space in world space, row vectors as everywhere else
+	static float3 ToWorld(const float4x4& m, const float3& v, f32 w)
+	{
+		return float3(v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + w * m.m[3][0],
+			v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + w * m.m[3][1],
+			v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + w * m.m[3][2]);
+	}
+
+	u32 Append(LightClusters::LightSpheres& visible, u32 visibleCount, u32 i) const
+	{
+		visible.X[visibleCount] = m_X[i];
+		visible.Y[visibleCount] = m_Y[i];
+		visible.Z[visibleCount] = m_Z[i];
+		visible.Radius[visibleCount] = m_Radius[i];
+		visible.Slots[visibleCount] = i;
+		return visibleCount + 1;
+	}
+
+#if defined(LIGHT_TABLE_SSE)
+	// Four lanes of a column, lanes past the last light read as 0
+	__m128 Load(const std::vector<f32>& column, u32 i) const
+	{
+		if (i + 4 <= column.size())
+			return _mm_loadu_ps(&column[i]);
+		alignas(16) f32 tail[4] = {};
+		for (u32 lane = 0; i + lane < column.size(); lane++)
+			tail[lane] = column[i + lane];
+		return _mm_load_ps(tail);
+	}
+#endif
+
+	// Slots stay where they are as lights are added, the dirty lists point at them
+	std::deque<Slot> m_Slots;
+	std::vector<LocalLight> m_Records;
+	// Lights queued by their setters since the last Gather, and the slots to upload
+	std::vector<LightNode*> m_Changed;
+	DirtyRing<Slot> m_Dirty;
+
+	// Culling columns: position, falloff end, spot direction, spot cone base radius and 1 for culled cones
+	std::vector<f32> m_X, m_Y, m_Z, m_Radius;
+	std::vector<f32> m_DirX, m_DirY, m_DirZ, m_ConeRadius, m_Spot;
+
+	std::vector<LightNode*> m_DirectionalNodes;
+	std::vector<Light> m_DirectionalLights;
+};
+
+}
+
+#endif //!LIGHT_TABLE_H
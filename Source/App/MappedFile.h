@@ -0,0 +1,142 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Core.h"
+
+namespace Loxodonta
+{
+
+// Last write time and byte size of a file on disk
+struct FileStamp
+{
+	u64 LastWriteTime = 0;
+	u64 Size = 0;
+};
+
+inline bool GetFileStamp(const std::string& filepath, FileStamp& stamp)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(filepath.c_str(), GetFileExInfoStandard, &attributes))
+		return false;
+	stamp.LastWriteTime = ((u64) attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	stamp.Size = ((u64) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+#else
+	struct stat attributes;
+	if (stat(filepath.c_str(), &attributes) != 0)
+		return false;
+	stamp.LastWriteTime = (u64) attributes.st_mtime;
+	stamp.Size = (u64) attributes.st_size;
+#endif
+	return true;
+}
+
+// Read-only memory mapped view of an entire file
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile& rhs) = delete;
+	MappedFile& operator=(const MappedFile& rhs) = delete;
+
+	bool Open(const std::string& filepath)
+	{
+		Close();
+#ifdef _WIN32
+		m_file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		m_size = (u64) size.QuadPart;
+
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping == nullptr)
+		{
+			Close();
+			return false;
+		}
+		m_pData = (const u8*) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		m_file = open(filepath.c_str(), O_RDONLY);
+		if (m_file < 0)
+			return false;
+
+		struct stat attributes;
+		if (fstat(m_file, &attributes) != 0 || attributes.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+		m_size = (u64) attributes.st_size;
+
+		void* pView = mmap(nullptr, (size_t) m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+		m_pData = (pView == MAP_FAILED) ? nullptr : (const u8*) pView;
+#endif
+		if (m_pData == nullptr)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_pData != nullptr)
+			UnmapViewOfFile(m_pData);
+		if (m_mapping != nullptr)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_pData != nullptr)
+			munmap((void*) m_pData, (size_t) m_size);
+		if (m_file >= 0)
+			close(m_file);
+		m_file = -1;
+#endif
+		m_pData = nullptr;
+		m_size = 0;
+	}
+
+	bool IsOpen() const { return m_pData != nullptr; }
+	const u8* Data() const { return m_pData; }
+	u64 Size() const { return m_size; }
+
+private:
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+	const u8* m_pData = nullptr;
+	u64 m_size = 0;
+};
+
+}
+
+#endif //!MAPPED_FILE_H
@@ -40,7 +40,7 @@ struct Material
 
 	std::string Name;
 
-	// Index into constant buffer corresponding to this material.
+	// Index into the material buffer corresponding to this material.
 	int MatCBIndex = -1;
 	
 	// Different Possible Textures
@@ -57,11 +57,10 @@ struct Material
 	Texture* pEmissive = nullptr;
 	Texture* pOpacity = nullptr;
 
-	// Dirty flag indicating the material has changed and we need to update the constant buffer.
-	// Because we have a material constant buffer for each FrameResource, we have to apply the
-	// update to each FrameResource.  Thus, when we modify a material we should set 
-	// NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-	int NumFramesDirty = NUM_FRAME_RESOURCES;
+	// Last frame the material was marked dirty in, see DirtyRing. Because we have a material buffer for
+	// each FrameResource, a changed material has to be uploaded to each of them: mark it through
+	// FrameRenderer::MarkDirty after modifying Properties.
+	u64 DirtyFrame = 0;
 
 	// Material properties
 	//uint PropertiesActive;
@@ -293,6 +293,10 @@ namespace Vector
 	{
 		return XMVectorZero();
 	}
+	inline vect Replicate(float value)
+	{
+		return XMVectorReplicate(value);
+	}
 
 	inline float GetX(vect V)
 	{
@@ -371,6 +375,11 @@ namespace Vector
 	{
 		return XMVectorSin(V);
 	}
+	// Sine and cosine of four angles at once
+	inline void SinCos(vect* pSin, vect* pCos, vect V)
+	{
+		XMVectorSinCos(pSin, pCos, V);
+	}
 
 	inline vect SphericalToCartesian(float radius, float theta, float phi)
 	{
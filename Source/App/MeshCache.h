@@ -0,0 +1,312 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+#include "Core.h"
+#include "MappedFile.h"
+#include "ObjLoader.h"
+
+namespace Loxodonta
+{
+
+// Binary container for imported meshes, written next to the source .obj on first import.
+//
+// Layout (all sections 16-byte aligned):
+//   Header
+//   vertex blob     VertexCount * VertexByteStride
+//   index blob      IndexCount * sizeof(IndexFormat)
+//   submesh table   SubmeshCount * SubmeshEntry
+//   LOD table       LodCount * LodRange, each submesh owns a run of it
+//   material table  MaterialCount * MaterialEntry
+//   string table    names referenced by offset/length from the tables
+namespace MeshCache
+{
+	const u32 MAGIC = 0x434D584C; // "LXMC"
+	// Bump whenever the layout or the importer output changes
+	const u32 VERSION = 4;
+
+	struct Header
+	{
+		u32 Magic;
+		u32 Version;
+
+		// Source .obj the cache was built from
+		u64 SourceLastWriteTime;
+		u64 SourceSize;
+		u64 SourceHash;
+
+		u32 VertexByteStride;
+		u32 VertexCount;
+		u32 IndexFormat; // DXGI_FORMAT
+		u32 IndexCount;
+		u32 SubmeshCount;
+		u32 MaterialCount;
+		u32 LodCount;
+		u32 LodPad;
+
+		u64 VertexOffset;
+		u64 IndexOffset;
+		u64 SubmeshOffset;
+		u64 LodOffset;
+		u64 MaterialOffset;
+		u64 StringOffset;
+		u64 StringSize;
+	};
+
+	struct StringRef
+	{
+		u32 Offset;
+		u32 Length;
+	};
+
+	struct SubmeshEntry
+	{
+		StringRef Name;
+		i32 MaterialIndex;
+		u32 IndexCount;
+		u32 StartIndexLocation;
+		i32 BaseVertexLocation;
+		u32 FirstLod;
+		u32 LodCount;
+	};
+
+	struct MaterialEntry
+	{
+		StringRef Name;
+		StringRef DiffuseTexname;
+		MaterialProperties Properties;
+	};
+
+	// 64-bit FNV-1a
+	inline u64 Hash(const u8* pData, u64 size)
+	{
+		u64 hash = 0xcbf29ce484222325ull;
+		for (u64 i = 0; i < size; i++)
+		{
+			hash ^= pData[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	inline bool HashFile(const std::string& filepath, u64& hash)
+	{
+		MappedFile source;
+		if (!source.Open(filepath))
+			return false;
+		hash = Hash(source.Data(), source.Size());
+		return true;
+	}
+
+	// "Assets/model.obj" -> "Assets/model.lxmesh"
+	inline std::string CachePath(const std::string& sourcePath)
+	{
+		return sourcePath.substr(0, sourcePath.find_last_of(".")) + ".lxmesh";
+	}
+
+	inline u64 AlignUp(u64 offset)
+	{
+		return (offset + 15) & ~15ull;
+	}
+
+	// Read-only view of a validated cache file
+	class View
+	{
+	public:
+		const Header& GetHeader() const { return *m_pHeader; }
+
+		const void* Vertices() const { return m_file.Data() + m_pHeader->VertexOffset; }
+		const void* Indices() const { return m_file.Data() + m_pHeader->IndexOffset; }
+
+		// Fills an ObjModelView pointing straight into the mapped file
+		void GetModelView(ObjModelView& view) const
+		{
+			view.pVertices = Vertices();
+			view.VertexCount = m_pHeader->VertexCount;
+			view.VertexByteStride = m_pHeader->VertexByteStride;
+			view.pIndices = Indices();
+			view.IndexCount = m_pHeader->IndexCount;
+			view.IndexFormat = (DXGI_FORMAT) m_pHeader->IndexFormat;
+
+			const SubmeshEntry* pSubmeshes = (const SubmeshEntry*) (m_file.Data() + m_pHeader->SubmeshOffset);
+			const MeshSimplifier::LodRange* pLods = (const MeshSimplifier::LodRange*) (m_file.Data() + m_pHeader->LodOffset);
+			view.Submeshes.resize(m_pHeader->SubmeshCount);
+			for (u32 i = 0; i < m_pHeader->SubmeshCount; i++)
+			{
+				view.Submeshes[i].Name = GetString(pSubmeshes[i].Name);
+				view.Submeshes[i].MaterialIndex = pSubmeshes[i].MaterialIndex;
+				view.Submeshes[i].IndexCount = pSubmeshes[i].IndexCount;
+				view.Submeshes[i].StartIndexLocation = pSubmeshes[i].StartIndexLocation;
+				view.Submeshes[i].BaseVertexLocation = pSubmeshes[i].BaseVertexLocation;
+				if (pSubmeshes[i].FirstLod + (u64) pSubmeshes[i].LodCount <= m_pHeader->LodCount)
+					view.Submeshes[i].Lods.assign(pLods + pSubmeshes[i].FirstLod, pLods + pSubmeshes[i].FirstLod + pSubmeshes[i].LodCount);
+			}
+
+			const MaterialEntry* pMaterials = (const MaterialEntry*) (m_file.Data() + m_pHeader->MaterialOffset);
+			view.Materials.resize(m_pHeader->MaterialCount);
+			for (u32 i = 0; i < m_pHeader->MaterialCount; i++)
+			{
+				view.Materials[i].Name = GetString(pMaterials[i].Name);
+				view.Materials[i].DiffuseTexname = GetString(pMaterials[i].DiffuseTexname);
+				view.Materials[i].Properties = pMaterials[i].Properties;
+			}
+		}
+
+		// Maps the cache and checks it is complete, current and built from sourcePath
+		bool Open(const std::string& cachePath, const std::string& sourcePath)
+		{
+			m_pHeader = nullptr;
+			if (!m_file.Open(cachePath) || m_file.Size() < sizeof(Header))
+				return false;
+
+			const Header* pHeader = (const Header*) m_file.Data();
+			if (pHeader->Magic != MAGIC || pHeader->Version != VERSION || pHeader->VertexByteStride != sizeof(Vertex))
+				return Reject();
+
+			u64 indexSize = pHeader->IndexFormat == DXGI_FORMAT_R16_UINT ? sizeof(u16) : sizeof(u32);
+			if (pHeader->VertexOffset + (u64) pHeader->VertexCount * pHeader->VertexByteStride > m_file.Size() ||
+				pHeader->IndexOffset + (u64) pHeader->IndexCount * indexSize > m_file.Size() ||
+				pHeader->SubmeshOffset + (u64) pHeader->SubmeshCount * sizeof(SubmeshEntry) > m_file.Size() ||
+				pHeader->LodOffset + (u64) pHeader->LodCount * sizeof(MeshSimplifier::LodRange) > m_file.Size() ||
+				pHeader->MaterialOffset + (u64) pHeader->MaterialCount * sizeof(MaterialEntry) > m_file.Size() ||
+				pHeader->StringOffset + pHeader->StringSize > m_file.Size())
+				return Reject();
+
+			// The timestamp is the cheap check, the content hash decides when it has moved
+			FileStamp stamp;
+			if (!GetFileStamp(sourcePath, stamp))
+				return Reject();
+			if (stamp.LastWriteTime != pHeader->SourceLastWriteTime || stamp.Size != pHeader->SourceSize)
+			{
+				u64 hash = 0;
+				if (stamp.Size != pHeader->SourceSize || !HashFile(sourcePath, hash) || hash != pHeader->SourceHash)
+					return Reject();
+			}
+
+			m_pHeader = pHeader;
+			return true;
+		}
+
+	private:
+		MappedFile m_file;
+		const Header* m_pHeader = nullptr;
+
+		bool Reject()
+		{
+			m_file.Close();
+			return false;
+		}
+
+		std::string GetString(const StringRef& ref) const
+		{
+			if (ref.Offset + (u64) ref.Length > m_pHeader->StringSize)
+				return std::string();
+			const char* pStrings = (const char*) (m_file.Data() + m_pHeader->StringOffset);
+			return std::string(pStrings + ref.Offset, ref.Length);
+		}
+	};
+
+	// Serializes an imported model. Returns false if the file could not be written.
+	inline bool Write(const std::string& cachePath, const std::string& sourcePath, const ObjModel& model)
+	{
+		Header header = {};
+		header.Magic = MAGIC;
+		header.Version = VERSION;
+
+		FileStamp stamp;
+		if (!GetFileStamp(sourcePath, stamp) || !HashFile(sourcePath, header.SourceHash))
+			return false;
+		header.SourceLastWriteTime = stamp.LastWriteTime;
+		header.SourceSize = stamp.Size;
+
+		// Indices are stored in the format they are uploaded in
+		std::vector<u16> indices16;
+		DXGI_FORMAT indexFormat = PackIndices(model.Indices, model.MaxIndex, indices16);
+		const void* pIndices = indexFormat == DXGI_FORMAT_R16_UINT ? (const void*) indices16.data() : (const void*) model.Indices.data();
+		u64 indexBytes = model.Indices.size() * (indexFormat == DXGI_FORMAT_R16_UINT ? sizeof(u16) : sizeof(u32));
+
+		std::string strings;
+		auto addString = [&strings](const std::string& str)
+		{
+			StringRef ref = { (u32) strings.size(), (u32) str.size() };
+			strings += str;
+			return ref;
+		};
+
+		std::vector<SubmeshEntry> submeshes(model.Submeshes.size());
+		std::vector<MeshSimplifier::LodRange> lods;
+		for (size_t i = 0; i < model.Submeshes.size(); i++)
+		{
+			submeshes[i].FirstLod = (u32) lods.size();
+			submeshes[i].LodCount = (u32) model.Submeshes[i].Lods.size();
+			lods.insert(lods.end(), model.Submeshes[i].Lods.begin(), model.Submeshes[i].Lods.end());
+			submeshes[i].Name = addString(model.Submeshes[i].Name);
+			submeshes[i].MaterialIndex = model.Submeshes[i].MaterialIndex;
+			submeshes[i].IndexCount = model.Submeshes[i].IndexCount;
+			submeshes[i].StartIndexLocation = model.Submeshes[i].StartIndexLocation;
+			submeshes[i].BaseVertexLocation = model.Submeshes[i].BaseVertexLocation;
+		}
+
+		std::vector<MaterialEntry> materials(model.Materials.size());
+		for (size_t i = 0; i < model.Materials.size(); i++)
+		{
+			materials[i].Name = addString(model.Materials[i].Name);
+			materials[i].DiffuseTexname = addString(model.Materials[i].DiffuseTexname);
+			materials[i].Properties = model.Materials[i].Properties;
+		}
+
+		header.VertexByteStride = sizeof(Vertex);
+		header.VertexCount = (u32) model.Vertices.size();
+		header.IndexFormat = (u32) indexFormat;
+		header.IndexCount = (u32) model.Indices.size();
+		header.SubmeshCount = (u32) submeshes.size();
+		header.MaterialCount = (u32) materials.size();
+		header.LodCount = (u32) lods.size();
+
+		header.VertexOffset = AlignUp(sizeof(Header));
+		header.IndexOffset = AlignUp(header.VertexOffset + (u64) header.VertexCount * sizeof(Vertex));
+		header.SubmeshOffset = AlignUp(header.IndexOffset + indexBytes);
+		header.LodOffset = AlignUp(header.SubmeshOffset + submeshes.size() * sizeof(SubmeshEntry));
+		header.MaterialOffset = AlignUp(header.LodOffset + lods.size() * sizeof(MeshSimplifier::LodRange));
+		header.StringOffset = AlignUp(header.MaterialOffset + materials.size() * sizeof(MaterialEntry));
+		header.StringSize = strings.size();
+
+		// Write to a temporary file first so a partial write never looks like a valid cache
+		std::string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file)
+				return false;
+
+			auto writeAt = [&file](u64 offset, const void* pData, u64 size)
+			{
+				static const char zeros[16] = {};
+				u64 position = (u64) file.tellp();
+				if (offset > position)
+					file.write(zeros, offset - position);
+				if (size > 0)
+					file.write((const char*) pData, size);
+			};
+			writeAt(0, &header, sizeof(Header));
+			writeAt(header.VertexOffset, model.Vertices.data(), (u64) header.VertexCount * sizeof(Vertex));
+			writeAt(header.IndexOffset, pIndices, indexBytes);
+			writeAt(header.SubmeshOffset, submeshes.data(), submeshes.size() * sizeof(SubmeshEntry));
+			writeAt(header.LodOffset, lods.data(), lods.size() * sizeof(MeshSimplifier::LodRange));
+			writeAt(header.MaterialOffset, materials.data(), materials.size() * sizeof(MaterialEntry));
+			writeAt(header.StringOffset, strings.data(), strings.size());
+			if (!file)
+				return false;
+		}
+
+		std::remove(cachePath.c_str());
+		return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+	}
+}
+
+}
+
+#endif //!MESH_CACHE_H
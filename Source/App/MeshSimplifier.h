@@ -0,0 +1,620 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "Parallel.h"
+#include "MeshOptimizer.h"
+
+namespace Loxodonta
+{
+
+// Level of detail generation by edge collapse (Garland and Heckbert 1997, quadric error metrics).
+// Vertices never move: an edge collapses onto one of its endpoints, so every level indexes the
+// vertex buffer of the full mesh and only adds indices.
+// Vertices split for UV or normal seams and vertices on open borders only slide along their
+// seam or border, a seam pair always collapses together so no cracks open between the two sides.
+namespace MeshSimplifier
+{
+	// One level of detail of an index range, the first entry of a chain is the range itself
+	struct LodRange
+	{
+		u32 StartIndex = 0;
+		u32 IndexCount = 0;
+		f32 Error = 0.0f; // estimated distance from the original surface, in mesh units
+	};
+
+	// Triangle fractions of the levels built at import, each one about half the previous
+	const f32 DEFAULT_LOD_RATIOS[] = { 0.5f, 0.25f, 0.125f, 0.0625f };
+	const u32 DEFAULT_LOD_COUNT = sizeof(DEFAULT_LOD_RATIOS) / sizeof(DEFAULT_LOD_RATIOS[0]);
+
+	// A level that keeps more than this fraction of the previous one ends the chain
+	const f32 MIN_LOD_REDUCTION = 0.85f;
+
+	// Marks a missing vertex in the adjacency tables
+	const u32 NO_VERTEX = ~0u;
+
+	// Borders and seams weigh this much more than faces so their outline is kept longest
+	const f32 BORDER_WEIGHT = 10.0f;
+
+	enum class VertexKind : u8
+	{
+		Manifold, // interior vertex, collapses onto any neighbour
+		Border,   // on one open edge loop, collapses along it
+		Seam,     // one of two copies at the same position, collapses along the seam with its twin
+		Locked,   // corners, seam ends and anything more tangled, never moves
+	};
+
+	// Weighted mean squared distance of a point p to a set of planes: (p'Ap + 2b'p + c) / W
+	struct Quadric
+	{
+		f32 A00 = 0, A11 = 0, A22 = 0, A01 = 0, A02 = 0, A12 = 0;
+		f32 B0 = 0, B1 = 0, B2 = 0;
+		f32 C = 0;
+		f32 W = 0;
+
+		void AddPlane(const f32* n, f32 d, f32 weight)
+		{
+			A00 += weight * n[0] * n[0]; A11 += weight * n[1] * n[1]; A22 += weight * n[2] * n[2];
+			A01 += weight * n[0] * n[1]; A02 += weight * n[0] * n[2]; A12 += weight * n[1] * n[2];
+			B0 += weight * n[0] * d; B1 += weight * n[1] * d; B2 += weight * n[2] * d;
+			C += weight * d * d;
+			W += weight;
+		}
+
+		void Add(const Quadric& q)
+		{
+			A00 += q.A00; A11 += q.A11; A22 += q.A22; A01 += q.A01; A02 += q.A02; A12 += q.A12;
+			B0 += q.B0; B1 += q.B1; B2 += q.B2;
+			C += q.C;
+			W += q.W;
+		}
+
+		f32 Evaluate(const f32* p) const
+		{
+			f32 error = A00 * p[0] * p[0] + A11 * p[1] * p[1] + A22 * p[2] * p[2] +
+				2.0f * (A01 * p[0] * p[1] + A02 * p[0] * p[2] + A12 * p[1] * p[2]) +
+				2.0f * (B0 * p[0] + B1 * p[1] + B2 * p[2]) + C;
+			return (W > 0.0f) ? Math::Max(error, 0.0f) / W : 0.0f;
+		}
+	};
+
+	inline void Cross(const f32* a, const f32* b, f32* out)
+	{
+		out[0] = a[1] * b[2] - a[2] * b[1];
+		out[1] = a[2] * b[0] - a[0] * b[2];
+		out[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	inline f32 Dot(const f32* a, const f32* b)
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	// Working state of one simplification, positions rescaled to the unit cube so the quadrics stay in range
+	class Simplifier
+	{
+	public:
+		Simplifier(const u8* pVertices, u32 vertexStride, u32 vertexCount, const u32* pIndices, size_t indexCount)
+			: m_VertexCount(vertexCount), m_Indices(pIndices, pIndices + (indexCount - indexCount % 3))
+		{
+			LoadPositions(pVertices, vertexStride);
+			BuildWedges();
+			BuildAdjacency();
+			ClassifyVertices();
+			BuildQuadrics();
+		}
+
+		// Collapses edges until at most targetIndexCount indices are left or nothing can go.
+		// Returns the largest error of a collapse in mesh units.
+		f32 Run(size_t targetIndexCount)
+		{
+			f32 maxError = 0.0f;
+			while (m_Indices.size() > targetIndexCount)
+			{
+				u32 collapsed = CollapsePass((u32) ((m_Indices.size() - targetIndexCount) / 3), maxError);
+				ApplyRemap();
+				if (collapsed == 0)
+					break;
+			}
+			return std::sqrt(maxError) * m_Scale;
+		}
+
+		const std::vector<u32>& Indices() const { return m_Indices; }
+
+	private:
+		struct Collapse
+		{
+			u32 From;
+			u32 To;
+			f32 Error;
+		};
+
+		u32 m_VertexCount;
+		std::vector<u32> m_Indices;
+		std::vector<f32> m_Positions; // xyz per vertex, in the unit cube
+		f32 m_Scale = 1.0f;
+
+		std::vector<u32> m_Wedge; // next vertex at the same position, a cycle through all copies
+		std::vector<VertexKind> m_Kind;
+		std::vector<Quadric> m_Quadrics;
+		std::unordered_set<u64> m_BorderEdges; // open edges of the input, a << 32 | b
+
+		// Rebuilt every pass
+		std::vector<u32> m_OpenNext;     // b of the one open edge a -> b leaving each vertex
+		std::vector<u32> m_OpenPrevious; // a of the one open edge a -> b entering each vertex
+		std::vector<u32> m_TriangleOffsets;
+		std::vector<u32> m_VertexTriangles;
+		std::vector<u32> m_Remap;
+
+		const f32* Position(u32 v) const { return &m_Positions[(size_t) v * 3]; }
+
+		void LoadPositions(const u8* pVertices, u32 vertexStride)
+		{
+			m_Positions.resize((size_t) m_VertexCount * 3);
+			f32 minPos[3] = {0.0f, 0.0f, 0.0f};
+			f32 maxPos[3] = {0.0f, 0.0f, 0.0f};
+			for (u32 v = 0; v < m_VertexCount; v++)
+			{
+				const f32* p = reinterpret_cast<const f32*>(pVertices + (size_t) v * vertexStride);
+				for (int k = 0; k < 3; k++)
+				{
+					m_Positions[(size_t) v * 3 + k] = p[k];
+					minPos[k] = (v == 0) ? p[k] : Math::Min(minPos[k], p[k]);
+					maxPos[k] = (v == 0) ? p[k] : Math::Max(maxPos[k], p[k]);
+				}
+			}
+			m_Scale = Math::Max(Math::Max(maxPos[0] - minPos[0], maxPos[1] - minPos[1]), maxPos[2] - minPos[2]);
+			if (!(m_Scale > 0.0f))
+				m_Scale = 1.0f;
+			for (u32 v = 0; v < m_VertexCount; v++)
+				for (int k = 0; k < 3; k++)
+					m_Positions[(size_t) v * 3 + k] = (m_Positions[(size_t) v * 3 + k] - minPos[k]) / m_Scale;
+		}
+
+		// Links the copies of each position into a cycle, by exact bit pattern
+		void BuildWedges()
+		{
+			struct PositionHash
+			{
+				size_t operator()(const std::array<u32, 3>& key) const
+				{
+					return (size_t) (key[0] * 73856093u ^ key[1] * 19349663u ^ key[2] * 83492791u);
+				}
+			};
+			std::unordered_map<std::array<u32, 3>, u32, PositionHash> first;
+			first.reserve(m_VertexCount);
+			m_Wedge.resize(m_VertexCount);
+			for (u32 v = 0; v < m_VertexCount; v++)
+			{
+				std::array<u32, 3> key;
+				std::memcpy(key.data(), Position(v), sizeof(u32) * 3);
+				auto inserted = first.emplace(key, v);
+				if (inserted.second)
+				{
+					m_Wedge[v] = v;
+				}
+				else
+				{
+					u32 head = inserted.first->second;
+					m_Wedge[v] = m_Wedge[head];
+					m_Wedge[head] = v;
+				}
+			}
+		}
+
+		// An edge a -> b is open when no triangle around b uses b -> a. Needs the adjacency.
+		void FindOpenEdges(std::unordered_set<u64>* pOpenEdges = nullptr)
+		{
+			// NO_VERTEX when there is no open edge, v itself when there are several
+			m_OpenNext.assign(m_VertexCount, NO_VERTEX);
+			m_OpenPrevious.assign(m_VertexCount, NO_VERTEX);
+			for (size_t i = 0; i < m_Indices.size(); i++)
+			{
+				u32 a = m_Indices[i];
+				u32 b = m_Indices[i - i % 3 + (i + 1) % 3];
+				if (m_OpenNext[a] == b || HasEdge(b, a))
+					continue;
+				if (pOpenEdges != nullptr)
+					pOpenEdges->insert(((u64) a << 32) | b);
+				m_OpenNext[a] = (m_OpenNext[a] == NO_VERTEX) ? b : a;
+				m_OpenPrevious[b] = (m_OpenPrevious[b] == NO_VERTEX) ? a : b;
+			}
+		}
+
+		bool HasEdge(u32 a, u32 b) const
+		{
+			for (u32 t = m_TriangleOffsets[a]; t < m_TriangleOffsets[a + 1]; t++)
+			{
+				const u32* tri = &m_Indices[(size_t) m_VertexTriangles[t] * 3];
+				int k = (tri[0] == a) ? 0 : (tri[1] == a) ? 1 : 2;
+				if (tri[(k + 1) % 3] == b)
+					return true;
+			}
+			return false;
+		}
+
+		bool SamePosition(u32 a, u32 b) const
+		{
+			if (a == NO_VERTEX || b == NO_VERTEX)
+				return false;
+			for (u32 w = a; ; )
+			{
+				if (w == b)
+					return true;
+				w = m_Wedge[w];
+				if (w == a)
+					return false;
+			}
+		}
+
+		bool HasSingleLoop(u32 v) const
+		{
+			return m_OpenNext[v] != NO_VERTEX && m_OpenNext[v] != v && m_OpenPrevious[v] != NO_VERTEX && m_OpenPrevious[v] != v;
+		}
+
+		void ClassifyVertices()
+		{
+			FindOpenEdges(&m_BorderEdges);
+			m_Kind.assign(m_VertexCount, VertexKind::Manifold);
+			for (u32 v = 0; v < m_VertexCount; v++)
+			{
+				u32 twin = m_Wedge[v];
+				bool open = m_OpenNext[v] != NO_VERTEX || m_OpenPrevious[v] != NO_VERTEX;
+				if (twin == v)
+				{
+					if (open)
+						m_Kind[v] = HasSingleLoop(v) ? VertexKind::Border : VertexKind::Locked;
+				}
+				else if (m_Wedge[twin] == v && HasSingleLoop(v) && HasSingleLoop(twin) &&
+					SamePosition(m_OpenNext[v], m_OpenPrevious[twin]) && SamePosition(m_OpenPrevious[v], m_OpenNext[twin]))
+				{
+					// Two copies whose open edges run along each other in opposite directions
+					m_Kind[v] = VertexKind::Seam;
+				}
+				else
+				{
+					m_Kind[v] = VertexKind::Locked;
+				}
+			}
+		}
+
+		// Area weighted face planes, plus planes through open edges perpendicular to their face
+		void BuildQuadrics()
+		{
+			std::vector<Quadric> quadrics(m_VertexCount);
+			for (size_t i = 0; i < m_Indices.size(); i += 3)
+			{
+				const f32* p[3] = {Position(m_Indices[i]), Position(m_Indices[i + 1]), Position(m_Indices[i + 2])};
+				f32 e0[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+				f32 e1[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+				f32 n[3];
+				Cross(e0, e1, n);
+				f32 length = std::sqrt(Dot(n, n));
+				if (length <= 0.0f)
+					continue;
+				for (int k = 0; k < 3; k++)
+					n[k] /= length;
+				Quadric face;
+				face.AddPlane(n, -Dot(n, p[0]), length * 0.5f);
+				for (int k = 0; k < 3; k++)
+					quadrics[m_Indices[i + k]].Add(face);
+
+				for (int k = 0; k < 3; k++)
+				{
+					u32 a = m_Indices[i + k];
+					u32 b = m_Indices[i + (k + 1) % 3];
+					if (m_BorderEdges.count(((u64) a << 32) | b) == 0)
+						continue;
+					const f32* pa = Position(a);
+					const f32* pb = Position(b);
+					f32 edge[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+					f32 edgeLength = std::sqrt(Dot(edge, edge));
+					if (edgeLength <= 0.0f)
+						continue;
+					f32 side[3];
+					Cross(edge, n, side);
+					f32 sideLength = std::sqrt(Dot(side, side));
+					if (sideLength <= 0.0f)
+						continue;
+					for (int c = 0; c < 3; c++)
+						side[c] /= sideLength;
+					Quadric border;
+					border.AddPlane(side, -Dot(side, pa), edgeLength * edgeLength * BORDER_WEIGHT);
+					quadrics[a].Add(border);
+					quadrics[b].Add(border);
+				}
+			}
+
+			m_BorderEdges.clear();
+
+			// Copies of a position share one quadric
+			m_Quadrics.resize(m_VertexCount);
+			for (u32 v = 0; v < m_VertexCount; v++)
+			{
+				if (m_Wedge[v] != v && v > m_Wedge[v])
+					continue;
+				Quadric sum;
+				u32 w = v;
+				do { sum.Add(quadrics[w]); w = m_Wedge[w]; } while (w != v);
+				do { m_Quadrics[w] = sum; w = m_Wedge[w]; } while (w != v);
+			}
+		}
+
+		void BuildAdjacency()
+		{
+			m_TriangleOffsets.assign(m_VertexCount + 1, 0);
+			for (u32 v : m_Indices)
+				m_TriangleOffsets[v + 1]++;
+			for (u32 v = 0; v < m_VertexCount; v++)
+				m_TriangleOffsets[v + 1] += m_TriangleOffsets[v];
+			m_VertexTriangles.resize(m_Indices.size());
+			std::vector<u32> fill(m_TriangleOffsets.begin(), m_TriangleOffsets.end() - 1);
+			for (size_t i = 0; i < m_Indices.size(); i++)
+				m_VertexTriangles[fill[m_Indices[i]]++] = (u32) (i / 3);
+		}
+
+		// The copy of 'to' at the other end of twin's seam edge, NO_VERTEX if the seam does not continue there
+		u32 TwinTarget(u32 twin, u32 to) const
+		{
+			if (m_OpenNext[twin] != twin && SamePosition(to, m_OpenNext[twin]))
+				return m_OpenNext[twin];
+			if (m_OpenPrevious[twin] != twin && SamePosition(to, m_OpenPrevious[twin]))
+				return m_OpenPrevious[twin];
+			return NO_VERTEX;
+		}
+
+		bool CanCollapse(u32 from, u32 to) const
+		{
+			switch (m_Kind[from])
+			{
+			case VertexKind::Manifold:
+				return true;
+			case VertexKind::Border:
+				return to == m_OpenNext[from] || to == m_OpenPrevious[from];
+			case VertexKind::Seam:
+				return (to == m_OpenNext[from] || to == m_OpenPrevious[from]) && TwinTarget(m_Wedge[from], to) != NO_VERTEX;
+			default:
+				return false;
+			}
+		}
+
+		// Rejects collapses that turn a surrounding triangle over or make it degenerate
+		bool FlipsTriangle(u32 from, u32 to) const
+		{
+			const f32* target = Position(to);
+			for (u32 t = m_TriangleOffsets[from]; t < m_TriangleOffsets[from + 1]; t++)
+			{
+				const u32* tri = &m_Indices[(size_t) m_VertexTriangles[t] * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+					continue; // removed by the collapse
+				int k = (tri[0] == from) ? 0 : (tri[1] == from) ? 1 : 2;
+				const f32* p1 = Position(tri[(k + 1) % 3]);
+				const f32* p2 = Position(tri[(k + 2) % 3]);
+				const f32* p0 = Position(from);
+				f32 e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+				f32 e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+				f32 f1[3] = {p1[0] - target[0], p1[1] - target[1], p1[2] - target[2]};
+				f32 f2[3] = {p2[0] - target[0], p2[1] - target[1], p2[2] - target[2]};
+				f32 before[3], after[3];
+				Cross(e1, e2, before);
+				Cross(f1, f2, after);
+				if (Dot(before, after) <= 0.0f)
+					return true;
+			}
+			return false;
+		}
+
+		u32 SharedTriangles(u32 a, u32 b) const
+		{
+			u32 count = 0;
+			for (u32 t = m_TriangleOffsets[a]; t < m_TriangleOffsets[a + 1]; t++)
+			{
+				const u32* tri = &m_Indices[(size_t) m_VertexTriangles[t] * 3];
+				count += (tri[0] == b || tri[1] == b || tri[2] == b) ? 1 : 0;
+			}
+			return count;
+		}
+
+		void LockNeighbourhood(u32 v, std::vector<u8>& locked) const
+		{
+			for (u32 t = m_TriangleOffsets[v]; t < m_TriangleOffsets[v + 1]; t++)
+			{
+				const u32* tri = &m_Indices[(size_t) m_VertexTriangles[t] * 3];
+				locked[tri[0]] = locked[tri[1]] = locked[tri[2]] = 1;
+			}
+		}
+
+		// Cheapest collapses first, each one locks the triangles around it for the rest of the pass
+		u32 CollapsePass(u32 trianglesToRemove, f32& maxError)
+		{
+			BuildAdjacency();
+			FindOpenEdges();
+			m_Remap.resize(m_VertexCount);
+			for (u32 v = 0; v < m_VertexCount; v++)
+				m_Remap[v] = v;
+
+			std::vector<Collapse> candidates;
+			candidates.reserve(m_Indices.size());
+			for (size_t i = 0; i < m_Indices.size(); i++)
+			{
+				u32 a = m_Indices[i];
+				u32 b = m_Indices[i - i % 3 + (i + 1) % 3];
+				if (a > b && m_OpenNext[a] != b)
+					continue; // interior edges are seen from both triangles
+				Collapse best = { NO_VERTEX, NO_VERTEX, 0.0f };
+				if (CanCollapse(a, b))
+					best = { a, b, m_Quadrics[a].Evaluate(Position(b)) };
+				if (CanCollapse(b, a))
+				{
+					f32 error = m_Quadrics[b].Evaluate(Position(a));
+					if (best.From == NO_VERTEX || error < best.Error)
+						best = { b, a, error };
+				}
+				if (best.From != NO_VERTEX)
+					candidates.push_back(best);
+			}
+			std::sort(candidates.begin(), candidates.end(),
+				[](const Collapse& x, const Collapse& y) { return x.Error < y.Error; });
+
+			std::vector<u8> locked(m_VertexCount, 0);
+			u32 collapsed = 0;
+			u32 removed = 0;
+			for (const Collapse& collapse : candidates)
+			{
+				if (removed >= trianglesToRemove)
+					break;
+				u32 from = collapse.From;
+				u32 to = collapse.To;
+				u32 twin = NO_VERTEX, twinTo = NO_VERTEX;
+				if (m_Kind[from] == VertexKind::Seam)
+				{
+					twin = m_Wedge[from];
+					twinTo = TwinTarget(twin, to);
+				}
+				if (locked[from] || locked[to] || (twin != NO_VERTEX && (locked[twin] || locked[twinTo])))
+					continue;
+				if (FlipsTriangle(from, to) || (twin != NO_VERTEX && FlipsTriangle(twin, twinTo)))
+					continue;
+
+				m_Remap[from] = to;
+				removed += SharedTriangles(from, to);
+				LockNeighbourhood(from, locked);
+				LockNeighbourhood(to, locked);
+				if (twin != NO_VERTEX)
+				{
+					m_Remap[twin] = twinTo;
+					removed += SharedTriangles(twin, twinTo);
+					LockNeighbourhood(twin, locked);
+					LockNeighbourhood(twinTo, locked);
+				}
+
+				// Every copy of the target takes on the planes of the collapsed vertex
+				Quadric merged = m_Quadrics[to];
+				merged.Add(m_Quadrics[from]);
+				u32 w = to;
+				do { m_Quadrics[w] = merged; w = m_Wedge[w]; } while (w != to);
+
+				maxError = Math::Max(maxError, collapse.Error);
+				collapsed++;
+			}
+			return collapsed;
+		}
+
+		// Moves collapsed vertices out of the position cycles and drops the triangles that became degenerate
+		void ApplyRemap()
+		{
+			for (u32 v = 0; v < m_VertexCount; v++)
+			{
+				if (m_Remap[v] == v || m_Wedge[v] == v)
+					continue;
+				u32 previous = v;
+				while (m_Wedge[previous] != v)
+					previous = m_Wedge[previous];
+				m_Wedge[previous] = m_Wedge[v];
+				m_Wedge[v] = v;
+			}
+
+			size_t write = 0;
+			for (size_t i = 0; i < m_Indices.size(); i += 3)
+			{
+				u32 a = m_Remap[m_Indices[i]];
+				u32 b = m_Remap[m_Indices[i + 1]];
+				u32 c = m_Remap[m_Indices[i + 2]];
+				if (a == b || b == c || c == a)
+					continue;
+				m_Indices[write++] = a;
+				m_Indices[write++] = b;
+				m_Indices[write++] = c;
+			}
+			m_Indices.resize(write);
+		}
+	};
+
+	// Simplifies one index range towards targetIndexCount indices, writing the result to output.
+	// Indices address pVertices directly, positions are the first three floats of every vertex.
+	// Returns the geometric error of the result in mesh units.
+	template <typename Index>
+	f32 Simplify(const u8* pVertices, u32 vertexStride, u32 vertexCount, const Index* pIndices, size_t indexCount,
+		size_t targetIndexCount, std::vector<Index>& output)
+	{
+		std::vector<u32> indices(pIndices, pIndices + indexCount);
+		Simplifier simplifier(pVertices, vertexStride, vertexCount, indices.data(), indices.size());
+		f32 error = simplifier.Run(targetIndexCount);
+		output.assign(simplifier.Indices().begin(), simplifier.Indices().end());
+		return error;
+	}
+
+	// Builds a LOD chain for every range on all cores and appends the new levels to indices.
+	// Each level is simplified from the full range and reordered for the post-transform cache.
+	// Returns one chain per range, starting with the range itself.
+	template <typename Index>
+	std::vector<std::vector<LodRange>> BuildLods(const u8* pVertices, u32 vertexStride, u32 vertexCount,
+		std::vector<Index>& indices, const std::vector<MeshOptimizer::IndexRange>& ranges,
+		const f32* pRatios = DEFAULT_LOD_RATIOS, u32 ratioCount = DEFAULT_LOD_COUNT, u32 threadCount = 0)
+	{
+		struct Level
+		{
+			std::vector<Index> Indices;
+			f32 Error = 0.0f;
+		};
+		std::vector<Level> levels(ranges.size() * ratioCount);
+		ParallelFor(levels.size(), threadCount, [&](size_t task)
+		{
+			const MeshOptimizer::IndexRange& range = ranges[task / ratioCount];
+			const size_t target = (size_t) (range.IndexCount / 3 * pRatios[task % ratioCount]) * 3;
+			Level& level = levels[task];
+			level.Error = Simplify(pVertices, vertexStride, vertexCount, indices.data() + range.StartIndex, range.IndexCount,
+				target, level.Indices);
+			std::vector<u32> clusterStarts;
+			MeshOptimizer::OptimizeVertexCache(level.Indices.data(), level.Indices.size(), vertexCount,
+				MeshOptimizer::DEFAULT_CACHE_SIZE, clusterStarts);
+		});
+
+		std::vector<std::vector<LodRange>> chains(ranges.size());
+		for (size_t r = 0; r < ranges.size(); r++)
+		{
+			LodRange full;
+			full.StartIndex = ranges[r].StartIndex;
+			full.IndexCount = ranges[r].IndexCount;
+			chains[r].push_back(full);
+			for (u32 l = 0; l < ratioCount; l++)
+			{
+				const Level& level = levels[r * ratioCount + l];
+				const LodRange& previous = chains[r].back();
+				if (level.Indices.empty() || level.Indices.size() > previous.IndexCount * MIN_LOD_REDUCTION)
+					break;
+				LodRange lod;
+				lod.StartIndex = (u32) indices.size();
+				lod.IndexCount = (u32) level.Indices.size();
+				lod.Error = Math::Max(level.Error, previous.Error);
+				indices.insert(indices.end(), level.Indices.begin(), level.Indices.end());
+				chains[r].push_back(lod);
+			}
+		}
+		return chains;
+	}
+
+	// Coarsest level whose error covers at most maxPixelError pixels.
+	// pixelsPerUnit is the screen size of one mesh unit at the object's distance,
+	// scale * projection[1][1] * screenHeight / (2 * distance) for a perspective camera.
+	inline u32 SelectLod(const LodRange* pLods, u32 lodCount, f32 pixelsPerUnit, f32 maxPixelError = 1.0f)
+	{
+		u32 lod = 0;
+		while (lod + 1 < lodCount && pLods[lod + 1].Error * pixelsPerUnit <= maxPixelError)
+			lod++;
+		return lod;
+	}
+}
+
+}
+
+#endif //!MESH_SIMPLIFIER_H
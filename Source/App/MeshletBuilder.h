@@ -0,0 +1,301 @@
+#ifndef MESHLET_BUILDER_H
+#define MESHLET_BUILDER_H
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+
+namespace Loxodonta
+{
+
+// Splits index ranges into meshlets, small clusters of triangles that can be culled on their own.
+// Each meshlet references at most MAX_VERTICES vertices and MAX_TRIANGLES triangles through a
+// local vertex list and 8 bit local triangle indices, and carries:
+//   a bounding sphere, for frustum culling
+//   a normal cone, for rejecting clusters whose triangles all face away from the camera
+// Triangles are taken in index buffer order, so run MeshOptimizer first to get compact clusters.
+namespace MeshletBuilder
+{
+	// Sizes that suit both mesh shader groups and CPU culling granularity, vertices must stay below 255
+	const u32 MAX_VERTICES = 64;
+	const u32 MAX_TRIANGLES = 124;
+
+	struct Meshlet
+	{
+		u32 VertexOffset = 0;   // first entry in MeshletSet::VertexIndices
+		u32 TriangleOffset = 0; // first entry in MeshletSet::PrimitiveIndices, three per triangle
+		u32 VertexCount = 0;
+		u32 TriangleCount = 0;
+
+		f32 Center[3] = {0.0f, 0.0f, 0.0f};
+		f32 Radius = 0.0f;
+
+		// Every front face normal lies in the cone around ConeAxis.
+		// ConeCutoff is the sine of the cone half angle, 1 when the cone can never cull.
+		f32 ConeAxis[3] = {0.0f, 0.0f, 1.0f};
+		f32 ConeCutoff = 1.0f;
+	};
+
+	struct MeshletSet
+	{
+		std::vector<Meshlet> Meshlets;
+		std::vector<u32> VertexIndices;  // values as found in the index buffer, before BaseVertexLocation
+		std::vector<u8> PrimitiveIndices; // into the meshlet's slice of VertexIndices
+	};
+
+	inline const f32* Position(const u8* pVertices, u32 vertexStride, u32 v)
+	{
+		return reinterpret_cast<const f32*>(pVertices + (size_t) v * vertexStride);
+	}
+
+	inline f32 Distance(const f32* a, const f32* b)
+	{
+		f32 d[3] = {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+		return std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+
+	// Ritter's sphere: the two points far apart, then grown over the outliers
+	inline void ComputeBounds(Meshlet& meshlet, const u32* pVertexIndices, i32 baseVertex, const u8* pVertices, u32 vertexStride)
+	{
+		auto position = [&](u32 i) { return Position(pVertices, vertexStride, (u32) (pVertexIndices[i] + baseVertex)); };
+
+		const f32* a = position(0);
+		const f32* b = a;
+		for (u32 i = 1; i < meshlet.VertexCount; i++)
+			if (Distance(position(i), a) > Distance(b, a))
+				b = position(i);
+		const f32* c = b;
+		for (u32 i = 0; i < meshlet.VertexCount; i++)
+			if (Distance(position(i), b) > Distance(c, b))
+				c = position(i);
+
+		f32 center[3] = {(b[0] + c[0]) * 0.5f, (b[1] + c[1]) * 0.5f, (b[2] + c[2]) * 0.5f};
+		f32 radius = Distance(b, c) * 0.5f;
+		for (u32 i = 0; i < meshlet.VertexCount; i++)
+		{
+			const f32* p = position(i);
+			f32 d = Distance(p, center);
+			if (d > radius)
+			{
+				// Move the centre towards p so the new sphere just touches both p and the old far side
+				f32 newRadius = (radius + d) * 0.5f;
+				f32 t = (newRadius - radius) / d;
+				for (int k = 0; k < 3; k++)
+					center[k] += (p[k] - center[k]) * t;
+				radius = newRadius;
+			}
+		}
+		for (int k = 0; k < 3; k++)
+			meshlet.Center[k] = center[k];
+		meshlet.Radius = radius;
+	}
+
+	// Average of the unit face normals, widened to contain all of them.
+	// Face normals follow the winding the rasterizer treats as front facing.
+	inline void ComputeCone(Meshlet& meshlet, const MeshletSet& set, i32 baseVertex, const u8* pVertices, u32 vertexStride)
+	{
+		std::vector<f32> normals;
+		normals.reserve(meshlet.TriangleCount * 3);
+		f32 axis[3] = {0.0f, 0.0f, 0.0f};
+		for (u32 t = 0; t < meshlet.TriangleCount; t++)
+		{
+			const u8* pTriangle = &set.PrimitiveIndices[meshlet.TriangleOffset + t * 3];
+			const f32* p0 = Position(pVertices, vertexStride, (u32) (set.VertexIndices[meshlet.VertexOffset + pTriangle[0]] + baseVertex));
+			const f32* p1 = Position(pVertices, vertexStride, (u32) (set.VertexIndices[meshlet.VertexOffset + pTriangle[1]] + baseVertex));
+			const f32* p2 = Position(pVertices, vertexStride, (u32) (set.VertexIndices[meshlet.VertexOffset + pTriangle[2]] + baseVertex));
+			f32 e0[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+			f32 e1[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+			// Front faces are clockwise on screen, in a left handed frame e0 x e1 then points at the viewer
+			f32 n[3] = {e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0]};
+			f32 length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length <= 0.0f)
+				continue; // degenerate triangles are never rasterized
+			for (int k = 0; k < 3; k++)
+			{
+				normals.push_back(n[k] / length);
+				axis[k] += n[k] / length;
+			}
+		}
+
+		meshlet.ConeCutoff = 1.0f;
+		f32 axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		if (normals.empty() || axisLength <= 0.0f)
+			return;
+		for (int k = 0; k < 3; k++)
+			meshlet.ConeAxis[k] = axis[k] / axisLength;
+
+		f32 minDot = 1.0f;
+		for (size_t i = 0; i < normals.size(); i += 3)
+			minDot = Math::Min(minDot, normals[i] * meshlet.ConeAxis[0] + normals[i + 1] * meshlet.ConeAxis[1] + normals[i + 2] * meshlet.ConeAxis[2]);
+
+		// Cones of 90 degrees or more have some triangle facing any viewpoint
+		if (minDot > 0.0f)
+			meshlet.ConeCutoff = std::sqrt(Math::Max(1.0f - minDot * minDot, 0.0f));
+	}
+
+	// Appends the meshlets of one index range to set and returns how many were added.
+	// Vertex v of the range is read at pVertices + (v + baseVertex) * vertexStride.
+	template <typename Index>
+	u32 Build(MeshletSet& set, const Index* pIndices, size_t indexCount, i32 baseVertex,
+		const u8* pVertices, u32 vertexStride, u32 vertexCount,
+		u32 maxVertices = MAX_VERTICES, u32 maxTriangles = MAX_TRIANGLES)
+	{
+		const u32 firstMeshlet = (u32) set.Meshlets.size();
+		const u32 NOT_LOADED = 0xFF;
+		// Slot of each vertex in the meshlet being built, cleared through the meshlet's vertex list
+		std::vector<u8> localIndex(vertexCount, NOT_LOADED);
+
+		Meshlet meshlet;
+		meshlet.VertexOffset = (u32) set.VertexIndices.size();
+		meshlet.TriangleOffset = (u32) set.PrimitiveIndices.size();
+
+		auto finish = [&]()
+		{
+			if (meshlet.TriangleCount == 0)
+				return;
+			for (u32 i = 0; i < meshlet.VertexCount; i++)
+				localIndex[set.VertexIndices[meshlet.VertexOffset + i]] = NOT_LOADED;
+			ComputeBounds(meshlet, &set.VertexIndices[meshlet.VertexOffset], baseVertex, pVertices, vertexStride);
+			ComputeCone(meshlet, set, baseVertex, pVertices, vertexStride);
+			set.Meshlets.push_back(meshlet);
+
+			meshlet = Meshlet();
+			meshlet.VertexOffset = (u32) set.VertexIndices.size();
+			meshlet.TriangleOffset = (u32) set.PrimitiveIndices.size();
+		};
+
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			u32 v[3] = {pIndices[i], pIndices[i + 1], pIndices[i + 2]};
+			u32 newVertices = 0;
+			for (int k = 0; k < 3; k++)
+				if (localIndex[v[k]] == NOT_LOADED && (k == 0 || v[k] != v[0]) && (k < 2 || v[k] != v[1]))
+					newVertices++;
+			if (meshlet.VertexCount + newVertices > maxVertices || meshlet.TriangleCount + 1 > maxTriangles)
+				finish();
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (localIndex[v[k]] == NOT_LOADED)
+				{
+					localIndex[v[k]] = (u8) meshlet.VertexCount++;
+					set.VertexIndices.push_back(v[k]);
+				}
+				set.PrimitiveIndices.push_back(localIndex[v[k]]);
+			}
+			meshlet.TriangleCount++;
+		}
+		finish();
+
+		return (u32) set.Meshlets.size() - firstMeshlet;
+	}
+
+	// Planes as (a, b, c, d) with a point inside when a*x + b*y + c*z + d >= 0.
+	// viewProj is row major and multiplies row vectors (v * M), clip space depth in [0, w].
+	inline void ExtractFrustumPlanes(const f32* viewProj, f32 planes[6][4])
+	{
+		auto column = [viewProj](int c, int r) { return viewProj[r * 4 + c]; };
+		for (int r = 0; r < 4; r++)
+		{
+			planes[0][r] = column(3, r) + column(0, r); // left
+			planes[1][r] = column(3, r) - column(0, r); // right
+			planes[2][r] = column(3, r) + column(1, r); // bottom
+			planes[3][r] = column(3, r) - column(1, r); // top
+			planes[4][r] = column(2, r);                // near
+			planes[5][r] = column(3, r) - column(2, r); // far
+		}
+		for (int p = 0; p < 6; p++)
+		{
+			f32 length = std::sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+			for (int r = 0; r < 4; r++)
+				planes[p][r] /= length;
+		}
+	}
+
+	inline bool IsOutsideFrustum(const Meshlet& meshlet, const f32 planes[6][4])
+	{
+		for (int p = 0; p < 6; p++)
+		{
+			f32 distance = planes[p][0] * meshlet.Center[0] + planes[p][1] * meshlet.Center[1] + planes[p][2] * meshlet.Center[2] + planes[p][3];
+			if (distance < -meshlet.Radius)
+				return true;
+		}
+		return false;
+	}
+
+	// True when every triangle faces away from eye, for any eye in the same space as the meshlet.
+	// With d = |Center - eye|, all points of the sphere are seen within asin(ConeCutoff) of the cone's
+	// back side when dot(Center - eye, ConeAxis) - Radius >= ConeCutoff * (d + Radius).
+	inline bool IsBackfacing(const Meshlet& meshlet, const f32* eye)
+	{
+		f32 toCenter[3] = {meshlet.Center[0] - eye[0], meshlet.Center[1] - eye[1], meshlet.Center[2] - eye[2]};
+		f32 distance = std::sqrt(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+		f32 along = toCenter[0] * meshlet.ConeAxis[0] + toCenter[1] * meshlet.ConeAxis[1] + toCenter[2] * meshlet.ConeAxis[2];
+		return along - meshlet.Radius >= meshlet.ConeCutoff * (distance + meshlet.Radius);
+	}
+
+	struct CullStats
+	{
+		u32 MeshletCount = 0;
+		u32 FrustumCulled = 0;
+		u32 BackfaceCulled = 0; // among the ones inside the frustum
+		u64 TriangleCount = 0;
+		u64 TrianglesCulled = 0;
+
+		void Add(const CullStats& other)
+		{
+			MeshletCount += other.MeshletCount;
+			FrustumCulled += other.FrustumCulled;
+			BackfaceCulled += other.BackfaceCulled;
+			TriangleCount += other.TriangleCount;
+			TrianglesCulled += other.TrianglesCulled;
+		}
+	};
+
+	// Culls meshlets [first, first + count) against planes and eye, both given in the meshlet's space.
+	// pVisible, if set, receives one flag per tested meshlet.
+	inline CullStats Cull(const MeshletSet& set, u32 first, u32 count, const f32 planes[6][4], const f32* eye,
+		std::vector<u8>* pVisible = nullptr)
+	{
+		CullStats stats;
+		if (pVisible != nullptr)
+			pVisible->assign(count, 0);
+		for (u32 i = 0; i < count; i++)
+		{
+			const Meshlet& meshlet = set.Meshlets[first + i];
+			stats.MeshletCount++;
+			stats.TriangleCount += meshlet.TriangleCount;
+			bool culled = true;
+			if (IsOutsideFrustum(meshlet, planes))
+				stats.FrustumCulled++;
+			else if (IsBackfacing(meshlet, eye))
+				stats.BackfaceCulled++;
+			else
+				culled = false;
+
+			if (culled)
+				stats.TrianglesCulled += meshlet.TriangleCount;
+			else if (pVisible != nullptr)
+				(*pVisible)[i] = 1;
+		}
+		return stats;
+	}
+
+	// "812 meshlets, 57.3 vertices and 98.1 triangles each"
+	inline std::string Describe(const MeshletSet& set)
+	{
+		f64 count = (f64) Math::Max((size_t) 1, set.Meshlets.size());
+		char text[128];
+		std::snprintf(text, sizeof(text), "%u meshlets, %.1f vertices and %.1f triangles each",
+			(u32) set.Meshlets.size(), set.VertexIndices.size() / count, set.PrimitiveIndices.size() / 3 / count);
+		return text;
+	}
+}
+
+}
+
+#endif //!MESHLET_BUILDER_H
@@ -0,0 +1,245 @@
+#ifndef NULL_BACKEND_H
+#define NULL_BACKEND_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "Core.h"
+#include "Profiler.h"
+#include "RenderBackend.h"
+#include "TransientAllocator.h"
+
+namespace Loxodonta
+{
+
+// Backend without a device for measuring the frame loop on its own. Frame data is copied into system
+// memory, one set per frame resource as on the GPU, and each command list is a list of commands that
+// stays readable until the next BeginCommands. Pass constants and cluster lists come from transient
+// pages in plain memory, retired by a simulated fence the GPU reaches NUM_FRAME_RESOURCES frames
+// after it is signaled.
+class NullBackend : public RenderBackend
+{
+public:
+	enum class CommandType : u8
+	{
+		SetLayer,
+		SetGeometry,
+		SetDiffuse,
+		Draw
+	};
+
+	struct Command
+	{
+		CommandType Type = CommandType::Draw;
+		const void* pObject = nullptr; // mesh of SetGeometry, texture of SetDiffuse
+		u32 Args[5] = {0, 0, 0, 0, 0};  // layer, topology or the draw's arguments in call order
+
+		bool operator==(const Command& other) const
+		{
+			return Type == other.Type && pObject == other.pObject && std::equal(Args, Args + 5, other.Args);
+		}
+	};
+
+	class CommandList : public CommandRecorder
+	{
+	public:
+		void Reset(f64 commandCost)
+		{
+			m_Commands.clear();
+			m_DrawCount = 0;
+			m_InstanceCount = 0;
+			m_CommandCost = commandCost;
+		}
+
+		void SetLayer(RenderLayer layer) override
+		{
+			Command command;
+			command.Type = CommandType::SetLayer;
+			command.Args[0] = (u32) layer;
+			Add(command);
+		}
+
+		void SetGeometry(const Mesh* mesh, D3D12_PRIMITIVE_TOPOLOGY topology) override
+		{
+			Command command;
+			command.Type = CommandType::SetGeometry;
+			command.pObject = mesh;
+			command.Args[0] = (u32) topology;
+			Add(command);
+		}
+
+		void SetDiffuse(const Texture* texture) override
+		{
+			Command command;
+			command.Type = CommandType::SetDiffuse;
+			command.pObject = texture;
+			Add(command);
+		}
+
+		void DrawIndexedInstanced(u32 indexCount, u32 instanceCount, u32 startIndex, i32 baseVertex, u32 baseInstance) override
+		{
+			Command command;
+			command.Type = CommandType::Draw;
+			command.Args[0] = indexCount;
+			command.Args[1] = instanceCount;
+			command.Args[2] = startIndex;
+			command.Args[3] = (u32) baseVertex;
+			command.Args[4] = baseInstance;
+			Add(command);
+			m_DrawCount++;
+			m_InstanceCount += instanceCount;
+		}
+
+		const std::vector<Command>& Commands() const { return m_Commands; }
+		u32 DrawCount() const { return m_DrawCount; }
+		u32 InstanceCount() const { return m_InstanceCount; }
+
+	private:
+		void Add(const Command& command)
+		{
+			m_Commands.push_back(command);
+			if(m_CommandCost > 0.0)
+			{
+				Stopwatch timer;
+				while(timer.ElapsedMs() < m_CommandCost)
+					;
+			}
+		}
+
+		std::vector<Command> m_Commands;
+		u32 m_DrawCount = 0;
+		u32 m_InstanceCount = 0;
+		f64 m_CommandCost = 0.0;
+	};
+
+	NullBackend(u32 instanceCount, u32 materialCount, u32 lightCount = 0, u32 maxCommandLists = 16)
+		: m_Frames(NUM_FRAME_RESOURCES), m_Lists(maxCommandLists)
+	{
+		for(FrameData& frame : m_Frames)
+		{
+			frame.Instances.resize(instanceCount);
+			frame.Materials.resize(materialCount);
+			frame.Lights.resize(lightCount);
+		}
+		m_TransientConstants.Initialize(&m_TransientPages);
+	}
+
+	// CPU time every recorded command busy waits for, in milliseconds, standing in for a driver's
+	// recording cost so the split across threads has work to share
+	void SetCommandCost(f64 milliseconds) { m_CommandCost = milliseconds; }
+
+	void BeginFrame() override
+	{
+		m_FrameIndex = (m_FrameIndex + 1) % (u32) m_Frames.size();
+		m_FrameCount++;
+		if(m_FrameCount > (u32) NUM_FRAME_RESOURCES)
+			m_TransientConstants.Retire(m_FrameCount - NUM_FRAME_RESOURCES);
+	}
+
+	// Grown buffers lose their contents like new GPU buffers would
+	void Reserve(u32 instanceCount, u32 materialCount, u32 lightCount) override
+	{
+		FrameData& frame = m_Frames[m_FrameIndex];
+		if(frame.Instances.size() < instanceCount)
+			frame.Instances.assign(Math::Max(instanceCount, (u32) frame.Instances.size() * 3 / 2), InstanceData());
+		if(frame.Materials.size() < materialCount)
+			frame.Materials.assign(Math::Max(materialCount, (u32) frame.Materials.size() * 3 / 2), MaterialProperties());
+		if(frame.Lights.size() < lightCount)
+			frame.Lights.assign(Math::Max(lightCount, (u32) frame.Lights.size() * 3 / 2), LocalLight());
+	}
+	InstanceData* MapInstances() override { return m_Frames[m_FrameIndex].Instances.data(); }
+	void WriteMaterial(u32 slot, const MaterialProperties& material) override { m_Frames[m_FrameIndex].Materials[slot] = material; }
+	void WritePass(const PassConstants& pass) override { CopyTransient(&pass, sizeof(PassConstants)); }
+	void WriteLight(u32 slot, const LocalLight& light) override
+	{
+		assert(slot < m_Frames[m_FrameIndex].Lights.size());
+		m_Frames[m_FrameIndex].Lights[slot] = light;
+	}
+	void WriteLightClusters(const LightClusters::ClusterLists& clusters) override
+	{
+		CopyTransient(clusters.Clusters.data(), clusters.Clusters.size() * sizeof(LightClusters::ClusterRange));
+		CopyTransient(clusters.Indices.data(), clusters.Indices.size() * sizeof(u32));
+	}
+
+	u32 MaxCommandLists() const override { return (u32) m_Lists.size(); }
+
+	void BeginCommands(u32 listCount) override
+	{
+		m_ListCount = listCount;
+		for(u32 i = 0; i < listCount; i++)
+			m_Lists[i].Reset(m_CommandCost);
+	}
+
+	CommandRecorder& Recorder(u32 list) override { return m_Lists[list]; }
+
+	// Signals the frame's fence, which is the frame's number
+	void EndFrame() override { m_TransientConstants.Commit(m_FrameCount); }
+
+	u32 ListCount() const { return m_ListCount; }
+	const CommandList& List(u32 list) const { return m_Lists[list]; }
+
+	u32 DrawCount() const
+	{
+		u32 count = 0;
+		for(u32 i = 0; i < m_ListCount; i++)
+			count += m_Lists[i].DrawCount();
+		return count;
+	}
+
+	u32 InstanceCount() const
+	{
+		u32 count = 0;
+		for(u32 i = 0; i < m_ListCount; i++)
+			count += m_Lists[i].InstanceCount();
+		return count;
+	}
+
+	u32 CommandCount() const
+	{
+		u32 count = 0;
+		for(u32 i = 0; i < m_ListCount; i++)
+			count += (u32) m_Lists[i].Commands().size();
+		return count;
+	}
+
+	u32 FrameCount() const { return m_FrameCount; }
+	// Buffers of the frame resource written last
+	const std::vector<InstanceData>& Instances() const { return m_Frames[m_FrameIndex].Instances; }
+	const std::vector<MaterialProperties>& Materials() const { return m_Frames[m_FrameIndex].Materials; }
+	const std::vector<LocalLight>& Lights() const { return m_Frames[m_FrameIndex].Lights; }
+	const TransientAllocator& TransientConstants() const { return m_TransientConstants; }
+
+private:
+	void CopyTransient(const void* pData, size_t size)
+	{
+		if(size == 0)
+			return;
+		TransientAllocation allocation = m_TransientConstants.Allocate(size);
+		std::memcpy(allocation.pCpu, pData, size);
+	}
+
+	struct FrameData
+	{
+		std::vector<InstanceData> Instances;
+		std::vector<MaterialProperties> Materials;
+		std::vector<LocalLight> Lights;
+	};
+
+	std::vector<FrameData> m_Frames;
+	u32 m_FrameIndex = 0;
+	u32 m_FrameCount = 0;
+
+	// Declared in this order so the pages outlive the allocator
+	MemoryPageSource m_TransientPages;
+	TransientAllocator m_TransientConstants;
+
+	std::vector<CommandList> m_Lists;
+	u32 m_ListCount = 0;
+	f64 m_CommandCost = 0.0;
+};
+
+}
+
+#endif //!NULL_BACKEND_H
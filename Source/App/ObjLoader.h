@@ -0,0 +1,351 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "../3rdParty/tinyobjloader/tiny_obj_loader.h"
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "FrameResource.h"
+#include "Material.h"
+#include "MeshSimplifier.h"
+
+namespace Loxodonta
+{
+
+// Material referenced by an imported model, before it is turned into a Material
+struct ObjMaterial
+{
+	std::string Name;
+	MaterialProperties Properties;
+	std::string DiffuseTexname;
+};
+
+// Range of the model's index buffer drawn with a single material
+struct ObjSubmesh
+{
+	std::string Name;
+	i32 MaterialIndex = -1; // into ObjModel::Materials, -1 for none
+	uint IndexCount = 0;
+	uint StartIndexLocation = 0;
+	int BaseVertexLocation = 0;
+
+	// Levels of detail, Lods[0] is the submesh itself. Empty until they are built.
+	std::vector<MeshSimplifier::LodRange> Lods;
+};
+
+// CPU side result of importing an .obj file
+struct ObjModel
+{
+	std::string Name;
+	std::string Basepath;
+
+	std::vector<Vertex> Vertices;
+	std::vector<u32> Indices;
+	u32 MaxIndex = 0;
+
+	std::vector<ObjSubmesh> Submeshes;
+	std::vector<ObjMaterial> Materials;
+};
+
+// Non-owning view over the buffers of a model, ready to be copied into a Mesh
+struct ObjModelView
+{
+	const void* pVertices = nullptr;
+	uint VertexCount = 0;
+	uint VertexByteStride = sizeof(Vertex);
+
+	const void* pIndices = nullptr;
+	uint IndexCount = 0;
+	DXGI_FORMAT IndexFormat = DXGI_FORMAT_R32_UINT;
+
+	std::vector<ObjSubmesh> Submeshes;
+	std::vector<ObjMaterial> Materials;
+
+	uint VertexBufferByteSize() const { return VertexCount * VertexByteStride; }
+	uint IndexBufferByteSize() const
+	{
+		return IndexCount * (IndexFormat == DXGI_FORMAT_R16_UINT ? sizeof(u16) : sizeof(u32));
+	}
+};
+
+// Converts to 16 bit indices when every index fits, otherwise keeps 32 bit indices
+inline DXGI_FORMAT PackIndices(const std::vector<u32>& indices, u32 maxIndex, std::vector<u16>& indices16)
+{
+	indices16.clear();
+	if (maxIndex > 0xFFFF)
+		return DXGI_FORMAT_R32_UINT;
+
+	indices16.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+		indices16[i] = static_cast<u16>(indices[i]);
+	return DXGI_FORMAT_R16_UINT;
+}
+
+// Returns the file name without folders or extension
+inline std::string ObjNameFromPath(const std::string& filepath)
+{
+	std::string objName = filepath.substr(filepath.find_last_of("/") + 1); // get local file path
+	return objName.substr(0, objName.size() - 4);                          // remove .obj file extension
+}
+
+inline ObjMaterial ConvertObjMaterial(const tinyobj::material_t& tinyobjShapeMat)
+{
+	ObjMaterial mat;
+	mat.Name = tinyobjShapeMat.name;
+	// @todo deal with different illum models in tinyobjShapeMat
+	mat.Properties.Anisotropy = tinyobjShapeMat.anisotropy;
+	mat.Properties.AnisotropyRotation = tinyobjShapeMat.anisotropy_rotation;
+	mat.Properties.ClearCoatRoughness = tinyobjShapeMat.clearcoat_roughness;
+	mat.Properties.ClearCoatThickness = tinyobjShapeMat.clearcoat_thickness;
+	mat.Properties.Diffuse = Vector::SetFloat3(tinyobjShapeMat.diffuse[0], tinyobjShapeMat.diffuse[1], tinyobjShapeMat.diffuse[2]);
+	mat.Properties.Emissive = Vector::SetFloat3(tinyobjShapeMat.emission[0], tinyobjShapeMat.emission[1], tinyobjShapeMat.emission[2]);
+	mat.Properties.FresnelR0 = Vector::SetFloat3(tinyobjShapeMat.specular[0], tinyobjShapeMat.specular[1], tinyobjShapeMat.specular[2]);
+	mat.Properties.Metallic = tinyobjShapeMat.metallic;
+	mat.Properties.Opacity = tinyobjShapeMat.dissolve;
+	mat.Properties.Roughness = 1 - Math::Min(tinyobjShapeMat.shininess / 256.0f, 1.0f); // @todo needs be switched to roughness for real pbr
+	mat.Properties.Sheen = tinyobjShapeMat.sheen;
+	mat.Properties.Transmission = Vector::SetFloat3(tinyobjShapeMat.transmittance[0], tinyobjShapeMat.transmittance[1], tinyobjShapeMat.transmittance[2]);
+	mat.DiffuseTexname = tinyobjShapeMat.diffuse_texname;
+	return mat;
+}
+
+// Open addressing hash table from an .obj (position, normal, texcoord) index triplet
+// to the index of the vertex built from it. Vertices are only materialized once per key.
+class ObjIndexTable
+{
+public:
+	explicit ObjIndexTable(size_t expectedKeys = 0)
+	{
+		Reserve(expectedKeys);
+	}
+
+	// Sizes the table so expectedKeys fit without growing
+	void Reserve(size_t expectedKeys)
+	{
+		size_t capacity = 16;
+		while (capacity * MAX_LOAD_NUM < expectedKeys * MAX_LOAD_DEN)
+			capacity *= 2;
+		if (capacity > m_slots.size())
+			Rehash(capacity);
+	}
+
+	// Returns true and stores newValue if the key was not present,
+	// otherwise returns false and the value already mapped to the key
+	bool FindOrInsert(const tinyobj::index_t& key, u32 newValue, u32& value)
+	{
+		if ((m_count + 1) * MAX_LOAD_DEN > m_slots.size() * MAX_LOAD_NUM)
+			Rehash(m_slots.size() * 2);
+
+		size_t slot = Hash(key) & m_mask;
+		while (true)
+		{
+			Slot& s = m_slots[slot];
+			if (s.Value == EMPTY)
+			{
+				s.Key = key;
+				s.Value = newValue;
+				m_count++;
+				value = newValue;
+				return true;
+			}
+			if (s.Key.vertex_index == key.vertex_index &&
+				s.Key.normal_index == key.normal_index &&
+				s.Key.texcoord_index == key.texcoord_index)
+			{
+				value = s.Value;
+				return false;
+			}
+			slot = (slot + 1) & m_mask;
+		}
+	}
+
+	size_t Count() const { return m_count; }
+	size_t Capacity() const { return m_slots.size(); }
+
+private:
+	static const u32 EMPTY = 0xFFFFFFFF;
+	// Maximum load factor of 7/10 keeps linear probe sequences short
+	static const size_t MAX_LOAD_NUM = 7;
+	static const size_t MAX_LOAD_DEN = 10;
+
+	struct Slot
+	{
+		tinyobj::index_t Key;
+		u32 Value;
+	};
+
+	std::vector<Slot> m_slots;
+	size_t m_mask = 0;
+	size_t m_count = 0;
+
+	static size_t Hash(const tinyobj::index_t& key)
+	{
+		u64 h = (u64) (u32) key.vertex_index * 0x9E3779B97F4A7C15ull;
+		h ^= (u64) (u32) key.normal_index * 0xC2B2AE3D27D4EB4Full;
+		h ^= (u64) (u32) key.texcoord_index * 0x165667B19E3779F9ull;
+		h ^= h >> 29;
+		return (size_t) h;
+	}
+
+	void Rehash(size_t capacity)
+	{
+		std::vector<Slot> oldSlots;
+		oldSlots.swap(m_slots);
+		Slot empty;
+		empty.Key.vertex_index = empty.Key.normal_index = empty.Key.texcoord_index = -1;
+		empty.Value = EMPTY;
+		m_slots.assign(capacity, empty);
+		m_mask = capacity - 1;
+
+		for (const Slot& s : oldSlots)
+		{
+			if (s.Value == EMPTY)
+				continue;
+			size_t slot = Hash(s.Key) & m_mask;
+			while (m_slots[slot].Value != EMPTY)
+				slot = (slot + 1) & m_mask;
+			m_slots[slot] = s;
+		}
+	}
+};
+
+// Builds the vertex referenced by one .obj face corner
+inline Vertex MakeObjVertex(const tinyobj::attrib_t& attrib, const tinyobj::index_t& index)
+{
+	Vertex V;
+	V.Pos = Vector::SetFloat3(
+		attrib.vertices[3*index.vertex_index+0],
+		attrib.vertices[3*index.vertex_index+1],
+		attrib.vertices[3*index.vertex_index+2]
+	);
+	if(index.normal_index!=-1)
+	{
+		V.Normal = Vector::SetFloat3(
+			attrib.normals[3*index.normal_index+0],
+			attrib.normals[3*index.normal_index+1],
+			attrib.normals[3*index.normal_index+2]
+		);
+	}
+	else
+	{
+		V.Normal = Vector::SetFloat3(0.0f, 0.0f, 0.0f);
+	}
+	V.Tangent = Vector::SetFloat3(0.0f, 0.0f, 0.0f);
+	V.Bitangent = Vector::SetFloat3(0.0f, 0.0f, 0.0f);
+	if(index.texcoord_index!=-1)
+	{
+		V.TexCoord = Vector::SetFloat2(
+			attrib.texcoords[2*index.texcoord_index+0],
+			1.0f-attrib.texcoords[2*index.texcoord_index+1]
+		);
+	}
+	else
+	{
+		V.TexCoord = Vector::SetFloat2(0.0f, 0.0f);
+	}
+	return V;
+}
+
+// Appends one shape's face corners to vertices/indices, reusing vertices already in uniqueVertices
+inline void DeduplicateObjIndices(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::index_t>& objIndices,
+	ObjIndexTable& uniqueVertices, std::vector<Vertex>& vertices, std::vector<u32>& indices, u32& maxIndex)
+{
+	for(const auto& index : objIndices)
+	{
+		u32 vertexIndex;
+		if(uniqueVertices.FindOrInsert(index, static_cast<u32>(vertices.size()), vertexIndex))
+		{ // first time this triplet is seen
+			vertices.push_back(MakeObjVertex(attrib, index));
+			maxIndex = (vertexIndex > maxIndex) ? vertexIndex : maxIndex;
+		}
+		indices.push_back(vertexIndex);
+	}
+}
+
+// Rough guess of the unique vertex count used to pre-size the dedup table, which grows past it if needed
+inline size_t EstimateObjVertexCount(const tinyobj::attrib_t& attrib)
+{
+	size_t estimate = attrib.vertices.size() / 3;
+	estimate = Math::Max(estimate, attrib.normals.size() / 3);
+	estimate = Math::Max(estimate, attrib.texcoords.size() / 2);
+	return estimate;
+}
+
+// Builds a deduplicated, indexed model from parsed .obj data
+inline void BuildObjModel(const std::string& filepath, const std::string& basepath, const tinyobj::attrib_t& attrib,
+	const std::vector<tinyobj::shape_t>& shapes, const std::vector<tinyobj::material_t>& materials, ObjModel& model)
+{
+	model.Name = ObjNameFromPath(filepath);
+	model.Basepath = basepath;
+	model.Vertices.clear();
+	model.Indices.clear();
+	model.MaxIndex = 0;
+	model.Submeshes.clear();
+	model.Materials.clear();
+
+	// Only the materials actually used by a shape are kept
+	std::vector<i32> materialRemap(materials.size(), -1);
+
+	size_t totalIndexCount = 0;
+	for(const auto& shape : shapes)
+		totalIndexCount += shape.mesh.indices.size();
+
+	size_t expectedVertexCount = EstimateObjVertexCount(attrib);
+	ObjIndexTable uniqueVertices(expectedVertexCount);
+	model.Vertices.reserve(expectedVertexCount);
+	model.Indices.reserve(totalIndexCount);
+
+	uint lastIndexCount = 0;
+	// Iterate over .obj geometries
+	for(const auto& shape : shapes)
+	{
+		ObjSubmesh submesh;
+		submesh.Name = shape.name;
+
+		// Get the material that defines this shape's visuals
+		int materialID = shape.mesh.material_ids.empty() ? -1 : shape.mesh.material_ids[0];
+		if(materialID != -1)
+		{
+			if(materialRemap[materialID] == -1)
+			{ // new material
+				materialRemap[materialID] = (i32) model.Materials.size();
+				model.Materials.push_back(ConvertObjMaterial(materials[materialID]));
+			}
+			submesh.MaterialIndex = materialRemap[materialID];
+		}
+
+		// Get shape vertices and indices
+		DeduplicateObjIndices(attrib, shape.mesh.indices, uniqueVertices, model.Vertices, model.Indices, model.MaxIndex);
+
+		submesh.StartIndexLocation = lastIndexCount;
+		submesh.IndexCount = (uint) model.Indices.size() - lastIndexCount;
+		lastIndexCount = (uint) model.Indices.size();
+
+		model.Submeshes.push_back(submesh);
+	}
+}
+
+// Parses an .obj (and its .mtl) and builds a deduplicated, indexed model on the CPU
+inline void ImportOBJ(const std::string& filepath, ObjModel& model)
+{
+	// Load model, or throw error
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+	std::string basepath = filepath.substr(0, filepath.find_last_of("/") + 1);
+	if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filepath.c_str(), basepath.c_str(), true))
+	{
+		throw std::runtime_error(err);
+	}
+
+	BuildObjModel(filepath, basepath, attrib, shapes, materials, model);
+}
+
+}
+
+#endif //!OBJ_LOADER_H
@@ -0,0 +1,849 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "Core.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "ObjLoader.h"
+
+namespace Loxodonta
+{
+
+// Multithreaded replacement for tinyobj::LoadObj(..., triangulate = true).
+//
+// The .obj is memory mapped and split at line boundaries into one chunk per thread.
+//   1. every chunk counts its v/vn/vt lines, a prefix sum gives each chunk its global attribute offsets
+//   2. every chunk parses its lines, writing attributes straight into the shared arrays and
+//      resolving face indices (relative ones included) against the global counts
+//   3. the o/g/usemtl/mtllib statements are replayed in file order to build the shapes,
+//      exactly as tinyobj groups and triangulates them
+// attrib.vertices/normals/texcoords and the shapes' indices, face sizes, material and smoothing ids
+// match tinyobj bit for bit. Vertex colors, tags and line paths are not filled, nothing uses them.
+namespace ObjParser
+{
+	// Replayed in order after the parallel parse
+	struct Statement
+	{
+		enum Kind { UseMtl, MtlLib, Group, Object, Lines, Smoothing };
+
+		Kind Type;
+		size_t FaceCount;     // faces of the chunk parsed before this statement
+		size_t PositionCount; // positions of the whole file parsed before this statement
+		std::string Text;
+		u32 Value;            // line pairs or smoothing group id
+	};
+
+	struct Chunk
+	{
+		const char* pBegin = nullptr;
+		const char* pEnd = nullptr;
+
+		size_t PositionCount = 0;
+		size_t NormalCount = 0;
+		size_t TexcoordCount = 0;
+		size_t PositionBase = 0;
+		size_t NormalBase = 0;
+		size_t TexcoordBase = 0;
+
+		std::vector<tinyobj::index_t> Corners;
+		std::vector<u32> FaceSizes;
+		std::vector<Statement> Statements;
+		bool Failed = false;
+	};
+
+	inline bool IsSpace(char c) { return c == ' ' || c == '\t'; }
+	inline bool IsDigit(char c) { return (unsigned int) (c - '0') < 10u; }
+	inline bool IsNewLine(char c) { return c == '\r' || c == '\n' || c == '\0'; }
+
+	// Calls fn(pLine, length) for every line in [pBegin, pEnd), with the same
+	// "\n", "\r\n" and "\r" handling as tinyobj's safeGetline
+	template <typename LineFn>
+	void ForEachLine(const char* pBegin, const char* pEnd, LineFn fn)
+	{
+		const char* p = pBegin;
+		while (p < pEnd)
+		{
+			const char* pLine = p;
+			while (p < pEnd && *p != '\n' && *p != '\r')
+				p++;
+			fn(pLine, (size_t) (p - pLine));
+			if (p < pEnd)
+				p += (*p == '\r' && p + 1 < pEnd && p[1] == '\n') ? 2 : 1;
+		}
+	}
+
+	// Kind of a line as tinyobj dispatches it: 'v', 'n' (vn), 't' (vt) or 0 for anything else
+	inline char AttributeKind(const char* pLine, size_t length)
+	{
+		size_t i = 0;
+		while (i < length && IsSpace(pLine[i]))
+			i++;
+		auto at = [pLine, length](size_t k) { return k < length ? pLine[k] : '\0'; };
+		if (at(i) != 'v')
+			return 0;
+		if (IsSpace(at(i + 1)))
+			return 'v';
+		if ((at(i + 1) == 'n' || at(i + 1) == 't') && IsSpace(at(i + 2)))
+			return at(i + 1);
+		return 0;
+	}
+
+	// Same algorithm as tinyobj's tryParseDouble so the parsed floats are identical
+	inline bool TryParseDouble(const char* s, const char* s_end, double* result)
+	{
+		if (s >= s_end)
+			return false;
+
+		double mantissa = 0.0;
+		int exponent = 0;
+		char sign = '+';
+		char exp_sign = '+';
+		const char* curr = s;
+		int read = 0;
+		bool end_not_reached = false;
+
+		if (*curr == '+' || *curr == '-')
+		{
+			sign = *curr;
+			curr++;
+		}
+		else if (!IsDigit(*curr))
+			return false;
+
+		// Integer part
+		end_not_reached = (curr != s_end);
+		while (end_not_reached && IsDigit(*curr))
+		{
+			mantissa *= 10;
+			mantissa += static_cast<int>(*curr - 0x30);
+			curr++;
+			read++;
+			end_not_reached = (curr != s_end);
+		}
+		if (read == 0)
+			return false;
+
+		if (end_not_reached)
+		{
+			bool hasExponent = false;
+			if (*curr == '.')
+			{
+				// Decimal part
+				curr++;
+				read = 1;
+				end_not_reached = (curr != s_end);
+				while (end_not_reached && IsDigit(*curr))
+				{
+					static const double pow_lut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+					const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+					mantissa += static_cast<int>(*curr - 0x30) * (read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+					read++;
+					curr++;
+					end_not_reached = (curr != s_end);
+				}
+				hasExponent = end_not_reached;
+			}
+			else
+			{
+				hasExponent = (*curr == 'e' || *curr == 'E');
+			}
+
+			// Exponent part
+			if (hasExponent && (*curr == 'e' || *curr == 'E'))
+			{
+				curr++;
+				end_not_reached = (curr != s_end);
+				if (end_not_reached && (*curr == '+' || *curr == '-'))
+				{
+					exp_sign = *curr;
+					curr++;
+				}
+				else if (!IsDigit(*curr))
+					return false;
+
+				read = 0;
+				end_not_reached = (curr != s_end);
+				while (end_not_reached && IsDigit(*curr))
+				{
+					exponent *= 10;
+					exponent += static_cast<int>(*curr - 0x30);
+					curr++;
+					read++;
+					end_not_reached = (curr != s_end);
+				}
+				exponent *= (exp_sign == '+' ? 1 : -1);
+				if (read == 0)
+					return false;
+			}
+		}
+
+		*result = (sign == '+' ? 1 : -1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+		return true;
+	}
+
+	inline tinyobj::real_t ParseReal(const char** token)
+	{
+		(*token) += strspn((*token), " \t");
+		const char* end = (*token) + strcspn((*token), " \t\r");
+		double val = 0.0;
+		TryParseDouble((*token), end, &val);
+		(*token) = end;
+		return static_cast<tinyobj::real_t>(val);
+	}
+
+	// tinyobj's fixIndex: one based or relative to the attributes parsed so far
+	inline bool FixIndex(int idx, size_t n, int* ret)
+	{
+		if (idx > 0)
+		{
+			*ret = idx - 1;
+			return true;
+		}
+		if (idx == 0)
+			return false;
+		*ret = (int) n + idx;
+		return true;
+	}
+
+	// tinyobj's parseTriple: i, i/j/k, i//k, i/j
+	inline bool ParseTriple(const char** token, size_t vsize, size_t vnsize, size_t vtsize, tinyobj::index_t* ret)
+	{
+		tinyobj::index_t vi;
+		vi.vertex_index = vi.normal_index = vi.texcoord_index = -1;
+
+		if (!FixIndex(atoi((*token)), vsize, &vi.vertex_index))
+			return false;
+		(*token) += strcspn((*token), "/ \t\r");
+		if ((*token)[0] == '/')
+		{
+			(*token)++;
+			if ((*token)[0] == '/')
+			{ // i//k
+				(*token)++;
+				if (!FixIndex(atoi((*token)), vnsize, &vi.normal_index))
+					return false;
+				(*token) += strcspn((*token), "/ \t\r");
+			}
+			else
+			{ // i/j/k or i/j
+				if (!FixIndex(atoi((*token)), vtsize, &vi.texcoord_index))
+					return false;
+				(*token) += strcspn((*token), "/ \t\r");
+				if ((*token)[0] == '/')
+				{
+					(*token)++;
+					if (!FixIndex(atoi((*token)), vnsize, &vi.normal_index))
+						return false;
+					(*token) += strcspn((*token), "/ \t\r");
+				}
+			}
+		}
+		*ret = vi;
+		return true;
+	}
+
+	inline void CountAttributes(Chunk& chunk)
+	{
+		ForEachLine(chunk.pBegin, chunk.pEnd, [&chunk](const char* pLine, size_t length)
+		{
+			switch (AttributeKind(pLine, length))
+			{
+			case 'v': chunk.PositionCount++; break;
+			case 'n': chunk.NormalCount++; break;
+			case 't': chunk.TexcoordCount++; break;
+			}
+		});
+	}
+
+	// Second pass over a chunk, attributes are written at the chunk's global offsets
+	inline void ParseChunk(Chunk& chunk, tinyobj::attrib_t& attrib)
+	{
+		size_t positions = chunk.PositionBase;
+		size_t normals = chunk.NormalBase;
+		size_t texcoords = chunk.TexcoordBase;
+		std::string linebuf;
+
+		auto addStatement = [&](Statement::Kind type, const std::string& text, u32 value)
+		{
+			Statement statement;
+			statement.Type = type;
+			statement.FaceCount = chunk.FaceSizes.size();
+			statement.PositionCount = positions;
+			statement.Text = text;
+			statement.Value = value;
+			chunk.Statements.push_back(statement);
+		};
+
+		ForEachLine(chunk.pBegin, chunk.pEnd, [&](const char* pLine, size_t length)
+		{
+			if (chunk.Failed || length == 0)
+				return;
+
+			// Copied so the tokenizer stops at the end of the line like it does in tinyobj
+			linebuf.assign(pLine, length);
+			const char* token = linebuf.c_str();
+			token += strspn(token, " \t");
+			if (token[0] == '\0' || token[0] == '#')
+				return;
+
+			if (token[0] == 'v' && IsSpace(token[1]))
+			{
+				token += 2;
+				tinyobj::real_t* pOut = &attrib.vertices[3 * positions++];
+				pOut[0] = ParseReal(&token);
+				pOut[1] = ParseReal(&token);
+				pOut[2] = ParseReal(&token);
+				return;
+			}
+			if (token[0] == 'v' && token[1] == 'n' && IsSpace(token[2]))
+			{
+				token += 3;
+				tinyobj::real_t* pOut = &attrib.normals[3 * normals++];
+				pOut[0] = ParseReal(&token);
+				pOut[1] = ParseReal(&token);
+				pOut[2] = ParseReal(&token);
+				return;
+			}
+			if (token[0] == 'v' && token[1] == 't' && IsSpace(token[2]))
+			{
+				token += 3;
+				tinyobj::real_t* pOut = &attrib.texcoords[2 * texcoords++];
+				pOut[0] = ParseReal(&token);
+				pOut[1] = ParseReal(&token);
+				return;
+			}
+			if (token[0] == 'l' && IsSpace(token[1]))
+			{
+				// Only whether a group has line elements changes how shapes are emitted
+				token += 2;
+				u32 indexCount = 0;
+				while (!IsNewLine(token[0]))
+				{
+					token += strspn(token, " \t");
+					token += strcspn(token, " \t\r");
+					token += strspn(token, " \t\r");
+					indexCount++;
+				}
+				if (indexCount >= 2)
+					addStatement(Statement::Lines, std::string(), indexCount / 2);
+				return;
+			}
+			if (token[0] == 'f' && IsSpace(token[1]))
+			{
+				token += 2;
+				token += strspn(token, " \t");
+				u32 faceSize = 0;
+				while (!IsNewLine(token[0]))
+				{
+					tinyobj::index_t vi;
+					if (!ParseTriple(&token, positions, normals, texcoords, &vi))
+					{
+						chunk.Failed = true;
+						return;
+					}
+					chunk.Corners.push_back(vi);
+					faceSize++;
+					token += strspn(token, " \t\r");
+				}
+				chunk.FaceSizes.push_back(faceSize);
+				return;
+			}
+			if ((0 == strncmp(token, "usemtl", 6)) && IsSpace(token[6]))
+			{
+				addStatement(Statement::UseMtl, std::string(token + 7), 0);
+				return;
+			}
+			if ((0 == strncmp(token, "mtllib", 6)) && IsSpace(token[6]))
+			{
+				addStatement(Statement::MtlLib, std::string(token + 7), 0);
+				return;
+			}
+			if (token[0] == 'g' && IsSpace(token[1]))
+			{
+				// Multiple group names are joined with a space, a bare 'g' clears the name
+				std::vector<std::string> names;
+				while (!IsNewLine(token[0]))
+				{
+					token += strspn(token, " \t");
+					size_t e = strcspn(token, " \t\r");
+					names.push_back(std::string(token, token + e));
+					token += e;
+					token += strspn(token, " \t\r");
+				}
+				std::string name;
+				for (size_t i = 1; i < names.size(); i++)
+					name += (i > 1 ? " " : "") + names[i];
+				addStatement(Statement::Group, name, 0);
+				return;
+			}
+			if (token[0] == 'o' && IsSpace(token[1]))
+			{
+				addStatement(Statement::Object, std::string(token + 2), 0);
+				return;
+			}
+			if (token[0] == 's' && IsSpace(token[1]))
+			{
+				token += 2;
+				token += strspn(token, " \t");
+				if (token[0] == '\0' || token[0] == '\r' || token[1] == '\n')
+					return;
+				u32 smoothingId = 0;
+				if (strlen(token) >= 3)
+				{
+					if (token[0] != 'o' || token[1] != 'f' || token[2] != 'f')
+						return; // tinyobj keeps the current group for anything but "off"
+				}
+				else
+				{
+					int id = atoi(token);
+					smoothingId = id < 0 ? 0 : (u32) id;
+				}
+				addStatement(Statement::Smoothing, std::string(), smoothingId);
+				return;
+			}
+			// Tags and unknown statements are ignored
+		});
+	}
+
+	// tinyobj's polygon triangulation, vertexLimit is the number of position reals
+	// parsed when the face group was flushed
+	inline void TriangulateFace(const tinyobj::index_t* pFace, size_t npolys, const std::vector<tinyobj::real_t>& v,
+		size_t vertexLimit, int materialId, u32 smoothingId, tinyobj::mesh_t& mesh)
+	{
+		typedef tinyobj::real_t real_t;
+
+		auto emit = [&](const tinyobj::index_t& i0, const tinyobj::index_t& i1, const tinyobj::index_t& i2)
+		{
+			mesh.indices.push_back(i0);
+			mesh.indices.push_back(i1);
+			mesh.indices.push_back(i2);
+			mesh.num_face_vertices.push_back(3);
+			mesh.material_ids.push_back(materialId);
+			mesh.smoothing_group_ids.push_back(smoothingId);
+		};
+
+		if (npolys < 3)
+			return;
+		if (npolys == 3)
+		{
+			emit(pFace[0], pFace[1], pFace[2]);
+			return;
+		}
+
+		// Find the two axes to work in
+		size_t axes[2] = { 1, 2 };
+		for (size_t k = 0; k < npolys; ++k)
+		{
+			size_t vi0 = size_t(pFace[(k + 0) % npolys].vertex_index);
+			size_t vi1 = size_t(pFace[(k + 1) % npolys].vertex_index);
+			size_t vi2 = size_t(pFace[(k + 2) % npolys].vertex_index);
+			if (((3 * vi0 + 2) >= vertexLimit) || ((3 * vi1 + 2) >= vertexLimit) || ((3 * vi2 + 2) >= vertexLimit))
+				continue;
+			real_t e0x = v[vi1 * 3 + 0] - v[vi0 * 3 + 0];
+			real_t e0y = v[vi1 * 3 + 1] - v[vi0 * 3 + 1];
+			real_t e0z = v[vi1 * 3 + 2] - v[vi0 * 3 + 2];
+			real_t e1x = v[vi2 * 3 + 0] - v[vi1 * 3 + 0];
+			real_t e1y = v[vi2 * 3 + 1] - v[vi1 * 3 + 1];
+			real_t e1z = v[vi2 * 3 + 2] - v[vi1 * 3 + 2];
+			real_t cx = std::fabs(e0y * e1z - e0z * e1y);
+			real_t cy = std::fabs(e0z * e1x - e0x * e1z);
+			real_t cz = std::fabs(e0x * e1y - e0y * e1x);
+			const real_t epsilon = std::numeric_limits<real_t>::epsilon();
+			if (cx > epsilon || cy > epsilon || cz > epsilon)
+			{
+				// Found a corner
+				if (!(cx > cy && cx > cz))
+				{
+					axes[0] = 0;
+					if (cz > cx && cz > cy)
+						axes[1] = 1;
+				}
+				break;
+			}
+		}
+
+		real_t area = 0;
+		for (size_t k = 0; k < npolys; ++k)
+		{
+			size_t vi0 = size_t(pFace[(k + 0) % npolys].vertex_index);
+			size_t vi1 = size_t(pFace[(k + 1) % npolys].vertex_index);
+			if (((vi0 * 3 + axes[0]) >= vertexLimit) || ((vi0 * 3 + axes[1]) >= vertexLimit) ||
+				((vi1 * 3 + axes[0]) >= vertexLimit) || ((vi1 * 3 + axes[1]) >= vertexLimit))
+				continue;
+			real_t v0x = v[vi0 * 3 + axes[0]];
+			real_t v0y = v[vi0 * 3 + axes[1]];
+			real_t v1x = v[vi1 * 3 + axes[0]];
+			real_t v1y = v[vi1 * 3 + axes[1]];
+			area += (v0x * v1y - v0y * v1x) * static_cast<real_t>(0.5);
+		}
+
+		// Ear clipping, with the same round limit against degenerate polygons
+		int maxRounds = 10;
+		std::vector<tinyobj::index_t> remaining(pFace, pFace + npolys);
+		size_t guess_vert = 0;
+		tinyobj::index_t ind[3];
+		real_t vx[3];
+		real_t vy[3];
+		while (remaining.size() > 3 && maxRounds > 0)
+		{
+			npolys = remaining.size();
+			if (guess_vert >= npolys)
+			{
+				maxRounds -= 1;
+				guess_vert -= npolys;
+			}
+			for (size_t k = 0; k < 3; k++)
+			{
+				ind[k] = remaining[(guess_vert + k) % npolys];
+				size_t vi = size_t(ind[k].vertex_index);
+				if (((vi * 3 + axes[0]) >= vertexLimit) || ((vi * 3 + axes[1]) >= vertexLimit))
+				{
+					vx[k] = static_cast<real_t>(0.0);
+					vy[k] = static_cast<real_t>(0.0);
+				}
+				else
+				{
+					vx[k] = v[vi * 3 + axes[0]];
+					vy[k] = v[vi * 3 + axes[1]];
+				}
+			}
+			real_t e0x = vx[1] - vx[0];
+			real_t e0y = vy[1] - vy[0];
+			real_t e1x = vx[2] - vx[1];
+			real_t e1y = vy[2] - vy[1];
+			real_t cross = e0x * e1y - e0y * e1x;
+			// Internal angle
+			if (cross * area < static_cast<real_t>(0.0))
+			{
+				guess_vert += 1;
+				continue;
+			}
+
+			// Check all other vertices in case they are inside this triangle
+			bool overlap = false;
+			for (size_t otherVert = 3; otherVert < npolys; ++otherVert)
+			{
+				size_t ovi = size_t(remaining[(guess_vert + otherVert) % npolys].vertex_index);
+				if (((ovi * 3 + axes[0]) >= vertexLimit) || ((ovi * 3 + axes[1]) >= vertexLimit))
+					continue;
+				real_t tx = v[ovi * 3 + axes[0]];
+				real_t ty = v[ovi * 3 + axes[1]];
+				// pnpoly for a triangle
+				bool inside = false;
+				for (int i = 0, j = 2; i < 3; j = i++)
+				{
+					if (((vy[i] > ty) != (vy[j] > ty)) && (tx < (vx[j] - vx[i]) * (ty - vy[i]) / (vy[j] - vy[i]) + vx[i]))
+						inside = !inside;
+				}
+				if (inside)
+				{
+					overlap = true;
+					break;
+				}
+			}
+			if (overlap)
+			{
+				guess_vert += 1;
+				continue;
+			}
+
+			// This triangle is an ear
+			emit(ind[0], ind[1], ind[2]);
+
+			// Remove its middle vertex
+			size_t removed = (guess_vert + 1) % npolys;
+			while (removed + 1 < npolys)
+			{
+				remaining[removed] = remaining[removed + 1];
+				removed += 1;
+			}
+			remaining.pop_back();
+		}
+
+		if (remaining.size() == 3)
+			emit(remaining[0], remaining[1], remaining[2]);
+	}
+
+	// Third pass, replays the chunks' statements in file order with tinyobj's shape rules
+	class ShapeBuilder
+	{
+	public:
+		ShapeBuilder(const tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+			std::vector<tinyobj::material_t>& materials, const std::string& mtlBasedir)
+			: m_attrib(attrib), m_shapes(shapes), m_materials(materials), m_materialReader(mtlBasedir)
+		{
+		}
+
+		void AddChunk(const Chunk& chunk)
+		{
+			size_t face = 0;
+			size_t corner = 0;
+			for (const Statement& statement : chunk.Statements)
+			{
+				AddFaces(chunk, face, statement.FaceCount, corner);
+				switch (statement.Type)
+				{
+				case Statement::UseMtl:
+				{
+					auto found = m_materialMap.find(statement.Text);
+					int materialId = found != m_materialMap.end() ? found->second : -1;
+					if (materialId != m_material)
+					{
+						// Faces with another material go into the same shape
+						Flush(statement.PositionCount);
+						m_material = materialId;
+					}
+					break;
+				}
+				case Statement::MtlLib:
+					LoadMaterials(statement.Text);
+					break;
+				case Statement::Group:
+					Flush(statement.PositionCount);
+					if (!m_shape.mesh.indices.empty())
+						m_shapes.push_back(std::move(m_shape));
+					ResetShape();
+					m_name = statement.Text;
+					break;
+				case Statement::Object:
+					if (Flush(statement.PositionCount))
+						m_shapes.push_back(std::move(m_shape));
+					ResetShape();
+					m_name = statement.Text;
+					break;
+				case Statement::Lines:
+					m_lineCount += statement.Value;
+					break;
+				case Statement::Smoothing:
+					m_smoothingId = statement.Value;
+					break;
+				}
+			}
+			AddFaces(chunk, face, chunk.FaceSizes.size(), corner);
+		}
+
+		void Finish(size_t positionCount)
+		{
+			if (Flush(positionCount) || !m_shape.mesh.indices.empty())
+				m_shapes.push_back(std::move(m_shape));
+		}
+
+	private:
+		// Faces of one chunk sharing a smoothing group
+		struct FaceRange
+		{
+			const Chunk* pChunk;
+			size_t FaceBegin;
+			size_t FaceEnd;
+			size_t CornerBegin;
+			u32 SmoothingId;
+		};
+
+		const tinyobj::attrib_t& m_attrib;
+		std::vector<tinyobj::shape_t>& m_shapes;
+		std::vector<tinyobj::material_t>& m_materials;
+		tinyobj::MaterialFileReader m_materialReader;
+		std::map<std::string, int> m_materialMap;
+
+		tinyobj::shape_t m_shape;
+		std::vector<FaceRange> m_faceGroup;
+		std::string m_name;
+		int m_material = -1;
+		u32 m_smoothingId = 0;
+		// tinyobj swaps its pending line group with the shape's path on every flush
+		size_t m_lineCount = 0;
+		size_t m_shapeLineCount = 0;
+
+		void AddFaces(const Chunk& chunk, size_t& face, size_t faceEnd, size_t& corner)
+		{
+			if (faceEnd == face)
+				return;
+			FaceRange range = { &chunk, face, faceEnd, corner, m_smoothingId };
+			m_faceGroup.push_back(range);
+			for (; face < faceEnd; face++)
+				corner += chunk.FaceSizes[face];
+		}
+
+		void ResetShape()
+		{
+			m_shape = tinyobj::shape_t();
+			m_shapeLineCount = 0;
+		}
+
+		// exportGroupsToShape
+		bool Flush(size_t positionCount)
+		{
+			if (m_faceGroup.empty() && m_lineCount == 0)
+				return false;
+
+			if (!m_faceGroup.empty())
+			{
+				size_t cornerCount = 0;
+				for (const FaceRange& range : m_faceGroup)
+				{
+					const Chunk& chunk = *range.pChunk;
+					for (size_t face = range.FaceBegin; face < range.FaceEnd; face++)
+						cornerCount += chunk.FaceSizes[face];
+				}
+				m_shape.mesh.indices.reserve(m_shape.mesh.indices.size() + cornerCount);
+
+				for (const FaceRange& range : m_faceGroup)
+				{
+					const Chunk& chunk = *range.pChunk;
+					size_t corner = range.CornerBegin;
+					for (size_t face = range.FaceBegin; face < range.FaceEnd; face++)
+					{
+						TriangulateFace(&chunk.Corners[corner], chunk.FaceSizes[face], m_attrib.vertices,
+							positionCount * 3, m_material, range.SmoothingId, m_shape.mesh);
+						corner += chunk.FaceSizes[face];
+					}
+				}
+				m_shape.name = m_name;
+				m_faceGroup.clear();
+			}
+
+			if (m_lineCount != 0)
+			{
+				size_t swap = m_lineCount;
+				m_lineCount = m_shapeLineCount;
+				m_shapeLineCount = swap;
+			}
+			return true;
+		}
+
+		void LoadMaterials(const std::string& filenames)
+		{
+			// Same split as tinyobj, the first file that opens wins
+			std::stringstream ss(filenames);
+			std::string filename;
+			while (std::getline(ss, filename, ' '))
+			{
+				std::string err;
+				if (m_materialReader(filename, &m_materials, &m_materialMap, &err))
+					return;
+			}
+		}
+	};
+
+	// Parses filepath with threadCount threads (0 for one per core) into tinyobj's structures.
+	// Returns false and sets err on the same failures tinyobj::LoadObj reports.
+	inline bool LoadObj(tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes, std::vector<tinyobj::material_t>& materials,
+		std::string& err, const std::string& filepath, const std::string& mtlBasedir, u32 threadCount = 0)
+	{
+		attrib = tinyobj::attrib_t();
+		shapes.clear();
+
+		MappedFile file;
+		if (!file.Open(filepath))
+		{
+			// Empty files cannot be mapped but are still valid
+			FileStamp stamp;
+			if (!GetFileStamp(filepath, stamp) || stamp.Size != 0)
+			{
+				err = "Cannot open file [" + filepath + "]\n";
+				return false;
+			}
+		}
+
+		threadCount = WorkerCount(threadCount);
+		// Not worth a thread below a few hundred KB
+		const u64 minChunkSize = 256 * 1024;
+		u64 chunkCount = Math::Min((u64) threadCount, file.Size() / minChunkSize + 1);
+
+		// Chunks end just after a '\n' so no line (or "\r\n") is split
+		const char* pData = (const char*) file.Data();
+		const char* pDataEnd = pData + file.Size();
+		std::vector<Chunk> chunks((size_t) chunkCount);
+		const char* pChunkBegin = pData;
+		for (u64 i = 0; i < chunkCount; i++)
+		{
+			const char* pChunkEnd = pDataEnd;
+			if (i + 1 < chunkCount)
+			{
+				pChunkEnd = pData + file.Size() * (i + 1) / chunkCount;
+				if (pChunkEnd < pChunkBegin)
+					pChunkEnd = pChunkBegin;
+				const char* pNewLine = (const char*) memchr(pChunkEnd, '\n', (size_t) (pDataEnd - pChunkEnd));
+				pChunkEnd = pNewLine ? pNewLine + 1 : pDataEnd;
+			}
+			chunks[i].pBegin = pChunkBegin;
+			chunks[i].pEnd = pChunkEnd;
+			pChunkBegin = pChunkEnd;
+		}
+
+		ParallelFor(chunks.size(), (u32) chunks.size(), [&chunks](size_t i) { CountAttributes(chunks[i]); });
+
+		size_t positionCount = 0, normalCount = 0, texcoordCount = 0;
+		for (Chunk& chunk : chunks)
+		{
+			chunk.PositionBase = positionCount;
+			chunk.NormalBase = normalCount;
+			chunk.TexcoordBase = texcoordCount;
+			positionCount += chunk.PositionCount;
+			normalCount += chunk.NormalCount;
+			texcoordCount += chunk.TexcoordCount;
+		}
+		attrib.vertices.resize(positionCount * 3);
+		attrib.normals.resize(normalCount * 3);
+		attrib.texcoords.resize(texcoordCount * 2);
+
+		ParallelFor(chunks.size(), (u32) chunks.size(), [&chunks, &attrib](size_t i) { ParseChunk(chunks[i], attrib); });
+
+		for (const Chunk& chunk : chunks)
+		{
+			if (chunk.Failed)
+			{
+				err = "Failed parse `f' line(e.g. zero value for face index).\n";
+				return false;
+			}
+		}
+
+		std::string baseDir = mtlBasedir;
+		if (!baseDir.empty())
+		{
+#ifndef _WIN32
+			const char dirsep = '/';
+#else
+			const char dirsep = '\\';
+#endif
+			if (baseDir[baseDir.length() - 1] != dirsep)
+				baseDir += dirsep;
+		}
+		ShapeBuilder builder(attrib, shapes, materials, baseDir);
+		for (const Chunk& chunk : chunks)
+			builder.AddChunk(chunk);
+		builder.Finish(positionCount);
+		return true;
+	}
+}
+
+// ImportOBJ on top of the multithreaded parser, the resulting model is identical
+inline void ImportOBJParallel(const std::string& filepath, ObjModel& model, u32 threadCount = 0)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+	std::string basepath = filepath.substr(0, filepath.find_last_of("/") + 1);
+	if(!ObjParser::LoadObj(attrib, shapes, materials, err, filepath, basepath, threadCount))
+	{
+		throw std::runtime_error(err);
+	}
+
+	BuildObjModel(filepath, basepath, attrib, shapes, materials, model);
+}
+
+}
+
+#endif //!OBJ_PARSER_H
@@ -1,12 +1,12 @@
 #pragma once
 
+#include <cassert>
 #include <iostream>
 #include <locale>
 #include <codecvt>
 #include <string>
 
 #include "../3rdParty/FrankLuna/d3dApp.h"
-#include "../3rdParty/tinyobjloader/tiny_obj_loader.h"
 
 #include "Core.h"
 #include "MathUtil.h"
@@ -15,6 +15,15 @@
 #include "Texture.h"
 #include "Material.h"
 #include "Mesh.h"
+#include "GeometryCache.h"
+#include "ObjLoader.h"
+#include "ObjParser.h"
+#include "MeshCache.h"
+#include "Profiler.h"
+#include "Benchmarks.h"
+#include "FrameRenderer.h"
+#include "UploadPageSource.h"
+#include "TextureCompressor.h"
 
   
 using Microsoft::WRL::ComPtr;
@@ -24,41 +33,97 @@ using namespace Loxodonta;
 
 
 const int NUM_FRAME_RESOURCES = 3;
+// Command lists a frame can be split into, each frame resource has an allocator for every one
+const u32 MAX_COMMAND_LISTS = 8;
 
-struct RenderItem
+// What every command list of a frame binds the same way, filled in by BeginCommands before recording starts
+struct RecordState
 {
-	RenderItem() = default;
+	ID3D12PipelineState* LayerPSOs[(int) RenderLayer::Count] = {};
+	CD3DX12_GPU_DESCRIPTOR_HANDLE HeapStart;
+	uint DescriptorSize = 0;
+};
+
+// One of the command lists of a frame, recorded by one worker thread
+class D3D12Recorder : public CommandRecorder
+{
+public:
+	ComPtr<ID3D12GraphicsCommandList> CommandList;
+	const RecordState* pState = nullptr;
 
-	// Object's local space to World Space
-	float4x4 World = Matrix::Identity4x4();
-	float4x4 TexTransform = Matrix::Identity4x4();
+	// A reset command list has nothing bound
+	void ResetBindings() { m_Bindings = DrawBindings(); }
 
-	int numFramesDirty = NUM_FRAME_RESOURCES;
-	uint objCBIndex = -1;
+	void SetLayer(RenderLayer layer) override
+	{
+		// Wireframe mode leaves the list on the PSO it was reset with for every layer
+		ID3D12PipelineState* pso = pState->LayerPSOs[(int) layer];
+		if(pso != nullptr)
+			CommandList->SetPipelineState(pso);
+	}
 
-	Material* Mat = nullptr;
-	Mesh* Geo = nullptr;
+	void SetGeometry(const Mesh* mesh, D3D12_PRIMITIVE_TOPOLOGY topology) override
+	{
+		// Meshes in the arena share its buffers, only rebind when the mesh uses different ones
+		const D3D12_VERTEX_BUFFER_VIEW vbv = mesh->VertexBufferView();
+		if(vbv.BufferLocation != m_Bindings.VertexBuffer)
+		{
+			CommandList->IASetVertexBuffers(0, 1, &vbv);
+			m_Bindings.VertexBuffer = vbv.BufferLocation;
+		}
 
-	D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		const D3D12_INDEX_BUFFER_VIEW ibv = mesh->IndexBufferView();
+		if(ibv.BufferLocation != m_Bindings.IndexBuffer || ibv.Format != m_Bindings.IndexFormat)
+		{
+			CommandList->IASetIndexBuffer(&ibv);
+			m_Bindings.IndexBuffer = ibv.BufferLocation;
+			m_Bindings.IndexFormat = ibv.Format;
+		}
 
-	uint indexCount = 0;
-	uint startIndexLocation = 0;
-	int baseVertexLocation = 0;
-};
+		if(topology != m_Bindings.Topology)
+		{
+			CommandList->IASetPrimitiveTopology(topology);
+			m_Bindings.Topology = topology;
+		}
+	}
 
-enum class RenderLayer : int
-{
-	Opaque = 0,
-	OpaqueAmrn,
-	OpaqueAsrnd,
-	OpaqueTextureless,
-	Transparent,
-	AlphaTested,
-	SkyBox,
-	Count
+	void SetDiffuse(const Texture* texture) override
+	{
+		CD3DX12_GPU_DESCRIPTOR_HANDLE Tex(pState->HeapStart);
+
+		if(texture != nullptr)
+			Tex.Offset(texture->SRVHeapIndex, pState->DescriptorSize);
+
+		// Root arguments survive PSO changes under the same root signature
+		if(Tex.ptr != m_Bindings.DiffuseTable)
+		{
+			CommandList->SetGraphicsRootDescriptorTable(4, Tex);
+			m_Bindings.DiffuseTable = Tex.ptr;
+		}
+	}
+
+	void DrawIndexedInstanced(u32 indexCount, u32 instanceCount, u32 startIndex, i32 baseVertex, u32 baseInstance) override
+	{
+		// SV_InstanceID restarts at 0 for every draw, the shaders add this to find their instance
+		CommandList->SetGraphicsRoot32BitConstant(0, baseInstance, 0);
+		CommandList->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, 0);
+	}
+
+private:
+	// Per draw state last set on CommandList, used to skip binds that change nothing
+	struct DrawBindings
+	{
+		D3D12_GPU_VIRTUAL_ADDRESS VertexBuffer = 0;
+		D3D12_GPU_VIRTUAL_ADDRESS IndexBuffer = 0;
+		DXGI_FORMAT IndexFormat = DXGI_FORMAT_UNKNOWN;
+		D3D12_PRIMITIVE_TOPOLOGY Topology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+		UINT64 DiffuseTable = 0;
+	};
+	DrawBindings m_Bindings;
 };
 
-class PBRApp : public D3DApp
+// D3D12 window application, and the backend its FrameRenderer records into
+class PBRApp : public D3DApp, public RenderBackend
 {
 public:
 	PBRApp(HINSTANCE hInstance);
@@ -68,6 +133,9 @@ public:
 
 	virtual bool Initialize()override;
 
+	// Vertex buffer layout of every mesh built afterwards, set before Initialize
+	void SetVertexFormat(VertexFormat format);
+
 private:
 	virtual void OnResize()override;
 	void OnKeyboardInput(const GameTimer& gt);
@@ -79,6 +147,7 @@ private:
 	void LoadTextures();
 	void LoadModels();
 	void LoadOBJModel(std::string filepath);
+	void CreateOBJMesh(const std::string& objName, const std::string& basepath, const ObjModelView& view);
 	void AddImageTexture(Texture *&pTexture, std::string basepath, std::string texName);
 
 	void BuildRootSignature();
@@ -88,27 +157,48 @@ private:
 	void BuildMaterials();	
 	void BuildGeometry();
 	void BuildRenderItems();
+	void BuildLights();
+	RenderItem* AddRenderItem(Mesh* geo, const Submesh& submesh, Material* mat);
 	void BuildFrameResources();
+	void BuildCommandLists();
 	void BuildPSOs();
 
 	void UpdateCamera(const GameTimer& gt);
 	void AnimateMaterials(const GameTimer& gt);
-	void UpdateObjectCBs(const GameTimer& gt);
-	void UpdateMainPassCB(const GameTimer& gt);
-	void UpdateMaterialCBs(const GameTimer& gt);
 
 	virtual void Update(const GameTimer& gt)override;
 	virtual void Draw(const GameTimer& gt)override;
-	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
+
+	// RenderBackend
+	void BeginFrame() override;
+	void Reserve(u32 instanceCount, u32 materialCount, u32 lightCount) override;
+	InstanceData* MapInstances() override;
+	void WriteMaterial(u32 slot, const MaterialProperties& material) override;
+	void WritePass(const PassConstants& pass) override;
+	void WriteLight(u32 slot, const LocalLight& light) override;
+	void WriteLightClusters(const LightClusters::ClusterLists& clusters) override;
+	u32 MaxCommandLists() const override;
+	void BeginCommands(u32 listCount) override;
+	CommandRecorder& Recorder(u32 list) override;
+	void EndFrame() override;
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 	
 private:
+	// Copies data rewritten every frame into the transient pages, returns where the GPU reads it
+	D3D12_GPU_VIRTUAL_ADDRESS CopyTransient(const void* pData, u64 size);
 
 	std::vector <std::unique_ptr<FrameResource>> m_FrameResources;
 	FrameResource* m_CurrFrameResource = nullptr;
 	int m_currFrameResourceIndex = 0;
 
+	// Upload pages for data rewritten every frame, retired by fence value instead of per frame resource
+	UploadPageSource m_UploadPages;
+	TransientAllocator m_TransientConstants;
+	D3D12_GPU_VIRTUAL_ADDRESS m_PassConstants = 0;
+	D3D12_GPU_VIRTUAL_ADDRESS m_LightClusters = 0;
+	D3D12_GPU_VIRTUAL_ADDRESS m_ClusterLightIndices = 0;
+
 	uint m_cbvSrvDescriptorSize = 0;
 
 	ComPtr<ID3D12RootSignature> m_RootSignature = nullptr;
@@ -117,7 +207,12 @@ private:
 
 	Camera m_Camera;
 
+	// Shared vertex and index buffers the meshes suballocate from, declared first so it outlives them
+	GeometryArena m_GeometryArena;
 	std::unordered_map<std::string, std::unique_ptr<Mesh>> m_Meshes;
+	// Procedural shapes shared between scene objects, and the shape each named object uses
+	GeometryCache m_GeometryCache;
+	std::unordered_map<std::string, Mesh*> m_SceneGeometry;
 	std::unordered_map<std::string, std::unique_ptr<Material>> m_Materials;
 	std::unordered_map<std::string, std::vector<std::unique_ptr<Texture>>> m_Textures;
 
@@ -125,15 +220,18 @@ private:
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> m_PSOs;
 
 	std::vector<D3D12_INPUT_ELEMENT_DESC> m_InputLayout;
+	VertexFormat m_VertexFormat = VertexFormat::Full;
 
-	// List of all the render items.
-	std::vector<std::unique_ptr<RenderItem>> m_AllRenderItems;
+	// Per frame command lists, m_CommandList is left to initialization work
+	std::vector<D3D12Recorder> m_Recorders;
+	u32 m_ListCount = 0;
+	RecordState m_RecordState;
+
+	// Render items and everything the frame loop does with them short of calling D3D12
+	FrameRenderer m_Renderer;
+	// Threads recording the frame's command lists, 0 for one per core
+	u32 m_RecordThreads = 0;
 
-	// Render items divided by PSO
-	std::vector<RenderItem*> m_RenderItemLayer[(int) RenderLayer::Count];
-	
-	PassConstants m_MainPassCB;    
-	
 	POINT m_LastMousePos;
 };
 
@@ -148,7 +246,32 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 
 	try
 	{
+		// Headless CPU benchmarks, no window or device is created
+		if (strstr(cmdLine, "-benchmark") != nullptr)
+		{
+			std::ofstream report("benchmark.txt");
+			Benchmarks::RunAll(report);
+			return 0;
+		}
+
+		// Offline BCn compression of the material maps, the .dds files are written next to their sources.
+		// -quality=fast|best trades encode time against PSNR, the default sits in between.
+		if (strstr(cmdLine, "-compress-textures") != nullptr)
+		{
+			BlockCompression::Quality quality = BlockCompression::Quality::Normal;
+			if (strstr(cmdLine, "-quality=fast") != nullptr)
+				quality = BlockCompression::Quality::Fast;
+			else if (strstr(cmdLine, "-quality=best") != nullptr)
+				quality = BlockCompression::Quality::Best;
+			std::ofstream report("compress.txt");
+			TextureCompressor::CompressFolder(report, L"../../../Assets", quality);
+			return 0;
+		}
+
 		PBRApp theApp(hInstance);
+		// 20 byte quantized vertices instead of 56 byte float ones
+		if (strstr(cmdLine, "-packed-vertices") != nullptr)
+			theApp.SetVertexFormat(VertexFormat::Packed);
 		if (!theApp.Initialize())
 			return 0;
 
@@ -193,9 +316,19 @@ bool PBRApp::Initialize()
 	BuildCamera();
 	BuildShadersAndInputLayout();
 	BuildMaterials();
+
+	const u32 vertexStride = (m_VertexFormat == VertexFormat::Packed) ? sizeof(PackedVertex) : sizeof(Vertex);
+	m_GeometryArena.Initialize(m_D3dDevice, vertexStride, 1 << 20, 4 << 20, 4 << 20);
+	m_GeometryCache.SetArena(&m_GeometryArena);
+	m_UploadPages.Initialize(m_D3dDevice);
+	m_TransientConstants.Initialize(&m_UploadPages);
+
 	BuildGeometry();
 	BuildRenderItems();
+	BuildLights();
+	m_Renderer.BuildInstanceBatches();
 	BuildFrameResources();
+	BuildCommandLists();
 	BuildPSOs();
 
 	// Execute the initialization commands.
@@ -206,9 +339,18 @@ bool PBRApp::Initialize()
 	// Wait until initialization is complete.
 	FlushCommandQueue();
 
+	m_GeometryArena.DisposeUploaders();
+	LogLine("GeometryArena: " + m_GeometryArena.Describe());
+
 	return true;
 }
 
+void PBRApp::SetVertexFormat(VertexFormat format)
+{
+	m_VertexFormat = format;
+	m_GeometryCache.SetVertexFormat(format);
+}
+
 void PBRApp::OnResize()
 {
 	D3DApp::OnResize();
@@ -221,7 +363,18 @@ void PBRApp::Update(const GameTimer& gt)
 {
 	OnKeyboardInput(gt);
 	UpdateCamera(gt);
+	AnimateMaterials(gt);
+
+	m_Renderer.Update(*this, m_Camera, m_clientWidth, m_clientHeight, gt.TotalTime(), gt.DeltaTime());
+}
+
+void PBRApp::Draw(const GameTimer& gt)
+{
+	m_Renderer.Record(*this, m_RecordThreads);
+}
 
+void PBRApp::BeginFrame()
+{
 	// Cycle through the circular frame resource array
 	m_currFrameResourceIndex = (m_currFrameResourceIndex + 1) % NUM_FRAME_RESOURCES;
 	m_CurrFrameResource = m_FrameResources[m_currFrameResourceIndex].get();
@@ -236,101 +389,156 @@ void PBRApp::Update(const GameTimer& gt)
 		CloseHandle(eventHandle);
 	}
 
-	AnimateMaterials(gt);
-	UpdateObjectCBs(gt);
-	UpdateMaterialCBs(gt);
-	UpdateMainPassCB(gt);
+	// Transient pages of frames the GPU has finished can take this frame's data
+	m_TransientConstants.Retire(m_Fence->GetCompletedValue());
 }
 
-void PBRApp::Draw(const GameTimer& gt)
+void PBRApp::Reserve(u32 instanceCount, u32 materialCount, u32 lightCount)
+{
+	// BeginFrame waited for the GPU to finish with the current frame resource, its buffers can be replaced
+	m_CurrFrameResource->Reserve(m_D3dDevice.Get(), instanceCount, materialCount, lightCount);
+}
+
+InstanceData* PBRApp::MapInstances()
+{
+	// The instance buffer is a structured buffer, its elements are packed without constant buffer padding
+	return reinterpret_cast<InstanceData*>(m_CurrFrameResource->InstanceBuffer->MappedData());
+}
+
+void PBRApp::WriteMaterial(u32 slot, const MaterialProperties& material)
+{
+	m_CurrFrameResource->MaterialBuffer->CopyData(slot, material);
+}
+
+void PBRApp::WritePass(const PassConstants& pass)
+{
+	// Pass constants are written anew every frame, they come from the transient pages
+	m_PassConstants = CopyTransient(&pass, sizeof(PassConstants));
+}
+
+void PBRApp::WriteLight(u32 slot, const LocalLight& light)
+{
+	// CopyData does not check, Reserve must have made room for every light
+	assert(slot < m_CurrFrameResource->LightCapacity);
+	m_CurrFrameResource->LightBuffer->CopyData(slot, light);
+}
+
+void PBRApp::WriteLightClusters(const LightClusters::ClusterLists& clusters)
+{
+	m_LightClusters = CopyTransient(clusters.Clusters.data(), clusters.Clusters.size() * sizeof(LightClusters::ClusterRange));
+	m_ClusterLightIndices = CopyTransient(clusters.Indices.data(), clusters.Indices.size() * sizeof(u32));
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS PBRApp::CopyTransient(const void* pData, u64 size)
+{
+	// Empty lists still get memory of their own, root descriptors need a valid address
+	TransientAllocation allocation = m_TransientConstants.Allocate(Math::Max(size, (u64) 16));
+	if(size != 0)
+		std::memcpy(allocation.pCpu, pData, (size_t) size);
+	return allocation.GpuAddress;
+}
+
+u32 PBRApp::MaxCommandLists() const
+{
+	return MAX_COMMAND_LISTS;
+}
+
+void PBRApp::BeginCommands(u32 listCount)
 {
 	ThrowIfFailed(m_D3dDevice.Get()->GetDeviceRemovedReason());
 
-	auto cmdListAlloc = m_CurrFrameResource->CmdListAlloc;
+	m_ListCount = listCount;
+	ID3D12PipelineState* initialPSO = m_isWireframe ? m_PSOs["opaque_wireframe"].Get() : m_PSOs["opaque"].Get();
 
-	// Reuse the memory associated with command recording
-	// We can only reset when the associated command lists have finished execution on the GPU
-	ThrowIfFailed(cmdListAlloc->Reset());
+	// Looked up once here, the recording threads only read them
+	static const char* psoNames[(int) RenderLayer::Count] = {"opaque", "opaqueAmrn", "opaqueAsrnd", "opaqueTextureless",
+		"transparent", "alphaTested", "skybox"};
+	for(int layer = 0; layer < (int) RenderLayer::Count; layer++)
+		m_RecordState.LayerPSOs[layer] = m_isWireframe ? nullptr : m_PSOs[psoNames[layer]].Get();
+	m_RecordState.HeapStart = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_SrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
+	m_RecordState.DescriptorSize = m_cbvSrvDescriptorSize;
 
-	// A command list can be reset after it has been added to the command queue via ExecuteCommandList.
-	// Reusing the command list reuses memory.
-	if (m_isWireframe)
-	{
-		ThrowIfFailed(m_CommandList->Reset(cmdListAlloc.Get(), m_PSOs["opaque_wireframe"].Get()));
-	}
-	else
+	CD3DX12_GPU_DESCRIPTOR_HANDLE SkyTex(m_SrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
+	SkyTex.Offset(m_Textures["sky_box"][0]->SRVHeapIndex, m_cbvSrvDescriptorSize );
+	auto matBuffer = m_CurrFrameResource->MaterialBuffer->Resource();
+	auto instanceBuffer = m_CurrFrameResource->InstanceBuffer->Resource();
+	auto lightBuffer = m_CurrFrameResource->LightBuffer->Resource();
+
+	for(u32 i = 0; i < listCount; i++)
 	{
-		ThrowIfFailed(m_CommandList->Reset(cmdListAlloc.Get(), m_PSOs["opaque"].Get()));
-	}
+		auto cmdListAlloc = m_CurrFrameResource->CmdListAllocs[i];
+		ID3D12GraphicsCommandList* commandList = m_Recorders[i].CommandList.Get();
+
+		// Reuse the memory associated with command recording
+		// We can only reset when the associated command lists have finished execution on the GPU
+		ThrowIfFailed(cmdListAlloc->Reset());
+		ThrowIfFailed(commandList->Reset(cmdListAlloc.Get(), initialPSO));
+		m_Recorders[i].ResetBindings();
+
+		commandList->RSSetViewports(1, &m_ScreenViewport);
+		commandList->RSSetScissorRects(1, &m_ScissorRect);
 
-	m_CommandList->RSSetViewports(1, &m_ScreenViewport);
-	m_CommandList->RSSetScissorRects(1, &m_ScissorRect);
+		// The first list runs first on the queue, it prepares the targets for the others
+		if(i == 0)
+		{
+			// Indicate a state transition on the resource usage.
+			commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
+				D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
+
+			// Clear the back buffer and depth buffer.
+			float clearColor[] = {0.5f, 0.5f, 0.5f, 1.0f};
+			commandList->ClearRenderTargetView(CurrentBackBufferView(), clearColor, 0, nullptr);
+			commandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+		}
 
-	// Indicate a state transition on the resource usage.
-	m_CommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
-		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
+		// Specify the buffers we are going to render to.
+		commandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
 
-	// Clear the back buffer and depth buffer.
-	float clearColor[] = {0.5f, 0.5f, 0.5f, 1.0f};
-	m_CommandList->ClearRenderTargetView(CurrentBackBufferView(), clearColor, 0, nullptr);
-	m_CommandList->ClearDepthStencilView(DepthStencilView(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+		ID3D12DescriptorHeap* DescriptorHeaps[] = { m_SrvDescriptorHeap.Get() };
+		commandList->SetDescriptorHeaps(_countof(DescriptorHeaps), DescriptorHeaps);
 
-	// Specify the buffers we are going to render to.
-	m_CommandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
+		// Root arguments do not carry over between command lists, every list binds its own
+		commandList->SetGraphicsRootSignature(m_RootSignature.Get());
+		commandList->SetGraphicsRootConstantBufferView(1, m_PassConstants);
 
-	ID3D12DescriptorHeap* DescriptorHeaps[] = { m_SrvDescriptorHeap.Get() };
-	m_CommandList->SetDescriptorHeaps(_countof(DescriptorHeaps), DescriptorHeaps);
+		// Bind all materials and instances, shaders index into them per instance
+		commandList->SetGraphicsRootShaderResourceView(2, matBuffer->GetGPUVirtualAddress());
+		commandList->SetGraphicsRootShaderResourceView(5, instanceBuffer->GetGPUVirtualAddress());
 
-	m_CommandList->SetGraphicsRootSignature(m_RootSignature.Get());
+		// Local lights and the clusters they reach this frame
+		commandList->SetGraphicsRootShaderResourceView(6, lightBuffer->GetGPUVirtualAddress());
+		commandList->SetGraphicsRootShaderResourceView(7, m_LightClusters);
+		commandList->SetGraphicsRootShaderResourceView(8, m_ClusterLightIndices);
 
-	// Bind per pass constant buffer. We only need to do this once per pass
-	auto passCB = m_CurrFrameResource->PassCB->Resource();
-	m_CommandList->SetGraphicsRootConstantBufferView(1, passCB->GetGPUVirtualAddress());
+		commandList->SetGraphicsRootDescriptorTable(3, SkyTex);
+	}
 
 	ThrowIfFailed(m_D3dDevice.Get()->GetDeviceRemovedReason());
+}
 
-	// Opaque Draw pass
-	DrawRenderItems(m_CommandList.Get(), m_RenderItemLayer[(int)RenderLayer::Opaque]);	
-	// Opaque ASMRND Draw Pass
-	if(!m_isWireframe)
-		m_CommandList->SetPipelineState(m_PSOs["opaqueAsrnd"].Get());
-	DrawRenderItems(m_CommandList.Get(), m_RenderItemLayer[(int) RenderLayer::OpaqueAsrnd]);
-	// Opaque DMRN Draw Pass
-	if(!m_isWireframe)
-		m_CommandList->SetPipelineState(m_PSOs["opaqueAmrn"].Get());
-	DrawRenderItems(m_CommandList.Get(), m_RenderItemLayer[(int) RenderLayer::OpaqueAmrn]);
-	// Opaque Textureless Draw Pass
-	if(!m_isWireframe)
-		m_CommandList->SetPipelineState(m_PSOs["opaqueTextureless"].Get());
-	DrawRenderItems(m_CommandList.Get(), m_RenderItemLayer[(int) RenderLayer::OpaqueTextureless]);
-
-
-	// AlphaTested Draw pass
-	if(!m_isWireframe)
-		m_CommandList->SetPipelineState(m_PSOs["alphaTested"].Get());
-	DrawRenderItems(m_CommandList.Get(), m_RenderItemLayer[(int) RenderLayer::AlphaTested]);
-
-	// Transparent Draw pass
-	if (!m_isWireframe)
-		m_CommandList->SetPipelineState(m_PSOs["transparent"].Get());
-	DrawRenderItems(m_CommandList.Get(), m_RenderItemLayer[(int) RenderLayer::Transparent]);
-
-	if (!m_isWireframe)
-		m_CommandList->SetPipelineState(m_PSOs["skybox"].Get());
-	DrawRenderItems(m_CommandList.Get(), m_RenderItemLayer[(int) RenderLayer::SkyBox]);
-
-	// Indicate a state transition on the resource usage.
-	m_CommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
+CommandRecorder& PBRApp::Recorder(u32 list)
+{
+	return m_Recorders[list];
+}
+
+void PBRApp::EndFrame()
+{
+	// Indicate a state transition on the resource usage, after the last list has drawn.
+	m_Recorders[m_ListCount - 1].CommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
 		D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
 
 	// Done recording commands.
-	ThrowIfFailed(m_CommandList->Close());
+	ID3D12CommandList* cmdsLists[MAX_COMMAND_LISTS];
+	for(u32 i = 0; i < m_ListCount; i++)
+	{
+		ThrowIfFailed(m_Recorders[i].CommandList->Close());
+		cmdsLists[i] = m_Recorders[i].CommandList.Get();
+	}
 
 	ThrowIfFailed(m_D3dDevice.Get()->GetDeviceRemovedReason());
 
-	// Add the command list to the queue for execution.
-	ID3D12CommandList* cmdsLists[] = { m_CommandList.Get() };
-	m_CommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
+	// Add the command lists to the queue for execution, in one submission and in order.
+	m_CommandQueue->ExecuteCommandLists(m_ListCount, cmdsLists);
 	ThrowIfFailed(m_D3dDevice.Get()->GetDeviceRemovedReason());
 
 	// swap the back and front buffers
@@ -346,9 +554,9 @@ void PBRApp::Draw(const GameTimer& gt)
 	// Because we are on the GPU timeline, the new fence point won't be
 	// set until the GPU finishes processing all the commands prior to this Signal().
 	m_CommandQueue->Signal(m_Fence.Get(), m_currentFence);
+	m_TransientConstants.Commit(m_currentFence);
 
 	ThrowIfFailed(m_D3dDevice.Get()->GetDeviceRemovedReason());
-
 }
 
 void PBRApp::OnMouseDown(WPARAM btnState, int x, int y)
@@ -414,188 +622,32 @@ void PBRApp::AnimateMaterials(const GameTimer& gt)
 }
 
 
-void PBRApp::UpdateObjectCBs(const GameTimer& gt)
-{
-	auto currObjectCB = m_CurrFrameResource->ObjectCB.get();
-	for(auto& Item : m_AllRenderItems)
-	{
-		// loop through all render items
-		if(Item->numFramesDirty > 0)
-		{
-			// if they have a dirty frame, update the object CB
-			vect4 World = Matrix::LoadFloat4x4(&Item->World);
-			vect4 TexTransform = Matrix::LoadFloat4x4(&Item->TexTransform);
-
-			ObjectConstants objConstants;
-			Matrix::StoreFloat4x4(&objConstants.World,        Matrix::Transpose(World));
-			Matrix::StoreFloat4x4(&objConstants.TexTransform, Matrix::Transpose(TexTransform));
-
-			currObjectCB->CopyData(Item->objCBIndex, objConstants);
-
-			Item->numFramesDirty--;
-		}
-	}
-}
-
-void PBRApp::UpdateMaterialCBs(const GameTimer& gt)
-{
-	auto CurrMaterialCB = m_CurrFrameResource->MaterialCB.get();
-	for (auto& M : m_Materials)
-	{
-		// Only update the cbuffer data if the constants have changed
-		Material* Mat = M.second.get();
-		if (Mat->NumFramesDirty > 0)
-		{
-			CurrMaterialCB->CopyData(Mat->MatCBIndex, Mat->Properties);
-			Mat->NumFramesDirty--;
-		}
-	}
-}
-
-void PBRApp::UpdateMainPassCB(const GameTimer& gt)
-{
-	vect4 View = m_Camera.GetViewMatrix();
-	vect4 Proj = m_Camera.GetProjectionMatrix();
-	vect4 ViewProj = Matrix::Multiply(View, Proj);
-	vect4 InvView = Matrix::Inverse(&Matrix::Determinant(View), View);
-	vect4 InvProj = Matrix::Inverse(&Matrix::Determinant(Proj), Proj);
-	vect4 InvViewProj = Matrix::Inverse(&Matrix::Determinant(ViewProj), ViewProj);
-
-	Matrix::StoreFloat4x4(&m_MainPassCB.View,        Matrix::Transpose(View));
-	Matrix::StoreFloat4x4(&m_MainPassCB.InvView,     Matrix::Transpose(InvView));
-	Matrix::StoreFloat4x4(&m_MainPassCB.Proj,        Matrix::Transpose(Proj));
-	Matrix::StoreFloat4x4(&m_MainPassCB.InvProj,     Matrix::Transpose(InvProj));
-	Matrix::StoreFloat4x4(&m_MainPassCB.ViewProj,    Matrix::Transpose(ViewProj));
-	Matrix::StoreFloat4x4(&m_MainPassCB.InvViewProj, Matrix::Transpose(InvViewProj));
-	Vector::StoreFloat3(&m_MainPassCB.EyePosW, m_Camera.GetPosition());
-	m_MainPassCB.RenderTargetSize = float2((float) m_clientWidth, (float) m_clientHeight);
-	m_MainPassCB.InvRenderTargetSize = float2(1.0f / m_clientWidth, 1.0f / m_clientHeight);
-	m_MainPassCB.NearZ = m_Camera.GetNearZ();
-	m_MainPassCB.FarZ = m_Camera.GetFarZ();
-	m_MainPassCB.TotalTime = gt.TotalTime();
-	m_MainPassCB.DeltaTime = gt.DeltaTime();
-
-	m_MainPassCB.AmbientLight = { 0.03f, 0.03f, 0.03f, 1.0f };
-	// Direction Light
-	m_MainPassCB.Lights[0].Direction = { 0.57735f, 0.57735f, 0.57735f };
-	m_MainPassCB.Lights[0].Strength = {0.25f, 0.25f, 0.25f };
-	m_MainPassCB.Lights[1].Direction = {0.57735f, -0.57735f, 0.57735f};
-	m_MainPassCB.Lights[1].Strength = {0.25f, 0.25f, 0.25f};
-	m_MainPassCB.Lights[2].Direction = {-0.57735f, 0.57735f, 0.57735f};
-	m_MainPassCB.Lights[2].Strength = {0.25f, 0.25f, 0.25f};
-	m_MainPassCB.Lights[3].Direction = {-0.57735f, -0.57735f, 0.57735f};
-	m_MainPassCB.Lights[3].Strength = {0.25f, 0.25f, 0.25f};
-
-	// Point Lights
-	//m_MainPassCB.Lights[0].Position = { 20.0f,  20.0f, -20.0f };
-	//m_MainPassCB.Lights[0].Strength = { 100.0f,  100.0f,  100.0f };
-	//m_MainPassCB.Lights[1].Position = {-20.0f,  20.0f, -20.0f};
-	//m_MainPassCB.Lights[1].Strength = { 100.0f,  100.0f,  100.0f };
-	//m_MainPassCB.Lights[2].Position = { 20.0f, -20.0f, -20.0f};
-	//m_MainPassCB.Lights[2].Strength = { 100.0f,  100.0f,  100.0f};
-	//m_MainPassCB.Lights[3].Position = {-20.0f, -20.0f, -20.0f};
-	//m_MainPassCB.Lights[3].Strength = { 100.0f,  100.0f,  100.0f};
-	
-	// Copy over pass cb
-	auto currPassCB = m_CurrFrameResource->PassCB.get();
-	currPassCB->CopyData(0, m_MainPassCB);
-}
-
 void PBRApp::BuildGeometry()
 {
-	// Build all of the spheres for the render task
-	auto skyBox = std::make_unique<SphereMesh>();
-	skyBox->Name = "sky_box";
-	skyBox->Radius = 1.0f;
-	skyBox->SliceCount = 64;
-	skyBox->StackCount = 32;
-	skyBox->Initialize(m_D3dDevice, m_CommandList);
-	skyBox->DrawArgs["sphere"].pMaterial = m_Materials[skyBox->Name].get();
-	m_Meshes[skyBox->Name] = std::move(skyBox);
-	auto sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_rust";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_rock_copper";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_brick_modern";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_concrete_dirty";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_concrete_rough";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_grass_wild";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_metal_bare";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_soil_mud";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-	sphere = std::make_unique<SphereMesh>();
-	sphere->Name = "sphere_stone_wall";
-	sphere->Radius = 1.0f;
-	sphere->SliceCount = 64;
-	sphere->StackCount = 32;
-	sphere->Initialize(m_D3dDevice, m_CommandList);
-	sphere->DrawArgs["sphere"].pMaterial = m_Materials[sphere->Name].get();
-	m_Meshes[sphere->Name] = std::move(sphere);
-
+	// Every sphere in the scene has the same radius and tessellation, so they all resolve to one
+	// cached mesh and only differ by the material and transform of their render item
+	std::vector<std::string> sphereNames = {
+		"sky_box",
+		"sphere_rust",
+		"sphere_rock_copper",
+		"sphere_brick_modern",
+		"sphere_concrete_dirty",
+		"sphere_concrete_rough",
+		"sphere_grass_wild",
+		"sphere_metal_bare",
+		"sphere_soil_mud",
+		"sphere_stone_wall"
+	};
 	for(int i = 0; i < 49; i++)
-	{
-		auto redSphere = std::make_unique<SphereMesh>();
-		redSphere->Name = "sphere_red_" + std::to_string(i);
-		redSphere->Radius = 1.0f;
-		redSphere->SliceCount = 64;
-		redSphere->StackCount = 32;
-		redSphere->Initialize(m_D3dDevice, m_CommandList);
-		redSphere->DrawArgs["sphere"].pMaterial = m_Materials[redSphere->Name].get();
-		m_Meshes[redSphere->Name] = std::move(redSphere);
-	}
+		sphereNames.push_back("sphere_red_" + std::to_string(i));
+
+	for(const auto& name : sphereNames)
+		m_SceneGeometry[name] = m_GeometryCache.GetSphere(1.0f, 64, 32, m_D3dDevice, m_CommandList);
+
+	LogLine("BuildGeometry: " + std::to_string(m_GeometryCache.RequestCount()) + " meshes requested, " +
+		std::to_string(m_GeometryCache.MeshCount()) + " built, " +
+		std::to_string(m_GeometryCache.GpuBytes() / 1024) + " KB of vertex and index data instead of " +
+		std::to_string(m_GeometryCache.RequestedBytes() / 1024) + " KB");
 }
 
 
@@ -612,20 +664,24 @@ void PBRApp::BuildRootSignature()
 	CD3DX12_DESCRIPTOR_RANGE TexTable1;
 	TexTable1.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 12, 2, 0);
 
-	CD3DX12_ROOT_PARAMETER SlotRootParameter[5];
+	CD3DX12_ROOT_PARAMETER SlotRootParameter[9];
 
 	// Create root Constant Buffer Views (CBVs)
 	// @todo Reorder from most frequent to least frequent.
-	SlotRootParameter[0].InitAsConstantBufferView(0); // Per object CBV
+	SlotRootParameter[0].InitAsConstants(1, 0); // Per draw base instance
 	SlotRootParameter[1].InitAsConstantBufferView(1); // Per pass CBV
-	SlotRootParameter[2].InitAsConstantBufferView(2); // Per material CBV
+	SlotRootParameter[2].InitAsShaderResourceView(1, 1); // Material structured buffer
 	SlotRootParameter[3].InitAsDescriptorTable(1, &TexTable0, D3D12_SHADER_VISIBILITY_PIXEL);
 	SlotRootParameter[4].InitAsDescriptorTable(1, &TexTable1, D3D12_SHADER_VISIBILITY_PIXEL);
+	SlotRootParameter[5].InitAsShaderResourceView(0, 1, D3D12_SHADER_VISIBILITY_VERTEX); // Instance structured buffer
+	SlotRootParameter[6].InitAsShaderResourceView(2, 1, D3D12_SHADER_VISIBILITY_PIXEL); // Local lights
+	SlotRootParameter[7].InitAsShaderResourceView(3, 1, D3D12_SHADER_VISIBILITY_PIXEL); // Light cluster ranges
+	SlotRootParameter[8].InitAsShaderResourceView(4, 1, D3D12_SHADER_VISIBILITY_PIXEL); // Light indices of the clusters
 
 	auto StaticSamplers = GetStaticSamplers();
 
 	// A root signature is an array of root parameters.
-	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(5, SlotRootParameter, 
+	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(9, SlotRootParameter, 
 		(uint) StaticSamplers.size(), StaticSamplers.data(),
 		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -753,16 +809,37 @@ void PBRApp::BuildShadersAndInputLayout()
 		NULL, NULL
 	};
 
-	m_Shaders["skyboxVS"] = d3dUtil::CompileShader(L"../../Shaders/Skybox.hlsl", nullptr, "VS", "vs_5_1");
+	// Only the vertex shaders read the vertex layout
+	const D3D_SHADER_MACRO PACKED_VERTEX_DEFINES[] =
+	{
+		"PACKED_VERTEX", "1",
+		NULL, NULL
+	};
+	const D3D_SHADER_MACRO* vertexDefines = (m_VertexFormat == VertexFormat::Packed) ? PACKED_VERTEX_DEFINES : nullptr;
+
+	m_Shaders["skyboxVS"] = d3dUtil::CompileShader(L"../../Shaders/Skybox.hlsl", vertexDefines, "VS", "vs_5_1");
 	m_Shaders["skyboxPS"] = d3dUtil::CompileShader(L"../../Shaders/Skybox.hlsl", nullptr, "PS", "ps_5_1");
 
-	m_Shaders["standardVS"] = d3dUtil::CompileShader(L"../../Shaders/Default.hlsl", nullptr, "VS", "vs_5_1");
+	m_Shaders["standardVS"] = d3dUtil::CompileShader(L"../../Shaders/Default.hlsl", vertexDefines, "VS", "vs_5_1");
 	m_Shaders["opaquePS"] = d3dUtil::CompileShader(L"../../Shaders/Default.hlsl", OPAQUE_DEFINES, "PS", "ps_5_1");
 	m_Shaders["opaqueAmrnPS"] = d3dUtil::CompileShader(L"../../Shaders/Default.hlsl", OPAQUE_AMRN_DEFINES, "PS", "ps_5_1");
 	m_Shaders["opaqueAsrndPS"] = d3dUtil::CompileShader(L"../../Shaders/Default.hlsl", OPAQUE_ASRND_DEFINES, "PS", "ps_5_1");
 	m_Shaders["opaqueTexturelessPS"] = d3dUtil::CompileShader(L"../../Shaders/Default.hlsl", OPAQUE_TEXTURELESS_DEFINES, "PS", "ps_5_1");
 
 	m_Shaders["alphaTestedPS"] = d3dUtil::CompileShader(L"../../Shaders/Default.hlsl", ALPHA_TEST_DEFINES, "PS", "ps_5_1");
+
+	if (m_VertexFormat == VertexFormat::Packed)
+	{
+		// PackedVertex
+		m_InputLayout =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0,  D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "NORMAL",   0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 8,  D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_UNORM,       0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+		};
+		return;
+	}
+
 	m_InputLayout =
 	{ 
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,  D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
@@ -885,7 +962,22 @@ void PBRApp::BuildFrameResources()
 	for (int i = 0; i < NUM_FRAME_RESOURCES; i++)
 	{
 		m_FrameResources.push_back(std::make_unique<FrameResource>(m_D3dDevice.Get(),
-			1, (uint) m_AllRenderItems.size(), (uint) m_Materials.size()));
+			m_Renderer.RenderItemCount(), m_Renderer.MaterialSlotCount(), m_Renderer.LocalLightCount(), MAX_COMMAND_LISTS));
+	}
+}
+
+void PBRApp::BuildCommandLists()
+{
+	m_Recorders.resize(MAX_COMMAND_LISTS);
+	for (u32 i = 0; i < MAX_COMMAND_LISTS; i++)
+	{
+		ThrowIfFailed(m_D3dDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT,
+			m_FrameResources[0]->CmdListAllocs[i].Get(), nullptr,
+			IID_PPV_ARGS(m_Recorders[i].CommandList.GetAddressOf())));
+
+		// Lists are created open, BeginCommands expects to reset them
+		m_Recorders[i].CommandList->Close();
+		m_Recorders[i].pState = &m_RecordState;
 	}
 }
 
@@ -973,167 +1065,112 @@ void PBRApp::BuildMaterials()
 	}
 }
 
+void PBRApp::BuildLights()
+{
+	// Four directional lights from the corners of the view
+	const float3 directions[] =
+	{
+		{ 0.57735f,  0.57735f, 0.57735f},
+		{ 0.57735f, -0.57735f, 0.57735f},
+		{-0.57735f,  0.57735f, 0.57735f},
+		{-0.57735f, -0.57735f, 0.57735f}
+	};
+	for (const float3& direction : directions)
+	{
+		auto light = std::make_shared<DirectLightNode>();
+		light->SetDirection(direction);
+		light->SetStrength({0.25f, 0.25f, 0.25f});
+		m_Renderer.AddLight(light);
+	}
+}
+
 void PBRApp::BuildRenderItems()
 {
 	// Sky box
+	Mesh* skyGeo = m_SceneGeometry["sky_box"];
 	auto skyRenderItem = std::make_unique<RenderItem>();
 	XMStoreFloat4x4(&skyRenderItem->World, XMMatrixScaling(5000.0f, 5000.0f, 5000.0f));
 	skyRenderItem->TexTransform = MathHelper::Identity4x4();
-	skyRenderItem->objCBIndex = 0;
 	skyRenderItem->Mat = m_Materials["sky_box"].get();
-	skyRenderItem->Geo = m_Meshes["sky_box"].get();
+	skyRenderItem->Geo = skyGeo;
 	skyRenderItem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-	skyRenderItem->indexCount = skyRenderItem->Geo->DrawArgs.begin()->second.IndexCount;
-	skyRenderItem->startIndexLocation = skyRenderItem->Geo->DrawArgs.begin()->second.StartIndexLocation;
-	skyRenderItem->baseVertexLocation = skyRenderItem->Geo->DrawArgs.begin()->second.BaseVertexLocation;
-	m_RenderItemLayer[(int) RenderLayer::SkyBox].push_back(skyRenderItem.get());
-	m_AllRenderItems.push_back(std::move(skyRenderItem));
-
-	// All other render items
-	auto mesh = m_Meshes.begin();
-	int objCBIndex = 1;
-	while(mesh != m_Meshes.end())
+	skyRenderItem->indexCount = skyGeo->DrawArgs.begin()->second.IndexCount;
+	skyRenderItem->startIndexLocation = skyGeo->DrawArgs.begin()->second.StartIndexLocation;
+	skyRenderItem->baseVertexLocation = skyGeo->DrawArgs.begin()->second.BaseVertexLocation;
+	skyRenderItem->LocalBounds = skyGeo->DrawArgs.begin()->second.Bounds;
+	m_Renderer.AddRenderItem(std::move(skyRenderItem), RenderLayer::SkyBox);
+
+	// Scene objects on shared geometry, the material is named after the object. Objects and loaded models
+	// hang off one scene root, each placed relative to it.
+	const NodeHandle sceneRoot = m_Renderer.CreateNode("scene");
+	const std::unordered_map<std::string, float> sphereRow =
 	{
-		if(mesh->second->Name == "sky_box")
-		{
-			mesh++;
+		{"sphere_concrete_rough", -10.0f}, {"sphere_concrete_dirty", -7.5f}, {"sphere_brick_modern", -5.0f},
+		{"sphere_rock_copper", -2.5f}, {"sphere_rust", 0.0f}, {"sphere_grass_wild", 2.5f},
+		{"sphere_metal_bare", 5.0f}, {"sphere_soil_mud", 7.5f}, {"sphere_stone_wall", 10.0f}
+	};
+	for(const auto& object : m_SceneGeometry)
+	{
+		if(object.first == "sky_box")
 			continue;
-		}
-
-		auto submesh = mesh->second->DrawArgs.begin();
-		while(submesh != mesh->second->DrawArgs.end())
-		{
-			auto renderItem = std::make_unique<RenderItem>();
-			renderItem->objCBIndex = objCBIndex;
-			renderItem->Mat = submesh->second.pMaterial;
-			renderItem->Geo = mesh->second.get();
-			renderItem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-			renderItem->indexCount = submesh->second.IndexCount;
-			renderItem->startIndexLocation = submesh->second.StartIndexLocation;
-			renderItem->baseVertexLocation = submesh->second.BaseVertexLocation;
-
-			// Hacky translation at render item build time
-			if(renderItem->Mat->Name.substr(0, 11) == "sphere_red_")
-			{
-				int i = std::stoi(renderItem->Mat->Name.substr(11));
-				float x = ((i%7) * 2.5f) - 3 * 2.5f;
-				float y = ((i/7) * -2.5f) - 2.5f;
-				vect4 world = Matrix::SetupTranslation(x, y, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_rust")
-			{
-				vect4 world = Matrix::SetupTranslation(0.0f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_rock_copper")
-			{
-				vect4 world = Matrix::SetupTranslation(-2.5f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_brick_modern")
-			{
-				vect4 world = Matrix::SetupTranslation(-5.0f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_concrete_dirty")
-			{
-				vect4 world = Matrix::SetupTranslation(-7.5f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_concrete_rough")
-			{
-				vect4 world = Matrix::SetupTranslation(-10.0f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_grass_wild")
-			{
-				vect4 world = Matrix::SetupTranslation(2.5f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_metal_bare")
-			{
-				vect4 world = Matrix::SetupTranslation(5.0f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_soil_mud")
-			{
-				vect4 world = Matrix::SetupTranslation(7.5f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
-			if(renderItem->Mat->Name == "sphere_stone_wall")
-			{
-				vect4 world = Matrix::SetupTranslation(10.0f, 0.0f, 0.0f);
-				Matrix::StoreFloat4x4(&renderItem->World, world);
-			}
 
-			// Add to the appropriate renderlayer
-			if(renderItem->Mat->pDiffuse == nullptr)
-			{
-				m_RenderItemLayer[(int) RenderLayer::OpaqueTextureless].push_back(renderItem.get());
-			}
-			else if(renderItem->Mat->pMetallic == nullptr)
-			{ // @ todo missing metal texture
-				m_RenderItemLayer[(int) RenderLayer::OpaqueAsrnd].push_back(renderItem.get());
-			}
-			else if(renderItem->Mat->pSpecular == nullptr)
-			{ // @ todo missing spec texture
-				m_RenderItemLayer[(int) RenderLayer::OpaqueAmrn].push_back(renderItem.get());
-			}
-			else
-			{
-				m_RenderItemLayer[(int) RenderLayer::Opaque].push_back(renderItem.get());
-			}
+		Mesh* geo = object.second;
+		RenderItem* renderItem = AddRenderItem(geo, geo->DrawArgs.begin()->second, m_Materials[object.first].get());
 
-			m_AllRenderItems.push_back(std::move(renderItem));
-			submesh++;
+		Transform local;
+		const std::string& name = renderItem->Mat->Name;
+		if(name.substr(0, 11) == "sphere_red_")
+		{
+			int i = std::stoi(name.substr(11));
+			local.Translation = float3(((i%7) * 2.5f) - 3 * 2.5f, ((i/7) * -2.5f) - 2.5f, 0.0f);
 		}
-		objCBIndex++;
-		mesh++;
+		auto row = sphereRow.find(name);
+		if(row != sphereRow.end())
+			local.Translation = float3(row->second, 0.0f, 0.0f);
+		m_Renderer.AttachRenderItem(renderItem, m_Renderer.CreateNode(object.first, local, sceneRoot));
 	}
-}
-
-void PBRApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
-{
-	uint objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
-	uint matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialProperties));
-
-	auto ObjectCB = m_CurrFrameResource->ObjectCB->Resource();
-	auto MatCB = m_CurrFrameResource->MaterialCB->Resource();
-	CD3DX12_GPU_DESCRIPTOR_HANDLE SkyTex(m_SrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
-	SkyTex.Offset(m_Textures["sky_box"][0]->SRVHeapIndex, m_cbvSrvDescriptorSize );
 
-
-	// For each render item...
-	for (size_t i = 0; i < ritems.size(); ++i)
+	// Loaded models, one render item per submesh, all on the model's node
+	for(auto& mesh : m_Meshes)
 	{
-		auto ri = ritems[i];
-
-		cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-		cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-		cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
-	
-		CD3DX12_GPU_DESCRIPTOR_HANDLE Tex(m_SrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
-
-		if(ri->Mat->pDiffuse != nullptr)
-			Tex.Offset(ri->Mat->pDiffuse->SRVHeapIndex, m_cbvSrvDescriptorSize);
-
-
-		D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = ObjectCB->GetGPUVirtualAddress()
-			+ ri->objCBIndex*objCBByteSize;
-		D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = MatCB->GetGPUVirtualAddress()
-			+ ri->Mat->MatCBIndex*matCBByteSize;
-		
-		cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
-		cmdList->SetGraphicsRootConstantBufferView(2, matCBAddress);
-		cmdList->SetGraphicsRootDescriptorTable(3, SkyTex);
-		cmdList->SetGraphicsRootDescriptorTable(4, Tex);
+		const NodeHandle node = m_Renderer.CreateNode(mesh.first, Transform(), sceneRoot);
+		for(auto& submesh : mesh.second->DrawArgs)
+			m_Renderer.AttachRenderItem(AddRenderItem(mesh.second.get(), submesh.second, submesh.second.pMaterial), node);
+	}
 
+	for(auto& material : m_Materials)
+		m_Renderer.AddMaterial(material.second.get());
+}
 
-		cmdList->DrawIndexedInstanced(ri->indexCount, 1, ri->startIndexLocation, ri->baseVertexLocation, 0);
+RenderItem* PBRApp::AddRenderItem(Mesh* geo, const Submesh& submesh, Material* mat)
+{
+	auto renderItem = std::make_unique<RenderItem>();
+	renderItem->Mat = mat;
+	renderItem->Geo = geo;
+	renderItem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	renderItem->indexCount = submesh.IndexCount;
+	renderItem->startIndexLocation = submesh.StartIndexLocation;
+	renderItem->baseVertexLocation = submesh.BaseVertexLocation;
+	renderItem->Lods = submesh.Lods;
+	renderItem->LocalBounds = submesh.Bounds;
+
+	// Add to the appropriate renderlayer
+	RenderLayer layer = RenderLayer::Opaque;
+	if(renderItem->Mat->pDiffuse == nullptr)
+	{
+		layer = RenderLayer::OpaqueTextureless;
+	}
+	else if(renderItem->Mat->pMetallic == nullptr)
+	{ // @ todo missing metal texture
+		layer = RenderLayer::OpaqueAsrnd;
+	}
+	else if(renderItem->Mat->pSpecular == nullptr)
+	{ // @ todo missing spec texture
+		layer = RenderLayer::OpaqueAmrn;
 	}
-}
 
+	return m_Renderer.AddRenderItem(std::move(renderItem), layer);
+}
 
 std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> PBRApp::GetStaticSamplers()
 {
@@ -1195,18 +1232,22 @@ std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> PBRApp::GetStaticSamplers()
 
 void PBRApp::LoadTextures()
 {
+	// Every texture is decoded in parallel and uploaded together at the end
+	Stopwatch timer;
+	TextureBatch textureBatch;
+
 	std::vector<std::unique_ptr<Texture>> skyBox(2);
 	auto skyTex = std::make_unique<ImageTexture>();
 	skyTex->Name = "sky_box";
 	skyTex->Filename = L"../../../Assets/Subway_Lights/20_Subway_lights_3k.png";
 	//skyTex->Filename = L"../../../Assets/Chelsea_Stairs/Chelsea_Stairs_3k.png";
-	skyTex->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(skyTex.get());
 	skyBox[0] = std::move(skyTex);
 	skyTex = std::make_unique<ImageTexture>();
 	skyTex->Name = "sky_env";
 	skyTex->Filename = L"../../../Assets/Subway_Lights/20_Subway_lights_Env.png";
 	//skyTex->Filename = L"../../../Assets/Chelsea_Stairs/Chelsea_Stairs_Env.png";
-	skyTex->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(skyTex.get());
 	skyBox[1] = std::move(skyTex);
 	m_Textures["sky_box"] = std::move(skyBox);
 
@@ -1214,7 +1255,7 @@ void PBRApp::LoadTextures()
 	auto redPixelTex = std::make_unique<ImageTexture>();
 	redPixelTex->Name = "pixel_red";
 	redPixelTex->Filename = L"../../../Assets/RedPixel.png";
-	redPixelTex->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(redPixelTex.get());
 	redPixel[0] = std::move(redPixelTex);
 	m_Textures["pixel_red"] = std::move(redPixel);
 
@@ -1222,19 +1263,19 @@ void PBRApp::LoadTextures()
 	auto rcDiffuse = std::make_unique<ImageTexture>();
 	rcDiffuse->Name = "rc_diffuse";
 	rcDiffuse->Filename = L"../../../Assets/rockcopper/copper-rock1-alb.png";
-	rcDiffuse->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(rcDiffuse.get());
 	auto rcMetalness = std::make_unique<ImageTexture>();
 	rcMetalness->Name = "rc_metalness";
 	rcMetalness->Filename = L"../../../Assets/rockcopper/copper-rock1-metal.png";
-	rcMetalness->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(rcMetalness.get());
 	auto rcRoughness = std::make_unique<ImageTexture>();
 	rcRoughness->Name = "rc_roughness";
 	rcRoughness->Filename = L"../../../Assets/rockcopper/copper-rock1-rough.png";
-	rcRoughness->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(rcRoughness.get());
 	auto rcNormal = std::make_unique<ImageTexture>();
 	rcNormal->Name = "rc_normal";
 	rcNormal->Filename = L"../../../Assets/rockcopper/copper-rock1-normal.png";
-	rcNormal->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(rcNormal.get());
 	rockCopper[0] = std::move(rcDiffuse);
 	rockCopper[2] = std::move(rcMetalness);
 	rockCopper[3] = std::move(rcRoughness);
@@ -1245,19 +1286,19 @@ void PBRApp::LoadTextures()
 	auto riDiffuse = std::make_unique<ImageTexture>();
 	riDiffuse->Name = "ri_diffuse";
 	riDiffuse->Filename = L"../../../Assets/rustediron/rustediron2_basecolor.png";
-	riDiffuse->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(riDiffuse.get());
 	auto riMetalness = std::make_unique<ImageTexture>();
 	riMetalness->Name = "ri_metalness";
 	riMetalness->Filename = L"../../../Assets/rustediron/rustediron2_metallic.png";
-	riMetalness->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(riMetalness.get());
 	auto riRoughness = std::make_unique<ImageTexture>();
 	riRoughness->Name = "ri_roughness";
 	riRoughness->Filename = L"../../../Assets/rustediron/rustediron2_roughness.png";
-	riRoughness->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(riRoughness.get());
 	auto riNormal = std::make_unique<ImageTexture>();
 	riNormal->Name = "ri_normal";
 	riNormal->Filename = L"../../../Assets/rustediron/rustediron2_normal.png";
-	riNormal->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(riNormal.get());
 	rustedIron[0] = std::move(riDiffuse);
 	rustedIron[2] = std::move(riMetalness);
 	rustedIron[3] = std::move(riRoughness);
@@ -1268,27 +1309,27 @@ void PBRApp::LoadTextures()
 	auto bm1K = std::make_unique<ImageTexture>();
 	bm1K->Name = "bm1k_diffuse";
 	bm1K->Filename = L"../../../Assets/Brick_Modern_1K/semlcibb_8K_Albedo.jpg";
-	bm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(bm1K.get());
 	brickModern1K[0] = std::move(bm1K);
 	bm1K = std::make_unique<ImageTexture>();
 	bm1K->Name = "bm1k_specular";
 	bm1K->Filename = L"../../../Assets/Brick_Modern_1K/semlcibb_8K_Specular.jpg";
-	bm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(bm1K.get());
 	brickModern1K[1] = std::move(bm1K);
 	bm1K = std::make_unique<ImageTexture>();
 	bm1K->Name = "bm1k_roughness";
 	bm1K->Filename = L"../../../Assets/Brick_Modern_1K/semlcibb_8K_Roughness.jpg";
-	bm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(bm1K.get());
 	brickModern1K[3] = std::move(bm1K);
 	bm1K = std::make_unique<ImageTexture>();
 	bm1K->Name = "bm1k_normal";
 	bm1K->Filename = L"../../../Assets/Brick_Modern_1K/semlcibb_8K_Normal.jpg";
-	bm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(bm1K.get());
 	brickModern1K[4] = std::move(bm1K);
 	bm1K = std::make_unique<ImageTexture>();
 	bm1K->Name = "bm1k_displacement";
 	bm1K->Filename = L"../../../Assets/Brick_Modern_1K/semlcibb_8K_Displacement.jpg";
-	bm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(bm1K.get());
 	brickModern1K[5] = std::move(bm1K);
 	m_Textures["brick_modern"] = std::move(brickModern1K);
 
@@ -1296,27 +1337,27 @@ void PBRApp::LoadTextures()
 	auto cd1K = std::make_unique<ImageTexture>();
 	cd1K->Name = "cd1k_diffuse";
 	cd1K->Filename = L"../../../Assets/Concrete_Dirty_1K/rm4kshp_4K_Albedo.jpg";
-	cd1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cd1K.get());
 	concreteDirty1K[0] = std::move(cd1K);
 	cd1K = std::make_unique<ImageTexture>();
 	cd1K->Name = "cd1k_specular";
 	cd1K->Filename = L"../../../Assets/Concrete_Dirty_1K/rm4kshp_4K_Specular.jpg";
-	cd1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cd1K.get());
 	concreteDirty1K[1] = std::move(cd1K);
 	cd1K = std::make_unique<ImageTexture>();
 	cd1K->Name = "cd1k_roughness";
 	cd1K->Filename = L"../../../Assets/Concrete_Dirty_1K/rm4kshp_4K_Roughness.jpg";
-	cd1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cd1K.get());
 	concreteDirty1K[3] = std::move(cd1K);
 	cd1K = std::make_unique<ImageTexture>();
 	cd1K->Name = "cd1k_normal";
 	cd1K->Filename = L"../../../Assets/Concrete_Dirty_1K/rm4kshp_4K_Normal.jpg";
-	cd1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cd1K.get());
 	concreteDirty1K[4] = std::move(cd1K);
 	cd1K = std::make_unique<ImageTexture>();
 	cd1K->Name = "cd1k_displacement";
 	cd1K->Filename = L"../../../Assets/Concrete_Dirty_1K/rm4kshp_4K_Displacement.jpg";
-	cd1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cd1K.get());
 	concreteDirty1K[5] = std::move(cd1K);
 	m_Textures["concrete_dirty"] = std::move(concreteDirty1K);
 
@@ -1324,27 +1365,27 @@ void PBRApp::LoadTextures()
 	auto cr1K = std::make_unique<ImageTexture>();
 	cr1K->Name = "cr1k_diffuse";
 	cr1K->Filename = L"../../../Assets/Concrete_Rough_1K/sdbhdd3b_8K_Albedo.jpg";
-	cr1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cr1K.get());
 	concreteRough1K[0] = std::move(cr1K);
 	cr1K = std::make_unique<ImageTexture>();
 	cr1K->Name = "cr1k_specular";
 	cr1K->Filename = L"../../../Assets/Concrete_Rough_1K/sdbhdd3b_8K_Specular.jpg";
-	cr1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cr1K.get());
 	concreteRough1K[1] = std::move(cr1K);
 	cr1K = std::make_unique<ImageTexture>();
 	cr1K->Name = "cr1k_roughness";
 	cr1K->Filename = L"../../../Assets/Concrete_Rough_1K/sdbhdd3b_8K_Roughness.jpg";
-	cr1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cr1K.get());
 	concreteRough1K[3] = std::move(cr1K);
 	cr1K = std::make_unique<ImageTexture>();
 	cr1K->Name = "cr1k_normal";
 	cr1K->Filename = L"../../../Assets/Concrete_Rough_1K/sdbhdd3b_8K_Normal.jpg";
-	cr1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cr1K.get());
 	concreteRough1K[4] = std::move(cr1K);
 	cr1K = std::make_unique<ImageTexture>();
 	cr1K->Name = "cr1k_displacement";
 	cr1K->Filename = L"../../../Assets/Concrete_Rough_1K/sdbhdd3b_8K_Displacement.jpg";
-	cr1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(cr1K.get());
 	concreteRough1K[5] = std::move(cr1K);
 	m_Textures["concrete_rough"] = std::move(concreteRough1K);
 
@@ -1352,27 +1393,27 @@ void PBRApp::LoadTextures()
 	auto gw1K = std::make_unique<ImageTexture>();
 	gw1K->Name = "gw1k_diffuse";
 	gw1K->Filename = L"../../../Assets/Grass_Wild_1K/sfknaeoa_8K_Albedo.jpg";
-	gw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(gw1K.get());
 	grassWild1K[0] = std::move(gw1K);
 	gw1K = std::make_unique<ImageTexture>();
 	gw1K->Name = "gw1k_specular";
 	gw1K->Filename = L"../../../Assets/Grass_Wild_1K/sfknaeoa_8K_Specular.jpg";
-	gw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(gw1K.get());
 	grassWild1K[1] = std::move(gw1K);
 	gw1K = std::make_unique<ImageTexture>();
 	gw1K->Name = "gw1k_roughness";
 	gw1K->Filename = L"../../../Assets/Grass_Wild_1K/sfknaeoa_8K_Roughness.jpg";
-	gw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(gw1K.get());
 	grassWild1K[3] = std::move(gw1K);
 	gw1K = std::make_unique<ImageTexture>();
 	gw1K->Name = "gw1k_normal";
 	gw1K->Filename = L"../../../Assets/Grass_Wild_1K/sfknaeoa_8K_Normal.jpg";
-	gw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(gw1K.get());
 	grassWild1K[4] = std::move(gw1K);
 	gw1K = std::make_unique<ImageTexture>();
 	gw1K->Name = "gw1k_displacement";
 	gw1K->Filename = L"../../../Assets/Grass_Wild_1K/sfknaeoa_8K_Displacement.jpg";
-	gw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(gw1K.get());
 	grassWild1K[5] = std::move(gw1K);
 	m_Textures["grass_wild"] = std::move(grassWild1K);
 
@@ -1380,32 +1421,32 @@ void PBRApp::LoadTextures()
 	auto mb1K = std::make_unique<ImageTexture>();
 	mb1K->Name = "mb1k_diffuse";
 	mb1K->Filename = L"../../../Assets/Metal_Bare_1K/se2abbvc_8K_Albedo.jpg";
-	mb1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(mb1K.get());
 	metalBare1K[0] = std::move(mb1K);
 	mb1K = std::make_unique<ImageTexture>();
 	mb1K->Name = "mb1k_specular";
 	mb1K->Filename = L"../../../Assets/Metal_Bare_1K/se2abbvc_8K_Specular.jpg";
-	mb1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(mb1K.get());
 	metalBare1K[1] = std::move(mb1K);
 	mb1K = std::make_unique<ImageTexture>();
 	mb1K->Name = "mb1k_metallic";
 	mb1K->Filename = L"../../../Assets/Metal_Bare_1K/se2abbvc_8K_Metalness.jpg";
-	mb1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(mb1K.get());
 	metalBare1K[2] = std::move(mb1K);
 	mb1K = std::make_unique<ImageTexture>();
 	mb1K->Name = "mb1k_roughness";
 	mb1K->Filename = L"../../../Assets/Metal_Bare_1K/se2abbvc_8K_Roughness.jpg";
-	mb1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(mb1K.get());
 	metalBare1K[3] = std::move(mb1K);
 	mb1K = std::make_unique<ImageTexture>();
 	mb1K->Name = "mb1k_normal";
 	mb1K->Filename = L"../../../Assets/Metal_Bare_1K/se2abbvc_8K_Normal.jpg";
-	mb1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(mb1K.get());
 	metalBare1K[4] = std::move(mb1K);
 	mb1K = std::make_unique<ImageTexture>();
 	mb1K->Name = "mb1k_displacement";
 	mb1K->Filename = L"../../../Assets/Metal_Bare_1K/se2abbvc_8K_Displacement.jpg";
-	mb1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(mb1K.get());
 	metalBare1K[5] = std::move(mb1K);
 	m_Textures["metal_bare"] = std::move(metalBare1K);
 
@@ -1413,27 +1454,27 @@ void PBRApp::LoadTextures()
 	auto sm1K = std::make_unique<ImageTexture>();
 	sm1K->Name = "sm1k_diffuse";
 	sm1K->Filename = L"../../../Assets/Soil_Mud_1K/pjDtB2_8K_Albedo.jpg";
-	sm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sm1K.get());
 	soilMud1K[0] = std::move(sm1K);
 	sm1K = std::make_unique<ImageTexture>();
 	sm1K->Name = "sm1k_specular";
 	sm1K->Filename = L"../../../Assets/Soil_Mud_1K/pjDtB2_8K_Specular.jpg";
-	sm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sm1K.get());
 	soilMud1K[1] = std::move(sm1K);
 	sm1K = std::make_unique<ImageTexture>();
 	sm1K->Name = "sm1k_roughness";
 	sm1K->Filename = L"../../../Assets/Soil_Mud_1K/pjDtB2_8K_Roughness.jpg";
-	sm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sm1K.get());
 	soilMud1K[3] = std::move(sm1K);
 	sm1K = std::make_unique<ImageTexture>();
 	sm1K->Name = "sm1k_normal";
 	sm1K->Filename = L"../../../Assets/Soil_Mud_1K/pjDtB2_8K_Normal.jpg";
-	sm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sm1K.get());
 	soilMud1K[4] = std::move(sm1K);
 	sm1K = std::make_unique<ImageTexture>();
 	sm1K->Name = "sm1k_displacement";
 	sm1K->Filename = L"../../../Assets/Soil_Mud_1K/pjDtB2_8K_Displacement.jpg";
-	sm1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sm1K.get());
 	soilMud1K[5] = std::move(sm1K);
 	m_Textures["soil_mud"] = std::move(soilMud1K);
 
@@ -1441,199 +1482,146 @@ void PBRApp::LoadTextures()
 	auto sw1K = std::make_unique<ImageTexture>();
 	sw1K->Name = "sw1k_diffuse";
 	sw1K->Filename = L"../../../Assets/Stone_Wall_1K/scpgdgca_8K_Albedo.jpg";
-	sw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sw1K.get());
 	stoneWall1K[0] = std::move(sw1K);
 	sw1K = std::make_unique<ImageTexture>();
 	sw1K->Name = "sw1k_specular";
 	sw1K->Filename = L"../../../Assets/Stone_Wall_1K/scpgdgca_8K_Specular.jpg";
-	sw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sw1K.get());
 	stoneWall1K[1] = std::move(sw1K);
 	sw1K = std::make_unique<ImageTexture>();
 	sw1K->Name = "sw1k_roughness";
 	sw1K->Filename = L"../../../Assets/Stone_Wall_1K/scpgdgca_8K_Roughness.jpg";
-	sw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sw1K.get());
 	stoneWall1K[3] = std::move(sw1K);
 	sw1K = std::make_unique<ImageTexture>();
 	sw1K->Name = "sw1k_normal";
 	sw1K->Filename = L"../../../Assets/Stone_Wall_1K/scpgdgca_8K_Normal.jpg";
-	sw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sw1K.get());
 	stoneWall1K[4] = std::move(sw1K);
 	sw1K = std::make_unique<ImageTexture>();
 	sw1K->Name = "sw1k_displacement";
 	sw1K->Filename = L"../../../Assets/Stone_Wall_1K/scpgdgca_8K_Displacement.jpg";
-	sw1K->Initialize(m_D3dDevice, m_CommandQueue);
+	textureBatch.Add(sw1K.get());
 	stoneWall1K[5] = std::move(sw1K);
 	m_Textures["stone_wall"] = std::move(stoneWall1K);
+
+	size_t textureCount = textureBatch.Count();
+	textureBatch.Load(m_D3dDevice, m_CommandQueue);
+	LogLine("LoadTextures: " + std::to_string(textureCount) + " textures " + std::to_string(timer.ElapsedMs()) + " ms");
 }
 
 
 
 void PBRApp::LoadOBJModel(std::string filepath)
 {
-	// Load model, or throw error
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
+	std::string objName = ObjNameFromPath(filepath);
 	std::string basepath = filepath.substr(0, filepath.find_last_of("/") + 1);
-	if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filepath.c_str(), basepath.c_str(), true))
+	std::string cachePath = MeshCache::CachePath(filepath);
+
+	Stopwatch timer;
+	MeshCache::View cache;
+	if(cache.Open(cachePath, filepath))
+	{ // Up to date binary cache, buffers are copied straight out of the mapped file
+		ObjModelView view;
+		cache.GetModelView(view);
+		CreateOBJMesh(objName, basepath, view);
+		LogLine("LoadOBJModel " + objName + ": cache " + std::to_string(timer.ElapsedMs()) + " ms");
+		return;
+	}
+
+	// Missing or stale cache, parse the .obj on all cores and rebuild it
+	ObjModel model;
+	ImportOBJParallel(filepath, model);
+
+	// Reorder each submesh for the post-transform cache, the cache then stores the optimized buffers
+	std::vector<MeshOptimizer::IndexRange> ranges(model.Submeshes.size());
+	for(size_t i = 0; i < model.Submeshes.size(); i++)
+	{
+		ranges[i].StartIndex = model.Submeshes[i].StartIndexLocation;
+		ranges[i].IndexCount = model.Submeshes[i].IndexCount;
+	}
+	MeshOptimizer::Result optimization = MeshOptimizer::Optimize(model.Vertices.data(), (u32) model.Vertices.size(),
+		sizeof(Vertex), model.Indices.data(), model.Indices.size(), ranges);
+	LogLine("LoadOBJModel " + objName + ": " + MeshOptimizer::Describe(optimization));
+
+	// Simplified levels are appended after the full index data, all of them share the vertex buffer
+	Stopwatch lodTimer;
+	auto lods = MeshSimplifier::BuildLods((const u8*) model.Vertices.data(), sizeof(Vertex), (u32) model.Vertices.size(),
+		model.Indices, ranges);
+	size_t lodCount = 0;
+	for(size_t i = 0; i < model.Submeshes.size(); i++)
 	{
-		throw std::runtime_error(err);
+		model.Submeshes[i].Lods = lods[i];
+		lodCount += lods[i].size();
 	}
+	LogLine("LoadOBJModel " + objName + ": " + std::to_string(lodCount) + " levels of detail for " +
+		std::to_string(model.Submeshes.size()) + " submeshes in " + std::to_string(lodTimer.ElapsedMs()) + " ms");
+
+	std::vector<u16> Indices16;
+	ObjModelView view;
+	view.pVertices = model.Vertices.data();
+	view.VertexCount = (uint) model.Vertices.size();
+	view.IndexFormat = PackIndices(model.Indices, model.MaxIndex, Indices16);
+	view.pIndices = (view.IndexFormat == DXGI_FORMAT_R16_UINT) ? (const void*) Indices16.data() : (const void*) model.Indices.data();
+	view.IndexCount = (uint) model.Indices.size();
+	view.Submeshes = model.Submeshes;
+	view.Materials = model.Materials;
+	CreateOBJMesh(objName, basepath, view);
+	LogLine("LoadOBJModel " + objName + ": import " + std::to_string(timer.ElapsedMs()) + " ms");
+
+	if(!MeshCache::Write(cachePath, filepath, model))
+		LogLine("LoadOBJModel " + objName + ": could not write " + cachePath);
+}
 
+void PBRApp::CreateOBJMesh(const std::string& objName, const std::string& basepath, const ObjModelView& view)
+{
 	// Create new Mesh
 	auto mesh = std::make_unique<PolygonalMesh>();
-
-	// Set top level Model name
-	std::string objName = filepath.substr(filepath.find_last_of("/") + 1); // get local file path
-	objName = objName.substr(0, objName.size() - 4);  // remove .obj file extension
 	mesh->Name = objName;
 
-	std::vector<Vertex> Vertices = std::vector<Vertex>();
-	uint lastIndexCount = 0;
-	// Assume 32 bit indices
-	uint maxIndex = 0;
-	std::unordered_map<Vertex, u32> uniqueVertices = { };
-	std::vector<u32> Indices = std::vector<u32>();
-	// Iterate over .obj geometries
-	for(const auto& shape : shapes)
+	// Add the shape materials to m_Materials
+	std::vector<Material*> materials(view.Materials.size(), nullptr);
+	for(size_t i = 0; i < view.Materials.size(); i++)
 	{
-		Submesh submesh;
-		submesh.Name = shape.name;
-
-		// Get the material that defines this shape's visuals
-		if(shape.mesh.material_ids[0] != -1)
-		{
-			// Add new shape Material to m_material
-			tinyobj::material_t tinyobjShapeMat = materials[shape.mesh.material_ids[0]];
-			std::string matName = objName + "::";
-			matName = matName + tinyobjShapeMat.name;
-			if(m_Materials.find(matName) == m_Materials.end())
-			{ // new material
-				auto shapeMat = std::make_unique<Material>();
-				// @todo deal with different illum models in tinyobjShapeMat
-				shapeMat->Properties.Anisotropy = tinyobjShapeMat.anisotropy;
-				shapeMat->Properties.AnisotropyRotation = tinyobjShapeMat.anisotropy_rotation;
-				shapeMat->Properties.ClearCoatRoughness = tinyobjShapeMat.clearcoat_roughness;
-				shapeMat->Properties.ClearCoatThickness = tinyobjShapeMat.clearcoat_thickness;
-				shapeMat->Properties.Diffuse = Vector::SetFloat3(tinyobjShapeMat.diffuse[0], tinyobjShapeMat.diffuse[1], tinyobjShapeMat.diffuse[2]);
-				shapeMat->Properties.Emissive = Vector::SetFloat3(tinyobjShapeMat.emission[0], tinyobjShapeMat.emission[1], tinyobjShapeMat.emission[2]);
-				shapeMat->Properties.FresnelR0 = Vector::SetFloat3(tinyobjShapeMat.specular[0], tinyobjShapeMat.specular[1], tinyobjShapeMat.specular[2]);
-				shapeMat->Properties.Metallic = tinyobjShapeMat.metallic;
-				shapeMat->Properties.Opacity = tinyobjShapeMat.dissolve;
-				shapeMat->Properties.Roughness = 1 - Math::Min(tinyobjShapeMat.shininess / 256.0f, 1.0f); // @todo needs be switched to roughness for real pbr
-				shapeMat->Properties.Sheen = tinyobjShapeMat.sheen;
-				shapeMat->Properties.Transmission = Vector::SetFloat3(tinyobjShapeMat.transmittance[0], tinyobjShapeMat.transmittance[1], tinyobjShapeMat.transmittance[2]);
-
-				if(tinyobjShapeMat.diffuse_texname != "")
-					AddImageTexture(shapeMat->pDiffuse, basepath, tinyobjShapeMat.diffuse_texname); // Contains a diffuse texture, load it
-
-				//shapeMat->SetCBIndex();
-
-				// Move new material into m_Materials, and assign it the new shape
-				m_Materials[matName] = std::move(shapeMat);
-				submesh.pMaterial = m_Materials[matName].get();
-			}
-		}
-
-		// Get shape vertices and indices
-		for(const auto& index : shape.mesh.indices)
-		{
-			Vertex V;
-			V.Pos = Vector::SetFloat3(
-				attrib.vertices[3*index.vertex_index+0],
-				attrib.vertices[3*index.vertex_index+1],
-				attrib.vertices[3*index.vertex_index+2]
-			);
-			if(index.normal_index!=-1)
-			{
-				V.Normal = Vector::SetFloat3(
-					attrib.normals[3*index.normal_index+0],
-					attrib.normals[3*index.normal_index+1],
-					attrib.normals[3*index.normal_index+2]
-				);
-			}
-			else
-			{
-				V.Normal = Vector::SetFloat3(0.0f, 0.0f, 0.0f);
-			}
-			if(index.texcoord_index!=-1)
-			{
-				V.TexCoord = Vector::SetFloat2(
-					attrib.texcoords[2*index.texcoord_index+0],
-					1.0f-attrib.texcoords[2*index.texcoord_index+1]
-				);
-			}
-			else
-			{
-				V.TexCoord = Vector::SetFloat2(0.0f, 0.0f);
-			}
-
-			if(uniqueVertices.count(V)==0)
-			{ // V is not in uniqueVertices
-				uniqueVertices[V] = static_cast<u32>(Vertices.size());
-				maxIndex = (uniqueVertices[V] > maxIndex) ? uniqueVertices[V] : maxIndex;
-				Vertices.push_back(V);
-			}
-
-			Indices.push_back(uniqueVertices[V]);
-		}
-
-		submesh.StartIndexLocation = lastIndexCount;
-		submesh.IndexCount = Indices.size() - lastIndexCount;
-		lastIndexCount = Indices.size();
+		std::string matName = objName + "::" + view.Materials[i].Name;
+		if(m_Materials.find(matName) == m_Materials.end())
+		{ // new material
+			auto shapeMat = std::make_unique<Material>();
+			shapeMat->Name = matName;
+			shapeMat->Properties = view.Materials[i].Properties;
 
-		mesh->DrawArgs[submesh.Name] = submesh;
-	}
+			if(view.Materials[i].DiffuseTexname != "")
+				AddImageTexture(shapeMat->pDiffuse, basepath, view.Materials[i].DiffuseTexname); // Contains a diffuse texture, load it
 
-	std::vector<u16> Indices16 = std::vector<u16>();
-	uint indexTypeSize = sizeof(u32);
-	// Convert to 16 bit indices if there are few enough
-	if(maxIndex<=0xFFFF)
-	{ // Convert to 16 bit indices
-		Indices16.resize(Indices.size());
-		for(uint i = 0; i < Indices.size(); i++)
-		{
-			Indices16[i] = static_cast<u16>(Indices[i]);
+			m_Materials[matName] = std::move(shapeMat);
 		}
-		indexTypeSize = sizeof(u16);
-		mesh->IndexFormat = DXGI_FORMAT_R16_UINT;
+		materials[i] = m_Materials[matName].get();
 	}
 
-	const uint vbByteSize = (uint) Vertices.size()*sizeof(Vertex);
-	const uint ibByteSize = (uint) Indices.size() * indexTypeSize;
-
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &mesh->VertexBufferCPU));
-	CopyMemory(mesh->VertexBufferCPU->GetBufferPointer(), Vertices.data(), vbByteSize);
-
-	if(maxIndex<=0xFFFF)
-	{
-		ThrowIfFailed(D3DCreateBlob(ibByteSize, &mesh->IndexBufferCPU));
-		CopyMemory(mesh->IndexBufferCPU->GetBufferPointer(), Indices16.data(), ibByteSize);
-	}
-	else
+	for(const auto& objSubmesh : view.Submeshes)
 	{
-		ThrowIfFailed(D3DCreateBlob(ibByteSize, &mesh->IndexBufferCPU));
-		CopyMemory(mesh->IndexBufferCPU->GetBufferPointer(), Indices.data(), ibByteSize);
+		Submesh submesh;
+		submesh.Name = objSubmesh.Name;
+		submesh.pMaterial = (objSubmesh.MaterialIndex != -1) ? materials[objSubmesh.MaterialIndex] : nullptr;
+		submesh.IndexCount = objSubmesh.IndexCount;
+		submesh.StartIndexLocation = objSubmesh.StartIndexLocation;
+		submesh.BaseVertexLocation = objSubmesh.BaseVertexLocation;
+		submesh.Lods = objSubmesh.Lods;
+		mesh->DrawArgs[submesh.Name] = submesh;
 	}
 
-	mesh->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(m_D3dDevice.Get(),
-		m_CommandList.Get(), Vertices.data(), vbByteSize, mesh->VertexBufferUploader);
-
-	if(maxIndex<=0xFFFF)
-	{
-		mesh->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(m_D3dDevice.Get(),
-			m_CommandList.Get(), Indices16.data(), ibByteSize, mesh->IndexBufferUploader);
-	}
+	if(view.IndexFormat == DXGI_FORMAT_R16_UINT)
+		mesh->BuildMeshlets((const Vertex*) view.pVertices, view.VertexCount, (const u16*) view.pIndices);
 	else
-	{
-		mesh->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(m_D3dDevice.Get(),
-			m_CommandList.Get(), Indices.data(), ibByteSize, mesh->IndexBufferUploader);
-	}
-
-	mesh->VertexByteStride = sizeof(Vertex);
-	mesh->VertexBufferByteSize = vbByteSize;
-	mesh->IndexBufferByteSize = ibByteSize;
+		mesh->BuildMeshlets((const Vertex*) view.pVertices, view.VertexCount, (const u32*) view.pIndices);
+	LogLine("CreateOBJMesh " + objName + ": " + MeshletBuilder::Describe(mesh->Meshlets));
+
+	mesh->Format = m_VertexFormat;
+	mesh->pArena = &m_GeometryArena;
+	mesh->IndexFormat = view.IndexFormat;
+	mesh->UploadVertices(m_D3dDevice, m_CommandList, (const Vertex*) view.pVertices, view.VertexCount);
+	mesh->UploadIndices(m_D3dDevice, m_CommandList, view.pIndices, view.IndexCount);
 
 	m_Meshes[mesh->Name] = std::move(mesh);
 }
@@ -0,0 +1,178 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Core.h"
+
+namespace Loxodonta
+{
+
+// Number of threads to use when asked for threadCount, 0 meaning one per core
+inline u32 WorkerCount(u32 threadCount = 0)
+{
+	if (threadCount != 0)
+		return threadCount;
+	u32 cores = std::thread::hardware_concurrency();
+	return cores != 0 ? cores : 1;
+}
+
+// Calls fn(i) for every i in [0, count) on up to threadCount threads, the calling thread included.
+// Indices are handed out one at a time, so items of uneven cost still balance. The threads are started
+// and joined on every call, which suits one-off import and build work; frame loops use a WorkerPool.
+template <typename Fn>
+void ParallelFor(size_t count, u32 threadCount, Fn fn)
+{
+	u32 workers = WorkerCount(threadCount);
+	if (workers > count)
+		workers = (u32) count;
+	if (workers <= 1)
+	{
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto work = [&next, count, &fn]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+			fn(i);
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(workers - 1);
+	for (u32 t = 1; t < workers; t++)
+		threads.emplace_back(work);
+	work();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+// Threads kept waiting for work, for loops that run every frame and cannot pay for starting threads each
+// time. For has the same contract as ParallelFor. Only one thread may call For at a time, and fn must not
+// call For on the same pool.
+class WorkerPool
+{
+public:
+	// threadCount 0 means one per core, the thread calling For counts as one of them
+	explicit WorkerPool(u32 threadCount = 0)
+	{
+		const u32 workers = WorkerCount(threadCount);
+		m_Threads.reserve(workers - 1);
+		for (u32 t = 1; t < workers; t++)
+			m_Threads.emplace_back([this, t]() { Run(t); });
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+		m_Wake.notify_all();
+		for (auto& thread : m_Threads)
+			thread.join();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	u32 ThreadCount() const { return (u32) m_Threads.size() + 1; }
+
+	// Calls fn(i) for every i in [0, count) on up to threadCount of the pool's threads, the calling
+	// thread included
+	template <typename Fn>
+	void For(size_t count, u32 threadCount, Fn fn)
+	{
+		u32 workers = WorkerCount(threadCount);
+		if (workers > ThreadCount())
+			workers = ThreadCount();
+		if (workers > count)
+			workers = (u32) count;
+		if (workers <= 1)
+		{
+			for (size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_pFn = &fn;
+			m_Call = [](void* pFn, size_t i) { (*static_cast<Fn*>(pFn))(i); };
+			m_Count = count;
+			m_Next = 0;
+			m_Helpers = workers - 1;
+			m_Busy = workers - 1;
+			m_Generation++;
+		}
+		m_Wake.notify_all();
+		Work();
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Done.wait(lock, [this]() { return m_Busy == 0; });
+	}
+
+private:
+	// Thread t helps with the loops that ask for more than t threads
+	void Run(u32 t)
+	{
+		u64 seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_Wake.wait(lock, [this, seen]() { return m_Stopping || m_Generation != seen; });
+				if (m_Stopping)
+					return;
+				seen = m_Generation;
+				if (t > m_Helpers)
+					continue;
+			}
+			Work();
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (--m_Busy == 0)
+				m_Done.notify_one();
+		}
+	}
+
+	void Work()
+	{
+		for (size_t i = m_Next++; i < m_Count; i = m_Next++)
+			m_Call(m_pFn, i);
+	}
+
+	std::vector<std::thread> m_Threads;
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	std::condition_variable m_Done;
+	bool m_Stopping = false;
+
+	// The loop being run, set under the mutex before the helpers are woken
+	void* m_pFn = nullptr;
+	void (*m_Call)(void*, size_t) = nullptr;
+	size_t m_Count = 0;
+	std::atomic<size_t> m_Next{0};
+	u32 m_Helpers = 0;
+	u32 m_Busy = 0;
+	u64 m_Generation = 0;
+};
+
+// ParallelFor on the pool's threads when there is a pool, on threads of its own otherwise
+template <typename Fn>
+void ParallelFor(WorkerPool* pPool, size_t count, u32 threadCount, Fn fn)
+{
+	if (pPool != nullptr)
+		pPool->For(count, threadCount, fn);
+	else
+		ParallelFor(count, threadCount, fn);
+}
+
+}
+
+#endif //!PARALLEL_H
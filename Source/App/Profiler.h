@@ -0,0 +1,91 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdio>
+#endif
+
+#include "Core.h"
+
+namespace Loxodonta
+{
+
+// Wall clock stopwatch used for load time and benchmark measurements
+class Stopwatch
+{
+public:
+	Stopwatch() { Reset(); }
+
+	void Reset() { m_start = Clock::now(); }
+
+	// Milliseconds since the last Reset()
+	f64 ElapsedMs() const
+	{
+		return std::chrono::duration<f64, std::milli>(Clock::now() - m_start).count();
+	}
+
+private:
+	using Clock = std::chrono::high_resolution_clock;
+	Clock::time_point m_start;
+};
+
+// Collection of timing samples, reported as min/mean/percentiles
+class SampleSet
+{
+public:
+	void Add(f64 sample) { m_samples.push_back(sample); m_sorted = false; }
+	void Clear() { m_samples.clear(); m_sorted = false; }
+	size_t Count() const { return m_samples.size(); }
+
+	f64 Mean() const
+	{
+		if (m_samples.empty())
+			return 0.0;
+		f64 sum = 0.0;
+		for (f64 s : m_samples)
+			sum += s;
+		return sum / m_samples.size();
+	}
+
+	// p in [0,1], nearest rank
+	f64 Percentile(f64 p)
+	{
+		if (m_samples.empty())
+			return 0.0;
+		if (!m_sorted)
+		{
+			std::sort(m_samples.begin(), m_samples.end());
+			m_sorted = true;
+		}
+		size_t rank = (size_t) (p * (m_samples.size() - 1) + 0.5);
+		return m_samples[rank < m_samples.size() ? rank : m_samples.size() - 1];
+	}
+
+	f64 Min() { return Percentile(0.0); }
+	f64 Max() { return Percentile(1.0); }
+
+private:
+	std::vector<f64> m_samples;
+	bool m_sorted = false;
+};
+
+// Writes a line to the debugger output (or stdout when there is no debugger API)
+inline void LogLine(const std::string& line)
+{
+#ifdef _WIN32
+	OutputDebugStringA((line + "\n").c_str());
+#else
+	std::printf("%s\n", line.c_str());
+#endif
+}
+
+}
+
+#endif //!PROFILER_H
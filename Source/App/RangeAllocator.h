@@ -0,0 +1,409 @@
+#ifndef RANGE_ALLOCATOR_H
+#define RANGE_ALLOCATOR_H
+
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "Core.h"
+#include "MathUtil.h"
+
+namespace Loxodonta
+{
+
+// A range handed out by RangeAllocator, in units of the pool (vertices, indices, ...)
+struct RangeAllocation
+{
+	u32 Offset = 0;
+	u32 Size = 0;
+	u32 Block = ~0u; // allocator bookkeeping, ~0u when the allocation failed or was released
+
+	bool IsValid() const { return Block != ~0u; }
+};
+
+struct RangeAllocatorStats
+{
+	u32 Capacity = 0;
+	u32 UsedUnits = 0;
+	u32 FreeUnits = 0;
+	u32 LargestFreeRange = 0;
+	u32 FreeRangeCount = 0;
+	u32 AllocationCount = 0;
+
+	// 0 while the free space is a single range, towards 1 as it breaks into small pieces
+	f32 Fragmentation() const { return (FreeUnits == 0) ? 0.0f : 1.0f - (f32) LargestFreeRange / FreeUnits; }
+};
+
+// Two level segregated fit allocator (TLSF, Masmano et al. 2004) over a range of abstract units.
+// Free ranges are binned by size: the first level is the power of two, the second level splits it
+// into SL_COUNT linear steps. Two bitmaps find a non-empty bin that is large enough in constant time,
+// and a released range merges with its free neighbours right away.
+// The bookkeeping lives outside the managed range, so the range can be GPU memory.
+class RangeAllocator
+{
+public:
+	static const u32 SL_BITS = 4;
+	static const u32 SL_COUNT = 1u << SL_BITS;
+	// Sizes below SL_COUNT share first level 0, every larger power of two gets its own
+	static const u32 FL_COUNT = 32 - SL_BITS + 1;
+
+	RangeAllocator()
+	{
+		Reset(0);
+	}
+
+	explicit RangeAllocator(u32 capacity)
+	{
+		Reset(capacity);
+	}
+
+	// Forgets every allocation, the whole capacity becomes one free range
+	void Reset(u32 capacity)
+	{
+		m_Capacity = capacity;
+		m_Used = 0;
+		m_AllocationCount = 0;
+		m_FreeRangeCount = 0;
+		m_Blocks.clear();
+		m_UnusedBlocks.clear();
+		m_FirstLevelBitmap = 0;
+		for(u32 fl = 0; fl < FL_COUNT; fl++)
+		{
+			m_SecondLevelBitmaps[fl] = 0;
+			for(u32 sl = 0; sl < SL_COUNT; sl++)
+				m_FreeHeads[fl][sl] = NONE;
+		}
+
+		if(capacity == 0)
+			return;
+		// Block 0 always starts at offset 0, merges keep the lower block
+		u32 block = NewBlock();
+		m_Blocks[block].Offset = 0;
+		m_Blocks[block].Size = capacity;
+		InsertFree(block);
+	}
+
+	// Returns an invalid allocation when no free range holds size units.
+	// Good fit in constant time, with a scan of one bin only when nothing larger is left.
+	RangeAllocation Allocate(u32 size)
+	{
+		RangeAllocation allocation;
+		if(size == 0 || size > m_Capacity)
+			return allocation;
+
+		u32 fl, sl;
+		MappingSearch(size, fl, sl);
+		u32 block = FindFreeBin(fl, sl) ? m_FreeHeads[fl][sl] : NONE;
+		if(block == NONE)
+		{ // Every larger bin is empty, a range in the request's own bin may still be big enough
+			MappingInsert(size, fl, sl);
+			for(block = m_FreeHeads[fl][sl]; block != NONE && m_Blocks[block].Size < size; block = m_Blocks[block].NextFree)
+				;
+			if(block == NONE)
+				return allocation;
+		}
+		RemoveFree(block);
+
+		// The remainder goes back to the free lists as a range of its own
+		if(m_Blocks[block].Size > size)
+		{
+			u32 rest = NewBlock();
+			Block& b = m_Blocks[block];
+			Block& r = m_Blocks[rest];
+			r.Offset = b.Offset + size;
+			r.Size = b.Size - size;
+			r.PrevPhysical = block;
+			r.NextPhysical = b.NextPhysical;
+			if(b.NextPhysical != NONE)
+				m_Blocks[b.NextPhysical].PrevPhysical = rest;
+			b.NextPhysical = rest;
+			b.Size = size;
+			InsertFree(rest);
+		}
+
+		m_Used += size;
+		m_AllocationCount++;
+		allocation.Offset = m_Blocks[block].Offset;
+		allocation.Size = size;
+		allocation.Block = block;
+		return allocation;
+	}
+
+	// Returns the range to the pool and invalidates allocation
+	void Free(RangeAllocation& allocation)
+	{
+		if(!allocation.IsValid())
+			return;
+
+		u32 block = allocation.Block;
+		m_Used -= m_Blocks[block].Size;
+		m_AllocationCount--;
+		allocation = RangeAllocation();
+
+		// Merge with the free neighbours, the lower block survives
+		u32 next = m_Blocks[block].NextPhysical;
+		if(next != NONE && m_Blocks[next].IsFree)
+		{
+			RemoveFree(next);
+			Absorb(block, next);
+		}
+		u32 prev = m_Blocks[block].PrevPhysical;
+		if(prev != NONE && m_Blocks[prev].IsFree)
+		{
+			RemoveFree(prev);
+			Absorb(prev, block);
+			block = prev;
+		}
+		InsertFree(block);
+	}
+
+	RangeAllocatorStats Stats() const
+	{
+		RangeAllocatorStats stats;
+		stats.Capacity = m_Capacity;
+		stats.UsedUnits = m_Used;
+		stats.FreeUnits = m_Capacity - m_Used;
+		stats.FreeRangeCount = m_FreeRangeCount;
+		stats.AllocationCount = m_AllocationCount;
+
+		// The largest free range sits in the highest non-empty bin
+		if(m_FirstLevelBitmap != 0)
+		{
+			u32 fl = HighestBit(m_FirstLevelBitmap);
+			u32 sl = HighestBit(m_SecondLevelBitmaps[fl]);
+			for(u32 block = m_FreeHeads[fl][sl]; block != NONE; block = m_Blocks[block].NextFree)
+				stats.LargestFreeRange = Math::Max(stats.LargestFreeRange, m_Blocks[block].Size);
+		}
+		return stats;
+	}
+
+	u32 Capacity() const { return m_Capacity; }
+
+	// Walks every range and free list and checks the bookkeeping agrees with itself
+	bool Validate() const
+	{
+		if(m_Capacity == 0)
+			return m_Blocks.empty() && m_Used == 0;
+
+		u32 offset = 0, used = 0, freeCount = 0, allocationCount = 0;
+		u32 prev = NONE;
+		for(u32 block = 0; block != NONE; block = m_Blocks[block].NextPhysical)
+		{
+			const Block& b = m_Blocks[block];
+			if(b.Offset != offset || b.Size == 0 || b.PrevPhysical != prev)
+				return false;
+			if(b.IsFree)
+			{
+				// Two free neighbours should have merged
+				if(prev != NONE && m_Blocks[prev].IsFree)
+					return false;
+				u32 fl, sl;
+				MappingInsert(b.Size, fl, sl);
+				if(!InFreeList(block, fl, sl))
+					return false;
+				freeCount++;
+			}
+			else
+			{
+				used += b.Size;
+				allocationCount++;
+			}
+			offset += b.Size;
+			prev = block;
+		}
+		if(offset != m_Capacity || used != m_Used || allocationCount != m_AllocationCount || freeCount != m_FreeRangeCount)
+			return false;
+
+		// Bitmaps mark exactly the non-empty bins
+		for(u32 fl = 0; fl < FL_COUNT; fl++)
+		{
+			if(((m_FirstLevelBitmap >> fl) & 1) != (m_SecondLevelBitmaps[fl] != 0 ? 1u : 0u))
+				return false;
+			for(u32 sl = 0; sl < SL_COUNT; sl++)
+				if(((m_SecondLevelBitmaps[fl] >> sl) & 1) != (m_FreeHeads[fl][sl] != NONE ? 1u : 0u))
+					return false;
+		}
+		return true;
+	}
+
+	static std::string Describe(const RangeAllocatorStats& stats)
+	{
+		return std::to_string(stats.UsedUnits) + "/" + std::to_string(stats.Capacity) + " used by " +
+			std::to_string(stats.AllocationCount) + " ranges, " + std::to_string(stats.FreeRangeCount) +
+			" free ranges, largest " + std::to_string(stats.LargestFreeRange) + ", fragmentation " +
+			std::to_string(stats.Fragmentation());
+	}
+
+private:
+	static const u32 NONE = ~0u;
+
+	struct Block
+	{
+		u32 Offset = 0;
+		u32 Size = 0;
+		u32 PrevPhysical = NONE;
+		u32 NextPhysical = NONE;
+		u32 PrevFree = NONE;
+		u32 NextFree = NONE;
+		bool IsFree = false;
+	};
+
+	static u32 LowestBit(u32 x)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, x);
+		return (u32) index;
+#else
+		return (u32) __builtin_ctz(x);
+#endif
+	}
+
+	static u32 HighestBit(u32 x)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse(&index, x);
+		return (u32) index;
+#else
+		return 31u - (u32) __builtin_clz(x);
+#endif
+	}
+
+	// Bin a free range of this size is filed under
+	static void MappingInsert(u32 size, u32& fl, u32& sl)
+	{
+		if(size < SL_COUNT)
+		{
+			fl = 0;
+			sl = size;
+			return;
+		}
+		u32 msb = HighestBit(size);
+		fl = msb - SL_BITS + 1;
+		sl = (size >> (msb - SL_BITS)) - SL_COUNT;
+	}
+
+	// First bin whose every range holds at least size units
+	static void MappingSearch(u32 size, u32& fl, u32& sl)
+	{
+		u64 rounded = size;
+		if(size >= SL_COUNT)
+			rounded += (1ull << (HighestBit(size) - SL_BITS)) - 1;
+		if(rounded > 0xFFFFFFFFull)
+		{ // Past the last bin, FindFreeBin fails
+			fl = FL_COUNT;
+			sl = 0;
+			return;
+		}
+		MappingInsert((u32) rounded, fl, sl);
+	}
+
+	bool FindFreeBin(u32& fl, u32& sl) const
+	{
+		if(fl >= FL_COUNT)
+			return false;
+		u32 slMap = m_SecondLevelBitmaps[fl] & (~0u << sl);
+		if(slMap == 0)
+		{
+			u32 flMap = (fl + 1 < 32) ? m_FirstLevelBitmap & (~0u << (fl + 1)) : 0;
+			if(flMap == 0)
+				return false;
+			fl = LowestBit(flMap);
+			slMap = m_SecondLevelBitmaps[fl];
+		}
+		sl = LowestBit(slMap);
+		return true;
+	}
+
+	u32 NewBlock()
+	{
+		if(!m_UnusedBlocks.empty())
+		{
+			u32 block = m_UnusedBlocks.back();
+			m_UnusedBlocks.pop_back();
+			m_Blocks[block] = Block();
+			return block;
+		}
+		m_Blocks.emplace_back();
+		return (u32) m_Blocks.size() - 1;
+	}
+
+	// Appends the physically following block to block and recycles its node
+	void Absorb(u32 block, u32 next)
+	{
+		Block& b = m_Blocks[block];
+		const Block& n = m_Blocks[next];
+		b.Size += n.Size;
+		b.NextPhysical = n.NextPhysical;
+		if(n.NextPhysical != NONE)
+			m_Blocks[n.NextPhysical].PrevPhysical = block;
+		m_UnusedBlocks.push_back(next);
+	}
+
+	void InsertFree(u32 block)
+	{
+		u32 fl, sl;
+		MappingInsert(m_Blocks[block].Size, fl, sl);
+		Block& b = m_Blocks[block];
+		b.IsFree = true;
+		b.PrevFree = NONE;
+		b.NextFree = m_FreeHeads[fl][sl];
+		if(b.NextFree != NONE)
+			m_Blocks[b.NextFree].PrevFree = block;
+		m_FreeHeads[fl][sl] = block;
+		m_FirstLevelBitmap |= 1u << fl;
+		m_SecondLevelBitmaps[fl] |= 1u << sl;
+		m_FreeRangeCount++;
+	}
+
+	void RemoveFree(u32 block)
+	{
+		u32 fl, sl;
+		MappingInsert(m_Blocks[block].Size, fl, sl);
+		Block& b = m_Blocks[block];
+		if(b.PrevFree != NONE)
+			m_Blocks[b.PrevFree].NextFree = b.NextFree;
+		else
+			m_FreeHeads[fl][sl] = b.NextFree;
+		if(b.NextFree != NONE)
+			m_Blocks[b.NextFree].PrevFree = b.PrevFree;
+		if(m_FreeHeads[fl][sl] == NONE)
+		{
+			m_SecondLevelBitmaps[fl] &= ~(1u << sl);
+			if(m_SecondLevelBitmaps[fl] == 0)
+				m_FirstLevelBitmap &= ~(1u << fl);
+		}
+		b.IsFree = false;
+		b.PrevFree = NONE;
+		b.NextFree = NONE;
+		m_FreeRangeCount--;
+	}
+
+	bool InFreeList(u32 block, u32 fl, u32 sl) const
+	{
+		for(u32 b = m_FreeHeads[fl][sl]; b != NONE; b = m_Blocks[b].NextFree)
+			if(b == block)
+				return true;
+		return false;
+	}
+
+	u32 m_Capacity = 0;
+	u32 m_Used = 0;
+	u32 m_AllocationCount = 0;
+	u32 m_FreeRangeCount = 0;
+
+	std::vector<Block> m_Blocks;
+	std::vector<u32> m_UnusedBlocks;
+
+	u32 m_FirstLevelBitmap = 0;
+	u32 m_SecondLevelBitmaps[FL_COUNT] = {};
+	u32 m_FreeHeads[FL_COUNT][SL_COUNT];
+};
+
+}
+
+#endif //!RANGE_ALLOCATOR_H
@@ -0,0 +1,77 @@
+#ifndef RENDER_BACKEND_H
+#define RENDER_BACKEND_H
+
+#include "Core.h"
+#include "FrameResource.h"
+#include "Material.h"
+#include "Texture.h"
+#include "Mesh.h"
+#include "LightClusters.h"
+
+namespace Loxodonta
+{
+
+// Render items are divided by PSO
+enum class RenderLayer : int
+{
+	Opaque = 0,
+	OpaqueAmrn,
+	OpaqueAsrnd,
+	OpaqueTextureless,
+	Transparent,
+	AlphaTested,
+	SkyBox,
+	Count
+};
+
+// Records draws into one command list. A recorder is only used by one thread at a time, but different
+// recorders of a frame may be recording at once.
+class CommandRecorder
+{
+public:
+	virtual ~CommandRecorder() {}
+
+	virtual void SetLayer(RenderLayer layer) = 0;
+	virtual void SetGeometry(const Mesh* mesh, D3D12_PRIMITIVE_TOPOLOGY topology) = 0;
+	// Null for the first descriptor of the heap, as textureless materials expect
+	virtual void SetDiffuse(const Texture* texture) = 0;
+	virtual void DrawIndexedInstanced(u32 indexCount, u32 instanceCount, u32 startIndex, i32 baseVertex, u32 baseInstance) = 0;
+};
+
+// What the frame loop needs from a graphics API. A frame is
+//   BeginFrame, Write* for the data that changed, BeginCommands, draws into each Recorder, EndFrame
+// Frame data goes into the current frame resource, so a slot written NUM_FRAME_RESOURCES frames in a row
+// is up to date everywhere.
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend() {}
+
+	// Moves on to the next frame resource, waiting until the GPU is done with it
+	virtual void BeginFrame() = 0;
+
+	// Makes the current frame resource's instance, material and light buffers hold at least this many
+	// slots. A buffer that grows starts out empty, the caller writes every slot into it before it is drawn with.
+	virtual void Reserve(u32 instanceCount, u32 materialCount, u32 lightCount) = 0;
+	// Instance buffer of the current frame resource, mapped and write only
+	virtual InstanceData* MapInstances() = 0;
+	virtual void WriteMaterial(u32 slot, const MaterialProperties& material) = 0;
+	virtual void WritePass(const PassConstants& pass) = 0;
+	// Point or spot light of a light buffer slot
+	virtual void WriteLight(u32 slot, const LocalLight& light) = 0;
+	// Cluster lists of the lights in view, slots of the light buffer, rewritten every frame
+	virtual void WriteLightClusters(const LightClusters::ClusterLists& clusters) = 0;
+
+	// Most command lists a frame can be recorded into
+	virtual u32 MaxCommandLists() const = 0;
+	// Starts recording into listCount command lists. Each one starts with the targets and per pass data
+	// bound and nothing else, the first one also clears the targets.
+	virtual void BeginCommands(u32 listCount) = 0;
+	virtual CommandRecorder& Recorder(u32 list) = 0;
+	// Submits the lists in index order, whichever order they were recorded in, and presents
+	virtual void EndFrame() = 0;
+};
+
+}
+
+#endif //!RENDER_BACKEND_H
@@ -0,0 +1,309 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Core.h"
+#include "SlotMap.h"
+
+namespace Loxodonta
+{
+
+class Node;
+struct SceneNode;
+struct SceneComponent;
+
+typedef Handle<SceneNode> NodeHandle;
+typedef Handle<SceneComponent> ComponentHandle;
+
+// Ids of scene nodes and components, unique across graphs and threads
+inline u32 NextSceneId()
+{
+	static std::atomic<u32> nextId(1);
+	return nextId++;
+}
+
+struct SceneNode
+{
+	u32 Id = 0;
+	std::string Name;
+	bool Active = true;
+
+	// Children form a list through their sibling links, in the order they were attached
+	NodeHandle Parent;
+	NodeHandle FirstChild;
+	NodeHandle LastChild;
+	NodeHandle PrevSibling;
+	NodeHandle NextSibling;
+	u32 ChildCount = 0;
+
+	ComponentHandle FirstComponent;
+	// Object the node stands for, such as a light, not owned
+	Node* pObject = nullptr;
+	// Node of the TransformHierarchy placing it, ~0u when it has none
+	u32 TransformNode = ~0u;
+};
+
+// What a component is and where its data lives is up to its Type, Data is typically a slot in the store
+// of that type
+struct SceneComponent
+{
+	u32 Id = 0;
+	u32 Type = 0;
+	u32 Data = 0;
+	bool Active = true;
+	NodeHandle Owner;
+	ComponentHandle NextOnNode;
+};
+
+// Scene nodes and their components in slot maps, linked to each other by handles. Lookups by handle and by
+// id are O(1), walking the tree follows the sibling links, and ForEachNode runs over the nodes in memory
+// order. Not safe to change from several threads at once, only ids are.
+class SceneGraph
+{
+public:
+	// A null handle when parent is given but no longer alive
+	NodeHandle CreateNode(const std::string& name = std::string(), NodeHandle parent = NodeHandle())
+	{
+		if (!parent.IsNull() && !m_Nodes.Contains(parent))
+			return NodeHandle();
+		SceneNode node;
+		node.Id = NextSceneId();
+		node.Name = name;
+		const NodeHandle handle = m_Nodes.Insert(std::move(node));
+		m_NodeById[m_Nodes.Get(handle)->Id] = handle;
+		if (!parent.IsNull())
+			Link(handle, parent);
+		return handle;
+	}
+
+	// Destroys the node with everything below it and all their components
+	void DestroyNode(NodeHandle handle)
+	{
+		if (!m_Nodes.Contains(handle))
+			return;
+		Unlink(handle);
+
+		std::vector<NodeHandle>& stack = m_Scratch;
+		stack.assign(1, handle);
+		while (!stack.empty())
+		{
+			const NodeHandle current = stack.back();
+			stack.pop_back();
+			const SceneNode* pNode = m_Nodes.Get(current);
+			for (NodeHandle child = pNode->FirstChild; !child.IsNull(); child = m_Nodes.Get(child)->NextSibling)
+				stack.push_back(child);
+			for (ComponentHandle component = pNode->FirstComponent; !component.IsNull(); )
+			{
+				const SceneComponent* pComponent = m_Components.Get(component);
+				const ComponentHandle next = pComponent->NextOnNode;
+				m_ComponentById.erase(pComponent->Id);
+				m_Components.Remove(component);
+				component = next;
+			}
+			m_NodeById.erase(pNode->Id);
+			m_Nodes.Remove(current);
+		}
+	}
+
+	// Moves the node under parent, after its last child, or makes it a root. Refused when parent is the
+	// node or below it.
+	bool SetParent(NodeHandle handle, NodeHandle parent)
+	{
+		if (!m_Nodes.Contains(handle) || (!parent.IsNull() && !m_Nodes.Contains(parent)))
+			return false;
+		for (NodeHandle ancestor = parent; !ancestor.IsNull(); ancestor = m_Nodes.Get(ancestor)->Parent)
+		{
+			if (ancestor == handle)
+				return false;
+		}
+		Unlink(handle);
+		if (!parent.IsNull())
+			Link(handle, parent);
+		return true;
+	}
+
+	bool IsAlive(NodeHandle handle) const { return m_Nodes.Contains(handle); }
+	SceneNode* Get(NodeHandle handle) { return m_Nodes.Get(handle); }
+	const SceneNode* Get(NodeHandle handle) const { return m_Nodes.Get(handle); }
+
+	NodeHandle Find(u32 id) const
+	{
+		auto it = m_NodeById.find(id);
+		return (it != m_NodeById.end()) ? it->second : NodeHandle();
+	}
+
+	// The node with id when it is a child of parent
+	NodeHandle FindChild(NodeHandle parent, u32 id) const
+	{
+		const NodeHandle handle = Find(id);
+		return (!handle.IsNull() && m_Nodes.Get(handle)->Parent == parent) ? handle : NodeHandle();
+	}
+
+	u32 NodeCount() const { return m_Nodes.Size(); }
+	u32 ComponentCount() const { return m_Components.Size(); }
+
+	// Calls fn(handle, node) for the node's children in order
+	template <typename Fn>
+	void ForEachChild(NodeHandle parent, Fn fn)
+	{
+		const SceneNode* pParent = m_Nodes.Get(parent);
+		if (pParent == nullptr)
+			return;
+		for (NodeHandle child = pParent->FirstChild; !child.IsNull(); )
+		{
+			SceneNode& node = *m_Nodes.Get(child);
+			const NodeHandle next = node.NextSibling;
+			fn(child, node);
+			child = next;
+		}
+	}
+
+	// Calls fn(handle, node) for the node and everything below it, parents before children. fn must not
+	// create or destroy nodes.
+	template <typename Fn>
+	void ForEachDepthFirst(NodeHandle root, Fn fn)
+	{
+		if (!m_Nodes.Contains(root))
+			return;
+		NodeHandle current = root;
+		while (true)
+		{
+			SceneNode& node = *m_Nodes.Get(current);
+			fn(current, node);
+			if (!node.FirstChild.IsNull())
+			{
+				current = node.FirstChild;
+				continue;
+			}
+			// Up until there is a next sibling, stopping at the root
+			while (current != root && m_Nodes.Get(current)->NextSibling.IsNull())
+				current = m_Nodes.Get(current)->Parent;
+			if (current == root)
+				return;
+			current = m_Nodes.Get(current)->NextSibling;
+		}
+	}
+
+	// Calls fn(handle, node) for every node in memory order. fn must not create or destroy nodes.
+	template <typename Fn>
+	void ForEachNode(Fn fn)
+	{
+		std::vector<SceneNode>& nodes = m_Nodes.Values();
+		for (u32 i = 0; i < (u32) nodes.size(); i++)
+			fn(m_Nodes.HandleAt(i), nodes[i]);
+	}
+
+	ComponentHandle AddComponent(NodeHandle owner, u32 type, u32 data = 0)
+	{
+		SceneNode* pOwner = m_Nodes.Get(owner);
+		if (pOwner == nullptr)
+			return ComponentHandle();
+		SceneComponent component;
+		component.Id = NextSceneId();
+		component.Type = type;
+		component.Data = data;
+		component.Owner = owner;
+		component.NextOnNode = pOwner->FirstComponent;
+		const ComponentHandle handle = m_Components.Insert(component);
+		pOwner->FirstComponent = handle;
+		m_ComponentById[component.Id] = handle;
+		return handle;
+	}
+
+	void RemoveComponent(ComponentHandle handle)
+	{
+		const SceneComponent* pComponent = m_Components.Get(handle);
+		if (pComponent == nullptr)
+			return;
+		SceneNode* pOwner = m_Nodes.Get(pComponent->Owner);
+		if (pOwner->FirstComponent == handle)
+		{
+			pOwner->FirstComponent = pComponent->NextOnNode;
+		}
+		else
+		{
+			SceneComponent* pPrevious = m_Components.Get(pOwner->FirstComponent);
+			while (pPrevious->NextOnNode != handle)
+				pPrevious = m_Components.Get(pPrevious->NextOnNode);
+			pPrevious->NextOnNode = pComponent->NextOnNode;
+		}
+		m_ComponentById.erase(pComponent->Id);
+		m_Components.Remove(handle);
+	}
+
+	SceneComponent* Get(ComponentHandle handle) { return m_Components.Get(handle); }
+	const SceneComponent* Get(ComponentHandle handle) const { return m_Components.Get(handle); }
+
+	ComponentHandle FindComponent(u32 id) const
+	{
+		auto it = m_ComponentById.find(id);
+		return (it != m_ComponentById.end()) ? it->second : ComponentHandle();
+	}
+
+	// First component of the node with the given type
+	ComponentHandle FindComponent(NodeHandle owner, u32 type) const
+	{
+		const SceneNode* pOwner = m_Nodes.Get(owner);
+		if (pOwner == nullptr)
+			return ComponentHandle();
+		for (ComponentHandle component = pOwner->FirstComponent; !component.IsNull(); component = m_Components.Get(component)->NextOnNode)
+		{
+			if (m_Components.Get(component)->Type == type)
+				return component;
+		}
+		return ComponentHandle();
+	}
+
+	// All components in memory order
+	std::vector<SceneComponent>& Components() { return m_Components.Values(); }
+
+private:
+	void Link(NodeHandle handle, NodeHandle parent)
+	{
+		SceneNode* pNode = m_Nodes.Get(handle);
+		SceneNode* pParent = m_Nodes.Get(parent);
+		pNode->Parent = parent;
+		pNode->PrevSibling = pParent->LastChild;
+		pNode->NextSibling = NodeHandle();
+		if (pParent->LastChild.IsNull())
+			pParent->FirstChild = handle;
+		else
+			m_Nodes.Get(pParent->LastChild)->NextSibling = handle;
+		pParent->LastChild = handle;
+		pParent->ChildCount++;
+	}
+
+	void Unlink(NodeHandle handle)
+	{
+		SceneNode* pNode = m_Nodes.Get(handle);
+		SceneNode* pParent = m_Nodes.Get(pNode->Parent);
+		if (pParent == nullptr)
+			return;
+		if (pNode->PrevSibling.IsNull())
+			pParent->FirstChild = pNode->NextSibling;
+		else
+			m_Nodes.Get(pNode->PrevSibling)->NextSibling = pNode->NextSibling;
+		if (pNode->NextSibling.IsNull())
+			pParent->LastChild = pNode->PrevSibling;
+		else
+			m_Nodes.Get(pNode->NextSibling)->PrevSibling = pNode->PrevSibling;
+		pParent->ChildCount--;
+		pNode->Parent = NodeHandle();
+		pNode->PrevSibling = NodeHandle();
+		pNode->NextSibling = NodeHandle();
+	}
+
+	SlotMap<SceneNode> m_Nodes;
+	SlotMap<SceneComponent> m_Components;
+	std::unordered_map<u32, NodeHandle> m_NodeById;
+	std::unordered_map<u32, ComponentHandle> m_ComponentById;
+	std::vector<NodeHandle> m_Scratch;
+};
+
+}
+
+#endif //!SCENE_GRAPH_H
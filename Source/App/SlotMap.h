@@ -0,0 +1,130 @@
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+#include <utility>
+#include <vector>
+
+#include "Core.h"
+
+namespace Loxodonta
+{
+
+// Reference to a value in a SlotMap<T>: the slot it was given and the slot's generation at the time. A
+// slot's generation moves on every time its value is removed, so handles to removed values stop
+// resolving instead of reaching whatever took the slot over. Generations wrap after 2^32 reuses of a slot.
+template <typename T>
+struct Handle
+{
+	static const u32 INVALID_INDEX = ~0u;
+
+	u32 Index = INVALID_INDEX;
+	u32 Generation = 0;
+
+	bool IsNull() const { return Index == INVALID_INDEX; }
+	u64 Packed() const { return ((u64) Generation << 32) | Index; }
+
+	bool operator==(const Handle& other) const { return Index == other.Index && Generation == other.Generation; }
+	bool operator!=(const Handle& other) const { return !(*this == other); }
+};
+
+// Values kept contiguous for iteration, reached in O(1) through generational handles. Removing a value
+// moves the last one into its place, so values move but handles stay good; pointers from Get only last
+// until the next Insert or Remove.
+template <typename T>
+class SlotMap
+{
+public:
+	typedef Handle<T> HandleType;
+
+	HandleType Insert(T value)
+	{
+		u32 slot;
+		if (m_FreeHead != HandleType::INVALID_INDEX)
+		{
+			slot = m_FreeHead;
+			m_FreeHead = m_Slots[slot].Dense;
+		}
+		else
+		{
+			slot = (u32) m_Slots.size();
+			m_Slots.push_back(Slot());
+		}
+		m_Slots[slot].Dense = (u32) m_Values.size();
+		m_Values.push_back(std::move(value));
+		m_SlotOf.push_back(slot);
+
+		HandleType handle;
+		handle.Index = slot;
+		handle.Generation = m_Slots[slot].Generation;
+		return handle;
+	}
+
+	// False when the handle was already stale
+	bool Remove(HandleType handle)
+	{
+		if (!Contains(handle))
+			return false;
+
+		const u32 dense = m_Slots[handle.Index].Dense;
+		const u32 last = (u32) m_Values.size() - 1;
+		if (dense != last)
+		{
+			m_Values[dense] = std::move(m_Values[last]);
+			m_SlotOf[dense] = m_SlotOf[last];
+			m_Slots[m_SlotOf[dense]].Dense = dense;
+		}
+		m_Values.pop_back();
+		m_SlotOf.pop_back();
+
+		Slot& slot = m_Slots[handle.Index];
+		slot.Generation++;
+		slot.Dense = m_FreeHead;
+		m_FreeHead = handle.Index;
+		return true;
+	}
+
+	bool Contains(HandleType handle) const
+	{
+		return handle.Index < m_Slots.size() && m_Slots[handle.Index].Generation == handle.Generation &&
+			m_Slots[handle.Index].Dense < m_Values.size() && m_SlotOf[m_Slots[handle.Index].Dense] == handle.Index;
+	}
+
+	// nullptr for stale handles
+	T* Get(HandleType handle) { return Contains(handle) ? &m_Values[m_Slots[handle.Index].Dense] : nullptr; }
+	const T* Get(HandleType handle) const { return Contains(handle) ? &m_Values[m_Slots[handle.Index].Dense] : nullptr; }
+
+	u32 Size() const { return (u32) m_Values.size(); }
+
+	// The values in no particular order, and the handle of the value at each position
+	std::vector<T>& Values() { return m_Values; }
+	const std::vector<T>& Values() const { return m_Values; }
+	HandleType HandleAt(u32 dense) const
+	{
+		HandleType handle;
+		handle.Index = m_SlotOf[dense];
+		handle.Generation = m_Slots[handle.Index].Generation;
+		return handle;
+	}
+
+	void Clear()
+	{
+		for (u32 dense = Size(); dense > 0; dense--)
+			Remove(HandleAt(dense - 1));
+	}
+
+private:
+	struct Slot
+	{
+		u32 Dense = 0;      // position of the value, or the next free slot while free
+		u32 Generation = 0;
+	};
+
+	std::vector<T> m_Values;
+	std::vector<u32> m_SlotOf;
+	std::vector<Slot> m_Slots;
+	u32 m_FreeHead = HandleType::INVALID_INDEX;
+};
+
+}
+
+#endif //!SLOT_MAP_H
@@ -6,8 +6,14 @@
 #include "../3rdParty/DirectXTK12/WICTextureLoader.h"
 #include "../3rdParty/DirectXTK12/DDSTextureLoader.h"
 
+#include <cwctype>
+#include <fstream>
+#include <memory>
+#include <vector>
+
 #include "Core.h"
 #include "FrameResource.h"
+#include "Parallel.h"
 
 namespace Loxodonta
 {
@@ -33,6 +39,133 @@ struct Texture
 		Microsoft::WRL::ComPtr<ID3D12CommandQueue>& commandQueue) = 0;
 };
 
+inline bool IsDDSFile(const std::wstring& filename)
+{
+	return filename.size() >= 4 && filename.substr(filename.length() - 4) == L".dds";
+}
+
+// "Assets/foo_Albedo.jpg" -> "Assets/foo_Albedo.dds", as written by TextureCompressor
+inline std::wstring CompressedTexturePath(const std::wstring& filename)
+{
+	return filename.substr(0, filename.find_last_of(L'.')) + L".dds";
+}
+
+inline bool GetLastWriteTime(const std::wstring& filename, u64& time)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if(!GetFileAttributesExW(filename.c_str(), GetFileExInfoStandard, &attributes))
+		return false;
+	time = ((u64) attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
+// The file to load for a texture: its block compressed .dds when one at least as new as the source exists
+inline std::wstring TextureLoadPath(const std::wstring& filename)
+{
+	if(IsDDSFile(filename))
+		return filename;
+	std::wstring compressed = CompressedTexturePath(filename);
+	u64 sourceTime, compressedTime;
+	if(GetLastWriteTime(compressed, compressedTime) && GetLastWriteTime(filename, sourceTime) && compressedTime >= sourceTime)
+		return compressed;
+	return filename;
+}
+
+// Every .png, .jpg and .dds below folder
+inline void ListImageFiles(const std::wstring& folder, std::vector<std::wstring>& files)
+{
+	WIN32_FIND_DATAW data;
+	HANDLE find = FindFirstFileW((folder + L"/*").c_str(), &data);
+	if(find == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		std::wstring name = data.cFileName;
+		if(name == L"." || name == L"..")
+			continue;
+		std::wstring path = folder + L"/" + name;
+		if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			ListImageFiles(path, files);
+			continue;
+		}
+		std::wstring extension = name.substr(name.find_last_of(L'.') + 1);
+		for(auto& c : extension)
+			c = (wchar_t) towlower(c);
+		if(extension == L"png" || extension == L"jpg" || extension == L"dds")
+			files.push_back(path);
+	} while(FindNextFileW(find, &data));
+	FindClose(find);
+}
+
+// Image decoded into CPU memory, the part of a texture load that needs no device
+struct CpuImage
+{
+	std::wstring Filename;
+	HRESULT Result = E_PENDING;
+
+	// Decoded pixels, or the whole file for .dds which is already in GPU layout
+	std::unique_ptr<u8[]> Data;
+	size_t DataSize = 0;
+
+	// Texture to create for decoded pixels, unused for .dds
+	D3D12_RESOURCE_DESC Desc = {};
+	D3D12_SUBRESOURCE_DATA Subresource = {};
+};
+
+inline HRESULT DecodeImage(CpuImage& image)
+{
+	if(IsDDSFile(image.Filename))
+	{ // dds format
+		std::ifstream file(image.Filename, std::ios::binary | std::ios::ate);
+		if(!file)
+			return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+		image.DataSize = (size_t) file.tellg();
+		image.Data.reset(new u8[image.DataSize]);
+		file.seekg(0);
+		file.read((char*) image.Data.get(), image.DataSize);
+		return file ? S_OK : E_FAIL;
+	}
+	// otherwise
+	HRESULT hr = DirectX::DecodeWICTextureFromFileEx(image.Filename.c_str(), 0, DirectX::WIC_LOADER_DEFAULT,
+		image.Desc, image.Data, image.Subresource);
+	image.DataSize = SUCCEEDED(hr) ? (size_t) image.Subresource.SlicePitch : 0;
+	return hr;
+}
+
+// Decodes every image on up to threadCount threads (0 for one per core), results are in CpuImage::Result
+inline void DecodeImages(std::vector<CpuImage>& images, u32 threadCount = 0)
+{
+	ParallelFor(images.size(), threadCount, [&images](size_t i)
+	{
+		// WIC needs COM initialized on the decoding thread
+		HRESULT com = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+		images[i].Result = DecodeImage(images[i]);
+		if(SUCCEEDED(com))
+			CoUninitialize();
+	});
+}
+
+// Creates the texture for a decoded image and records its upload into resourceUpload
+inline HRESULT CreateTextureFromImage(ID3D12Device* d3dDevice, ResourceUploadBatch& resourceUpload,
+	const CpuImage& image, ID3D12Resource** texture)
+{
+	if(IsDDSFile(image.Filename))
+	{
+		return DirectX::CreateDDSTextureFromMemory(d3dDevice, resourceUpload, image.Data.get(), image.DataSize, texture);
+	}
+
+	CD3DX12_HEAP_PROPERTIES defaultHeapProperties(D3D12_HEAP_TYPE_DEFAULT);
+	HRESULT hr = d3dDevice->CreateCommittedResource(&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &image.Desc,
+		D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(texture));
+	if(FAILED(hr))
+		return hr;
+
+	resourceUpload.Upload(*texture, 0, &image.Subresource, 1);
+	resourceUpload.Transition(*texture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	return S_OK;
+}
+
 struct ImageTexture : public Texture
 {
 	std::wstring Filename;
@@ -40,18 +173,13 @@ struct ImageTexture : public Texture
 	virtual int Initialize(Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice,
 		Microsoft::WRL::ComPtr<ID3D12CommandQueue>& commandQueue)
 	{
+		CpuImage image;
+		image.Filename = TextureLoadPath(Filename);
+		ThrowIfFailed(DecodeImage(image));
+
 		ResourceUpload = ResourceUploadBatch(d3dDevice.Get());
 		ResourceUpload.Begin();
-		if(Filename.substr(Filename.length() - 4) == L".dds")
-		{ // dds format
-			ThrowIfFailed(DirectX::CreateDDSTextureFromFile(d3dDevice.Get(), ResourceUpload,
-				Filename.c_str(), Resource.ReleaseAndGetAddressOf()));
-		}
-		else
-		{ // otherwise
-			ThrowIfFailed(DirectX::CreateWICTextureFromFile(d3dDevice.Get(), ResourceUpload,
-				Filename.c_str(), Resource.ReleaseAndGetAddressOf()));
-		}
+		ThrowIfFailed(CreateTextureFromImage(d3dDevice.Get(), ResourceUpload, image, Resource.ReleaseAndGetAddressOf()));
 		// Upload the resources to the GPU
 		auto RUTexFinished = ResourceUpload.End(commandQueue.Get());
 		// Wait for the upload thread to terminate
@@ -61,5 +189,41 @@ struct ImageTexture : public Texture
 	}
 };
 
+// Loads many ImageTextures together: every file is decoded concurrently, then all the
+// uploads are recorded into one ResourceUploadBatch and waited on once
+class TextureBatch
+{
+public:
+	void Add(ImageTexture* pTexture) { m_textures.push_back(pTexture); }
+	size_t Count() const { return m_textures.size(); }
+
+	void Load(Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice,
+		Microsoft::WRL::ComPtr<ID3D12CommandQueue>& commandQueue, u32 threadCount = 0)
+	{
+		std::vector<CpuImage> images(m_textures.size());
+		for(size_t i = 0; i < m_textures.size(); i++)
+			images[i].Filename = TextureLoadPath(m_textures[i]->Filename);
+		DecodeImages(images, threadCount);
+
+		ResourceUploadBatch resourceUpload(d3dDevice.Get());
+		resourceUpload.Begin();
+		for(size_t i = 0; i < m_textures.size(); i++)
+		{
+			ThrowIfFailed(images[i].Result);
+			ThrowIfFailed(CreateTextureFromImage(d3dDevice.Get(), resourceUpload, images[i],
+				m_textures[i]->Resource.ReleaseAndGetAddressOf()));
+			// Upload() has copied the pixels into an upload heap
+			images[i].Data.reset();
+		}
+		auto uploadFinished = resourceUpload.End(commandQueue.Get());
+		uploadFinished.wait();
+
+		m_textures.clear();
+	}
+
+private:
+	std::vector<ImageTexture*> m_textures;
+};
+
 }
 #endif //!TEXTURE_H
\ No newline at end of file
@@ -0,0 +1,283 @@
+#ifndef TEXTURE_COMPRESSOR_H
+#define TEXTURE_COMPRESSOR_H
+
+#include "../3rdParty/DirectXTK12/d3dx12.h"
+#include "../3rdParty/DirectXTK12/dds.h"
+
+#include <cmath>
+#include <cwctype>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Core.h"
+#include "BlockCompression.h"
+#include "Profiler.h"
+#include "Texture.h"
+
+namespace Loxodonta
+{
+
+// Offline stage turning the material maps under Assets/ into BCn .dds files next to their sources,
+// which TextureLoadPath then prefers over the .jpg/.png
+namespace TextureCompressor
+{
+	using BlockCompression::Format;
+	using BlockCompression::Quality;
+
+	// Block format for a material map, from the map names used under Assets/. Returns false for images
+	// that are not material maps (previews, environment maps, maps the shaders do not sample).
+	inline bool ChooseFormat(const std::wstring& filename, Format& format)
+	{
+		std::wstring name = filename.substr(filename.find_last_of(L"/\\") + 1);
+		for (auto& c : name)
+			c = (wchar_t) towlower(c);
+		auto contains = [&name](const wchar_t* pPart) { return name.find(pPart) != std::wstring::npos; };
+
+		if (contains(L"preview") || contains(L"thumb"))
+			return false;
+		if (contains(L"normal"))
+			format = Format::BC5;
+		// Specular is sampled as an RGB F0, so it keeps three channels
+		else if (contains(L"albedo") || contains(L"basecolor") || contains(L"-alb") || contains(L"specular"))
+			format = Format::BC7;
+		else if (contains(L"rough") || contains(L"metal") || contains(L"displacement"))
+			format = Format::BC4;
+		else
+			return false;
+		return true;
+	}
+
+	inline const char* FormatName(Format format)
+	{
+		return format == Format::BC4 ? "BC4" : format == Format::BC5 ? "BC5" : "BC7";
+	}
+
+	// BC4/BC5 have no sRGB variant, sRGB sources are linearized before encoding instead
+	inline DXGI_FORMAT ToDXGIFormat(Format format, bool sRGB)
+	{
+		if (format == Format::BC4)
+			return DXGI_FORMAT_BC4_UNORM;
+		if (format == Format::BC5)
+			return DXGI_FORMAT_BC5_UNORM;
+		return sRGB ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+	}
+
+	// Channels the shaders read from each kind of map, the PSNR is measured over these
+	inline u32 MeasuredChannels(Format format)
+	{
+		return format == Format::BC7 ? 3 : BlockCompression::ChannelCount(format);
+	}
+
+	inline std::string ToUtf8(const std::wstring& text)
+	{
+		int size = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int) text.size(), nullptr, 0, nullptr, nullptr);
+		std::string result(size, '\0');
+		WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int) text.size(), &result[0], size, nullptr, nullptr);
+		return result;
+	}
+
+	// Converts a decoded image to tightly packed RGBA8 holding what the sampler returns for it today:
+	// R8 reads as (r, 0, 0, 1) and, when linearize is set, sRGB formats are converted to linear.
+	// Returns false for formats the compressor does not take.
+	inline bool ToRGBA8(const CpuImage& image, bool linearize, std::vector<u8>& rgba)
+	{
+		DXGI_FORMAT format = image.Desc.Format;
+		bool sRGB = format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB || format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+		bool bgra = format == DXGI_FORMAT_B8G8R8A8_UNORM || format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+		bool r8 = format == DXGI_FORMAT_R8_UNORM;
+		if (!sRGB && !bgra && !r8 && format != DXGI_FORMAT_R8G8B8A8_UNORM)
+			return false;
+
+		u8 toLinear[256];
+		for (int i = 0; i < 256; i++)
+		{
+			f64 s = i / 255.0;
+			f64 linear = s <= 0.04045 ? s / 12.92 : std::pow((s + 0.055) / 1.055, 2.4);
+			toLinear[i] = (linearize && sRGB) ? (u8) (linear * 255.0 + 0.5) : (u8) i;
+		}
+
+		u32 width = (u32) image.Desc.Width, height = image.Desc.Height;
+		rgba.resize((size_t) width * height * 4);
+		for (u32 y = 0; y < height; y++)
+		{
+			const u8* pRow = image.Data.get() + (size_t) y * image.Subresource.RowPitch;
+			u8* pOut = &rgba[(size_t) y * width * 4];
+			for (u32 x = 0; x < width; x++, pOut += 4)
+			{
+				if (r8)
+				{
+					pOut[0] = pRow[x];
+					pOut[1] = pOut[2] = 0;
+					pOut[3] = 255;
+					continue;
+				}
+				const u8* pPixel = pRow + 4 * x;
+				pOut[0] = toLinear[pPixel[bgra ? 2 : 0]];
+				pOut[1] = toLinear[pPixel[1]];
+				pOut[2] = toLinear[pPixel[bgra ? 0 : 2]];
+				pOut[3] = pPixel[3];
+			}
+		}
+		return true;
+	}
+
+	// Writes a single mip .dds with the DX10 header, through a temporary file so a partial write never
+	// shadows the source image
+	inline bool WriteDDS(const std::wstring& filename, DXGI_FORMAT format, u32 width, u32 height, const std::vector<u8>& blocks)
+	{
+		DirectX::DDS_HEADER header = {};
+		header.size = sizeof(DirectX::DDS_HEADER);
+		header.flags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_LINEARSIZE;
+		header.height = height;
+		header.width = width;
+		header.pitchOrLinearSize = (u32) blocks.size();
+		header.mipMapCount = 1;
+		header.ddspf = DirectX::DDSPF_DX10;
+		header.caps = DDS_SURFACE_FLAGS_TEXTURE;
+
+		DirectX::DDS_HEADER_DXT10 extension = {};
+		extension.dxgiFormat = format;
+		extension.resourceDimension = DirectX::DDS_DIMENSION_TEXTURE2D;
+		extension.arraySize = 1;
+
+		std::wstring tempName = filename + L".tmp";
+		{
+			std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+			if (!file)
+				return false;
+			u32 magic = DirectX::DDS_MAGIC;
+			file.write((const char*) &magic, sizeof(magic));
+			file.write((const char*) &header, sizeof(header));
+			file.write((const char*) &extension, sizeof(extension));
+			file.write((const char*) blocks.data(), blocks.size());
+			if (!file)
+				return false;
+		}
+		return MoveFileExW(tempName.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+
+	struct MapStats
+	{
+		std::wstring Filename;
+		Format BlockFormat = Format::BC7;
+		u32 Width = 0;
+		u32 Height = 0;
+		u64 SourceBytes = 0;     // as uploaded from the decoded .jpg/.png
+		u64 CompressedBytes = 0;
+		f64 PSNR = 0.0;
+		f64 EncodeMs = 0.0;
+	};
+
+	// Compresses one decoded material map to CompressedTexturePath(image.Filename).
+	// Returns an empty string on success, otherwise why the map was skipped.
+	inline std::string CompressMap(const CpuImage& image, Format format, Quality quality, u32 threadCount, MapStats& stats)
+	{
+		if (FAILED(image.Result))
+			return "decode failed";
+		u32 width = (u32) image.Desc.Width, height = image.Desc.Height;
+		// D3D12 only creates block compressed textures whose top level is whole blocks
+		if (width % 4 != 0 || height % 4 != 0)
+			return "size is not a multiple of 4";
+
+		bool sRGB = image.Desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB || image.Desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+		std::vector<u8> rgba;
+		if (!ToRGBA8(image, format != Format::BC7, rgba))
+			return "unsupported pixel format";
+
+		std::vector<u8> blocks;
+		Stopwatch timer;
+		BlockCompression::CompressImage(rgba.data(), width, height, width * 4, format, quality, threadCount, blocks);
+		stats.EncodeMs = timer.ElapsedMs();
+
+		std::vector<u8> decoded;
+		BlockCompression::DecompressImage(blocks.data(), width, height, format, decoded);
+		stats.PSNR = BlockCompression::PSNR(rgba.data(), width * 4, decoded.data(), width * 4, width, height, MeasuredChannels(format));
+
+		stats.Filename = image.Filename;
+		stats.BlockFormat = format;
+		stats.Width = width;
+		stats.Height = height;
+		stats.SourceBytes = image.DataSize;
+		stats.CompressedBytes = blocks.size();
+
+		if (!WriteDDS(CompressedTexturePath(image.Filename), ToDXGIFormat(format, sRGB), width, height, blocks))
+			return "could not write .dds";
+		return std::string();
+	}
+
+	// Compresses every material map below root and reports memory savings, PSNR and throughput per map
+	// and per asset folder. Maps are decoded a folder at a time on all cores, then each map's blocks are
+	// spread over threadCount threads (0 for one per core).
+	inline void CompressFolder(std::ostream& out, const std::wstring& root, Quality quality, u32 threadCount = 0)
+	{
+		std::vector<std::wstring> files;
+		ListImageFiles(root, files);
+
+		// Material maps grouped by the folder they are in
+		std::map<std::wstring, std::vector<std::pair<std::wstring, Format>>> folders;
+		for (const std::wstring& file : files)
+		{
+			Format format;
+			if (!IsDDSFile(file) && ChooseFormat(file, format))
+				folders[file.substr(0, file.find_last_of(L'/'))].push_back(std::make_pair(file, format));
+		}
+
+		const char* qualityNames[] = { "fast", "normal", "best" };
+		out << "TextureCompress quality " << qualityNames[(int) quality] << ", " << WorkerCount(threadCount) << " threads\n";
+
+		Stopwatch total;
+		u64 totalSource = 0, totalCompressed = 0;
+		for (const auto& folder : folders)
+		{
+			std::vector<CpuImage> images(folder.second.size());
+			for (size_t i = 0; i < images.size(); i++)
+				images[i].Filename = folder.second[i].first;
+			DecodeImages(images, threadCount);
+
+			u64 folderSource = 0, folderCompressed = 0, folderPixels = 0;
+			f64 folderMs = 0.0, folderPSNR = 0.0;
+			u32 compressed = 0;
+			out << ToUtf8(folder.first) << "\n";
+			for (size_t i = 0; i < images.size(); i++)
+			{
+				std::string name = ToUtf8(images[i].Filename.substr(images[i].Filename.find_last_of(L'/') + 1));
+				MapStats stats;
+				std::string error = CompressMap(images[i], folder.second[i].second, quality, threadCount, stats);
+				images[i].Data.reset();
+				if (!error.empty())
+				{
+					out << "  " << name << ": skipped, " << error << "\n";
+					continue;
+				}
+
+				f64 pixels = (f64) stats.Width * stats.Height;
+				out << "  " << name << ": " << FormatName(stats.BlockFormat) << " " << stats.Width << "x" << stats.Height << ", "
+					<< stats.SourceBytes / 1024 << " KB -> " << stats.CompressedBytes / 1024 << " KB, "
+					<< stats.PSNR << " dB, " << stats.EncodeMs << " ms, " << pixels / 1000.0 / Math::Max(stats.EncodeMs, 1e-6) << " MPix/s\n";
+
+				folderSource += stats.SourceBytes;
+				folderCompressed += stats.CompressedBytes;
+				folderPixels += (u64) pixels;
+				folderMs += stats.EncodeMs;
+				folderPSNR += stats.PSNR;
+				compressed++;
+			}
+			if (compressed == 0)
+				continue;
+
+			out << "  total: " << compressed << " maps, " << folderSource / (1024 * 1024.0) << " MB -> "
+				<< folderCompressed / (1024 * 1024.0) << " MB (" << 100.0 * (1.0 - (f64) folderCompressed / Math::Max(folderSource, (u64) 1))
+				<< "% saved), mean " << folderPSNR / compressed << " dB, " << folderPixels / 1000.0 / Math::Max(folderMs, 1e-6) << " MPix/s\n";
+			totalSource += folderSource;
+			totalCompressed += folderCompressed;
+		}
+		out << "All folders: " << totalSource / (1024 * 1024.0) << " MB -> " << totalCompressed / (1024 * 1024.0) << " MB in "
+			<< total.ElapsedMs() / 1000.0 << " s\n";
+	}
+}
+
+}
+
+#endif //!TEXTURE_COMPRESSOR_H
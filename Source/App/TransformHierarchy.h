@@ -0,0 +1,372 @@
+#ifndef TRANSFORM_HIERARCHY_H
+#define TRANSFORM_HIERARCHY_H
+
+#include <cstring>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "Parallel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define TRANSFORM_HIERARCHY_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace Loxodonta
+{
+
+// Scale, then rotation, then translation, relative to the parent
+struct Transform
+{
+	float3 Translation = { 0.0f, 0.0f, 0.0f };
+	float4 Rotation = { 0.0f, 0.0f, 0.0f, 1.0f }; // unit quaternion
+	float3 Scale = { 1.0f, 1.0f, 1.0f };
+};
+
+// Local transforms of a tree of nodes and the world matrices they add up to. Nodes are kept flattened in
+// breadth first order, one array per field, so every node comes after its parent, each level is one range
+// and a node's children are one range of the next level. Update walks the levels top down and only
+// visits the dirty nodes: those given a new local transform and everything below them. A level with
+// enough dirty nodes is split into chunks across threads, its nodes only read the level above.
+//
+// Node ids are handed out in the order nodes are added and stay the same when the hierarchy is flattened
+// again, which happens on the first Update after nodes were added.
+class TransformHierarchy
+{
+public:
+	static const u32 NO_PARENT = ~0u;
+	// Dirty nodes a level needs before it is split across threads, and nodes per chunk
+	static const u32 MIN_PARALLEL_NODES = 8192;
+	static const u32 CHUNK_NODES = 2048;
+
+	// The parent must have been added first, NO_PARENT makes a root
+	u32 Add(const Transform& local, u32 parent = NO_PARENT)
+	{
+		const u32 id = (u32) m_ParentId.size();
+		m_ParentId.push_back(parent);
+		m_PosOf.push_back((u32) m_IdOf.size());
+		m_IdOf.push_back(id);
+		m_Translation.push_back(local.Translation);
+		m_Rotation.push_back(local.Rotation);
+		m_Scale.push_back(local.Scale);
+		m_World.push_back(Matrix::Identity4x4());
+		m_Flattened = false;
+		return id;
+	}
+
+	u32 Count() const { return (u32) m_ParentId.size(); }
+	u32 Parent(u32 id) const { return m_ParentId[id]; }
+	u32 LevelCount() const { return (u32) m_LevelStarts.size() - 1; }
+
+	Transform Local(u32 id) const
+	{
+		const u32 pos = m_PosOf[id];
+		Transform local;
+		local.Translation = m_Translation[pos];
+		local.Rotation = m_Rotation[pos];
+		local.Scale = m_Scale[pos];
+		return local;
+	}
+
+	void SetLocal(u32 id, const Transform& local)
+	{
+		const u32 pos = m_PosOf[id];
+		m_Translation[pos] = local.Translation;
+		m_Rotation[pos] = local.Rotation;
+		m_Scale[pos] = local.Scale;
+		Queue(pos);
+	}
+
+	void SetTranslation(u32 id, const float3& translation)
+	{
+		const u32 pos = m_PosOf[id];
+		m_Translation[pos] = translation;
+		Queue(pos);
+	}
+
+	void SetRotation(u32 id, const float4& rotation)
+	{
+		const u32 pos = m_PosOf[id];
+		m_Rotation[pos] = rotation;
+		Queue(pos);
+	}
+
+	// As of the last Update
+	const float4x4& World(u32 id) const { return m_World[m_PosOf[id]]; }
+
+	// Brings the world matrices of the dirty nodes up to date. threadCount 0 means one per core, taken from
+	// pPool when given.
+	void Update(u32 threadCount = 1, WorkerPool* pPool = nullptr)
+	{
+		if (!m_Flattened)
+			Flatten();
+
+		for (std::vector<u32>& updated : m_UpdatedLevels)
+			updated.clear();
+		for (u32 level = 0; level < LevelCount(); level++)
+		{
+			std::vector<u32>& dirty = m_DirtyLevels[level];
+			if (dirty.empty())
+				continue;
+
+			const u32 count = (u32) dirty.size();
+			if (count >= MIN_PARALLEL_NODES && WorkerCount(threadCount) > 1)
+			{
+				const u32 chunkCount = (count + CHUNK_NODES - 1) / CHUNK_NODES;
+				ParallelFor(pPool, chunkCount, threadCount, [this, &dirty, count](size_t chunk)
+				{
+					const u32 first = (u32) chunk * CHUNK_NODES;
+					UpdateNodes(dirty.data() + first, Math::Min(first + CHUNK_NODES, count) - first);
+				});
+			}
+			else
+			{
+				UpdateNodes(dirty.data(), count);
+			}
+
+			// Children of the nodes just updated follow them on the next level
+			std::vector<u32>* pNext = (level + 1 < LevelCount()) ? &m_DirtyLevels[level + 1] : nullptr;
+			for (u32 pos : dirty)
+			{
+				m_Queued[pos] = 0;
+				const u32 last = m_FirstChild[pos] + m_ChildCount[pos];
+				for (u32 child = m_FirstChild[pos]; child < last; child++)
+				{
+					if (m_Queued[child] == 0)
+					{
+						m_Queued[child] = 1;
+						pNext->push_back(child);
+					}
+				}
+			}
+			m_UpdatedLevels[level].swap(dirty);
+		}
+	}
+
+	// Calls fn(id, world) for every node the last Update recomputed, level by level
+	template <typename Fn>
+	void ForEachUpdated(Fn fn) const
+	{
+		for (const std::vector<u32>& updated : m_UpdatedLevels)
+		{
+			for (u32 pos : updated)
+				fn(m_IdOf[pos], m_World[pos]);
+		}
+	}
+
+	u32 UpdatedCount() const
+	{
+		u32 count = 0;
+		for (const std::vector<u32>& updated : m_UpdatedLevels)
+			count += (u32) updated.size();
+		return count;
+	}
+
+	// World matrix of a node multiplied out from its root, without SIMD, for checking Update
+	float4x4 ComputeReference(u32 id) const
+	{
+		std::vector<u32> chain;
+		for (u32 node = id; node != NO_PARENT; node = m_ParentId[node])
+			chain.push_back(node);
+
+		float4x4 world = Matrix::Identity4x4();
+		for (u32 node : chain)
+		{
+			float rows[4][4];
+			LocalRows(m_PosOf[node], rows);
+			float4x4 product;
+			for (int r = 0; r < 4; r++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					product.m[r][c] = world.m[r][0] * rows[0][c] + world.m[r][1] * rows[1][c] +
+						world.m[r][2] * rows[2][c] + world.m[r][3] * rows[3][c];
+				}
+			}
+			world = product;
+		}
+		return world;
+	}
+
+private:
+	void Queue(u32 pos)
+	{
+		if (!m_Flattened || m_Queued[pos] != 0)
+			return;
+		m_Queued[pos] = 1;
+		m_DirtyLevels[m_Level[pos]].push_back(pos);
+	}
+
+	// Rows of scale * rotation * translation, the rotation as XMMatrixRotationQuaternion builds it
+	void LocalRows(u32 pos, float rows[4][4]) const
+	{
+		const float4& q = m_Rotation[pos];
+		const float3& s = m_Scale[pos];
+		const float3& t = m_Translation[pos];
+		const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+		const float local[4][4] =
+		{
+			{ s.x * (1.0f - 2.0f * (yy + zz)), s.x * 2.0f * (xy + wz), s.x * 2.0f * (xz - wy), 0.0f },
+			{ s.y * 2.0f * (xy - wz), s.y * (1.0f - 2.0f * (xx + zz)), s.y * 2.0f * (yz + wx), 0.0f },
+			{ s.z * 2.0f * (xz + wy), s.z * 2.0f * (yz - wx), s.z * (1.0f - 2.0f * (xx + yy)), 0.0f },
+			{ t.x, t.y, t.z, 1.0f }
+		};
+		std::memcpy(rows, local, sizeof(local));
+	}
+
+	// World matrices of count nodes whose parents are up to date
+	void UpdateNodes(const u32* pPositions, u32 count)
+	{
+		for (u32 i = 0; i < count; i++)
+		{
+			const u32 pos = pPositions[i];
+			float rows[4][4];
+			LocalRows(pos, rows);
+			float4x4& world = m_World[pos];
+			const u32 parent = m_Parent[pos];
+			if (parent == NO_PARENT)
+			{
+				std::memcpy(world.m, rows, sizeof(rows));
+				continue;
+			}
+			const float4x4& parentWorld = m_World[parent];
+#if defined(TRANSFORM_HIERARCHY_SSE)
+			// Each row of the product is the parent's rows weighted by the local row
+			const __m128 p0 = _mm_loadu_ps(parentWorld.m[0]), p1 = _mm_loadu_ps(parentWorld.m[1]);
+			const __m128 p2 = _mm_loadu_ps(parentWorld.m[2]), p3 = _mm_loadu_ps(parentWorld.m[3]);
+			for (int r = 0; r < 3; r++)
+			{
+				const __m128 row = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rows[r][0]), p0), _mm_mul_ps(_mm_set1_ps(rows[r][1]), p1)),
+					_mm_mul_ps(_mm_set1_ps(rows[r][2]), p2));
+				_mm_storeu_ps(world.m[r], row);
+			}
+			const __m128 origin = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rows[3][0]), p0), _mm_mul_ps(_mm_set1_ps(rows[3][1]), p1)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rows[3][2]), p2), p3));
+			_mm_storeu_ps(world.m[3], origin);
+#else
+			for (int r = 0; r < 4; r++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					world.m[r][c] = rows[r][0] * parentWorld.m[0][c] + rows[r][1] * parentWorld.m[1][c] +
+						rows[r][2] * parentWorld.m[2][c] + rows[r][3] * parentWorld.m[3][c];
+				}
+			}
+#endif
+		}
+	}
+
+	// Breadth first order over the nodes, then every field moved into it. Every node is dirty afterwards.
+	void Flatten()
+	{
+		const u32 count = Count();
+
+		// Children of each node by id, in the order they were added
+		std::vector<u32> childStarts(count + 1, 0), children(count);
+		for (u32 id = 0; id < count; id++)
+		{
+			if (m_ParentId[id] != NO_PARENT)
+				childStarts[m_ParentId[id] + 1]++;
+		}
+		for (u32 id = 0; id < count; id++)
+			childStarts[id + 1] += childStarts[id];
+		std::vector<u32> fill(childStarts.begin(), childStarts.end() - 1);
+		for (u32 id = 0; id < count; id++)
+		{
+			if (m_ParentId[id] != NO_PARENT)
+				children[fill[m_ParentId[id]]++] = id;
+		}
+
+		std::vector<u32> order;
+		order.reserve(count);
+		for (u32 id = 0; id < count; id++)
+		{
+			if (m_ParentId[id] == NO_PARENT)
+				order.push_back(id);
+		}
+		m_LevelStarts.assign(1, 0);
+		for (u32 levelStart = 0; levelStart < (u32) order.size(); )
+		{
+			const u32 levelEnd = (u32) order.size();
+			m_LevelStarts.push_back(levelEnd);
+			for (u32 i = levelStart; i < levelEnd; i++)
+				order.insert(order.end(), children.begin() + childStarts[order[i]], children.begin() + childStarts[order[i] + 1]);
+			levelStart = levelEnd;
+		}
+
+		std::vector<float3> translation(count), scale(count);
+		std::vector<float4> rotation(count);
+		std::vector<float4x4> world(count);
+		for (u32 pos = 0; pos < count; pos++)
+		{
+			const u32 from = m_PosOf[order[pos]];
+			translation[pos] = m_Translation[from];
+			rotation[pos] = m_Rotation[from];
+			scale[pos] = m_Scale[from];
+			world[pos] = m_World[from];
+		}
+		m_Translation.swap(translation);
+		m_Rotation.swap(rotation);
+		m_Scale.swap(scale);
+		m_World.swap(world);
+		m_IdOf = order;
+		for (u32 pos = 0; pos < count; pos++)
+			m_PosOf[order[pos]] = pos;
+
+		// Children were appended level by level in their parents' order, so they are found one parent at a time
+		m_Parent.resize(count);
+		m_FirstChild.resize(count);
+		m_ChildCount.resize(count);
+		m_Level.resize(count);
+		u32 nextChild = (LevelCount() > 0) ? m_LevelStarts[1] : 0;
+		for (u32 level = 0; level < LevelCount(); level++)
+		{
+			for (u32 pos = m_LevelStarts[level]; pos < m_LevelStarts[level + 1]; pos++)
+			{
+				const u32 id = m_IdOf[pos];
+				m_Parent[pos] = (m_ParentId[id] == NO_PARENT) ? NO_PARENT : m_PosOf[m_ParentId[id]];
+				m_FirstChild[pos] = nextChild;
+				m_ChildCount[pos] = childStarts[id + 1] - childStarts[id];
+				m_Level[pos] = level;
+				nextChild += m_ChildCount[pos];
+			}
+		}
+
+		// Roots are enough, Update takes everything below them
+		m_Queued.assign(count, 0);
+		m_DirtyLevels.assign(LevelCount(), std::vector<u32>());
+		m_UpdatedLevels.assign(LevelCount(), std::vector<u32>());
+		m_Flattened = true;
+		for (u32 pos = 0; pos < (LevelCount() > 0 ? m_LevelStarts[1] : 0); pos++)
+			Queue(pos);
+	}
+
+	// By id: parents and where each node is in the flattened arrays, and back
+	std::vector<u32> m_ParentId;
+	std::vector<u32> m_PosOf;
+	std::vector<u32> m_IdOf;
+
+	// By flattened position
+	std::vector<float3> m_Translation;
+	std::vector<float4> m_Rotation;
+	std::vector<float3> m_Scale;
+	std::vector<float4x4> m_World;
+	std::vector<u32> m_Parent;
+	std::vector<u32> m_FirstChild;
+	std::vector<u32> m_ChildCount;
+	std::vector<u32> m_Level;
+	std::vector<u8> m_Queued;
+
+	std::vector<u32> m_LevelStarts = std::vector<u32>(1, 0);
+	// Nodes of each level to update, and those the last Update did
+	std::vector<std::vector<u32>> m_DirtyLevels;
+	std::vector<std::vector<u32>> m_UpdatedLevels;
+	bool m_Flattened = true;
+};
+
+}
+
+#endif //!TRANSFORM_HIERARCHY_H
@@ -0,0 +1,281 @@
+#ifndef TRANSIENT_ALLOCATOR_H
+#define TRANSIENT_ALLOCATOR_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Core.h"
+
+namespace Loxodonta
+{
+
+// Memory of one page: where the CPU writes it and where the GPU reads it
+struct TransientPage
+{
+	u8* pCpu = nullptr;
+	u64 GpuAddress = 0;
+	u64 Size = 0;
+};
+
+// Where TransientAllocator gets its pages from, upload heap resources or plain memory.
+// Page bases are aligned to TransientAllocator::PAGE_GRANULARITY.
+class TransientPageSource
+{
+public:
+	virtual ~TransientPageSource() {}
+
+	virtual TransientPage CreatePage(u64 size) = 0;
+	virtual void DestroyPage(const TransientPage& page) = 0;
+};
+
+// Memory that is only good until the GPU is done with the frame it was allocated in
+struct TransientAllocation
+{
+	u8* pCpu = nullptr;
+	u64 GpuAddress = 0;
+	u64 Size = 0;
+
+	bool IsValid() const { return pCpu != nullptr; }
+};
+
+struct TransientAllocatorStats
+{
+	u32 PageCount = 0;      // pages of the standard size, wherever they are
+	u32 PendingPages = 0;   // waiting for their fence, large pages included
+	u32 FreePages = 0;
+	u32 LargePageCount = 0; // dedicated pages of allocations above the page size
+};
+
+// Linear allocator for data written once per frame, such as constants. Allocations are bumped off the
+// current page and never freed one by one: Commit tags every page used since the last commit with the
+// frame's fence value, and Retire takes pages whose fence the GPU has passed back for reuse. Pages are
+// retired in the order they were committed, so the pages form a ring that grows by a page whenever
+// the GPU is too far behind for the frames in flight to fit.
+// The current page stays current across a commit: its tail was never handed out, only its start has to
+// wait for the fence. Allocations larger than a page get a dedicated page, destroyed once retired.
+class TransientAllocator
+{
+public:
+	// Constant buffer views need 256 byte aligned addresses
+	static const u64 DEFAULT_ALIGNMENT = 256;
+	// Upload heap resources are placed at 64k boundaries, pages come in multiples of it
+	static const u64 PAGE_GRANULARITY = 65536;
+
+	TransientAllocator() = default;
+	TransientAllocator(const TransientAllocator&) = delete;
+	TransientAllocator& operator=(const TransientAllocator&) = delete;
+
+	~TransientAllocator()
+	{
+		Destroy();
+	}
+
+	// pSource must outlive the allocator
+	void Initialize(TransientPageSource* pSource, u64 pageSize = PAGE_GRANULARITY)
+	{
+		Destroy();
+		m_pSource = pSource;
+		m_PageSize = RoundUp(pageSize, PAGE_GRANULARITY);
+	}
+
+	// alignment is a power of two up to PAGE_GRANULARITY
+	TransientAllocation Allocate(u64 size, u64 alignment = DEFAULT_ALIGNMENT)
+	{
+		TransientAllocation allocation;
+		if (size == 0 || m_pSource == nullptr)
+			return allocation;
+
+		if (size > m_PageSize)
+		{
+			Page large;
+			large.Memory = m_pSource->CreatePage(RoundUp(size, PAGE_GRANULARITY));
+			large.Offset = size;
+			large.Large = true;
+			m_Used.push_back(large);
+			m_LargePageCount++;
+			return Suballocation(large.Memory, 0, size);
+		}
+
+		u64 offset = RoundUp(m_Current.Offset, alignment);
+		if (!m_HasCurrent || offset + size > m_Current.Memory.Size)
+		{
+			if (m_HasCurrent)
+				m_Used.push_back(m_Current);
+			NextPage();
+			offset = 0;
+		}
+		m_Current.Offset = offset + size;
+		m_CurrentUsed = true;
+		return Suballocation(m_Current.Memory, offset, size);
+	}
+
+	// Call once the work of the frame is submitted, with the fence value signaled after it
+	void Commit(u64 fence)
+	{
+		for (Page& page : m_Used)
+		{
+			page.Fence = fence;
+			m_Pending.push_back(page);
+		}
+		m_Used.clear();
+
+		if (m_CurrentUsed)
+			m_Current.Fence = fence;
+		m_CurrentUsed = false;
+	}
+
+	// Call with the GPU's completed fence value, before allocating for a new frame
+	void Retire(u64 completedFence)
+	{
+		while (!m_Pending.empty() && m_Pending.front().Fence <= completedFence)
+		{
+			Page page = m_Pending.front();
+			m_Pending.pop_front();
+			if (page.Large)
+			{
+				m_pSource->DestroyPage(page.Memory);
+				m_LargePageCount--;
+			}
+			else
+			{
+				page.Offset = 0;
+				m_Free.push_back(page);
+			}
+		}
+	}
+
+	// Destroys the pages nothing is using at the moment, after a spike in demand
+	void Shrink()
+	{
+		for (const Page& page : m_Free)
+			m_pSource->DestroyPage(page.Memory);
+		m_PageCount -= (u32) m_Free.size();
+		m_Free.clear();
+	}
+
+	u64 PageSize() const { return m_PageSize; }
+
+	TransientAllocatorStats Stats() const
+	{
+		TransientAllocatorStats stats;
+		stats.PageCount = m_PageCount;
+		stats.PendingPages = (u32) m_Pending.size();
+		stats.FreePages = (u32) m_Free.size();
+		stats.LargePageCount = m_LargePageCount;
+		return stats;
+	}
+
+private:
+	struct Page
+	{
+		TransientPage Memory;
+		u64 Offset = 0; // first byte not handed out yet
+		u64 Fence = 0;  // fence of the last frame that allocated from the page
+		bool Large = false;
+	};
+
+	static u64 RoundUp(u64 value, u64 alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	static TransientAllocation Suballocation(const TransientPage& memory, u64 offset, u64 size)
+	{
+		TransientAllocation allocation;
+		allocation.pCpu = memory.pCpu + offset;
+		allocation.GpuAddress = memory.GpuAddress + offset;
+		allocation.Size = size;
+		return allocation;
+	}
+
+	// The page retired last, still warm in the caches, or a new one when every page is in flight
+	void NextPage()
+	{
+		if (!m_Free.empty())
+		{
+			m_Current = m_Free.back();
+			m_Free.pop_back();
+		}
+		else
+		{
+			m_Current = Page();
+			m_Current.Memory = m_pSource->CreatePage(m_PageSize);
+			m_PageCount++;
+		}
+		m_HasCurrent = true;
+	}
+
+	void Destroy()
+	{
+		if (m_pSource == nullptr)
+			return;
+		if (m_HasCurrent)
+			m_pSource->DestroyPage(m_Current.Memory);
+		for (const Page& page : m_Used)
+			m_pSource->DestroyPage(page.Memory);
+		for (const Page& page : m_Pending)
+			m_pSource->DestroyPage(page.Memory);
+		for (const Page& page : m_Free)
+			m_pSource->DestroyPage(page.Memory);
+		m_Used.clear();
+		m_Pending.clear();
+		m_Free.clear();
+		m_HasCurrent = false;
+		m_CurrentUsed = false;
+		m_PageCount = 0;
+		m_LargePageCount = 0;
+	}
+
+	TransientPageSource* m_pSource = nullptr;
+	u64 m_PageSize = PAGE_GRANULARITY;
+
+	Page m_Current;
+	bool m_HasCurrent = false;
+	bool m_CurrentUsed = false; // allocated from since the last commit
+	// Full pages allocated from since the last commit, pages waiting for their fence in commit order,
+	// and pages ready for reuse
+	std::vector<Page> m_Used;
+	std::deque<Page> m_Pending;
+	std::vector<Page> m_Free;
+
+	u32 m_PageCount = 0;
+	u32 m_LargePageCount = 0;
+};
+
+// Pages in plain memory with made up GPU addresses, for running the allocator without a device
+class MemoryPageSource : public TransientPageSource
+{
+public:
+	TransientPage CreatePage(u64 size) override
+	{
+		const u64 granularity = TransientAllocator::PAGE_GRANULARITY;
+		std::unique_ptr<u8[]> storage(new u8[size + granularity]);
+		const u64 misalignment = reinterpret_cast<uintptr_t>(storage.get()) & (granularity - 1);
+
+		TransientPage page;
+		page.pCpu = storage.get() + ((misalignment == 0) ? 0 : granularity - misalignment);
+		page.GpuAddress = m_NextGpuAddress;
+		page.Size = size;
+		m_NextGpuAddress += (size + granularity - 1) / granularity * granularity;
+		m_Storage[page.pCpu] = std::move(storage);
+		return page;
+	}
+
+	void DestroyPage(const TransientPage& page) override
+	{
+		m_Storage.erase(page.pCpu);
+	}
+
+	u32 LivePageCount() const { return (u32) m_Storage.size(); }
+
+private:
+	std::unordered_map<u8*, std::unique_ptr<u8[]>> m_Storage;
+	u64 m_NextGpuAddress = TransientAllocator::PAGE_GRANULARITY;
+};
+
+}
+
+#endif //!TRANSIENT_ALLOCATOR_H
@@ -0,0 +1,62 @@
+#ifndef UPLOAD_PAGE_SOURCE_H
+#define UPLOAD_PAGE_SOURCE_H
+
+#include <unordered_map>
+
+#include "../3rdParty/FrankLuna/d3dUtil.h"
+
+#include "Core.h"
+#include "TransientAllocator.h"
+
+namespace Loxodonta
+{
+
+// Transient pages as upload heap buffers, each mapped for its whole life
+class UploadPageSource : public TransientPageSource
+{
+public:
+	void Initialize(Microsoft::WRL::ComPtr<ID3D12Device>& d3dDevice)
+	{
+		m_Device = d3dDevice;
+	}
+
+	TransientPage CreatePage(u64 size) override
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
+		ThrowIfFailed(m_Device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(size),
+			D3D12_RESOURCE_STATE_GENERIC_READ,
+			nullptr,
+			IID_PPV_ARGS(buffer.GetAddressOf())));
+
+		void* pMapped = nullptr;
+		ThrowIfFailed(buffer->Map(0, nullptr, &pMapped));
+
+		TransientPage page;
+		page.pCpu = static_cast<u8*>(pMapped);
+		page.GpuAddress = buffer->GetGPUVirtualAddress();
+		page.Size = size;
+		m_Buffers[page.pCpu] = buffer;
+		return page;
+	}
+
+	// The GPU must be done with the page, TransientAllocator only destroys retired ones
+	void DestroyPage(const TransientPage& page) override
+	{
+		auto it = m_Buffers.find(page.pCpu);
+		if(it == m_Buffers.end())
+			return;
+		it->second->Unmap(0, nullptr);
+		m_Buffers.erase(it);
+	}
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> m_Device;
+	std::unordered_map<u8*, Microsoft::WRL::ComPtr<ID3D12Resource>> m_Buffers;
+};
+
+}
+
+#endif //!UPLOAD_PAGE_SOURCE_H
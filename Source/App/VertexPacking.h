@@ -0,0 +1,238 @@
+#ifndef VERTEX_PACKING_H
+#define VERTEX_PACKING_H
+
+#include <cmath>
+#include <vector>
+
+#include "Core.h"
+#include "MathUtil.h"
+#include "FrameResource.h"
+
+namespace Loxodonta
+{
+
+enum class VertexFormat
+{
+	Full = 0, // Vertex, 56 bytes of floats
+	Packed,   // PackedVertex, 20 bytes
+};
+
+// Quantized vertex read through PACKED_VERTEX in the shaders.
+// Position and texcoord are 16 bit fractions of the mesh bounds, undone with VertexQuantization.
+// Normal and tangent are octahedral encoded, the bitangent is rebuilt as cross(N, T) * sign.
+struct PackedVertex
+{
+	u16 Position[4];      // R16G16B16A16_UNORM, w holds the bitangent sign: 0 is -1, 0xFFFF is +1
+	i16 NormalTangent[4]; // R16G16B16A16_SNORM, octahedral normal in xy, octahedral tangent in zw
+	u16 TexCoord[2];      // R16G16_UNORM
+};
+
+// Maps the [0,1] values of a packed vertex back to mesh space: value * Scale + Offset
+struct VertexQuantization
+{
+	float3 PositionScale = {1.0f, 1.0f, 1.0f};
+	float3 PositionOffset = {0.0f, 0.0f, 0.0f};
+	float2 TexCoordScale = {1.0f, 1.0f};
+	float2 TexCoordOffset = {0.0f, 0.0f};
+};
+
+// Worst case round trip differences over a set of vertices.
+// Position and texcoord stay within about half a step of their bounds (extent / 131070),
+// the 16 bit octahedral directions within about 0.005 degrees.
+struct PackingError
+{
+	f32 MaxPosition = 0.0f;
+	f32 MaxTexCoord = 0.0f;
+	f32 MaxNormalDegrees = 0.0f;
+	f32 MaxTangentDegrees = 0.0f;
+	u32 BitangentSignFlips = 0;
+};
+
+namespace VertexPacking
+{
+	inline f32 Length(const float3& v)
+	{
+		return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+	}
+
+	inline f32 Dot(const float3& a, const float3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	inline float3 Cross(const float3& a, const float3& b)
+	{
+		return float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	inline float3 Normalize(const float3& v, const float3& fallback)
+	{
+		f32 length = Length(v);
+		if (!(length > 1e-12f))
+			return fallback;
+		return float3(v.x / length, v.y / length, v.z / length);
+	}
+
+	inline i16 ToSnorm16(f32 value)
+	{
+		value = Math::Clamp(value, -1.0f, 1.0f);
+		return (i16) std::floor(value * 32767.0f + 0.5f);
+	}
+
+	inline f32 FromSnorm16(i16 value)
+	{
+		return Math::Max(value / 32767.0f, -1.0f);
+	}
+
+	inline u16 ToUnorm16(f32 value, f32 offset, f32 scale)
+	{
+		if (scale == 0.0f)
+			return 0;
+		f32 t = Math::Clamp((value - offset) / scale, 0.0f, 1.0f);
+		return (u16) std::floor(t * 65535.0f + 0.5f);
+	}
+
+	inline f32 FromUnorm16(u16 value, f32 offset, f32 scale)
+	{
+		return (value / 65535.0f) * scale + offset;
+	}
+
+	// Unit vector onto the octahedron |x| + |y| + |z| = 1, lower half folded over the upper one
+	inline void OctahedralEncode(const float3& n, i16* pOut)
+	{
+		f32 l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+		f32 x = n.x / l1;
+		f32 y = n.y / l1;
+		if (n.z < 0.0f)
+		{
+			f32 foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			f32 foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = foldedX;
+			y = foldedY;
+		}
+		pOut[0] = ToSnorm16(x);
+		pOut[1] = ToSnorm16(y);
+	}
+
+	// Same arithmetic as OctahedralDecode in Core.hlsl
+	inline float3 OctahedralDecode(const i16* pIn)
+	{
+		float3 n(FromSnorm16(pIn[0]), FromSnorm16(pIn[1]), 0.0f);
+		n.z = 1.0f - std::fabs(n.x) - std::fabs(n.y);
+		f32 t = Math::Clamp(-n.z, 0.0f, 1.0f);
+		n.x += (n.x >= 0.0f) ? -t : t;
+		n.y += (n.y >= 0.0f) ? -t : t;
+		return Normalize(n, float3(0.0f, 0.0f, 1.0f));
+	}
+
+	// Bounds of the positions and texcoords, the whole 16 bit range is spread over them
+	inline VertexQuantization ComputeQuantization(const Vertex* pVertices, u32 vertexCount)
+	{
+		VertexQuantization q;
+		if (vertexCount == 0)
+			return q;
+
+		float3 minPos = pVertices[0].Pos, maxPos = pVertices[0].Pos;
+		float2 minUV = pVertices[0].TexCoord, maxUV = pVertices[0].TexCoord;
+		for (u32 i = 1; i < vertexCount; i++)
+		{
+			const Vertex& v = pVertices[i];
+			minPos = float3(Math::Min(minPos.x, v.Pos.x), Math::Min(minPos.y, v.Pos.y), Math::Min(minPos.z, v.Pos.z));
+			maxPos = float3(Math::Max(maxPos.x, v.Pos.x), Math::Max(maxPos.y, v.Pos.y), Math::Max(maxPos.z, v.Pos.z));
+			minUV = float2(Math::Min(minUV.x, v.TexCoord.x), Math::Min(minUV.y, v.TexCoord.y));
+			maxUV = float2(Math::Max(maxUV.x, v.TexCoord.x), Math::Max(maxUV.y, v.TexCoord.y));
+		}
+		q.PositionOffset = minPos;
+		q.PositionScale = float3(maxPos.x - minPos.x, maxPos.y - minPos.y, maxPos.z - minPos.z);
+		q.TexCoordOffset = minUV;
+		q.TexCoordScale = float2(maxUV.x - minUV.x, maxUV.y - minUV.y);
+		return q;
+	}
+
+	inline PackedVertex Pack(const Vertex& v, const VertexQuantization& q)
+	{
+		PackedVertex p;
+		p.Position[0] = ToUnorm16(v.Pos.x, q.PositionOffset.x, q.PositionScale.x);
+		p.Position[1] = ToUnorm16(v.Pos.y, q.PositionOffset.y, q.PositionScale.y);
+		p.Position[2] = ToUnorm16(v.Pos.z, q.PositionOffset.z, q.PositionScale.z);
+
+		// Orthonormal frame: the tangent loses its component along the normal before encoding
+		float3 normal = Normalize(v.Normal, float3(0.0f, 1.0f, 0.0f));
+		f32 d = Dot(v.Tangent, normal);
+		float3 tangent(v.Tangent.x - normal.x * d, v.Tangent.y - normal.y * d, v.Tangent.z - normal.z * d);
+		float3 fallback = std::fabs(normal.x) < 0.9f ? float3(1.0f, 0.0f, 0.0f) : float3(0.0f, 1.0f, 0.0f);
+		tangent = Normalize(tangent, Normalize(Cross(Cross(normal, fallback), normal), fallback));
+		OctahedralEncode(normal, &p.NormalTangent[0]);
+		OctahedralEncode(tangent, &p.NormalTangent[2]);
+		p.Position[3] = (Dot(Cross(normal, tangent), v.Bitangent) < 0.0f) ? 0 : 0xFFFF;
+
+		p.TexCoord[0] = ToUnorm16(v.TexCoord.x, q.TexCoordOffset.x, q.TexCoordScale.x);
+		p.TexCoord[1] = ToUnorm16(v.TexCoord.y, q.TexCoordOffset.y, q.TexCoordScale.y);
+		return p;
+	}
+
+	// What the vertex shader sees, with unit length tangent frame
+	inline Vertex Unpack(const PackedVertex& p, const VertexQuantization& q)
+	{
+		Vertex v;
+		v.Pos = float3(
+			FromUnorm16(p.Position[0], q.PositionOffset.x, q.PositionScale.x),
+			FromUnorm16(p.Position[1], q.PositionOffset.y, q.PositionScale.y),
+			FromUnorm16(p.Position[2], q.PositionOffset.z, q.PositionScale.z));
+		v.Normal = OctahedralDecode(&p.NormalTangent[0]);
+		v.Tangent = OctahedralDecode(&p.NormalTangent[2]);
+		float3 bitangent = Cross(v.Normal, v.Tangent);
+		f32 sign = (p.Position[3] != 0) ? 1.0f : -1.0f;
+		v.Bitangent = float3(bitangent.x * sign, bitangent.y * sign, bitangent.z * sign);
+		v.TexCoord = float2(
+			FromUnorm16(p.TexCoord[0], q.TexCoordOffset.x, q.TexCoordScale.x),
+			FromUnorm16(p.TexCoord[1], q.TexCoordOffset.y, q.TexCoordScale.y));
+		return v;
+	}
+
+	inline VertexQuantization PackVertices(const Vertex* pVertices, u32 vertexCount, std::vector<PackedVertex>& packed)
+	{
+		VertexQuantization q = ComputeQuantization(pVertices, vertexCount);
+		packed.resize(vertexCount);
+		for (u32 i = 0; i < vertexCount; i++)
+			packed[i] = Pack(pVertices[i], q);
+		return q;
+	}
+
+	// atan2 keeps its precision for small angles where acos of the dot product does not
+	inline f32 AngleDegrees(const float3& a, const float3& b)
+	{
+		return std::atan2(Length(Cross(a, b)), Dot(a, b)) * (180.0f / 3.14159265f);
+	}
+
+	inline PackingError MeasureError(const Vertex* pVertices, const PackedVertex* pPacked, u32 vertexCount, const VertexQuantization& q)
+	{
+		PackingError error;
+		for (u32 i = 0; i < vertexCount; i++)
+		{
+			const Vertex& original = pVertices[i];
+			Vertex decoded = Unpack(pPacked[i], q);
+			error.MaxPosition = Math::Max(error.MaxPosition, std::fabs(decoded.Pos.x - original.Pos.x));
+			error.MaxPosition = Math::Max(error.MaxPosition, std::fabs(decoded.Pos.y - original.Pos.y));
+			error.MaxPosition = Math::Max(error.MaxPosition, std::fabs(decoded.Pos.z - original.Pos.z));
+			error.MaxTexCoord = Math::Max(error.MaxTexCoord, std::fabs(decoded.TexCoord.x - original.TexCoord.x));
+			error.MaxTexCoord = Math::Max(error.MaxTexCoord, std::fabs(decoded.TexCoord.y - original.TexCoord.y));
+			if (Length(original.Normal) > 0.0f)
+				error.MaxNormalDegrees = Math::Max(error.MaxNormalDegrees, AngleDegrees(decoded.Normal, original.Normal));
+
+			// Against the orthogonalized tangent, the part along the normal is dropped on purpose
+			float3 normal = Normalize(original.Normal, float3(0.0f, 1.0f, 0.0f));
+			f32 d = Dot(original.Tangent, normal);
+			float3 tangent(original.Tangent.x - normal.x * d, original.Tangent.y - normal.y * d, original.Tangent.z - normal.z * d);
+			if (Length(tangent) > 1e-6f * Math::Max(Length(original.Tangent), 1e-20f))
+				error.MaxTangentDegrees = Math::Max(error.MaxTangentDegrees, AngleDegrees(decoded.Tangent, tangent));
+			if (Dot(decoded.Bitangent, original.Bitangent) < 0.0f)
+				error.BitangentSignFlips++;
+		}
+		return error;
+	}
+}
+
+}
+
+#endif //!VERTEX_PACKING_H
@@ -1,16 +1,3 @@
-// Defaults for number of lights.
-#ifndef NUM_DIR_LIGHTS
-	#define NUM_DIR_LIGHTS 4
-#endif
-
-#ifndef NUM_POINT_LIGHTS
-	#define NUM_POINT_LIGHTS 0
-#endif
-
-#ifndef NUM_SPOT_LIGHTS
-	#define NUM_SPOT_LIGHTS 0
-#endif
-
 #include "LightingUtil.hlsl"
 
 Texture2D g_SkyArray[2] : register(t0);
@@ -24,11 +11,46 @@ SamplerState g_SamLinearClamp      : register(s3);
 SamplerState g_SamAnisotropicWrap  : register(s4);
 SamplerState g_SamAnisotropicClamp : register(s5);
 
-// Constant data that varies per object
-cbuffer cbPerObject : register(b0)
+// Data that varies per instance
+struct InstanceData
+{
+	float4x4 World;
+	float4x4 TexTransform;
+	float3   PositionScale;
+	uint     MaterialIndex;
+	float3   PositionOffset;
+	uint     __InstancePad0;
+	float4   TexCoordScaleOffset;
+};
+
+// Data that varies per material
+struct MaterialData
 {
-	float4x4 g_World;
-	float4x4 g_TexTransform;
+	float4x4 MatTransform;
+	float3 DiffuseAlbedo;
+	float  Metallic;
+	float3 FresnelR0;
+	float  Roughness;
+	float3 Transmission;
+	float  HeightScale;
+	float3 Emissive;
+	float  Opacity;
+	float  Sheen;
+	float  ClearCoatThickness;
+	float  ClearCoatRoughness;
+	float  Anisotropy;
+	float  AnisotropyRotation;
+	float3 __MaterialPad0;
+};
+
+StructuredBuffer<InstanceData> g_InstanceData : register(t0, space1);
+StructuredBuffer<MaterialData> g_MaterialData : register(t1, space1);
+
+// Constant data that varies per draw
+cbuffer cbPerDraw : register(b0)
+{
+	// Index of the draw's first instance in g_InstanceData
+	uint g_BaseInstance;
 };
 
 // Constant data that varies per frame
@@ -57,25 +79,101 @@ cbuffer cbPass : register(b1)
 	float g_FogRange;
 	float2 __g_pass_PAD001;
 
+	// Cluster grid of the local lights, see ClusterIndex
+	uint3 g_ClusterCount;
+	float g_ClusterDepthScale;
+	float2 g_ClusterTileScale;
+	float g_ClusterDepthBias;
+	uint g_DirectionalLightCount;
+
+	// Directional lights, the first g_DirectionalLightCount are lit
 	Light g_Lights[MAX_LIGHTS];
 };
 
-// Constant data that varies per material
-cbuffer cbMaterial : register(b2)
+// Point and spot lights of the scene, and for every cluster the offset and count of its indices into them
+StructuredBuffer<LocalLight> g_LocalLights : register(t2, space1);
+StructuredBuffer<uint2> g_LightClusters : register(t3, space1);
+StructuredBuffer<uint> g_ClusterLightIndices : register(t4, space1);
+
+// Cluster of a pixel from its position on screen and world position. Tiles divide the screen evenly,
+// slices are spaced exponentially in view space depth.
+uint ClusterIndex(float2 pixel, float3 posW)
+{
+	float viewZ = mul(float4(posW, 1.0f), g_View).z;
+	uint x = min((uint) (pixel.x * g_ClusterTileScale.x), g_ClusterCount.x - 1);
+	uint y = min((uint) (pixel.y * g_ClusterTileScale.y), g_ClusterCount.y - 1);
+	uint z = min((uint) max(log(viewZ) * g_ClusterDepthScale + g_ClusterDepthBias, 0.0f), g_ClusterCount.z - 1);
+	return (z * g_ClusterCount.y + y) * g_ClusterCount.x + x;
+}
+
+// Evaluates the local lights of the pixel's cluster, the CPU binned every light reaching it there
+float3 ComputeClusteredLighting(Material mat, float2 pixel, float3 pos, float3 N, float3 V)
+{
+	uint2 cluster = g_LightClusters[ClusterIndex(pixel, pos)];
+	float3 result = 0.0f;
+	for(uint i = 0; i < cluster.y; i++)
+	{
+		LocalLight light = g_LocalLights[g_ClusterLightIndices[cluster.x + i]];
+		if(light.Type == LOCAL_LIGHT_SPOT)
+			result += ComputeSpotLight(light, mat, pos, N, V);
+		else
+			result += ComputePointLight(light, mat, pos, N, V);
+	}
+	return result;
+}
+
+#if PACKED_VERTEX
+// PackedVertex: 16 bit fractions of the mesh bounds, octahedral normal and tangent
+struct VertexIn
+{
+	float4 PosL          : POSITION; // w is 0 or 1, the sign of the bitangent
+	float4 NormalTangent : NORMAL;
+	float2 TexCoord      : TEXCOORD;
+};
+#else
+struct VertexIn
+{
+	float3 PosL       : POSITION;
+	float3 NormalL    : NORMAL;
+	float3 TangentU   : TANGENT;
+	float3 BitangentU : BINORMAL;
+	float2 TexCoord   : TEXCOORD;
+};
+#endif
+
+// Vertex attributes in mesh space, whatever the input layout
+struct LocalVertex
+{
+	float3 PosL;
+	float3 NormalL;
+	float3 TangentU;
+	float3 BitangentU;
+	float2 TexCoord;
+};
+
+float3 OctahedralDecode(float2 e)
 {
-	float4x4 g_MatTransform;
-	float3 g_DiffuseAlbedo;
-	float  g_Metallic;
-	float3 g_FresnelR0;
-	float  g_Roughness;
-	float3 g_Transmission;
-	float  g_HeightScale;
-	float3 g_Emissive;
-	float  g_Opacity;
-	float  g_Sheen;
-	float  g_ClearCoatThickness;
-	float  g_ClearCoatRoughness;
-	float  g_Anisotropy;
-	float  g_AnisotropyRotation;
-	float3 __g_mat_pass_PAD000;
+	float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	float t = saturate(-n.z);
+	n.xy += (n.xy >= 0.0f) ? -t : t;
+	return normalize(n);
+}
+
+LocalVertex DecodeVertex(VertexIn vin, InstanceData instance)
+{
+	LocalVertex v;
+#if PACKED_VERTEX
+	v.PosL = vin.PosL.xyz * instance.PositionScale + instance.PositionOffset;
+	v.NormalL = OctahedralDecode(vin.NormalTangent.xy);
+	v.TangentU = OctahedralDecode(vin.NormalTangent.zw);
+	v.BitangentU = cross(v.NormalL, v.TangentU) * (vin.PosL.w * 2.0f - 1.0f);
+	v.TexCoord = vin.TexCoord * instance.TexCoordScaleOffset.xy + instance.TexCoordScaleOffset.zw;
+#else
+	v.PosL = vin.PosL;
+	v.NormalL = vin.NormalL;
+	v.TangentU = vin.TangentU;
+	v.BitangentU = vin.BitangentU;
+	v.TexCoord = vin.TexCoord;
+#endif
+	return v;
 }
@@ -1,14 +1,5 @@
 #include "Core.hlsl"
 
-struct VertexIn
-{
-	float3 PosL       : POSITION;
-    float3 NormalL    : NORMAL;
-	float3 TangentU   : TANGENT;
-	float3 BitangentU : BINORMAL;
-	float2 TexCoord   : TEXCOORD;
-};
-
 struct VertexOut
 {
 	float4 PosH       : SV_POSITION;
@@ -17,35 +8,46 @@ struct VertexOut
 	float3 TangentW   : TANGENT;
 	float3 BitangentW : BINORMAL;
 	float2 TexCoord   : TEXCOORD;
+
+	nointerpolation uint MatIndex : MATINDEX;
 };
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
 {
 	VertexOut vout = (VertexOut)0.0f;
+
+	// Fetch the instance and its material
+	InstanceData instance = g_InstanceData[g_BaseInstance + instanceID];
+	float4x4 world = instance.World;
+	MaterialData matData = g_MaterialData[instance.MaterialIndex];
+	vout.MatIndex = instance.MaterialIndex;
+	LocalVertex v = DecodeVertex(vin, instance);
 	
 	// Transform to world space
-	float4 posW = mul(float4(vin.PosL, 1.0f), g_World);
+	float4 posW = mul(float4(v.PosL, 1.0f), world);
 	vout.PosW = posW.xyz;
 
 	// Assumes nonuniform scaling; otherwise use inverse-transpose
-	vout.NormalW = mul(vin.NormalL, (float3x3)g_World);
+	vout.NormalW = mul(v.NormalL, (float3x3)world);
 
 	// Transform tangents and bitangents to world space
-	vout.TangentW = mul(vin.TangentU, (float3x3)g_World);
-	vout.BitangentW = mul(vin.BitangentU, (float3x3)g_World);
+	vout.TangentW = mul(v.TangentU, (float3x3)world);
+	vout.BitangentW = mul(v.BitangentU, (float3x3)world);
 
 	// Transform to homogeneous clip space.
     vout.PosH = mul(posW, g_ViewProj);
     
 	// Output vertex attributes for interpolation across triangle.
-    float4 texCoord = mul(float4(vin.TexCoord, 0.0f, 1.0f), g_TexTransform);
-    vout.TexCoord = mul(texCoord, g_MatTransform).xy;
+    float4 texCoord = mul(float4(v.TexCoord, 0.0f, 1.0f), instance.TexTransform);
+    vout.TexCoord = mul(texCoord, matData.MatTransform).xy;
 
     return vout;
 }
 
 float4 PS(VertexOut pin) : SV_Target
 {
+	MaterialData matData = g_MaterialData[pin.MatIndex];
+
     // Interpolating normal can unnormalize it, so renormalize it.
     pin.NormalW = normalize(pin.NormalW);
 	
@@ -59,7 +61,7 @@ float4 PS(VertexOut pin) : SV_Target
 	float3x3 TBN = float3x3(pin.TangentW, pin.BitangentW, pin.NormalW);
 
 	float3 VinTan = mul(V, TBN);
-	float2 P = (VinTan.xy ) * (height * g_HeightScale);
+	float2 P = (VinTan.xy ) * (height * matData.HeightScale);
 	float2 TexCoord = pin.TexCoord - P;
 
 	clip(TexCoord.x);
@@ -79,26 +81,26 @@ float4 PS(VertexOut pin) : SV_Target
 #if DIFFUSE_TEXTURE != 0
     float3 diffuseAlbedo = g_TextureArray[0].Sample(g_SamAnisotropicWrap, TexCoord).rgb;
 #else
-	float3 diffuseAlbedo = g_DiffuseAlbedo;
+	float3 diffuseAlbedo = matData.DiffuseAlbedo;
 #endif
 
 #if METALLIC_TEXTURE != 0
 	float metallic = g_TextureArray[2].Sample(g_SamAnisotropicWrap, TexCoord).r;
 #else
-	float metallic = g_Metallic;
+	float metallic = matData.Metallic;
 #endif
 
 #if SPECULAR_TEXTURE != 0
 	float3 F0 = g_TextureArray[1].Sample(g_SamAnisotropicWrap, TexCoord).rgb;
 #else
-	float3 F0 = g_FresnelR0;
+	float3 F0 = matData.FresnelR0;
 	F0 = lerp(F0, diffuseAlbedo, metallic);
 #endif
 
 #if ROUGHNESS_TEXTURE != 0
 	float roughness = g_TextureArray[3].Sample(g_SamAnisotropicWrap, TexCoord).r;
 #else
-	float roughness = g_Roughness;
+	float roughness = matData.Roughness;
 #endif
 
 #if NORMAL_TEXTURE != 0
@@ -112,7 +114,7 @@ float4 PS(VertexOut pin) : SV_Target
 	float fragOpacity = g_TextureArray[11].Sample(g_SamPointWrap, TexCoord).r;
 	clip(fragOpacity - 0.1f);
 #else
-	float fragOpacity = g_Opacity;
+	float fragOpacity = matData.Opacity;
 #endif
 
 
@@ -123,18 +125,19 @@ float4 PS(VertexOut pin) : SV_Target
 		metallic,
 		F0,
 		roughness,
-		g_Transmission,
+		matData.Transmission,
 		fragOpacity,
-		g_Emissive,
-		g_Sheen,
-		g_ClearCoatThickness,
-		g_ClearCoatRoughness,
-		g_Anisotropy,
-		g_AnisotropyRotation};
+		matData.Emissive,
+		matData.Sheen,
+		matData.ClearCoatThickness,
+		matData.ClearCoatRoughness,
+		matData.Anisotropy,
+		matData.AnisotropyRotation};
 
     float3 shadowFactor = 1.0f;
-    float3 directLight = ComputeLighting(g_Lights, mat, pin.PosW,
+    float3 directLight = ComputeLighting(g_Lights, g_DirectionalLightCount, mat, pin.PosW,
         N, V, shadowFactor);
+    directLight += ComputeClusteredLighting(mat, pin.PosH.xy, pin.PosW, N, V);
 
 	// ambient lighting solved wih the IBL
 	/*
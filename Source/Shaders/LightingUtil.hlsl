@@ -16,6 +16,20 @@ struct Light
     float __PAD001;    
 };
 
+#define LOCAL_LIGHT_POINT 0
+#define LOCAL_LIGHT_SPOT 1
+
+// Point or spot light of the clustered light lists
+struct LocalLight
+{
+	float3 Position;
+	float Range;        // the light fades out entirely at this distance
+	float3 Direction;   // spot light only
+	float SpotPower;    // spot light only
+	float3 Strength;
+	uint Type;
+};
+
 struct Material
 {
 	float3 DiffuseAlbedo;
@@ -32,11 +46,12 @@ struct Material
 	float AnisotropyRotation;
 };
 
-float CalcAttenuation(float d)
+float CalcAttenuation(float d, float range)
 {
-	// Quadratic falloff
+	// Quadratic falloff, windowed down to zero at the range so the clusters beyond it can leave the light out
 	float dSat = max(d, 0.01f);
-	return 1 / (dSat*dSat);
+	float window = saturate(1.0f - pow(d / range, 4.0f));
+	return window * window / (dSat*dSat);
 }
 
 // Schlick gives an approximation to Fresnel reflectance
@@ -121,21 +136,21 @@ float3 ComputeDirectionalLight(Light light, Material mat, float3 N, float3 V)
 //---------------------------------------------------------------------------------------
 // Evaluates the lighting equation for point lights.
 //---------------------------------------------------------------------------------------
-float3 ComputePointLight(Light light, Material mat, float3 pos, float3 N, float3 V)
+float3 ComputePointLight(LocalLight light, Material mat, float3 pos, float3 N, float3 V)
 {
 	// Calculate per-light radiance
     // The vector from the surface to the light.
     float3 L = light.Position - pos;
     float d = length(L);
     // Range test.
-    if(d > 100.0f) // Implicit falloff of 100.0f for all lights
+    if(d > light.Range)
         return 0.0f;
     // Normalize the light vector.
     L /= d;
 	// half vector
 	float3 H = normalize(V + L);
 	// Attenuate light by distance.
-    float attenuation = CalcAttenuation(d);
+    float attenuation = CalcAttenuation(d, light.Range);
     float3 radiance = light.Strength * attenuation;
 
 	return BRDFCookTorrance(mat, radiance, N, V, L, H);	
@@ -144,21 +159,21 @@ float3 ComputePointLight(Light light, Material mat, float3 pos, float3 N, float3
 //---------------------------------------------------------------------------------------
 // Evaluates the lighting equation for spot lights.
 //---------------------------------------------------------------------------------------
-float3 ComputeSpotLight(Light light, Material mat, float3 pos, float3 N, float3 V)
+float3 ComputeSpotLight(LocalLight light, Material mat, float3 pos, float3 N, float3 V)
 {
 	// Calculate per-light radiance
     // The vector from the surface to the light.
     float3 L = light.Position - pos;
     float d = length(L);
     // Range test.
-    if(d > 100.0f) // Implicit falloff of 100.0f for all lights
+    if(d > light.Range)
         return 0.0f;
     // Normalize the light vector.
     L /= d;
 	// half vector
 	float3 H = normalize(V + L);
 	// Attenuate light by distance.
-    float attenuation = CalcAttenuation(d);
+    float attenuation = CalcAttenuation(d, light.Range);
 	// Attenuate light by angle
 	attenuation *= pow(max(dot(-L, light.Direction), 0.0f), light.SpotPower);
     float3 radiance = light.Strength * attenuation;
@@ -167,34 +182,18 @@ float3 ComputeSpotLight(Light light, Material mat, float3 pos, float3 N, float3
 }
 
 
-float3 ComputeLighting(Light gLights[MAX_LIGHTS], Material mat,
+float3 ComputeLighting(Light gLights[MAX_LIGHTS], uint dirLightCount, Material mat,
                        float3 pos, float3 N, float3 V,
                        float3 shadowFactor)
 {
     float3 result = 0.0f;
 
-    int i = 0;
-
-#if (NUM_DIR_LIGHTS > 0)
-    for(i = 0; i < NUM_DIR_LIGHTS; i++)
+    for(uint i = 0; i < dirLightCount; i++)
     {
         result += shadowFactor * ComputeDirectionalLight(gLights[i], mat, N, V);
     }
-#endif
 
-#if (NUM_POINT_LIGHTS > 0)
-    for(i = NUM_DIR_LIGHTS; i < NUM_DIR_LIGHTS+NUM_POINT_LIGHTS; i++)
-    {
-        result += ComputePointLight(gLights[i], mat, pos, N, V);
-    }
-#endif
-
-#if (NUM_SPOT_LIGHTS > 0)
-    for(i = NUM_DIR_LIGHTS + NUM_POINT_LIGHTS; i < NUM_DIR_LIGHTS + NUM_POINT_LIGHTS + NUM_SPOT_LIGHTS; i++)
-    {
-        result += ComputeSpotLight(gLights[i], mat, pos, N, V);
-    }
-#endif 
+    // Point and spot lights come from the light clusters, see ComputeClusteredLighting
 
     return result;
 }
@@ -204,6 +203,8 @@ float3 NormalSampleToWorldSpace(float3 normalMapSample, float3 N, float3 T, floa
 {
 	// Uncompress each component from [0,1] to [-1,1].
 	float3 normalT = 2.0f * normalMapSample - 1.0f;
+	// Rebuild Z from X and Y, BC5 compressed normal maps only store those two
+	normalT.z = sqrt(saturate(1.0f - dot(normalT.xy, normalT.xy)));
 	
 	float3x3 TBN = float3x3(T, B, N);
 
@@ -1,13 +1,5 @@
 #include "Core.hlsl"
 
-struct VertexIn
-{
-	float3 PosL       : POSITION;
-    float3 NormalL    : NORMAL;
-	float3 TangentU   : TANGENT;
-	float3 BitangentU : BINORMAL;
-	float2 TexCoord   : TEXCOORD;
-};
 struct VertexOut
 {
 	float4 PosH       : SV_POSITION;
@@ -15,15 +7,19 @@ struct VertexOut
 };
 
 
-VertexOut VS(VertexIn vin)
+VertexOut VS(VertexIn vin, uint instanceID : SV_InstanceID)
 {
 	VertexOut vout;
 
+	InstanceData instance = g_InstanceData[g_BaseInstance + instanceID];
+	float4x4 world = instance.World;
+	LocalVertex v = DecodeVertex(vin, instance);
+
 	// Use local vertex position as cubemap lookup vector.
-	vout.PosW = vin.PosL;
+	vout.PosW = v.PosL;
 	
 	// Transform to world space.
-	float4 posW = mul(float4(vin.PosL, 1.0f), g_World);
+	float4 posW = mul(float4(v.PosL, 1.0f), world);
 
 	// Always center sky about camera.
 	posW.xyz += g_CameraPosW;